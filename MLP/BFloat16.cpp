@@ -0,0 +1,147 @@
+﻿// BFloat16.cpp
+// bfloat16 の変換・内積カーネル
+#include "BFloat16.h"
+#if defined(_M_X64) || defined(__x86_64__)
+#define BF16_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC は /arch 指定なしで AVX-512 の組み込み関数を使える
+#define BF16_TARGET
+#else
+#include <cpuid.h>
+// GCC / Clang は関数単位で命令セットを有効にする (実行時判定で呼び分ける)
+#define BF16_TARGET __attribute__((target("avx512f,avx512bf16")))
+#endif
+#endif
+
+// AVX512_BF16 の実行時判定
+bool HasAVX512BF16()
+{
+#ifdef BF16_X86
+	static const bool supported = [] {
+		unsigned int regs[4] = {};
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7) { return false; }
+		// OSXSAVE (CPUID.1:ECX bit 27)
+		__cpuid(info, 1);
+		if (!(info[2] & (1 << 27))) { return false; }
+		// AVX512F (CPUID.7.0:EBX bit 16)
+		__cpuidex(info, 7, 0);
+		regs[1] = (unsigned int)info[1];
+		// AVX512_BF16 (CPUID.7.1:EAX bit 5)
+		__cpuidex(info, 7, 1);
+		regs[0] = (unsigned int)info[0];
+		unsigned long long xcr0 = _xgetbv(0);
+#else
+		unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+		if (__get_cpuid_max(0, nullptr) < 7) { return false; }
+		__get_cpuid(1, &eax, &ebx, &ecx, &edx);
+		if (!(ecx & (1u << 27))) { return false; }
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+		regs[1] = ebx;
+		__cpuid_count(7, 1, eax, ebx, ecx, edx);
+		regs[0] = eax;
+		unsigned int xcrLow, xcrHigh;
+		__asm__("xgetbv" : "=a"(xcrLow), "=d"(xcrHigh) : "c"(0));
+		unsigned long long xcr0 = ((unsigned long long)xcrHigh << 32) | xcrLow;
+#endif
+		// OS が XMM/YMM/ZMM (opmask, 上位 256 bit, ZMM16-31) の状態を保存するか (XCR0 bit 1,2,5,6,7)
+		bool osSupport = (xcr0 & 0xE6) == 0xE6;
+		return osSupport && (regs[1] & (1u << 16)) && (regs[0] & (1u << 5));
+	}();
+	return supported;
+#else
+	return false;
+#endif
+}
+
+#ifdef BF16_X86
+// AVX512_BF16 で 16 要素ずつ変換する
+BF16_TARGET static void ConvertToBF16AVX512(const float* source, uint16_t* destination, size_t count)
+{
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m256bh packed = _mm512_cvtneps_pbh(_mm512_loadu_ps(source + i));
+		_mm256_storeu_si256((__m256i*)(destination + i), (__m256i)packed);
+	}
+	for (; i < count; i++) { destination[i] = FloatToBF16(source[i]); }
+}
+
+// AVX512_BF16 の vdpbf16ps で内積を計算する (32 要素ずつ、fp32 の 16 レーンに累積)
+BF16_TARGET static float DotBF16AVX512(const uint16_t* a, const uint16_t* b, int count)
+{
+	__m512 accumulator = _mm512_setzero_ps();
+	int i = 0;
+	for (; i + 32 <= count; i += 32)
+	{
+		__m512i va = _mm512_loadu_si512(a + i);
+		__m512i vb = _mm512_loadu_si512(b + i);
+		accumulator = _mm512_dpbf16_ps(accumulator, (__m512bh)va, (__m512bh)vb);
+	}
+	float sum = _mm512_reduce_add_ps(accumulator);
+	// 端数はスカラーで計算する
+	for (; i < count; i++) { sum += BF16ToFloat(a[i]) * BF16ToFloat(b[i]); }
+	return sum;
+}
+#endif
+
+// fp32 配列を bf16 配列に変換する
+void ConvertToBF16(const float* source, uint16_t* destination, size_t count)
+{
+#ifdef BF16_X86
+	if (HasAVX512BF16()) { ConvertToBF16AVX512(source, destination, count); return; }
+#endif
+	for (size_t i = 0; i < count; i++) { destination[i] = FloatToBF16(source[i]); }
+}
+
+// bf16 配列を fp32 配列に変換する (シフトだけなのでコンパイラのベクトル化に任せる)
+void ConvertFromBF16(const uint16_t* source, float* destination, size_t count)
+{
+	for (size_t i = 0; i < count; i++) { destination[i] = BF16ToFloat(source[i]); }
+}
+
+// bf16 ベクトル同士の内積
+float DotBF16(const uint16_t* a, const uint16_t* b, int count)
+{
+#ifdef BF16_X86
+	if (HasAVX512BF16()) { return DotBF16AVX512(a, b, count); }
+#endif
+	// エミュレーション: fp32 に戻して積和する (8 本の累積で依存関係を切り、ベクトル化しやすくする)
+	float partial[8] = {};
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		for (int lane = 0; lane < 8; lane++)
+		{
+			partial[lane] += BF16ToFloat(a[i + lane]) * BF16ToFloat(b[i + lane]);
+		}
+	}
+	float sum = 0.0f;
+	for (int lane = 0; lane < 8; lane++) { sum += partial[lane]; }
+	for (; i < count; i++) { sum += BF16ToFloat(a[i]) * BF16ToFloat(b[i]); }
+	return sum;
+}
+
+// fp32 のテンソルを bf16 に変換して保存する
+void Tensor3DBF16::Pack(const Tensor3D& tensor)
+{
+	m_height = tensor.GetH();
+	m_width = tensor.GetW();
+	m_channels = tensor.GetC();
+	m_data.resize((size_t)tensor.Size());
+	ConvertToBF16(tensor.Data(), m_data.data(), m_data.size());
+}
+
+// fp32 のテンソルに展開する
+void Tensor3DBF16::Unpack(Tensor3D& tensor) const
+{
+	if (tensor.GetH() != m_height || tensor.GetW() != m_width || tensor.GetC() != m_channels)
+	{
+		tensor = Tensor3D(m_height, m_width, m_channels);
+	}
+	ConvertFromBF16(m_data.data(), tensor.Data(), m_data.size());
+}
@@ -0,0 +1,66 @@
+﻿// BFloat16.h
+// bfloat16 (bf16) の保存形式と変換・内積カーネル
+// ・bf16 は fp32 の上位 16 bit (符号 1 + 指数 8 + 仮数 7) で、指数範囲が fp32 と同じなのでスケーリング不要
+// ・混合精度学習では活性値・重みを bf16 で保存してメモリ量と帯域を半分にし、
+//   積和の累積と重みの更新 (マスター重み) は fp32 で行う
+// ・AVX512_BF16 が使える CPU ではハードウェア命令、それ以外はソフトウェアでエミュレートする
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include "Tensor3D.h"
+
+// fp32 → bf16 に変換する (最近接偶数丸め、NaN は NaN のまま)
+inline uint16_t FloatToBF16(float value)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	// NaN は丸めで Inf にならないよう仮数の上位ビットを立てて切り捨てる
+	if ((bits & 0x7FFFFFFFu) > 0x7F800000u) { return (uint16_t)((bits >> 16) | 0x0040u); }
+	// 下位 16 bit を最近接偶数丸めする
+	bits += 0x7FFFu + ((bits >> 16) & 1u);
+	return (uint16_t)(bits >> 16);
+}
+
+// bf16 → fp32 に変換する (下位 16 bit を 0 で埋めるだけなので誤差なし)
+inline float BF16ToFloat(uint16_t value)
+{
+	uint32_t bits = (uint32_t)value << 16;
+	float result;
+	std::memcpy(&result, &bits, sizeof(result));
+	return result;
+}
+
+// 実行中の CPU が AVX512_BF16 命令を使えるかを返す (初回に cpuid で判定する)
+bool HasAVX512BF16();
+
+// fp32 配列を bf16 配列に変換する
+void ConvertToBF16(const float* source, uint16_t* destination, size_t count);
+// bf16 配列を fp32 配列に変換する
+void ConvertFromBF16(const uint16_t* source, float* destination, size_t count);
+
+// bf16 ベクトル同士の内積を fp32 で累積して返す
+// ・AVX512_BF16 があれば vdpbf16ps (2 要素ずつの積を fp32 に累積) を使う
+float DotBF16(const uint16_t* a, const uint16_t* b, int count);
+
+// bf16 で保存した Tensor3D (H×W×C、HWC の並び)
+// ・逆伝播まで保持する活性値を半分のサイズで持つために使う
+class Tensor3DBF16
+{
+public:
+	// fp32 のテンソルを bf16 に変換して保存する
+	void Pack(const Tensor3D& tensor);
+	// fp32 のテンソルに展開する (形状が合っていれば再確保しない)
+	void Unpack(Tensor3D& tensor) const;
+	// 保存に使っているバイト数
+	size_t Bytes() const { return m_data.size() * sizeof(uint16_t); }
+
+private:
+	// 形状
+	int m_height = 0;
+	int m_width = 0;
+	int m_channels = 0;
+	// bf16 のデータ
+	std::vector<uint16_t> m_data;
+};
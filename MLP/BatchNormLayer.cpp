@@ -0,0 +1,268 @@
+﻿// BatchNormLayer.cpp
+// バッチ正規化層の実装
+// ・テンソルは HWC の並び (チャネルが最も内側) なので、画素ごとに C 個の連続した値を
+//   チャネル別の累積配列へまとめて加算する形にし、内側ループをベクトル化しやすくしている
+#include "BatchNormLayer.h"
+#include "Checkpoint.h"
+#include <algorithm>
+#include <cmath>
+
+// コンストラクタ
+BatchNormLayer::BatchNormLayer(int channels, float momentum, float epsilon)
+	: m_channels(channels),
+	m_momentum(momentum),
+	m_epsilon(epsilon),
+	m_gamma(channels, 1.0f),
+	m_beta(channels, 0.0f),
+	m_runningMean(channels, 0.0f),
+	m_runningVar(channels, 1.0f),
+	m_invStd(channels, 1.0f)
+{
+}
+
+// 順伝播する (バッチサイズ 1 の学習モード)
+Tensor3D BatchNormLayer::Forward(const Tensor3D& input)
+{
+	Tensor3D out = input;
+	ForwardBatch(&out, 1);
+	return out;
+}
+
+// 推論用の順伝播する
+Tensor3D BatchNormLayer::Infer(const Tensor3D& input) const
+{
+	// 移動平均の統計量から y = x * scale + shift の係数を求める
+	std::vector<float> scale, shift;
+	GetFoldedScaleShift(scale, shift);
+	Tensor3D out = input;
+	float* data = out.Data();
+	const int pixels = out.GetH() * out.GetW();
+	for (int p = 0; p < pixels; p++)
+	{
+		float* x = data + (size_t)p * m_channels;
+		for (int c = 0; c < m_channels; c++)
+		{
+			x[c] = x[c] * scale[c] + shift[c];
+		}
+	}
+	return out;
+}
+
+// 逆伝播する (バッチサイズ 1)
+Tensor3D BatchNormLayer::Backward(const Tensor3D& dOut, float learningRate)
+{
+	Tensor3D dInput = dOut;
+	BackwardBatch(&dInput, 1, learningRate);
+	return dInput;
+}
+
+// Infer の順伝播に対する逆伝播
+Tensor3D BatchNormLayer::BackwardInference(const Tensor3D& dOut) const
+{
+	// y = x * scale + shift なので dx = dy * scale
+	std::vector<float> scale, shift;
+	GetFoldedScaleShift(scale, shift);
+	Tensor3D dInput = dOut;
+	float* data = dInput.Data();
+	const int pixels = dInput.GetH() * dInput.GetW();
+	for (int p = 0; p < pixels; p++)
+	{
+		float* dx = data + (size_t)p * m_channels;
+		for (int c = 0; c < m_channels; c++)
+		{
+			dx[c] *= scale[c];
+		}
+	}
+	return dInput;
+}
+
+// ミニバッチの順伝播をその場で行う
+void BatchNormLayer::ForwardBatch(Tensor3D* maps, int count)
+{
+	if (count <= 0) { return; }
+	const int pixels = maps[0].GetH() * maps[0].GetW();
+	// 1チャネルあたりの要素数 M = N×H×W
+	const float numElements = (float)count * pixels;
+
+	// 1パス目: チャネルごとの平均を求める
+	std::vector<float> mean(m_channels, 0.0f);
+	for (int n = 0; n < count; n++)
+	{
+		const float* data = maps[n].Data();
+		for (int p = 0; p < pixels; p++)
+		{
+			const float* x = data + (size_t)p * m_channels;
+			for (int c = 0; c < m_channels; c++) { mean[c] += x[c]; }
+		}
+	}
+	for (int c = 0; c < m_channels; c++) { mean[c] /= numElements; }
+
+	// 2パス目: 平均を引いた値の2乗和から分散を求める (1パスの E[x^2] - E[x]^2 より桁落ちしにくい)
+	std::vector<float> var(m_channels, 0.0f);
+	for (int n = 0; n < count; n++)
+	{
+		const float* data = maps[n].Data();
+		for (int p = 0; p < pixels; p++)
+		{
+			const float* x = data + (size_t)p * m_channels;
+			for (int c = 0; c < m_channels; c++)
+			{
+				float d = x[c] - mean[c];
+				var[c] += d * d;
+			}
+		}
+	}
+	for (int c = 0; c < m_channels; c++)
+	{
+		var[c] /= numElements;
+		m_invStd[c] = 1.0f / std::sqrt(var[c] + m_epsilon);
+		// 推論用の移動平均を更新する (分散は不偏推定に補正する)
+		float unbiased = (numElements > 1.0f) ? var[c] * numElements / (numElements - 1.0f) : var[c];
+		m_runningMean[c] = (1.0f - m_momentum) * m_runningMean[c] + m_momentum * mean[c];
+		m_runningVar[c] = (1.0f - m_momentum) * m_runningVar[c] + m_momentum * unbiased;
+	}
+
+	// 3パス目: 正規化して x^ を保存し、γ・β を適用する
+	// (混合精度モードでは x^ を先頭のスロットで計算してから bf16 に詰める)
+	if ((int)m_normalized.size() < (m_mixedPrecision ? 1 : count)) { m_normalized.resize(m_mixedPrecision ? 1 : count); }
+	if (m_mixedPrecision && (int)m_normalizedBF16.size() < count) { m_normalizedBF16.resize(count); }
+	for (int n = 0; n < count; n++)
+	{
+		Tensor3D& normalized = m_normalized[m_mixedPrecision ? 0 : n];
+		if (normalized.GetH() != maps[n].GetH() || normalized.GetW() != maps[n].GetW() || normalized.GetC() != m_channels)
+		{
+			normalized = Tensor3D(maps[n].GetH(), maps[n].GetW(), m_channels);
+		}
+		float* data = maps[n].Data();
+		float* xhatData = normalized.Data();
+		for (int p = 0; p < pixels; p++)
+		{
+			float* x = data + (size_t)p * m_channels;
+			float* xhat = xhatData + (size_t)p * m_channels;
+			for (int c = 0; c < m_channels; c++)
+			{
+				xhat[c] = (x[c] - mean[c]) * m_invStd[c];
+				x[c] = xhat[c] * m_gamma[c] + m_beta[c];
+			}
+		}
+		if (m_mixedPrecision) { m_normalizedBF16[n].Pack(normalized); }
+	}
+}
+
+// サンプル n の x^ を返す
+const Tensor3D& BatchNormLayer::GetNormalized(int n, Tensor3D& scratch) const
+{
+	if (!m_mixedPrecision) { return m_normalized[n]; }
+	m_normalizedBF16[n].Unpack(scratch);
+	return scratch;
+}
+
+// ミニバッチの逆伝播をその場で行う
+// ・dβ = Σ dy、 dγ = Σ dy・x^
+// ・dx = γ / sqrt(σ^2 + ε) / M × (M・dy - dβ - x^・dγ)
+void BatchNormLayer::BackwardBatch(Tensor3D* grads, int count, float learningRate)
+{
+	if (count <= 0) { return; }
+	const int pixels = grads[0].GetH() * grads[0].GetW();
+	const float numElements = (float)count * pixels;
+
+	// γ・β の勾配をチャネルごとに集計する
+	std::vector<float> dGamma(m_channels, 0.0f);
+	std::vector<float> dBeta(m_channels, 0.0f);
+	// bf16 で保存した x^ の展開先
+	Tensor3D scratch;
+	for (int n = 0; n < count; n++)
+	{
+		const float* dyData = grads[n].Data();
+		const float* xhatData = GetNormalized(n, scratch).Data();
+		for (int p = 0; p < pixels; p++)
+		{
+			const float* dy = dyData + (size_t)p * m_channels;
+			const float* xhat = xhatData + (size_t)p * m_channels;
+			for (int c = 0; c < m_channels; c++)
+			{
+				dBeta[c] += dy[c];
+				dGamma[c] += dy[c] * xhat[c];
+			}
+		}
+	}
+
+	// 入力側の勾配を計算する (更新前の γ を使う)
+	std::vector<float> coefficient(m_channels);
+	for (int c = 0; c < m_channels; c++) { coefficient[c] = m_gamma[c] * m_invStd[c] / numElements; }
+	for (int n = 0; n < count; n++)
+	{
+		float* dyData = grads[n].Data();
+		const float* xhatData = GetNormalized(n, scratch).Data();
+		for (int p = 0; p < pixels; p++)
+		{
+			float* dy = dyData + (size_t)p * m_channels;
+			const float* xhat = xhatData + (size_t)p * m_channels;
+			for (int c = 0; c < m_channels; c++)
+			{
+				dy[c] = coefficient[c] * (numElements * dy[c] - dBeta[c] - xhat[c] * dGamma[c]);
+			}
+		}
+	}
+
+	// 勾配降下法により γ・β を更新する
+	for (int c = 0; c < m_channels; c++)
+	{
+		m_gamma[c] -= learningRate * dGamma[c];
+		m_beta[c] -= learningRate * dBeta[c];
+	}
+}
+
+// 保存済みの x^ から出力を再計算する
+void BatchNormLayer::RecomputeOutput(int n, Tensor3D& output) const
+{
+	const Tensor3D& normalized = GetNormalized(n, output);
+	if (&normalized != &output) { output = normalized; }
+	float* data = output.Data();
+	const int pixels = output.GetH() * output.GetW();
+	for (int p = 0; p < pixels; p++)
+	{
+		float* x = data + (size_t)p * m_channels;
+		for (int c = 0; c < m_channels; c++)
+		{
+			x[c] = x[c] * m_gamma[c] + m_beta[c];
+		}
+	}
+}
+
+// 逆伝播用に保持している x^ のバイト数
+size_t BatchNormLayer::GetStoredBytes() const
+{
+	size_t bytes = 0;
+	for (const auto& normalized : m_normalized) { bytes += (size_t)normalized.Size() * sizeof(float); }
+	for (const auto& normalized : m_normalizedBF16) { bytes += normalized.Bytes(); }
+	return bytes;
+}
+
+// 推論時の変換係数を返す
+void BatchNormLayer::GetFoldedScaleShift(std::vector<float>& scale, std::vector<float>& shift) const
+{
+	scale.resize(m_channels);
+	shift.resize(m_channels);
+	for (int c = 0; c < m_channels; c++)
+	{
+		scale[c] = m_gamma[c] / std::sqrt(m_runningVar[c] + m_epsilon);
+		shift[c] = m_beta[c] - m_runningMean[c] * scale[c];
+	}
+}
+
+// γ・β と移動平均の統計量を書き出す
+void BatchNormLayer::SaveParameters(std::ostream& out) const
+{
+	WriteCheckpointArray(out, m_gamma);
+	WriteCheckpointArray(out, m_beta);
+	WriteCheckpointArray(out, m_runningMean);
+	WriteCheckpointArray(out, m_runningVar);
+}
+
+// γ・β と移動平均の統計量を読み込む
+bool BatchNormLayer::LoadParameters(std::istream& in)
+{
+	return ReadCheckpointArray(in, m_gamma) && ReadCheckpointArray(in, m_beta)
+		&& ReadCheckpointArray(in, m_runningMean) && ReadCheckpointArray(in, m_runningVar);
+}
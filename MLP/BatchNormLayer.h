@@ -0,0 +1,93 @@
+﻿// BatchNormLayer.h
+// バッチ正規化層（Batch Normalization）
+// ・学習時 : チャネルごとにバッチ全体 (N×H×W) の平均・分散で正規化し、γ・β でスケール/シフトする
+// ・推論時 : 学習中に移動平均で求めた平均・分散を使う
+// ・推論用に書き出すときは、直前の ConvLayer の重み・バイアスに折り込んで層ごと取り除ける
+#pragma once
+#include <vector>
+#include <iosfwd>
+#include "Tensor3D.h"
+#include "IBaseLayer.h"
+#include "BFloat16.h"
+
+// BatchNormLayer クラス
+// ・入力と出力は同じ形状 (H×W×C)
+// ・Forward / Backward (IBaseLayer) はバッチサイズ 1 として扱う
+// ・ミニバッチ学習では ForwardBatch / BackwardBatch を使う
+class BatchNormLayer : public IBaseLayer
+{
+public:
+	// コンストラクタ
+	// ・channels : チャネル数
+	// ・momentum : 移動平均の更新率 (running = (1 - momentum) * running + momentum * batch)
+	// ・epsilon  : 分散に加える小さな値 (0 除算防止)
+	BatchNormLayer(int channels, float momentum = 0.1f, float epsilon = 1e-5f);
+
+	// 順伝播する (バッチサイズ 1 の学習モード)
+	Tensor3D Forward(const Tensor3D& input) override;
+	// 推論用の順伝播する (移動平均の統計量を使い、状態を書き換えない)
+	Tensor3D Infer(const Tensor3D& input) const override;
+	// 逆伝播する (バッチサイズ 1、γ・β を更新する)
+	Tensor3D Backward(const Tensor3D& dOut, float learningRate) override;
+	// Infer の順伝播に対する逆伝播 (入力側勾配 dOut × scale を返すだけで、γ・β は更新しない)
+	// ・1 枚の統計量で正規化すると移動平均が壊れるので、単一サンプルの学習では BN を移動平均の統計量で固定する
+	Tensor3D BackwardInference(const Tensor3D& dOut) const;
+
+	// ミニバッチの順伝播をその場で行う (学習モード)
+	// ・maps  : count 枚の特徴マップ (正規化後の値で上書きする)
+	// ・バッチ統計量で正規化し、移動平均を更新する
+	void ForwardBatch(Tensor3D* maps, int count);
+	// ミニバッチの逆伝播をその場で行う
+	// ・grads : count 枚の出力側勾配 (入力側勾配で上書きする)
+	// ・γ・β をバッチ全体の勾配で更新する
+	void BackwardBatch(Tensor3D* grads, int count, float learningRate);
+
+	// 推論時の変換 y = x * scale + shift の係数を返す (ConvLayer への折り込み用)
+	// ・scale = γ / sqrt(runningVar + ε)
+	// ・shift = β - runningMean * scale
+	void GetFoldedScaleShift(std::vector<float>& scale, std::vector<float>& shift) const;
+
+	// 直近のバッチのサンプル n の出力 γ・x^ + β を保存済みの x^ から再計算する
+	// ・勾配チェックポイントで ReLU 前の値を保持せずに済ませるために使う
+	void RecomputeOutput(int n, Tensor3D& output) const;
+	// 逆伝播用に保持している x^ のバイト数
+	size_t GetStoredBytes() const;
+	// γ・β と移動平均の統計量のバイト数
+	size_t GetParameterBytes() const { return (m_gamma.size() + m_beta.size() + m_runningMean.size() + m_runningVar.size()) * sizeof(float); }
+
+	// 混合精度モードを切り替える (逆伝播用に保存する x^ を bf16 で持つ)
+	void SetMixedPrecision(bool enabled) { m_mixedPrecision = enabled; }
+
+	// γ・β と移動平均の統計量を書き出す (チェックポイント用)
+	void SaveParameters(std::ostream& out) const;
+	// γ・β と移動平均の統計量を読み込む (チャネル数がこの層と違えば false)
+	bool LoadParameters(std::istream& in);
+
+private:
+	// サンプル n の x^ を返す (bf16 で保存している場合は scratch に展開する)
+	const Tensor3D& GetNormalized(int n, Tensor3D& scratch) const;
+
+private:
+	// チャネル数
+	int m_channels;
+	// 移動平均の更新率
+	float m_momentum;
+	// 0 除算防止の値
+	float m_epsilon;
+	// スケール γ (チャネルごと)
+	std::vector<float> m_gamma;
+	// シフト β (チャネルごと)
+	std::vector<float> m_beta;
+	// 推論用の平均の移動平均
+	std::vector<float> m_runningMean;
+	// 推論用の分散の移動平均
+	std::vector<float> m_runningVar;
+	// 直近のバッチの 1 / sqrt(分散 + ε) (逆伝播用)
+	std::vector<float> m_invStd;
+	// 直近のバッチの正規化済みの値 x^ (逆伝播用、サンプルごと)
+	std::vector<Tensor3D> m_normalized;
+	// 混合精度モードか
+	bool m_mixedPrecision = false;
+	// 混合精度モードで保存する x^ (bf16)
+	std::vector<Tensor3DBF16> m_normalizedBF16;
+};
@@ -1 +1,140 @@
-#pragma once
+﻿#pragma once
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include "MappedFile.h"
+#include "Tensor3D.h"
+
+// CIFAR10Loader クラス
+//   - CIFAR-10 バイナリ版 (cifar-10-batches-bin) を読み込むクラス
+//   - data_batch_1〜5.bin / test_batch.bin をメモリマップし、読み込み時のコピーを行わない
+//   - 1レコード = ラベル 1 byte + 画像 3072 byte (R 1024, G 1024, B 1024 の順の 32×32 プレーン)
+class CIFAR10Loader
+{
+public:
+	// 画像の高さ
+	static constexpr int Height = 32;
+	// 画像の幅
+	static constexpr int Width = 32;
+	// チャネル数 (RGB)
+	static constexpr int Channels = 3;
+	// 1プレーン (1チャネル) のバイト数
+	static constexpr int PlaneBytes = Height * Width;
+	// 画像1枚のバイト数
+	static constexpr int ImageBytes = PlaneBytes * Channels;
+	// 1レコードのバイト数 (ラベル + 画像)
+	static constexpr int RecordBytes = 1 + ImageBytes;
+
+	// バッチファイルを読み込む (メモリマップする)
+	//  ・directory : "cifar-10-batches-bin" など、バッチファイルのあるディレクトリ
+	//  ・isTraining = true  → data_batch_1〜5.bin を学習データとして開く
+	//  ・false → test_batch.bin をテストデータとして開く
+	bool Load(const std::string& directory, bool isTraining)
+	{
+		// 開くファイル名の一覧を作る
+		std::vector<std::string> names;
+		if (isTraining) {
+			for (int i = 1; i <= 5; i++) { names.push_back("data_batch_" + std::to_string(i) + ".bin"); }
+		}
+		else {
+			names.push_back("test_batch.bin");
+		}
+		// 読み込み先を初期化する
+		Split& split = isTraining ? m_train : m_test;
+		split = Split();
+		for (const auto& name : names)
+		{
+			MappedFile file;
+			// 開けない、またはレコード長の倍数でないファイルはエラー復帰する
+			if (!file.Open(directory + "/" + name) || file.Size() % RecordBytes != 0) { split = Split(); return false; }
+			// 各レコードの先頭アドレスを索引に登録する
+			size_t numRecords = file.Size() / RecordBytes;
+			for (size_t r = 0; r < numRecords; r++)
+			{
+				split.records.push_back(file.Data() + r * RecordBytes);
+			}
+			split.files.push_back(std::move(file));
+		}
+		// クラス名 (batches.meta.txt) は任意なので読めなくても続行する
+		LoadLabelNames(directory + "/batches.meta.txt");
+		return true;
+	}
+
+	// 画像数を返す
+	size_t GetCount(bool isTraining) const { return (isTraining ? m_train : m_test).records.size(); }
+
+	// 正解ラベル (0〜9) を返す
+	int GetLabel(bool isTraining, size_t index) const { return (isTraining ? m_train : m_test).records[index][0]; }
+
+	// 画像の生データ (R, G, B の順に 32×32 の uint8 プレーンが連続した 3072 byte) を返す
+	// ・マップされたファイルを直接指すのでコピーは発生しない
+	const uint8_t* GetImage(bool isTraining, size_t index) const { return (isTraining ? m_train : m_test).records[index] + 1; }
+
+	// 画像を画素ごとにチャネルが並ぶ形式 (HWC、3072 byte) に並べ替えて image に書き込む
+	// ・データ拡張・キャッシュ・シャードは HWC の uint8 を受け取るので、それらに渡すときに使う
+	void CopyImageHWC(bool isTraining, size_t index, uint8_t* image) const
+	{
+		const uint8_t* planes = GetImage(isTraining, index);
+		for (int pixel = 0; pixel < PlaneBytes; pixel++)
+		{
+			image[pixel * Channels + 0] = planes[pixel];
+			image[pixel * Channels + 1] = planes[PlaneBytes + pixel];
+			image[pixel * Channels + 2] = planes[PlaneBytes * 2 + pixel];
+		}
+	}
+
+	// 画像をモデルのテンソル形式 (32×32×3、HWC、0〜1 に正規化) に変換する
+	// ・tensor の形状が合っていれば再確保しない (プリフェッチのバッファを使い回す)
+	void DecodeToTensor(bool isTraining, size_t index, Tensor3D& tensor) const
+	{
+		if (tensor.GetH() != Height || tensor.GetW() != Width || tensor.GetC() != Channels)
+		{
+			tensor = Tensor3D(Height, Width, Channels);
+		}
+		// プレーン (CHW) → 画素ごとのチャネル並び (HWC) に並べ替えながら正規化する
+		const uint8_t* planes = GetImage(isTraining, index);
+		float* out = tensor.Data();
+		for (int pixel = 0; pixel < PlaneBytes; pixel++)
+		{
+			out[pixel * Channels + 0] = planes[pixel] / 255.0f;
+			out[pixel * Channels + 1] = planes[PlaneBytes + pixel] / 255.0f;
+			out[pixel * Channels + 2] = planes[PlaneBytes * 2 + pixel] / 255.0f;
+		}
+	}
+
+	// クラス名 (batches.meta.txt の順、"airplane" など)
+	const std::vector<std::string>& GetLabelNames() const { return m_labelNames; }
+
+private:
+	// batches.meta.txt からクラス名を読み込む (空行は無視する)
+	void LoadLabelNames(const std::string& path)
+	{
+		std::ifstream ifs(path);
+		if (!ifs) { return; }
+		m_labelNames.clear();
+		std::string line;
+		while (std::getline(ifs, line))
+		{
+			// 改行コード (CR) と前後の空白を取り除く
+			while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) { line.pop_back(); }
+			if (!line.empty()) { m_labelNames.push_back(line); }
+		}
+	}
+
+	// 学習用 / テスト用それぞれのデータ
+	struct Split
+	{
+		// マップしたバッチファイル
+		std::vector<MappedFile> files;
+		// 各レコードの先頭アドレス (ラベルの位置)
+		std::vector<const uint8_t*> records;
+	};
+
+	// 学習データ (data_batch_1〜5)
+	Split m_train;
+	// テストデータ (test_batch)
+	Split m_test;
+	// クラス名
+	std::vector<std::string> m_labelNames;
+};
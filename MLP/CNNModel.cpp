@@ -1,199 +1,770 @@
 // CNNModel.cpp
 // CNN の順伝播・逆伝播を実装したファイル
 #include "CNNModel.h"
+#include "SoftmaxCrossEntropy.h"
+#include "Checkpoint.h"
+#include "TopK.h"
+#include <fstream>
 #include <algorithm>
 #include <cmath>
 
-// Softmax（数値安定化）
-// 目的：生のスコア(logits)を確率(0.0〜1.0)に変換する
-static std::vector<float> Softmax(const std::vector<float>& logits)
-{
-	// Softmax の安定化のため max(logits) を取得
-	float maxv = *std::max_element(logits.begin(), logits.end());
-	// exp() の結果を格納する配列
-	std::vector<float> exps(logits.size());
-	// exp の合計（正規化に使用）
-	float sum = 0.0f;
-	// logits[i] - maxv を exp() に通す
-	for (size_t i = 0; i < logits.size(); i++)
-	{
-		// 数値安定化のため maxv を引いた値に対して exp() を計算し、Softmax の分子を作る
-		exps[i] = std::exp(logits[i] - maxv);
-		// Softmax の正規化用に exp の総和を加算していく
-		sum += exps[i];
-	}
-	// 合計が 1 になるように割る（確率分布になる）
-	for (size_t i = 0; i < exps.size(); i++)
-	{
-		// Softmax の分子 exp(logit) を exp の総和で割り、確率（0〜1）に正規化する
-		exps[i] /= sum;
-	}
-	// Softmax 結果を返す
-	return exps;
-}
+// GetMemoryStats の層の並び（順伝播の順）
+enum MemoryLayer { MemoryConv1, MemoryBN1, MemoryPool1, MemoryConv2, MemoryBN2, MemoryPool2, MemoryFC1, MemoryFC2, MemoryLayerCount };
+static const char* const MemoryLayerNames[MemoryLayerCount] = { "conv1", "bn1", "relu1+pool1", "conv2", "bn2", "relu2+pool2", "fc1", "fc2+loss" };
 
 // CNNModel コンストラクタ
 // 畳み込み・プーリング・全結合層の設定
-CNNModel::CNNModel()
+// 各層の入力サイズは、入力画像の形状と前段の層の出力サイズから順に求める
+CNNModel::CNNModel(const CNNConfig& config)
 	: 
-	m_conv1(28, 28, 1, 3, 8),
-	m_pool1(2),
-	m_conv2(14, 14, 8, 3, 16),
-	m_pool2(2),
-	m_fcl1(7 * 7 * 16, 128),
-	m_fcl2(128, 10)
+	m_config(config),
+	m_hiddenMask(ReLULayer::MaskWords(config.hiddenSize)),
+	m_outputVector(config.numClasses),
+	m_dLogits(config.numClasses),
+	m_conv1(config.inputHeight, config.inputWidth, config.inputChannels,
+		config.filterSize, config.conv1Channels, config.convStride, config.convPadding),
+	m_pool1(config.poolSize),
+	m_conv2(m_pool1.OutputSize(m_conv1.GetOutputHeight()), m_pool1.OutputSize(m_conv1.GetOutputWidth()), config.conv1Channels,
+		config.filterSize, config.conv2Channels, config.convStride, config.convPadding),
+	m_pool2(config.poolSize),
+	m_fcl1(m_pool2.OutputSize(m_conv2.GetOutputHeight()) * m_pool2.OutputSize(m_conv2.GetOutputWidth()) * config.conv2Channels,
+		config.hiddenSize),
+	m_fcl2(config.hiddenSize, config.numClasses),
+	m_bn1(config.conv1Channels),
+	m_bn2(config.conv2Channels)
 {
+	// 混合精度モードを各層に設定する
+	if (config.mixedPrecision)
+	{
+		m_conv1.SetMixedPrecision(true);
+		m_conv2.SetMixedPrecision(true);
+		m_fcl1.SetMixedPrecision(true);
+		m_fcl2.SetMixedPrecision(true);
+		m_bn1.SetMixedPrecision(true);
+		m_bn2.SetMixedPrecision(true);
+	}
+	// メモリの計測値の層の名前を設定する
+	m_stepMemory.layers.resize(MemoryLayerCount);
+	for (int layer = 0; layer < MemoryLayerCount; layer++) { m_stepMemory.layers[layer].name = MemoryLayerNames[layer]; }
 }
 
 // Forward（順伝播）
-// 画像 → CNN → 10 クラス確率 を求める
+// 画像 → CNN → クラス確率 を求める
 std::vector<float> CNNModel::Forward(const Tensor3D& inputImage)
+{
+	// 順伝播を実行する
+	ForwardPass(inputImage);
+	// 推論結果（確率ベクトル）を返す
+	return m_outputVector;
+}
+
+// 順伝播の本体（結果はメンバ変数に残し、確率ベクトルのコピーは返さない）
+void CNNModel::ForwardPass(const Tensor3D& inputImage)
 {
 	// 入力画像 Tensor3D をメンバ変数に保存（Backprop 用）
 	m_inputImage = inputImage;
-	// Conv1 の順伝播（28×28×1 → 28×28×8）
+	// Conv1 の順伝播（Fashion-MNIST の場合 28×28×1 → 28×28×8）
 	m_conv1Output = m_conv1.Forward(m_inputImage);
-	// Conv1 の出力に ReLU を適用（負の値を 0 にする）
-	Tensor3D relu1Out = m_relu1.Forward(m_conv1Output);
-	// MaxPool1 を適用（空間解像度を 28→14 にダウンスケール）
-	m_pool1Output = m_pool1.Forward(relu1Out);
-	// Conv2 の順伝播（14×14×8 → 14×14×16）
+	// バッチ正規化（移動平均の統計量で正規化する）
+	// ・1 枚の統計量では画像ごとの正規化になり移動平均も壊れるので、推論 (Infer) と同じ変換を使う
+	if (m_config.batchNorm) { m_conv1Output = m_bn1.Infer(m_conv1Output); }
+	// Conv1 の出力にその場で ReLU を適用（負の値を 0 にする）
+	// ・逆伝播に必要なのは x > 0 だった位置だけなので、ReLU1 は 1 bit のマスクだけを持つ
+	m_relu1.ForwardInPlace(m_conv1Output);
+	// MaxPool1 を適用（空間解像度を 1/poolSize にダウンスケール、28→14 など）
+	m_pool1Output = m_pool1.Forward(m_conv1Output);
+	// Conv2 の順伝播（14×14×8 → 14×14×16 など）
 	m_conv2Output = m_conv2.Forward(m_pool1Output);
-	// Conv2 の出力に ReLU を適用
-	Tensor3D relu2Out = m_relu2.Forward(m_conv2Output);
-	// MaxPool2 を適用（14→7 にさらにダウンスケール）
-	m_pool2Output = m_pool2.Forward(relu2Out);
-	// Flatten により 7×7×16 → 784 の 1次元ベクトルへ変換
-	Tensor3D flatTensor = m_flatten.Forward(m_pool2Output);
-	// Flatten が生成した 1次元ベクトル（FC1 の入力）を取得
-	const std::vector<float>& flatVec = m_flatten.GetFlatOutput();
-	// 全結合層 FC1（784 → 128）で特徴変換
-	m_hiddenLayer1 = m_fcl1.Forward(flatVec);
-	// FC1 出力に ReLU を適用（非線形性を追加）
-	for (size_t i = 0; i < m_hiddenLayer1.size(); i++)
+	if (m_config.batchNorm) { m_conv2Output = m_bn2.Infer(m_conv2Output); }
+	// Conv2 の出力にその場で ReLU を適用
+	m_relu2.ForwardInPlace(m_conv2Output);
+	// MaxPool2 を適用（14→7 などさらにダウンスケール）
+	m_pool2Output = m_pool2.Forward(m_conv2Output);
+	// Flatten により 7×7×16 → 1×1×784 などの 1次元ベクトルへ変換（形状の付け替えだけでコピーしない）
+	m_flatten.ForwardInPlace(m_pool2Output);
+	// 全結合層 FC1（784 → hiddenSize）で特徴変換（Pool2 の出力をそのまま入力ベクトルとして使う）
+	m_hiddenLayer1 = m_fcl1.Forward(m_pool2Output.Data());
+	// FC1 出力にその場で ReLU を適用（非線形性を追加、畳み込み側の ReLU と同じ処理）
+	ReLULayer::ApplyInPlace(m_hiddenLayer1.data(), (int)m_hiddenLayer1.size(), m_hiddenMask.data());
+	// 全結合層 FC2（hiddenSize → クラス数）でクラス別スコア（logits）を計算
+	m_logits = m_fcl2.Forward(m_hiddenLayer1);
+	// Softmax を適用してクラスの確率分布に変換
+	Softmax(m_logits.data(), 1, (int)m_logits.size(), m_outputVector.data());
+	// 新しい入力に対する勾配はまだ計算していない
+	m_hasGradient = false;
+}
+
+// 推論専用の順伝播（読み取り専用）
+// 各層の Infer を使い、Backward 用のメンバ変数を一切書き換えない
+void CNNModel::InferLogits(const Tensor3D& inputImage, float* logits) const
+{
+	// Conv1 → (BN1) → ReLU1 → MaxPool1（Fashion-MNIST の場合 28×28×1 → 14×14×8）
+	Tensor3D conv1Out = m_conv1.Infer(inputImage);
+	// BN は学習中の移動平均の統計量で正規化する（折り込み済みなら何もしない）
+	if (m_config.batchNorm) { conv1Out = m_bn1.Infer(conv1Out); }
+	ReLULayer::ApplyInPlace(conv1Out);
+	Tensor3D pool1Out = m_pool1.Infer(conv1Out);
+	// Conv2 → (BN2) → ReLU2 → MaxPool2（14×14×8 → 7×7×16 など）
+	Tensor3D conv2Out = m_conv2.Infer(pool1Out);
+	if (m_config.batchNorm) { conv2Out = m_bn2.Infer(conv2Out); }
+	ReLULayer::ApplyInPlace(conv2Out);
+	Tensor3D pool2Out = m_pool2.Infer(conv2Out);
+	// Flatten（HWC の並びのままなので、Pool2 の出力をそのまま 1次元ベクトルとして FC1 に渡す）
+	// FC1 + ReLU
+	std::vector<float> hidden = m_fcl1.Infer(pool2Out.Data());
+	ReLULayer::ApplyInPlace(hidden.data(), (int)hidden.size());
+	// FC2 でクラス別スコアを計算する
+	std::vector<float> scores = m_fcl2.Infer(hidden);
+	std::copy(scores.begin(), scores.end(), logits);
+}
+
+// 推論専用の順伝播を count 枚まとめて行う
+void CNNModel::InferLogitsBatch(const Tensor3D* images, int count, float* logits) const
+{
+	if (count <= 0) return;
+	// Pool2 の出力（FC1 の入力）を count 行並べた行列
+	std::vector<float> pooled;
+	for (int i = 0; i < count; i++)
 	{
-		// もし値が 0 以下なら ReLU の性質により 0 にする
-		if (m_hiddenLayer1[i] < 0.0f)	{
-			m_hiddenLayer1[i] = 0.0f;
-		}
+		// Conv1 → (BN1) → ReLU1 → MaxPool1 → Conv2 → (BN2) → ReLU2 → MaxPool2（InferLogits と同じ）
+		Tensor3D conv1Out = m_conv1.Infer(images[i]);
+		if (m_config.batchNorm) { conv1Out = m_bn1.Infer(conv1Out); }
+		ReLULayer::ApplyInPlace(conv1Out);
+		Tensor3D pool1Out = m_pool1.Infer(conv1Out);
+		Tensor3D conv2Out = m_conv2.Infer(pool1Out);
+		if (m_config.batchNorm) { conv2Out = m_bn2.Infer(conv2Out); }
+		ReLULayer::ApplyInPlace(conv2Out);
+		Tensor3D pool2Out = m_pool2.Infer(conv2Out);
+		// 1 枚目で行列の大きさが決まる（Flatten は HWC の並びのままなので詰めるだけ）
+		if (pooled.empty()) { pooled.resize((size_t)count * pool2Out.Size()); }
+		std::copy(pool2Out.Data(), pool2Out.Data() + pool2Out.Size(), &pooled[(size_t)i * pool2Out.Size()]);
 	}
-	// 全結合層 FC2（128 → 10）でクラス別スコア（logits）を計算
-	auto logits = m_fcl2.Forward(m_hiddenLayer1);
-	// Softmax を適用して 10 クラスの確率分布に変換
-	m_outputVector = Softmax(logits);
-	// 推論結果（確率ベクトル）を返す
-	return m_outputVector;
+	// FC1 + ReLU → FC2（重みのパネルを全サンプルで使い回す）
+	std::vector<float> hidden((size_t)count * m_config.hiddenSize);
+	m_fcl1.InferBatch(pooled.data(), hidden.data(), count);
+	ReLULayer::ApplyInPlace(hidden.data(), (int)hidden.size());
+	m_fcl2.InferBatch(hidden.data(), logits, count);
 }
 
+// チェックポイントファイルの識別子（"MLPC"）と形式のバージョン
+static const uint32_t CheckpointMagic = 0x43504C4D;
+static const uint32_t CheckpointVersion = 1;
+
+// 構成設定と全層のパラメータをチェックポイントファイルに書き出す
+bool CNNModel::SaveCheckpoint(const std::string& path) const
+{
+	std::ofstream out(path, std::ios::binary);
+	if (!out) return false;
+	WriteCheckpointValue(out, CheckpointMagic);
+	WriteCheckpointValue(out, CheckpointVersion);
+	// 構成設定（層の形状の復元に必要な値をすべて int32 で並べる）
+	const CNNConfig& c = m_config;
+	const int32_t fields[] = { c.inputHeight, c.inputWidth, c.inputChannels, c.numClasses, c.filterSize,
+		c.convStride, c.convPadding, c.conv1Channels, c.conv2Channels, c.poolSize, c.hiddenSize,
+		c.batchNorm ? 1 : 0, c.mixedPrecision ? 1 : 0 };
+	for (int32_t field : fields) { WriteCheckpointValue(out, field); }
+	// 各層のパラメータ（BN は使っている場合だけ）
+	m_conv1.SaveParameters(out);
+	m_conv2.SaveParameters(out);
+	if (c.batchNorm)
+	{
+		m_bn1.SaveParameters(out);
+		m_bn2.SaveParameters(out);
+	}
+	m_fcl1.SaveParameters(out);
+	m_fcl2.SaveParameters(out);
+	return (bool)out;
+}
+
+// チェックポイントのヘッダと構成設定を読み込む
+static bool ReadCheckpointHeader(std::istream& in, CNNConfig& config)
+{
+	uint32_t magic = 0, version = 0;
+	if (!ReadCheckpointValue(in, magic) || !ReadCheckpointValue(in, version)) return false;
+	if (magic != CheckpointMagic || version != CheckpointVersion) return false;
+	// 構成設定（SaveCheckpoint と同じ順）
+	int32_t fields[13];
+	for (int32_t& field : fields) { if (!ReadCheckpointValue(in, field)) return false; }
+	config.inputHeight = fields[0];
+	config.inputWidth = fields[1];
+	config.inputChannels = fields[2];
+	config.numClasses = fields[3];
+	config.filterSize = fields[4];
+	config.convStride = fields[5];
+	config.convPadding = fields[6];
+	config.conv1Channels = fields[7];
+	config.conv2Channels = fields[8];
+	config.poolSize = fields[9];
+	config.hiddenSize = fields[10];
+	config.batchNorm = fields[11] != 0;
+	config.mixedPrecision = fields[12] != 0;
+	return true;
+}
+
+// チェックポイントの各層のパラメータを読み込む
+bool CNNModel::LoadLayerParameters(std::istream& in)
+{
+	bool ok = m_conv1.LoadParameters(in) && m_conv2.LoadParameters(in);
+	if (ok && m_config.batchNorm) { ok = m_bn1.LoadParameters(in) && m_bn2.LoadParameters(in); }
+	return ok && m_fcl1.LoadParameters(in) && m_fcl2.LoadParameters(in);
+}
+
+// チェックポイントファイルからモデルを作る
+std::unique_ptr<CNNModel> CNNModel::LoadCheckpoint(const std::string& path)
+{
+	std::ifstream in(path, std::ios::binary);
+	CNNConfig config;
+	if (!in || !ReadCheckpointHeader(in, config)) return nullptr;
+	// 形状を復元したモデルに各層のパラメータを読み込む（初期値の重みはすべて上書きされる）
+	auto model = std::make_unique<CNNModel>(config);
+	return model->LoadLayerParameters(in) ? std::move(model) : nullptr;
+}
+
+// チェックポイントファイルのパラメータをこのモデルに読み込む
+bool CNNModel::RestoreCheckpoint(const std::string& path)
+{
+	std::ifstream in(path, std::ios::binary);
+	CNNConfig config;
+	if (!in || !ReadCheckpointHeader(in, config)) return false;
+	// 層の形状に関わる構成設定がすべて一致していること
+	const CNNConfig& c = m_config;
+	bool matches = config.inputHeight == c.inputHeight && config.inputWidth == c.inputWidth && config.inputChannels == c.inputChannels
+		&& config.numClasses == c.numClasses && config.filterSize == c.filterSize && config.convStride == c.convStride
+		&& config.convPadding == c.convPadding && config.conv1Channels == c.conv1Channels && config.conv2Channels == c.conv2Channels
+		&& config.poolSize == c.poolSize && config.hiddenSize == c.hiddenSize && config.batchNorm == c.batchNorm;
+	return matches && LoadLayerParameters(in);
+}
 
 // CrossEntropy Loss を計算
-// target：one-hot ベクトル
-// outputVector：Softmax 出力
-float CNNModel::ComputeLoss(const std::vector<float>& target)
-{
-	// log(0) による -inf を防ぐためのごく小さな値（安定性のために足す）
-	float eps = 1e-9f;
-	// 損失値（交差エントロピー）を格納する変数
-	float loss = 0.0f;
-	// 10 クラス（0〜9）すべてについて損失を計算するループ
-	for (int i = 0; i < 10; i++)
+// label：正解クラス ID
+// Softmax + CrossEntropy の融合カーネルで損失と logits の勾配を同時に求める
+float CNNModel::ComputeLoss(int label)
+{
+	// 正解ラベルを保存する
+	m_label = label;
+	// 損失を計算し、Backward で使う勾配 dL/dz = y - t を m_dLogits に書き込む
+	float loss = SoftmaxCrossEntropy(m_logits.data(), &m_label, 1, (int)m_logits.size(), nullptr, m_dLogits.data(), m_labelSmoothing);
+	// 勾配は計算済み
+	m_hasGradient = true;
+	return loss;
+}
+
+// 1サンプル分の学習（Forward → 損失計算 → Backward）
+float CNNModel::TrainStep(const Tensor3D& x, int label, float learningRate)
+{
+	// 順伝播する（確率ベクトルはメンバに残るのでコピーしない）
+	ForwardPass(x);
+	// 損失と勾配を計算する
+	float loss = ComputeLoss(label);
+	// 逆伝播する（SGD 更新）
+	Backward(learningRate);
+	return loss;
+}
+
+// ミニバッチ 1 ステップ分の学習
+// 層ごとにバッチ全体を順伝播し、勾配をバッチ全体で累積してから 1 回だけ更新する
+// ・逆伝播まで保持する活性値は、通常は各段の ReLU 出力とプーリング出力
+// ・チェックポイントモードでは各段（Conv → BN → ReLU → Pool）の境界である ReLU 前の値だけを保持し、
+//   ReLU・プーリング・Flatten は逆伝播のときにサンプルごとに再計算する
+//   （BN ありの場合、ReLU 前の値は BN が保持する x^ から γ・x^ + β で戻せるので何も保持しない）
+float CNNModel::TrainBatch(const Tensor3D* images, const int* labels, int count, float learningRate, int* numCorrect,
+	float* sampleLosses)
+{
+	if (numCorrect) *numCorrect = 0;
+	if (count <= 0) return 0.0f;
+	// このステップのヒープの確保を計測する（層ごとの計測値はステップごとにやり直す）
+	AllocationScope stepScope;
+	for (LayerMemoryStats& layer : m_stepMemory.layers)
+	{
+		layer.activationBytes = layer.backwardPeakBytes = layer.backwardAllocations = 0;
+	}
+	// クラス数
+	const int numClasses = m_config.numClasses;
+	// サンプルごとの中間結果の領域を確保する（前回より大きいバッチのときだけ増やす）
+	if ((int)m_batchActivation1.size() < count)
+	{
+		m_batchActivation1.resize(count);
+		m_batchPool1.resize(count);
+		m_batchActivation2.resize(count);
+		m_batchPool2.resize(count);
+		m_batchArgmax1.resize(count);
+		m_batchArgmax2.resize(count);
+		m_batchGradient1.resize(count);
+		m_batchGradient2.resize(count);
+		if (m_config.mixedPrecision)
+		{
+			m_packedActivation1.resize(count);
+			m_packedPool1.resize(count);
+			m_packedActivation2.resize(count);
+		}
+	}
+	m_batchHidden.resize((size_t)count * m_config.hiddenSize);
+	// チェックポイントモードでなければ FC1 もバッチ全体の行列積でまとめて計算する
+	const bool batchedFC1 = !m_config.activationCheckpointing;
+	// Pool2 の出力の形状と FC1 の入力サイズ（FC1 の入力側勾配を Pool2 の形状に戻すのに使う）
+	const int pooledH = m_pool2.OutputSize(m_conv2.GetOutputHeight());
+	const int pooledW = m_pool2.OutputSize(m_conv2.GetOutputWidth());
+	const int pooledC = m_config.conv2Channels;
+	const size_t flatSize = (size_t)pooledH * pooledW * pooledC;
+	m_batchFlat.resize(batchedFC1 ? (size_t)count * flatSize : 0);
+	m_batchLogits.resize((size_t)count * numClasses);
+	m_batchDLogits.resize((size_t)count * numClasses);
+	// 混合精度モードでは逆伝播まで保持する活性値を bf16 に詰め、fp32 の領域を解放する
+	const bool packed = m_config.mixedPrecision;
+	auto keep = [packed](Tensor3D& tensor, Tensor3DBF16& storage)
+		{
+			if (packed) { storage.Pack(tensor); tensor = Tensor3D(); }
+		};
+	// 保持した活性値を取り出す（bf16 の場合は scratch に展開する）
+	auto restore = [packed](const Tensor3D& tensor, const Tensor3DBF16& storage, Tensor3D& scratch) -> const Tensor3D&
+		{
+			if (!packed) { return tensor; }
+			storage.Unpack(scratch);
+			return scratch;
+		};
+	// チェックポイントモードか
+	const bool checkpointing = m_config.activationCheckpointing;
+	// チェックポイントモードで各段の境界（ReLU 前の値）を保持し、段の途中の値を解放する
+	auto keepBoundary = [&](Tensor3D& boundary, Tensor3DBF16& storage, Tensor3D& pooled)
+		{
+			// BN ありなら境界は BN の x^ から戻せるので保持しない
+			if (m_config.batchNorm) { boundary = Tensor3D(); }
+			else { keep(boundary, storage); }
+			pooled = Tensor3D();
+		};
+	// チェックポイントモードで境界から ReLU → プーリングを再計算する
+	auto recompute = [&](int i, const BatchNormLayer& bn, const MaxPoolLayer& pool,
+		const Tensor3D& boundary, const Tensor3DBF16& storage, Tensor3D& activation, Tensor3D& pooled)
+		{
+			if (m_config.batchNorm) { bn.RecomputeOutput(i, activation); }
+			else { activation = restore(boundary, storage, activation); }
+			ReLULayer::ApplyInPlace(activation);
+			pooled = pool.Infer(activation);
+		};
+	// 活性値の最大バイト数を計測する（ResetPeakActivationBytes からの最大値）
+	// 再計算・展開用の作業領域
+	Tensor3D scratchActivation, scratchPool;
+	auto measure = [&]()
+		{
+			m_peakActivationBytes = std::max(m_peakActivationBytes,
+				CountBatchActivationBytes(count) + (size_t)(scratchActivation.Size() + scratchPool.Size()) * sizeof(float));
+		};
+
+	// ---- 順伝播 ----
+	// ReLU1 → Pool1 → Conv2
+	auto forwardSegment1 = [&](int i)
+		{
+			if (checkpointing)
+			{
+				// 境界（ReLU 前の値）を残すため、ReLU は作業領域で計算する
+				scratchActivation = m_batchActivation1[i];
+				ReLULayer::ApplyInPlace(scratchActivation);
+				m_batchPool1[i] = m_pool1.Forward(scratchActivation, m_batchArgmax1[i]);
+				m_batchActivation2[i] = m_conv2.Compute(m_batchPool1[i]);
+				keepBoundary(m_batchActivation1[i], m_packedActivation1[i], m_batchPool1[i]);
+				return;
+			}
+			ReLULayer::ApplyInPlace(m_batchActivation1[i]);
+			m_batchPool1[i] = m_pool1.Forward(m_batchActivation1[i], m_batchArgmax1[i]);
+			m_batchActivation2[i] = m_conv2.Compute(m_batchPool1[i]);
+			keep(m_batchActivation1[i], m_packedActivation1[i]);
+			keep(m_batchPool1[i], m_packedPool1[i]);
+		};
+	// ReLU2 → Pool2 → Flatten → FC1 → ReLU
+	// ・FC1 をまとめて行う場合は Pool2 の出力を m_batchFlat の行に写すだけで、FC1 / FC2 は全サンプルの順伝播の後で行う
+	auto forwardSegment2 = [&](int i)
+		{
+			if (checkpointing)
+			{
+				scratchActivation = m_batchActivation2[i];
+				ReLULayer::ApplyInPlace(scratchActivation);
+				m_batchPool2[i] = m_pool2.Forward(scratchActivation, m_batchArgmax2[i]);
+			}
+			else
+			{
+				ReLULayer::ApplyInPlace(m_batchActivation2[i]);
+				m_batchPool2[i] = m_pool2.Forward(m_batchActivation2[i], m_batchArgmax2[i]);
+			}
+			if (batchedFC1)
+			{
+				// HWC の並びのままなので Flatten は行への写しだけで済む
+				// ・FC1 の入力はバッチの行列積で逆伝播まで使うので fp32 のまま m_batchFlat に保持し、Pool2 の出力は解放する
+				const float* pooled = m_batchPool2[i].Data();
+				std::copy(pooled, pooled + flatSize, &m_batchFlat[(size_t)i * flatSize]);
+				measure();
+				keep(m_batchActivation2[i], m_packedActivation2[i]);
+				m_batchPool2[i] = Tensor3D();
+				return;
+			}
+			// チェックポイントモードではサンプルごとに FC1 を計算し、Pool2 の出力は逆伝播で再計算する
+			float* hidden = &m_batchHidden[(size_t)i * m_config.hiddenSize];
+			std::vector<float> hiddenOut = m_fcl1.Infer(m_batchPool2[i].Data());
+			std::copy(hiddenOut.begin(), hiddenOut.end(), hidden);
+			ReLULayer::ApplyInPlace(hidden, m_config.hiddenSize);
+			measure();
+			keepBoundary(m_batchActivation2[i], m_packedActivation2[i], m_batchPool2[i]);
+		};
+	if (m_config.batchNorm)
+	{
+		// BN はバッチ全体の統計量が必要なので、段ごとに全サンプルの計算を済ませてから正規化する
+		for (int i = 0; i < count; i++) { m_batchActivation1[i] = m_conv1.Compute(images[i]); }
+		m_bn1.ForwardBatch(m_batchActivation1.data(), count);
+		measure();
+		for (int i = 0; i < count; i++) { forwardSegment1(i); }
+		m_bn2.ForwardBatch(m_batchActivation2.data(), count);
+		measure();
+		for (int i = 0; i < count; i++) { forwardSegment2(i); }
+	}
+	else
+	{
+		// BN なしならサンプルごとに最後まで順伝播し、段の途中の値をバッチ分ためない
+		for (int i = 0; i < count; i++)
+		{
+			m_batchActivation1[i] = m_conv1.Compute(images[i]);
+			forwardSegment1(i);
+			forwardSegment2(i);
+		}
+	}
+	// FC1 / FC2 はバッチ全体をまとめて 1 回の行列積で計算する（重みのパネルを全サンプルで使い回す）
+	if (batchedFC1)
 	{
-		// 交差エントロピーの式： - Σ t[i] * log( y[i] )
-		// target[i] が 1 の位置だけ実質的に計算される（one-hot だから）
-		loss -= target[i] * std::log(m_outputVector[i] + eps);
+		m_fcl1.InferBatch(m_batchFlat.data(), m_batchHidden.data(), count);
+		ReLULayer::ApplyInPlace(m_batchHidden.data(), (int)m_batchHidden.size());
 	}
-	// 合計した損失値を返す
+	m_fcl2.InferBatch(m_batchHidden.data(), m_batchLogits.data(), count);
+	// バッチ全体の損失と logits の勾配（バッチ平均の勾配）を融合カーネルで求める
+	// (サンプルごとの損失も同じ計算の副産物として受け取る)
+	float loss = SoftmaxCrossEntropy(m_batchLogits.data(), labels, count, numClasses, nullptr, m_batchDLogits.data(), m_labelSmoothing, sampleLosses);
+	// 更新前の予測が正解していたか数える
+	if (numCorrect)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			const float* row = &m_batchLogits[(size_t)i * numClasses];
+			if ((int)(std::max_element(row, row + numClasses) - row) == labels[i]) (*numCorrect)++;
+		}
+	}
+	// 逆伝播まで保持する活性値が最大になるので、層ごとのバイト数を記録する
+	RecordBatchActivationBytes(count);
+
+	// ---- 逆伝播（勾配を累積するだけで、重みはまだ更新しない）----
+	// 使い終わった活性値・勾配はサンプルごとにすぐ解放する
+	// 層ごとの一時領域と確保回数を計測する（層の区間を終えるごとに次の層の計測をやり直す）
+	AllocationScope backwardScope;
+	auto recordBackward = [&](int layer)
+		{
+			LayerMemoryStats& stats = m_stepMemory.layers[layer];
+			stats.backwardPeakBytes = std::max(stats.backwardPeakBytes, backwardScope.GetPeakBytes());
+			stats.backwardAllocations += (size_t)backwardScope.GetAllocations();
+			backwardScope.Restart();
+		};
+	// FC2 の逆伝播はバッチ全体の 2 つの行列積でまとめて行い、FC1 の ReLU のマスクも掛けておく
+	std::vector<float> dHidden((size_t)count * m_config.hiddenSize);
+	m_fcl2.AccumulateGradients(m_batchHidden.data(), m_batchDLogits.data(), dHidden.data(), count);
+	ReLULayer::MaskGradient(m_batchHidden.data(), dHidden.data(), (int)dHidden.size());
+	recordBackward(MemoryFC2);
+	// FC1 の逆伝播もバッチ全体の行列積でまとめ、入力側勾配を count × 入力サイズの行列で受け取る
+	std::vector<float> dFlat;
+	if (batchedFC1)
+	{
+		dFlat.resize((size_t)count * flatSize);
+		m_fcl1.AccumulateGradients(m_batchFlat.data(), dHidden.data(), dFlat.data(), count);
+		recordBackward(MemoryFC1);
+	}
+	Tensor3D dPool1;
+	// FC1 → Pool2 → ReLU2 の逆伝播（Conv2 の出力側の勾配を求める）
+	auto backwardSegment2 = [&](int i)
+		{
+			// ReLU2 の出力を用意する（チェックポイントモードでは Pool2 の出力とともに再計算する）
+			Tensor3D dPool2(pooledH, pooledW, pooledC);
+			if (checkpointing)
+			{
+				recompute(i, m_bn2, m_pool2, m_batchActivation2[i], m_packedActivation2[i], scratchActivation, scratchPool);
+				// FC1 の入力側勾配を Pool2 の出力の形状の領域に直接書き込む（Flatten の逆伝播は不要）
+				m_fcl1.AccumulateGradients(scratchPool.Data(), &dHidden[(size_t)i * m_config.hiddenSize], dPool2.Data());
+				recordBackward(MemoryFC1);
+			}
+			else
+			{
+				// まとめて求めた FC1 の入力側勾配の行を Pool2 の出力の形状に戻す
+				const float* row = &dFlat[(size_t)i * flatSize];
+				std::copy(row, row + flatSize, dPool2.Data());
+			}
+			const Tensor3D& activation2 = checkpointing ? scratchActivation : restore(m_batchActivation2[i], m_packedActivation2[i], scratchActivation);
+			// Pool2 → ReLU2
+			m_batchGradient2[i] = m_pool2.Backward(activation2, m_batchArgmax2[i], dPool2);
+			ReLULayer::MaskGradient(activation2, m_batchGradient2[i]);
+			measure();
+			m_batchActivation2[i] = Tensor3D();
+			m_batchPool2[i] = Tensor3D();
+			recordBackward(MemoryPool2);
+		};
+	// Conv2 → Pool1 → ReLU1 の逆伝播（Conv1 の出力側の勾配を求める）
+	auto backwardSegment1 = [&](int i)
+		{
+			if (checkpointing) {
+				recompute(i, m_bn1, m_pool1, m_batchActivation1[i], m_packedActivation1[i], scratchActivation, scratchPool);
+			}
+			const Tensor3D& pool1 = checkpointing ? scratchPool : restore(m_batchPool1[i], m_packedPool1[i], scratchPool);
+			const Tensor3D& activation1 = checkpointing ? scratchActivation : restore(m_batchActivation1[i], m_packedActivation1[i], scratchActivation);
+			m_conv2.AccumulateGradients(pool1, m_batchGradient2[i], &dPool1);
+			recordBackward(MemoryConv2);
+			m_batchGradient1[i] = m_pool1.Backward(activation1, m_batchArgmax1[i], dPool1);
+			ReLULayer::MaskGradient(activation1, m_batchGradient1[i]);
+			measure();
+			m_batchGradient2[i] = Tensor3D();
+			m_batchActivation1[i] = Tensor3D();
+			m_batchPool1[i] = Tensor3D();
+			recordBackward(MemoryPool1);
+		};
+	// Conv1 の勾配を累積する（入力側の勾配は不要）
+	auto backwardConv1 = [&](int i)
+		{
+			m_conv1.AccumulateGradients(images[i], m_batchGradient1[i], nullptr);
+			m_batchGradient1[i] = Tensor3D();
+			recordBackward(MemoryConv1);
+		};
+	if (m_config.batchNorm)
+	{
+		// BN の逆伝播はバッチ全体の勾配の和が必要なので、段ごとに全サンプルを処理する
+		for (int i = 0; i < count; i++) { backwardSegment2(i); }
+		m_bn2.BackwardBatch(m_batchGradient2.data(), count, learningRate);
+		recordBackward(MemoryBN2);
+		for (int i = 0; i < count; i++) { backwardSegment1(i); }
+		m_bn1.BackwardBatch(m_batchGradient1.data(), count, learningRate);
+		recordBackward(MemoryBN1);
+		for (int i = 0; i < count; i++) { backwardConv1(i); }
+	}
+	else
+	{
+		// BN なしならサンプルごとに最後まで逆伝播し、勾配をバッチ分ためない
+		for (int i = 0; i < count; i++)
+		{
+			backwardSegment2(i);
+			backwardSegment1(i);
+			backwardConv1(i);
+		}
+	}
+
+	// ---- 累積した勾配で全層を 1 回だけ更新する ----
+	m_fcl2.ApplyGradients(learningRate);
+	m_fcl1.ApplyGradients(learningRate);
+	m_conv2.ApplyGradients(learningRate);
+	m_conv1.ApplyGradients(learningRate);
+	// 単一サンプル用の勾配は無効
+	m_hasGradient = false;
+	// ステップ全体の確保回数と使用中のヒープの最大の増分を記録する
+	m_stepMemory.stepAllocations = (size_t)stepScope.GetAllocations();
+	m_stepMemory.stepAllocatedBytes = (size_t)stepScope.GetAllocatedBytes();
+	m_stepMemory.stepPeakBytes = stepScope.GetPeakBytes();
 	return loss;
 }
+
+// TrainBatch で現在保持している活性値・勾配のバイト数を数える
+size_t CNNModel::CountBatchActivationBytes(int count) const
+{
+	size_t floats = m_batchFlat.size() + m_batchHidden.size() + m_batchLogits.size() + m_batchDLogits.size();
+	size_t bytes = 0;
+	for (int i = 0; i < count; i++)
+	{
+		floats += m_batchActivation1[i].Size() + m_batchPool1[i].Size()
+			+ m_batchActivation2[i].Size() + m_batchPool2[i].Size()
+			+ m_batchGradient1[i].Size() + m_batchGradient2[i].Size();
+		bytes += m_batchArgmax1[i].size() + m_batchArgmax2[i].size();
+		if (m_config.mixedPrecision)
+		{
+			bytes += m_packedActivation1[i].Bytes() + m_packedPool1[i].Bytes()
+				+ m_packedActivation2[i].Bytes();
+		}
+	}
+	// BN が逆伝播用に保持する x^
+	if (m_config.batchNorm) { bytes += m_bn1.GetStoredBytes() + m_bn2.GetStoredBytes(); }
+	return bytes + floats * sizeof(float);
+}
+
+// TrainBatch の順伝播の終わりに、層ごとに逆伝播まで保持する活性値のバイト数を記録する
+// ・各層の逆伝播で使う入力側の活性値をその層に数える（Conv1 の入力画像は呼び出し側が持つので数えない）
+void CNNModel::RecordBatchActivationBytes(int count)
+{
+	const bool packed = m_config.mixedPrecision;
+	// サンプルごとの活性値（混合精度モードでは bf16 版）のバイト数の合計
+	auto sum = [count, packed](const std::vector<Tensor3D>& tensors, const std::vector<Tensor3DBF16>& storage)
+		{
+			size_t bytes = 0;
+			for (int i = 0; i < count; i++)
+			{
+				bytes += (size_t)tensors[i].Size() * sizeof(float);
+				if (packed) { bytes += storage[i].Bytes(); }
+			}
+			return bytes;
+		};
+	std::vector<LayerMemoryStats>& layers = m_stepMemory.layers;
+	layers[MemoryBN1].activationBytes = m_config.batchNorm ? m_bn1.GetStoredBytes() : 0;
+	// プーリング層の最大値の位置
+	size_t argmax1 = 0, argmax2 = 0;
+	for (int i = 0; i < count; i++) { argmax1 += m_batchArgmax1[i].size(); argmax2 += m_batchArgmax2[i].size(); }
+	layers[MemoryPool1].activationBytes = sum(m_batchActivation1, m_packedActivation1) + argmax1;
+	layers[MemoryConv2].activationBytes = sum(m_batchPool1, m_packedPool1);
+	layers[MemoryBN2].activationBytes = m_config.batchNorm ? m_bn2.GetStoredBytes() : 0;
+	layers[MemoryPool2].activationBytes = sum(m_batchActivation2, m_packedActivation2) + argmax2;
+	// FC1 の入力（Pool2 の出力は m_batchFlat に写した時点で解放、チェックポイントモードでは再計算するので保持しない）
+	layers[MemoryFC1].activationBytes = m_batchFlat.size() * sizeof(float);
+	layers[MemoryFC2].activationBytes = (m_batchHidden.size() + m_batchLogits.size() + m_batchDLogits.size()) * sizeof(float);
+}
+
+// 層ごとのメモリ使用量を返す
+ModelMemoryStats CNNModel::GetMemoryStats() const
+{
+	ModelMemoryStats stats = m_stepMemory;
+	std::vector<LayerMemoryStats>& layers = stats.layers;
+	// パラメータ・勾配・作業領域
+	layers[MemoryConv1].parameterBytes = m_conv1.GetParameterBytes();
+	layers[MemoryConv1].gradientBytes = m_conv1.GetGradientBytes();
+	layers[MemoryConv1].workspaceBytes = m_conv1.GetWorkspaceBytes();
+	layers[MemoryConv2].parameterBytes = m_conv2.GetParameterBytes();
+	layers[MemoryConv2].gradientBytes = m_conv2.GetGradientBytes();
+	layers[MemoryConv2].workspaceBytes = m_conv2.GetWorkspaceBytes();
+	layers[MemoryFC1].parameterBytes = m_fcl1.GetParameterBytes();
+	layers[MemoryFC1].gradientBytes = m_fcl1.GetGradientBytes();
+	layers[MemoryFC2].parameterBytes = m_fcl2.GetParameterBytes();
+	layers[MemoryFC2].gradientBytes = m_fcl2.GetGradientBytes();
+	layers[MemoryBN1].parameterBytes = m_bn1.GetParameterBytes();
+	layers[MemoryBN2].parameterBytes = m_bn2.GetParameterBytes();
+	// 単一サンプルの Forward で保持している活性値（層は参照だけを持つので、実体のメンバを数える）
+	auto tensorBytes = [](const Tensor3D& tensor) { return (size_t)tensor.Size() * sizeof(float); };
+	layers[MemoryConv1].activationBytes += tensorBytes(m_inputImage);
+	layers[MemoryPool1].activationBytes += tensorBytes(m_conv1Output) + m_relu1.GetStoredBytes() + m_pool1.GetStoredBytes();
+	layers[MemoryConv2].activationBytes += tensorBytes(m_pool1Output);
+	layers[MemoryPool2].activationBytes += tensorBytes(m_conv2Output) + m_relu2.GetStoredBytes() + m_pool2.GetStoredBytes();
+	layers[MemoryFC1].activationBytes += tensorBytes(m_pool2Output);
+	layers[MemoryFC2].activationBytes += (m_hiddenLayer1.size() + m_logits.size() + m_outputVector.size() + m_dLogits.size()) * sizeof(float)
+		+ m_hiddenMask.size() * sizeof(uint64_t);
+	// BN なしのモデルでは BN の層を表示しない
+	if (!m_config.batchNorm)
+	{
+		layers.erase(layers.begin() + MemoryBN2);
+		layers.erase(layers.begin() + MemoryBN1);
+	}
+	return stats;
+}
+
+// バッチ正規化を直前の畳み込み層に折り込む
+void CNNModel::FoldBatchNorm()
+{
+	if (!m_config.batchNorm) return;
+	// BN(conv(x)) = scale * conv(x) + shift を conv の重み・バイアスに吸収させる
+	std::vector<float> scale, shift;
+	m_bn1.GetFoldedScaleShift(scale, shift);
+	m_conv1.FoldScaleShift(scale, shift);
+	m_bn2.GetFoldedScaleShift(scale, shift);
+	m_conv2.FoldScaleShift(scale, shift);
+	// 以降は BN なしのモデルとして推論する
+	m_config.batchNorm = false;
+}
+
+// 直前の Forward で最も確率の高いクラス ID を返す
+int CNNModel::GetPredictedClass() const
+{
+	return (int)(std::max_element(m_outputVector.begin(), m_outputVector.end()) - m_outputVector.begin());
+}
+
 // Backward（逆伝播）
 // 目的：Forward の逆順に勾配を流し、重みを更新する
 void CNNModel::Backward(float learningRate)
 {
-	// Softmax と CrossEntropy を組み合わせた場合の誤差勾配を計算する（非常にシンプルになる）
-	// 数式 dL/dz = y - t （Softmax の出力 - 教師データ）をそのまま使う
-	std::vector<float> dSoftmax(10);
-
-	// 各クラス（0〜9）について勾配を計算する
-	for (int i = 0; i < 10; i++) 	{
-		// Softmax の出力 y[i] から 教師の one-hot 値 t[i] を引いたものが勾配になる
-		dSoftmax[i] = m_outputVector[i] - targetVector[i];
+	// Softmax と CrossEntropy を組み合わせた場合の誤差勾配 dL/dz = y - t を使う
+	// ComputeLoss が未呼び出しの場合はここで融合カーネルを実行して求める
+	if (!m_hasGradient)	{
+		SoftmaxCrossEntropy(m_logits.data(), &m_label, 1, (int)m_logits.size(), nullptr, m_dLogits.data(), m_labelSmoothing);
+		m_hasGradient = true;
 	}
 	// FC2 の逆伝播
-	auto dFC2Input = m_fcl2.Backward(dSoftmax, learningRate);
+	auto dFC2Input = m_fcl2.Backward(m_dLogits, learningRate);
 	// FC1 層で行った ReLU（max(0, x)）の効果を逆伝播処理に反映する
-	for (size_t i = 0; i < dFC2Input.size(); i++)
-	{
-		// ReLU の入力値が 0 以下だった部分は、逆伝播する勾配も 0 に切り落とす
-		if (m_hiddenLayer1[i] <= 0.0f)	{
-			// 勾配を 0 にする（ReLU の性質：負の部分には勾配を流さない）
-			dFC2Input[i] = 0.0f;
-		}
-	}
+	// ・ReLU の入力値が 0 以下だった部分は、逆伝播する勾配も 0 に切り落とす
+	ReLULayer::MaskGradient(m_hiddenMask.data(), dFC2Input.data(), (int)dFC2Input.size());
 	// FC1 の逆伝播
 	auto dFC1Input = m_fcl1.Backward(dFC2Input, learningRate);
-	// Flatten の逆伝播のため、1x1xN の Tensor3D に詰め直す
-	Tensor3D dFlat(1, 1, (int)dFC1Input.size());
-	// FC1 の勾配ベクトル（1次元配列）を Flatten の逆伝播用に 1×1×N の Tensor3D に詰め直す
-	for (int i = 0; i < (int)dFC1Input.size(); i++)	{
-		// dFlat の i 番目のチャンネルに勾配をコピーする（Flatten 前の形に戻すため）
-		dFlat(0, 0, i) = dFC1Input[i];
-	}
-	// Flatten の逆伝播（全結合層 → プーリング層へ勾配を戻す）
-	Tensor3D dPool2 = m_flatten.Backward(dFlat, learningRate);
+	// FC1 の勾配ベクトルの領域をそのまま 1×1×N の Tensor3D として引き取る（コピーしない）
+	Tensor3D dPool2(1, 1, (int)dFC1Input.size(), std::move(dFC1Input));
+	// Flatten の逆伝播（全結合層 → プーリング層へ勾配を戻す、形状を H×W×C に付け替えるだけ）
+	m_flatten.BackwardInPlace(dPool2);
 	// MaxPool2 の逆伝播（プーリング → ReLU2 へ勾配を戻す）
-	Tensor3D dRelu2Out = m_pool2.Backward(dPool2);
-	// ReLU2 の逆伝播（ReLU → Conv2 へ勾配を戻す）
-	Tensor3D dConv2Out = m_relu2.Backward(dRelu2Out, learningRate);
+	Tensor3D dConv2Out = m_pool2.Backward(dPool2);
+	// ReLU2 の逆伝播（ReLU → Conv2 へ勾配を戻す、勾配の領域をそのまま使う）
+	m_relu2.BackwardInPlace(dConv2Out);
+	// BN2 の逆伝播（順伝播は移動平均の統計量で固定しているので、γ・β は更新しない）
+	if (m_config.batchNorm) { dConv2Out = m_bn2.BackwardInference(dConv2Out); }
 	// Conv2 の逆伝播（Conv2 → Pool1 へ勾配を戻す）
 	Tensor3D dPool1Out = m_conv2.Backward(dConv2Out, learningRate);
 	// MaxPool1 の逆伝播（プーリング → ReLU1 へ勾配を戻す）
-	Tensor3D dRelu1Out = m_pool1.Backward(dPool1Out);
+	Tensor3D dConv1Out = m_pool1.Backward(dPool1Out);
 	// ReLU1 の逆伝播（ReLU → Conv1 へ勾配を戻す）
-	Tensor3D dConv1Out = m_relu1.Backward(dRelu1Out, learningRate);
+	m_relu1.BackwardInPlace(dConv1Out);
+	// BN1 の逆伝播
+	if (m_config.batchNorm) { dConv1Out = m_bn1.BackwardInference(dConv1Out); }
 	// Conv1 の逆伝播（Conv1 のパラメータ更新）
 	m_conv1.Backward(dConv1Out, learningRate);
 }
 
 // Predict（もっとも確率の高いクラスIDを返す）
+// 推論専用の順伝播を使う（BN は学習時の統計量で正規化する）
 int CNNModel::Predict(const Tensor3D& inputTensor)
 {
-	auto probs = Forward(inputTensor);
-	return (int)(std::max_element(probs.begin(), probs.end()) - probs.begin());
+	std::vector<float> logits(m_config.numClasses);
+	InferLogits(inputTensor, logits.data());
+	return (int)(std::max_element(logits.begin(), logits.end()) - logits.begin());
 }
 
 // PredictProba（確率ベクトルを返す）
 std::vector<float> CNNModel::PredictProba(const Tensor3D& inputTensor)
 {
-	return Forward(inputTensor);
+	std::vector<float> probs(m_config.numClasses);
+	InferLogits(inputTensor, probs.data());
+	Softmax(probs.data(), 1, m_config.numClasses, probs.data());
+	return probs;
+}
+
+// count 枚の画像の Softmax の確率をまとめて求める
+void CNNModel::PredictProbaBatch(const Tensor3D* images, int count, float* probabilities) const
+{
+	InferLogitsBatch(images, count, probabilities);
+	Softmax(probabilities, count, m_config.numClasses, probabilities);
 }
 
 // Top-10（確率の高い順に並べた (クラスID, 確率) のリスト）を返す関数
 std::vector<std::pair<int, float>> CNNModel::GetTop10(const Tensor3D& inputTensor)
 {
-	// Forward を実行して Softmax の確率ベクトルを取得
-	auto probs = Forward(inputTensor);
-	// (クラスID, 確率) を格納するためのベクタを作成
-	std::vector<std::pair<int, float>> v;
-	// v の領域を 10 個分（クラス数）あらかじめ確保して高速化
-	v.reserve(10);
-	// 0〜9 の各クラスについて (ID, そのクラスの確率) を追加する
-	for (int i = 0; i < 10; i++)	{
-		v.emplace_back(i, probs[i]);
-	}
-	// 確率の高い順になるようにペアをソートする
-	std::sort(	v.begin(), v.end(), [](auto& a, auto& b)
-		{
-			// second（確率）が大きいものから順に並べる
-			return a.second > b.second;
-		}
-	);
-	// 上位 10 個（＝すべて）を返す
-	return v;
+	// 推論を実行して Softmax の確率ベクトルを取得し、上位 10 個を選ぶ
+	auto probs = PredictProba(inputTensor);
+	return GetTopK(probs.data(), 10);
+}
+
+// 計算済みの確率ベクトルから上位 k 個を返す
+std::vector<std::pair<int, float>> CNNModel::GetTopK(const float* probabilities, int k) const
+{
+	return SelectTopK(probabilities, m_config.numClasses, k);
+}
+
+// SetClassNames で設定したクラス名 (空なら Fashion-MNIST のクラス名を使う)
+static std::vector<std::wstring>& ClassNames()
+{
+	static std::vector<std::wstring> names;
+	return names;
 }
 
-// Top-10 の (クラスID, 確率) を wstring のクラス名に変換する関数
-std::vector<std::wstring> CNNModel::GetTop10Names(const std::vector<std::pair<int, float>>& top10)
+// データセットのクラス名を設定する
+void CNNModel::SetClassNames(const std::vector<std::wstring>& names)
 {
+	ClassNames() = names;
+}
+
+// クラス ID に対応するクラス名を返す
+const wchar_t* CNNModel::GetClassName(int classId)
+{
+	// データセットのクラス名が設定されていればそれを返す
+	const std::vector<std::wstring>& classNames = ClassNames();
+	if (!classNames.empty()) { return (classId >= 0 && classId < (int)classNames.size()) ? classNames[classId].c_str() : L""; }
 	// Fashion-MNIST の 10 クラス名（ID:0〜9 に対応する）
 	static const wchar_t* names[10] =
 	{
@@ -208,18 +779,18 @@ std::vector<std::wstring> CNNModel::GetTop10Names(const std::vector<std::pair<in
 		 L"Bag",
 		 L"Ankle boot"
 	};
-	// 結果のクラス名（wstring）を格納する配列を用意する
-	std::vector<std::wstring> result;
-	// 10 個分のメモリをあらかじめ確保して push_back を高速化する
+	// 範囲外の ID には空文字を返す
+	return (classId >= 0 && classId < 10) ? names[classId] : L"";
+}
+
+// Top-10 の (クラスID, 確率) をクラス名に変換する関数
+std::vector<std::wstring_view> CNNModel::GetTop10Names(const std::vector<std::pair<int, float>>& top10)
+{
+	// 結果のクラス名（静的なテーブルを指すビュー）を格納する配列を用意する
+	std::vector<std::wstring_view> result;
 	result.reserve(top10.size());
-	// Top-10 の各項目に対してループを回す
-	for (size_t i = 0; i < top10.size(); i++)	{
-		// top10[i].first はクラスID（0〜9）
-		int id = top10[i].first;
-		// 対応するクラス名（names[id]）を result に追加する
-		result.push_back(names[id]);
-	}
+	// top10[i].first のクラスIDに対応するクラス名を result に追加する
+	for (const auto& entry : top10) { result.emplace_back(GetClassName(entry.first)); }
 	// 変換したクラス名リストを返す
 	return result;
 }
-
@@ -1,87 +1,265 @@
 #pragma once
 // CNNModel.h
-// Fashion-MNIST p CNN f`
-// \FConv  ReLU  Pool  Conv  ReLU  Pool  Flatten  FC1  ReLU  FC2  Softmax
+// Fashion-MNIST / CIFAR-10 などの画像分類用 CNN モデル定義
+// 構成：Conv → (BN) → ReLU → Pool → Conv → (BN) → ReLU → Pool → Flatten → FC1 → ReLU → FC2 → Softmax
+// 各層の形状は CNNConfig（入力画像の形状と層の設定）から導出する
 
 #include <vector>
 #include <string>
+#include <string_view>
 #include <utility>
+#include <memory>
 
-#include "Tensor3D.h"								// 3e\iH~W~Cj
-#include "ConvLayer.h"							// ݍݑwiConvj
-#include "MaxPoolLayer.h"					// őlv[OwiPoolj
-#include "FullyConnectedLayer.h"	// SwiFCj
-#include "ReLULayer.h"							// ReLU w
-#include "FlattenLayer.h"						// Flatteni3D  1D xNgϊj
+#include "Tensor3D.h"								// 3次元テンソル（H×W×C）
+#include "ConvLayer.h"							// 畳み込み層（Conv）
+#include "MaxPoolLayer.h"					// 最大値プーリング層（Pool）
+#include "FullyConnectedLayer.h"	// 全結合層（FC）
+#include "ReLULayer.h"							// ReLU 活性化層
+#include "FlattenLayer.h"						// Flatten（3D → 1D ベクトル変換）
+#include "BatchNormLayer.h"					// バッチ正規化層（BN）
+#include "MemoryStats.h"						// メモリ使用量の計測
 
-// CNNModel NX
-// EForward() : 摜͂mzi10NXjo
-// EBackward(): t`dew̃p[^XV{
-// EPredict(): \NX ID 擾
-// EGetTop10(): Top-10 ̗\m擾
+// CNNModel の構成設定
+// ・入力形状はデータセットのヘッダ（画像の行数・列数・チャネル数）から設定する
+// ・既定値は Fashion-MNIST（28×28×1、10 クラス）
+struct CNNConfig
+{
+	// 入力画像の高さ
+	int inputHeight = 28;
+	// 入力画像の幅
+	int inputWidth = 28;
+	// 入力画像のチャネル数（1=グレースケール、3=RGB）
+	int inputChannels = 1;
+	// 分類クラス数
+	int numClasses = 10;
+	// 畳み込みカーネルサイズ
+	int filterSize = 3;
+	// 畳み込みのストライド
+	int convStride = 1;
+	// 畳み込みのパディング（負の値なら filterSize / 2）
+	int convPadding = -1;
+	// Conv1 の出力チャネル数
+	int conv1Channels = 8;
+	// Conv2 の出力チャネル数
+	int conv2Channels = 16;
+	// プーリングサイズ
+	int poolSize = 2;
+	// FC1 の出力次元（隠れ層のユニット数）
+	int hiddenSize = 128;
+	// 各畳み込み層の直後にバッチ正規化を入れるか
+	// ・TrainBatch のミニバッチ統計量で正規化するので、大きめのバッチ・学習率で学習できる
+	// ・FoldBatchNorm() で畳み込み層に折り込むと false に戻る
+	bool batchNorm = false;
+	// 混合精度学習を行うか
+	// ・順伝播の GEMM は bf16 の重み・入力で計算し、積和の累積と重みの更新は fp32 で行う
+	// ・TrainBatch で逆伝播まで保持する活性値を bf16 で保存する（メモリ量・帯域が約半分になる）
+	bool mixedPrecision = false;
+	// 勾配チェックポイント（活性値の再計算）モード
+	// ・TrainBatch で各段の境界（ReLU 前の値）だけを保持し、ReLU・プーリング・Flatten は逆伝播時に再計算する
+	// ・計算は少し増えるが、同じメモリ量でより大きなバッチを扱える
+	bool activationCheckpointing = false;
+};
+
+// CNNModel クラス
+// ・Forward() : 画像を入力し確率分布（クラス数次元）を出力
+// ・Backward(): 逆伝播し各層のパラメータ更新を実施
+// ・Predict(): 予測クラス ID 取得
+// ・GetTop10(): Top-10 の予測確率取得（計算済みの確率からは GetTopK()）
 class CNNModel
 {
 public:
-	// RXgN^
-	// EConv/Pool/FC w̏s
-	CNNModel();
+	// コンストラクタ
+	// ・config の形状に従って Conv/Pool/FC 層の初期化を行う
+	explicit CNNModel(const CNNConfig& config = CNNConfig());
+	// 各層は下の活性値メンバへの参照を保持するため、コピーは禁止する
+	CNNModel(const CNNModel&) = delete;
+	CNNModel& operator=(const CNNModel&) = delete;
 
-	// `d
-	// E Tensor3Di28~28~1j mxNgi10jԂ
+	// 順伝播する
+	// ・入力 Tensor3D（inputHeight×inputWidth×inputChannels）→ 確率ベクトル（クラス数次元）を返す
 	std::vector<float> Forward(const Tensor3D& x);
 
-	// t`d
-	// ElearningRate: wK
-	// ESoftmax + CrossEntropy ̌z𗬂SwXV
+	// 逆伝播する
+	// ・learningRate: 学習率
+	// ・Softmax + CrossEntropy の勾配を流し全層を更新する
 	void Backward(float learningRate);
 
-	// vZ
-	// ECrossEntropyLoss Ԃ
-	float ComputeLoss(const std::vector<float>& target);
-	// wKp̋txione-hotjZbg
-	void SetTarget(const std::vector<float>& target) { targetVector = target; }
-	// 摜͂čłm̍NXIDԂ
+	// 損失を計算する
+	// ・直前の Forward の logits と正解ラベルから CrossEntropyLoss を返す
+	// ・Softmax + CrossEntropy の融合カーネルで、Backward 用の勾配も同時に求める
+	float ComputeLoss(int label);
+	// 学習用の教師ラベル（正解クラス ID）をセット
+	void SetLabel(int label) { m_label = label; m_hasGradient = false; }
+	// ラベルスムージングの強さを設定する（0 = 無効）
+	// ・教師分布を (1 - ε)・onehot + ε / クラス数 として損失と勾配を計算する
+	void SetLabelSmoothing(float smoothing) { m_labelSmoothing = smoothing; }
+
+	// 1サンプル分の学習（Forward → 損失計算 → Backward）を行う
+	// ・BN ありの場合、BN は移動平均の統計量で固定して γ・β・移動平均を更新しない（BN の学習は TrainBatch で行う）
+	// ・戻り値: 損失
+	float TrainStep(const Tensor3D& x, int label, float learningRate);
+	// ミニバッチ 1 ステップ分の学習を行う
+	// ・各層をバッチ全体でまとめて順伝播し（BN はバッチ統計量を使う）、
+	//   逆伝播では勾配をバッチ全体で累積してから 1 回だけ更新する
+	// ・images / labels: count 個の画像と正解クラス ID
+	// ・numCorrect: 学習前の予測が正解だった数の格納先（不要なら nullptr）
+	// ・sampleLosses: 更新前のサンプルごとの損失の格納先（count 個、不要なら nullptr、サンプラの損失キャッシュ用）
+	// ・戻り値: 平均損失
+	float TrainBatch(const Tensor3D* images, const int* labels, int count, float learningRate, int* numCorrect = nullptr,
+		float* sampleLosses = nullptr);
+	// 直前の Forward の Softmax 出力を返す（コピーしない）
+	const std::vector<float>& GetProbabilities() const { return m_outputVector; }
+	// 直前の Forward で最も確率の高いクラス ID を返す
+	int GetPredictedClass() const;
+
+	// 推論専用の順伝播（読み取り専用）
+	// ・logits: クラス数分のスコアの格納先（Softmax 前）
+	// ・学習用の状態を書き換えないため、複数スレッドから同時に呼び出せる
+	void InferLogits(const Tensor3D& x, float* logits) const;
+	// 推論専用の順伝播を count 枚まとめて行う（読み取り専用）
+	// ・logits: count × クラス数のスコアの格納先
+	// ・畳み込み側は 1 枚ずつ計算し、FC1 / FC2 は全サンプルを 1 回の行列積で計算する
+	void InferLogitsBatch(const Tensor3D* images, int count, float* logits) const;
+	// TrainBatch で保持した活性値（勾配を含む）の最大バイト数を返す
+	size_t GetPeakActivationBytes() const { return m_peakActivationBytes; }
+	// 活性値の最大バイト数の計測をやり直す
+	void ResetPeakActivationBytes() { m_peakActivationBytes = 0; }
+	// 層ごとのメモリ使用量を返す
+	// ・パラメータ・勾配・作業領域は現在のバイト数、活性値は直前の TrainBatch の順伝播の終わりと単一サンプルの Forward の分
+	// ・逆伝播の一時領域と確保回数、ステップ全体の確保回数は直前の TrainBatch の計測値（TrainBatch を呼んだスレッドの確保を数える）
+	// ・ReLU は直後のプーリング層（FC1 の ReLU は FC1）、Flatten は FC1、Softmax + 損失は FC2 に含める
+	ModelMemoryStats GetMemoryStats() const;
+	// バッチ正規化を直前の畳み込み層の重み・バイアスに折り込む（推論用の書き出し前に呼ぶ）
+	// ・推論結果は変わらず、推論時の BN の計算が無くなる
+	// ・折り込み後は BN なしのモデルとして扱う
+	void FoldBatchNorm();
+	// 構成設定と全層のパラメータをチェックポイントファイルに書き出す（失敗したら false）
+	// ・BN の移動平均の統計量も含む（FoldBatchNorm 後に書き出せば BN なしのモデルとして保存される）
+	bool SaveCheckpoint(const std::string& path) const;
+	// チェックポイントファイルからモデルを作る（読めなければ nullptr）
+	// ・構成設定もファイルから読むので、学習時と同じ形状のモデルになる
+	static std::unique_ptr<CNNModel> LoadCheckpoint(const std::string& path);
+	// チェックポイントファイルのパラメータをこのモデルに読み込む（学習中の最良モデルに戻す用）
+	// ・構成設定が一致しなければ false（読み込みの途中で失敗した場合はパラメータが一部上書きされている）
+	bool RestoreCheckpoint(const std::string& path);
+	// 出力クラス数を返す
+	int GetNumClasses() const { return m_config.numClasses; }
+	// モデルの構成設定を返す
+	const CNNConfig& GetConfig() const { return m_config; }
+	// 画像を入力して最も確率の高いクラスIDを返す
 	int Predict(const Tensor3D& inputTensor);
-	// 摜͂ Softmax ̊mxNgԂ
+	// 画像を入力して Softmax の確率ベクトルを返す
 	std::vector<float> PredictProba(const Tensor3D& inputTensor);
-	// Top-10  (NXID, m) Ԃ
+	// count 枚の画像の Softmax の確率をまとめて求める（読み取り専用）
+	// ・probabilities: count × クラス数の格納先
+	void PredictProbaBatch(const Tensor3D* images, int count, float* probabilities) const;
+	// Top-10 の (クラスID, 確率) を返す（推論を1回実行する）
 	std::vector<std::pair<int, float>> GetTop10(const Tensor3D& inputTensor);
-	// Top-10 NXɕϊĕԂ
-	std::vector<std::wstring> GetTop10Names(const std::vector<std::pair<int, float>>& top10);
+	// 計算済みの確率ベクトル（クラス数次元）から上位 k 個の (クラスID, 確率) を確率の高い順に返す
+	// ・推論をやり直さず、全体を並べ替えずに上位 k 個だけを選ぶ（バッチは SelectTopKBatch を使う）
+	std::vector<std::pair<int, float>> GetTopK(const float* probabilities, int k) const;
+	// Top-10 をクラス名に変換して返す
+	// ・クラス名の静的なテーブルを指すビューを返すので、文字列の確保・コピーは発生しない
+	static std::vector<std::wstring_view> GetTop10Names(const std::vector<std::pair<int, float>>& top10);
+	// クラス ID に対応するクラス名を返す（"Sneaker" など）
+	// ・SetClassNames で設定していなければ Fashion-MNIST のクラス名を返す
+	static const wchar_t* GetClassName(int classId);
+	// 学習・評価に使うデータセットのクラス名を設定する（表示と混同行列に使う、空なら Fashion-MNIST に戻す）
+	// ・起動時に 1 回だけ呼ぶ（GetClassName が返すポインタはここで設定した文字列を指す）
+	static void SetClassNames(const std::vector<std::wstring>& names);
 
 private:
-	// Forward Ŏgpew̏óiBackward ŕKvj
-	 // ͉摜i28~28~1j
+	// 順伝播の本体（結果は m_outputVector に残す）
+	void ForwardPass(const Tensor3D& x);
+	// TrainBatch で現在保持している活性値・勾配のバイト数を数える
+	size_t CountBatchActivationBytes(int count) const;
+	// TrainBatch の順伝播の終わりに、層ごとに逆伝播まで保持する活性値のバイト数を記録する
+	void RecordBatchActivationBytes(int count);
+	// チェックポイントの各層のパラメータを読み込む（SaveCheckpoint と同じ順）
+	bool LoadLayerParameters(std::istream& in);
+
+private:
+	// モデルの構成設定（各層より先に初期化する）
+	CNNConfig m_config;
+
+	// Forward で使用する各層の出力（Backward で必要）
+	// ・活性値の実体はここにだけ置く。Conv/FC 層はこれらへの参照だけを持ち、ReLU は 1 bit のマスク、
+	//   MaxPool は最大値の位置、Flatten は入力形状だけを持つ（同じ活性値を層ごとにコピーしない）
+	// ・ReLU はその場で適用するので、m_conv1Output / m_conv2Output は ReLU 後の値になる
+	// ・そのため Forward から Backward までの間、これらを書き換えてはいけない
+	// （形状は Fashion-MNIST の既定構成の場合）
+	 // 入力画像（28×28×1）
 	Tensor3D m_inputImage;  
-	// Conv1 ̏ói28~28~8j
+	// Conv1 の出力（28×28×8）
 	Tensor3D m_conv1Output; 
-	// Pool1 ̏ói14~14~8j
+	// Pool1 の出力（14×14×8）
 	Tensor3D m_pool1Output;  
-	// Conv2 ̏ói14~14~16j
+	// Conv2 の出力（14×14×16）
 	Tensor3D m_conv2Output;  
-	// Pool2 ̏ói7~7~16j
+	// Pool2 の出力（7×7×16、Flatten で 1×1×784 に付け替えて FC1 の入力ベクトルとしてそのまま使う）
 	Tensor3D m_pool2Output;  
 
-	FlattenLayer m_flatten;  // 7~7~16  784xNgɕϊw
-	std::vector<float> m_hiddenLayer1; // FC1 ̏óiReLUA128j
-	std::vector<float> m_outputVector; // Softmax ói10j
-	std::vector<float> targetVector;   // tf[^(one-hot 10)
+	FlattenLayer m_flatten;  // 7×7×16 → 784次元ベクトルに変換する層
+	std::vector<float> m_hiddenLayer1; // FC1 の出力（ReLU後、hiddenSize 次元）
+	std::vector<uint64_t> m_hiddenMask; // FC1 の出力の ReLU マスク（x > 0 だった位置、1 要素 1 bit）
+	std::vector<float> m_logits;       // FC2 の出力（Softmax 前のスコア、クラス数次元）
+	std::vector<float> m_outputVector; // Softmax 出力（クラス数次元）
+	std::vector<float> m_dLogits;      // logits に対する勾配（ComputeLoss で計算、クラス数次元）
+	int m_label = 0;                   // 教師データの正解クラス ID
+	float m_labelSmoothing = 0.0f;     // ラベルスムージングの強さ ε
+	bool m_hasGradient = false;        // m_dLogits が直前の Forward に対して計算済みか
 
-	// CNN \wCX^X
-	// 1ݍݑwi3~3Ao 8`lj
+	// CNN を構成する層インスタンス
+	// 第1畳み込み層（filterSize×filterSize、出力 conv1Channels チャンネル）
 	ConvLayer m_conv1;
-	// 1v[Owi2~2j
+	// 第1プーリング層（poolSize×poolSize）
 	MaxPoolLayer m_pool1;
-	// 2ݍݑwi3~3Ao 16`lj
+	// 第2畳み込み層（filterSize×filterSize、出力 conv2Channels チャンネル）
 	ConvLayer m_conv2;       
-	// 2v[Owi2~2j
+	// 第2プーリング層（poolSize×poolSize）
 	MaxPoolLayer m_pool2;   
-	 // FC1i784  128j
+	 // FC1（Flatten 後の次元 → hiddenSize）
 	FullyConnectedLayer m_fcl1;
-	// FC2i128  10j
+	// FC2（hiddenSize → クラス数）
 	FullyConnectedLayer m_fcl2; 
-	 // Conv1  ReLU
+	 // Conv1 直後の ReLU
 	ReLULayer m_relu1;
-	// Conv2  ReLU
+	// Conv2 直後の ReLU
 	ReLULayer m_relu2;      
+	// Conv1 直後のバッチ正規化（config.batchNorm のときだけ使う）
+	BatchNormLayer m_bn1;
+	// Conv2 直後のバッチ正規化
+	BatchNormLayer m_bn2;
+
+	// ミニバッチ学習（TrainBatch）用のサンプルごとの中間結果（呼び出しごとに再利用する）
+	// Conv1 → BN1 → ReLU1 の出力
+	std::vector<Tensor3D> m_batchActivation1;
+	// Pool1 の出力
+	std::vector<Tensor3D> m_batchPool1;
+	// Conv2 → BN2 → ReLU2 の出力
+	std::vector<Tensor3D> m_batchActivation2;
+	// Pool2 の出力（m_batchFlat に写すか、チェックポイントモードでは FC1 に直接渡した後に解放する）
+	std::vector<Tensor3D> m_batchPool2;
+	// Pool1 / Pool2 の最大値の位置（出力1要素につき 1 byte、逆伝播で勾配を流す先）
+	std::vector<std::vector<uint8_t>> m_batchArgmax1;
+	std::vector<std::vector<uint8_t>> m_batchArgmax2;
+	// 混合精度モードで保持する Activation1 / Pool1 / Activation2 の bf16 版（fp32 版は順伝播が終わると解放する）
+	std::vector<Tensor3DBF16> m_packedActivation1;
+	std::vector<Tensor3DBF16> m_packedPool1;
+	std::vector<Tensor3DBF16> m_packedActivation2;
+	// FC1 の入力（Flatten 後の Pool2 の出力、count × 入力サイズを連続して並べる、FC1 の順伝播・逆伝播の行列積の入力）
+	// ・チェックポイントモードでは FC1 をサンプルごとに計算するので使わない
+	std::vector<float> m_batchFlat;
+	// FC1 の出力（ReLU 後、count × hiddenSize を連続して並べる、FC2 の逆伝播の行列積の入力）
+	std::vector<float> m_batchHidden;
+	// Conv1 / Conv2 の出力側の勾配
+	std::vector<Tensor3D> m_batchGradient1;
+	std::vector<Tensor3D> m_batchGradient2;
+	// バッチ全体の logits と勾配（count × クラス数）
+	std::vector<float> m_batchLogits;
+	std::vector<float> m_batchDLogits;
+	// TrainBatch での活性値の最大バイト数
+	size_t m_peakActivationBytes = 0;
+	// 直前の TrainBatch のメモリの計測値（層ごとの活性値・逆伝播の一時領域とステップ全体の確保）
+	ModelMemoryStats m_stepMemory;
 };
@@ -0,0 +1,41 @@
+﻿// Checkpoint.h
+// チェックポイントファイル (学習済みパラメータのバイナリ) の読み書きの共通処理
+// ・値はホストのバイト順でそのまま書き出す (同じ種類の CPU の間でだけ読み書きする)
+// ・各層の SaveParameters / LoadParameters と CNNModel::SaveCheckpoint / LoadCheckpoint から使う
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+
+// 値を1つ書き出す
+template <typename T>
+inline void WriteCheckpointValue(std::ostream& out, const T& value)
+{
+	out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+// 値を1つ読み込む (失敗したら false)
+template <typename T>
+inline bool ReadCheckpointValue(std::istream& in, T& value)
+{
+	in.read(reinterpret_cast<char*>(&value), sizeof(T));
+	return (bool)in;
+}
+
+// 配列を書き出す (要素数を先頭に付ける)
+inline void WriteCheckpointArray(std::ostream& out, const std::vector<float>& values)
+{
+	WriteCheckpointValue(out, (uint64_t)values.size());
+	out.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(float));
+}
+
+// 配列を読み込む
+// ・values の要素数 (層の形状から決まる) とファイルの要素数が違えば、読み込まずに false を返す
+inline bool ReadCheckpointArray(std::istream& in, std::vector<float>& values)
+{
+	uint64_t count = 0;
+	if (!ReadCheckpointValue(in, count) || count != values.size()) { return false; }
+	in.read(reinterpret_cast<char*>(values.data()), values.size() * sizeof(float));
+	return (bool)in;
+}
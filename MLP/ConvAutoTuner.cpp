@@ -0,0 +1,212 @@
+﻿// ConvAutoTuner.cpp
+// 畳み込みアルゴリズムの実測選択と、CPU モデル別の永続キャッシュ
+#include "ConvAutoTuner.h"
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <tuple>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+// 計測する候補アルゴリズムの一覧
+static const ConvAlgorithm kCandidates[] = { ConvAlgorithm::Direct, ConvAlgorithm::Im2colGemm };
+// 計測前の空回し回数（キャッシュやページを温める）
+constexpr int TUNE_WARMUP = 2;
+// 計測回数（最短時間を採用する）
+constexpr int TUNE_REPEAT = 5;
+
+// cpuid のブランド文字列から CPU モデル名を取得する
+static std::string QueryCpuName()
+{
+	// ブランド文字列（48文字 + 終端）
+	char brand[49] = {};
+	// cpuid の戻り値 (EAX, EBX, ECX, EDX)
+	unsigned int regs[4] = {};
+#ifdef _MSC_VER
+	int info[4] = {};
+	// 拡張機能の最大リーフを確認する
+	__cpuid(info, 0x80000000);
+	if ((unsigned int)info[0] >= 0x80000004u)
+	{
+		// 0x80000002〜0x80000004 の 3 リーフにブランド文字列が入っている
+		for (unsigned int leaf = 0; leaf < 3; leaf++)
+		{
+			__cpuid(info, (int)(0x80000002u + leaf));
+			std::memcpy(regs, info, sizeof(regs));
+			std::memcpy(brand + leaf * 16, regs, 16);
+		}
+	}
+#else
+	if (__get_cpuid_max(0x80000000u, nullptr) >= 0x80000004u)
+	{
+		for (unsigned int leaf = 0; leaf < 3; leaf++)
+		{
+			__get_cpuid(0x80000002u + leaf, &regs[0], &regs[1], &regs[2], &regs[3]);
+			std::memcpy(brand + leaf * 16, regs, 16);
+		}
+	}
+#endif
+	// 前後の空白を取り除く
+	std::string name(brand);
+	size_t first = name.find_first_not_of(' ');
+	size_t last = name.find_last_not_of(' ');
+	if (first == std::string::npos) { return "unknown-cpu"; }
+	return name.substr(first, last - first + 1);
+}
+
+// アルゴリズム名を文字列で返す
+const char* ConvAlgorithmName(ConvAlgorithm algorithm)
+{
+	switch (algorithm)
+	{
+	case ConvAlgorithm::Direct:     return "direct";
+	case ConvAlgorithm::Im2colGemm: return "im2col";
+	default:                        return "unset";
+	}
+}
+
+// 文字列からアルゴリズムに戻す（未知の名前は Unset）
+static ConvAlgorithm ParseConvAlgorithm(const std::string& name)
+{
+	for (ConvAlgorithm candidate : kCandidates)
+	{
+		if (name == ConvAlgorithmName(candidate)) { return candidate; }
+	}
+	return ConvAlgorithm::Unset;
+}
+
+// 形状の比較（全フィールドの辞書順）
+bool ConvSignature::operator<(const ConvSignature& other) const
+{
+	return std::tie(height, width, inChannels, outChannels, filterSize, stride, padding)
+		< std::tie(other.height, other.width, other.inChannels, other.outChannels, other.filterSize, other.stride, other.padding);
+}
+
+// "H W Cin Cout k stride padding" 形式の文字列にする
+std::string ConvSignature::ToString() const
+{
+	std::ostringstream oss;
+	oss << height << ' ' << width << ' ' << inChannels << ' ' << outChannels << ' ' << filterSize << ' ' << stride << ' ' << padding;
+	return oss.str();
+}
+
+// シングルトンを取得する
+ConvAutoTuner& ConvAutoTuner::Instance()
+{
+	static ConvAutoTuner instance;
+	return instance;
+}
+
+// コンストラクタ（CPU 名の取得のみ。キャッシュは初回 Select で読む）
+ConvAutoTuner::ConvAutoTuner()
+	: m_cachePath("conv_tuning_cache.txt"),
+	m_cpuName(QueryCpuName())
+{
+}
+
+// キャッシュファイルのパスを変更する
+void ConvAutoTuner::SetCachePath(const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_cachePath = path;
+	m_choices.clear();
+	m_loaded = false;
+}
+
+// キャッシュファイルを読み込む
+// 1行の形式: "<CPU名>\t<H W Cin Cout k stride padding>\t<アルゴリズム名>"
+void ConvAutoTuner::LoadCache()
+{
+	m_loaded = true;
+	std::ifstream ifs(m_cachePath);
+	if (!ifs) { return; }
+	std::string line;
+	while (std::getline(ifs, line))
+	{
+		// タブで3つのフィールドに分割する
+		size_t tab1 = line.find('\t');
+		size_t tab2 = (tab1 == std::string::npos) ? std::string::npos : line.find('\t', tab1 + 1);
+		if (tab2 == std::string::npos) { continue; }
+		// 他の CPU で計測した結果は使わない
+		if (line.compare(0, tab1, m_cpuName) != 0) { continue; }
+		// 形状を読み取る
+		ConvSignature signature{};
+		std::istringstream iss(line.substr(tab1 + 1, tab2 - tab1 - 1));
+		if (!(iss >> signature.height >> signature.width >> signature.inChannels
+			>> signature.outChannels >> signature.filterSize
+			>> signature.stride >> signature.padding)) { continue; }
+		// 以前の形式（バッチサイズを含む 8 項目）の行は読み飛ばす（その形状は次の Select で計測し直す）
+		std::string extra;
+		if (iss >> extra) { continue; }
+		// アルゴリズム名を読み取る（後の行が優先される）
+		ConvAlgorithm algorithm = ParseConvAlgorithm(line.substr(tab2 + 1));
+		if (algorithm != ConvAlgorithm::Unset) { m_choices[signature] = algorithm; }
+	}
+}
+
+// 1件の結果をキャッシュファイルへ追記する
+void ConvAutoTuner::AppendCache(const ConvSignature& signature, ConvAlgorithm algorithm)
+{
+	std::ofstream ofs(m_cachePath, std::ios::app);
+	// 書き込めない場所でもチューニング結果はプロセス内で有効なので無視する
+	if (!ofs) { return; }
+	ofs << m_cpuName << '\t' << signature.ToString() << '\t' << ConvAlgorithmName(algorithm) << '\n';
+}
+
+// 候補を実測して最速のアルゴリズムを返す
+ConvAlgorithm ConvAutoTuner::Benchmark(const RunCandidate& run)
+{
+	ConvAlgorithm best = kCandidates[0];
+	double bestSeconds = std::numeric_limits<double>::max();
+	for (ConvAlgorithm candidate : kCandidates)
+	{
+		// 空回ししてから計測する
+		for (int i = 0; i < TUNE_WARMUP; i++) { run(candidate); }
+		// 最短時間をその候補の代表値とする（外乱の影響を受けにくい）
+		double candidateSeconds = std::numeric_limits<double>::max();
+		for (int i = 0; i < TUNE_REPEAT; i++)
+		{
+			auto start = std::chrono::steady_clock::now();
+			run(candidate);
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			candidateSeconds = std::min(candidateSeconds, elapsed.count());
+		}
+		if (candidateSeconds < bestSeconds)
+		{
+			bestSeconds = candidateSeconds;
+			best = candidate;
+		}
+	}
+	return best;
+}
+
+// 形状に対して最速のアルゴリズムを返す
+ConvAlgorithm ConvAutoTuner::Select(const ConvSignature& signature, const RunCandidate& run)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	// 初回のみキャッシュファイルを読み込む
+	if (!m_loaded) { LoadCache(); }
+	// 計測済みならその結果を返す
+	auto it = m_choices.find(signature);
+	if (it != m_choices.end()) { return it->second; }
+	// 未計測なら候補を実測して保存する
+	ConvAlgorithm best = Benchmark(run);
+	m_choices[signature] = best;
+	AppendCache(signature, best);
+	return best;
+}
+
+// 計測済みのアルゴリズムを返す（計測はしない）
+ConvAlgorithm ConvAutoTuner::Lookup(const ConvSignature& signature)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!m_loaded) { LoadCache(); }
+	auto it = m_choices.find(signature);
+	return (it != m_choices.end()) ? it->second : ConvAlgorithm::Unset;
+}
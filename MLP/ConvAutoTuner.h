@@ -0,0 +1,97 @@
+﻿// ConvAutoTuner.h
+// 畳み込みアルゴリズムの自動選択（オートチューナ）
+// ・層の形状 (H, W, Cin, Cout, k, stride, padding) ごとに候補アルゴリズムを実測し、最速のものを選ぶ
+// ・畳み込みは 1 枚ずつ計算するので、ミニバッチのサイズはキーに含めない
+// ・選択結果は CPU モデル名をキーにキャッシュファイルへ保存し、次回起動時は計測を省略する
+#pragma once
+#include <string>
+#include <map>
+#include <mutex>
+#include <functional>
+
+// 畳み込みの計算アルゴリズム
+enum class ConvAlgorithm
+{
+	// 未選択（初回 Forward でチューナに問い合わせる）
+	Unset,
+	// 直接法（6重ループ）
+	Direct,
+	// im2col + GEMM
+	Im2colGemm,
+};
+
+// アルゴリズム名を文字列で返す（キャッシュファイルへの保存用）
+const char* ConvAlgorithmName(ConvAlgorithm algorithm);
+
+// チューニングのキーとなる畳み込みの形状
+struct ConvSignature
+{
+	// 入力の高さ
+	int height;
+	// 入力の幅
+	int width;
+	// 入力チャネル数
+	int inChannels;
+	// 出力チャネル数
+	int outChannels;
+	// カーネルサイズ
+	int filterSize;
+	// ストライド
+	int stride;
+	// パディング
+	int padding;
+
+	// std::map のキーにするための比較演算子
+	bool operator<(const ConvSignature& other) const;
+	// キャッシュファイル用の文字列表現（"H W Cin Cout k stride padding"）
+	std::string ToString() const;
+};
+
+// ConvAutoTuner クラス
+// ・プロセス内で1つだけ存在する（Instance() で取得する）
+// ・Select() は形状ごとに一度だけ候補を計測し、以降はキャッシュ結果を返す
+class ConvAutoTuner
+{
+public:
+	// 候補アルゴリズムを1回実行する関数（計測対象）
+	using RunCandidate = std::function<void(ConvAlgorithm)>;
+
+	// シングルトンを取得する
+	static ConvAutoTuner& Instance();
+
+	// 形状に対して最速のアルゴリズムを返す
+	// ・キャッシュにあればそのまま返す
+	// ・無ければ run で各候補を計測し、結果をキャッシュファイルに追記する
+	ConvAlgorithm Select(const ConvSignature& signature, const RunCandidate& run);
+	// 計測済みのアルゴリズムを返す（計測はしない、推論用の層の初期化に使う）
+	// ・同じ形状の結果が無ければ Unset
+	ConvAlgorithm Lookup(const ConvSignature& signature);
+
+	// キャッシュファイルのパスを変更する（既定: "conv_tuning_cache.txt"）
+	void SetCachePath(const std::string& path);
+
+	// 実行中の CPU モデル名を返す（キャッシュのキー）
+	const std::string& GetCpuName() const { return m_cpuName; }
+
+private:
+	ConvAutoTuner();
+
+	// キャッシュファイルから現在の CPU の結果を読み込む
+	void LoadCache();
+	// 1件の結果をキャッシュファイルへ追記する
+	void AppendCache(const ConvSignature& signature, ConvAlgorithm algorithm);
+	// 候補を実測して最速のアルゴリズムを返す
+	static ConvAlgorithm Benchmark(const RunCandidate& run);
+
+private:
+	// 排他制御（並列推論から同時に呼ばれても安全にする）
+	std::mutex m_mutex;
+	// キャッシュファイルのパス
+	std::string m_cachePath;
+	// CPU モデル名（cpuid のブランド文字列）
+	std::string m_cpuName;
+	// 形状 → 選択済みアルゴリズム
+	std::map<ConvSignature, ConvAlgorithm> m_choices;
+	// キャッシュファイルを読み込み済みか
+	bool m_loaded = false;
+};
@@ -1,167 +1,449 @@
 // ConvLayer.cpp
 #include "ConvLayer.h"
-#include <random>
+#include "Random.h"
+#include "Checkpoint.h"
 #include <cmath>
+#include <cassert>
+#include <algorithm>
 
-// Kzɏ]𐶐(He p)
+// 正規分布に従う乱数を生成する(He 初期化用)
 static float GenerateNormalRandomConv(float mean, float stddev)
 {
-	// ZkcCX^iV[h̓_foCXj
-	static std::mt19937 rng(std::random_device{}());
-	// ςƕW΍w肵Kz
-	std::normal_distribution<float> dist(mean, stddev);
-	// zɏ]Ԃ
-	return dist(rng);
+	// 共通の乱数サービスの初期化用ストリームから取る（シードが同じなら毎回同じ重みになる）
+	return InitializationRandom().NextNormal(mean, stddev);
 }
 
-// RXgN^(̓TCY, `l, J[lTCY, o̓`l)
-ConvLayer::ConvLayer(int inputHeight, int inputWidth, int inputChannel, int filterSize, int outChannels)
+// 出力の一辺のサイズを計算する
+int ConvLayer::OutputSize(int inputSize, int filterSize, int stride, int padding)
+{
+	return (inputSize + 2 * padding - filterSize) / stride + 1;
+}
+
+// コンストラクタ(入力サイズ, チャネル数, カーネルサイズ, 出力チャネル数, ストライド, パディング)
+ConvLayer::ConvLayer(int inputHeight, int inputWidth, int inputChannel, int filterSize, int outChannels, int stride, int padding)
 
 	:
-	// ͉摜̍L^
+	// 入力画像の高さを記録する
 	m_inputHeight(inputHeight)
-	// ͉摜̕L^
+	// 入力画像の幅を記録する
 	, m_inputWidth(inputWidth)
-	// ̓`li1=O[XP[A3=RGBȂǁj
+	// 入力チャネル数（1=グレースケール、3=RGBなど）
 	, m_numInputChannels(inputChannel)
-	// J[litB^j̏cTCYiF3  3~3j
+	// カーネル（フィルタ）の縦横サイズ（例：3 → 3×3）
 	, m_filtersize(filterSize)
-	// o̓`litB^A}bvj
+	// 出力チャネル数（フィルタ数、特徴マップ数）
 	, m_numOutputChannels(outChannels)
-	// 3~3 J[lœ͂Əo͂̃TCY𓯂ɕۂ߂̃pfBOiE㉺1j
-	, m_padding(1)
+	// ストライド（フィルタをずらす間隔）
+	, m_stride(stride)
+	// パディング（負の値なら filterSize / 2 とし、ストライド1で入力と出力のサイズを同じに保つ）
+	, m_padding(padding < 0 ? filterSize / 2 : padding)
 {
-	// 1̃tB^͂̑iHe Ɏgj
+	// 出力特徴マップのサイズを計算する
+	m_outputHeight = OutputSize(m_inputHeight, m_filtersize, m_stride, m_padding);
+	m_outputWidth = OutputSize(m_inputWidth, m_filtersize, m_stride, m_padding);
+	// 1つのフィルタが見る入力の総数（He 初期化に使う）
 	int inputConnections = m_filtersize * m_filtersize * m_numInputChannels;
-	// He ̕W΍  = sqrt(2 / fan_in)
+	// He 初期化の標準偏差 σ = sqrt(2 / fan_in)
 	float stddev = std::sqrt(2.0f / inputConnections);
-	// dݔzutB^ ~ ̓`l ~ tB^ ~ tB^vmۂ
+	// 重み配列を「フィルタ数 × 入力チャネル数 × フィルタ高さ × フィルタ幅」分確保する
 	m_weights.resize(m_numOutputChannels * m_numInputChannels * m_filtersize * m_filtersize);
-	// ed݂𕽋0EW΍stddev̐Kzŏ
+	// 各重みを平均0・標準偏差stddevの正規分布で初期化する
 	for (auto& weight : m_weights)
 	{
-		// K1̏d݂
+		// 正規乱数で1つの重みを初期化
 		weight = GenerateNormalRandomConv(0.0f, stddev);
 	}
-	// oCAX͊eo̓`lƂ1݂邽߁A0 ŏ
+	// バイアスは各出力チャネルごとに1つずつ存在するため、0 で初期化する
 	m_bias.assign(m_numOutputChannels, 0.0f);
+	// 勾配の累積領域を 0 で初期化する
+	m_dWeights.assign(m_weights.size(), 0.0f);
+	m_dBias.assign(m_numOutputChannels, 0.0f);
+	// im2col 用の並びの重みを作る
+	RefreshPackedWeights();
+	// 推論 (Infer) で使うアルゴリズムをチューニングのキャッシュから引く (計測済みでなければ直接法)
+	m_algorithm = ConvAutoTuner::Instance().Lookup(MakeSignature());
+}
+
+// オートチューナのキーとなる形状を返す
+ConvSignature ConvLayer::MakeSignature() const
+{
+	return ConvSignature{ m_inputHeight, m_inputWidth, m_numInputChannels, m_numOutputChannels, m_filtersize, m_stride, m_padding };
 }
 
-// `d(͓}bvo͓}bvvZ)
+// 順伝播する(入力特徴マップから出力特徴マップを計算)
 Tensor3D ConvLayer::Forward(const Tensor3D& inputFeatureMap)
 {
-	// t`dpɓ͂ێ
-	m_lastInput = inputFeatureMap;
-	// o͓}bvmۂ
-	// pfBO=1, XgCh=1 ̂߁Ao̓TCY͓͂Ɠ (H~W~outChannels)
-	Tensor3D outputFeatureMap(m_inputHeight, m_inputWidth, m_numOutputChannels);
-	// o͈ʒu (h, w) ƂɌvZ
-	for (int h = 0; h < m_inputHeight; h++)
+	// 逆伝播用に入力への参照を保持する (コピーはしない)
+	m_lastInput = &inputFeatureMap;
+	// 畳み込みを計算する
+	return Compute(inputFeatureMap);
+}
+
+// 順伝播の計算だけを行う(入力は保存しない)
+Tensor3D ConvLayer::Compute(const Tensor3D& inputFeatureMap)
+{
+	// 出力特徴マップを確保する (outH×outW×outChannels)
+	Tensor3D outputFeatureMap(m_outputHeight, m_outputWidth, m_numOutputChannels);
+	// 混合精度モードは bf16 の GEMM で計算する (チューナは使わない)
+	if (m_mixedPrecision)
+	{
+		ForwardIm2colBF16(inputFeatureMap, outputFeatureMap, m_columnBuffer, m_columnBF16);
+		return outputFeatureMap;
+	}
+	// 未選択なら、この形状で最速のアルゴリズムをオートチューナに選ばせる (キャッシュにあれば計測しない)
+	if (m_algorithm == ConvAlgorithm::Unset)
+	{
+		m_algorithm = ConvAutoTuner::Instance().Select(MakeSignature(),
+			[&](ConvAlgorithm candidate) { ForwardWith(candidate, inputFeatureMap, outputFeatureMap); });
+	}
+	// 選択されたアルゴリズムで畳み込みを計算する
+	ForwardWith(m_algorithm, inputFeatureMap, outputFeatureMap);
+	// 出力特徴マップを返す
+	return outputFeatureMap;
+}
+
+// 推論用の順伝播(学習用の状態を一切書き換えないため、複数スレッドから同時に呼べる)
+Tensor3D ConvLayer::Infer(const Tensor3D& inputFeatureMap) const
+{
+	// 出力特徴マップを確保する
+	Tensor3D outputFeatureMap(m_outputHeight, m_outputWidth, m_numOutputChannels);
+	if (m_mixedPrecision) {
+		// 列行列の1行分のバッファはスレッドごとに持つ
+		thread_local std::vector<float> columnBuffer;
+		thread_local std::vector<uint16_t> columnBF16;
+		ForwardIm2colBF16(inputFeatureMap, outputFeatureMap, columnBuffer, columnBF16);
+	}
+	else if (m_algorithm == ConvAlgorithm::Im2colGemm) {
+		// 列行列はスレッドごとに持つ
+		thread_local std::vector<float> columnBuffer;
+		ForwardIm2col(inputFeatureMap, outputFeatureMap, columnBuffer);
+	}
+	else {
+		// キャッシュに無くチューニング前なら直接法で計算する
+		ForwardDirect(inputFeatureMap, outputFeatureMap);
+	}
+	return outputFeatureMap;
+}
+
+// 指定アルゴリズムで畳み込みを計算する
+void ConvLayer::ForwardWith(ConvAlgorithm algorithm, const Tensor3D& inputFeatureMap, Tensor3D& outputFeatureMap)
+{
+	if (algorithm == ConvAlgorithm::Im2colGemm) {
+		ForwardIm2col(inputFeatureMap, outputFeatureMap, m_columnBuffer);
+	}
+	else {
+		ForwardDirect(inputFeatureMap, outputFeatureMap);
+	}
+}
+
+// 直接法で畳み込みを計算する
+void ConvLayer::ForwardDirect(const Tensor3D& inputFeatureMap, Tensor3D& outputFeatureMap) const
+{
+	// 出力位置 (h, w) ごとに計算する
+	for (int h = 0; h < m_outputHeight; h++)
 	{
-		for (int w = 0; w < m_inputWidth; w++)
+		for (int w = 0; w < m_outputWidth; w++)
 		{
-			// o̓`lƂɌvZ
+			// 出力チャネルごとに計算する
 			for (int k = 0; k < m_numOutputChannels; k++)
 			{
-				// o͂̏lƂăoCAXݒ
+				// 出力の初期値としてバイアスを設定
 				float sum = m_bias[k];
-				// tB^̊eʒu (fh, fw) 𑖍
+				// フィルタ内の各位置 (fh, fw) を走査する
 				for (int fh = 0; fh < m_filtersize; fh++)
 				{
 					for (int fw = 0; fw < m_filtersize; fw++)
 					{
-						// ͉摜̑Ήʒu()
-						int ih = h + fh - m_padding;
-						// ͉摜̑Ήʒu()
-						int iw = w + fw - m_padding;
-						// pfBÖ̓XLbv
+						// 入力画像上の対応位置(高さ)
+						int ih = h * m_stride + fh - m_padding;
+						// 入力画像上の対応位置(幅)
+						int iw = w * m_stride + fw - m_padding;
+						// パディング領域はスキップする
 						if (ih < 0 || iw < 0 || ih >= m_inputHeight || iw >= m_inputWidth) { continue; 	}
-						// e̓`lɂĘa
+						// 各入力チャネルについて和を取る
 						for (int ic = 0; ic < m_numInputChannels; ic++)
 						{
-							// ͒l
+							// 入力値
 							float inputValue = inputFeatureMap(ih, iw, ic);
-							// Ήd
+							// 対応する重み
 							float weight = m_weights[WeightIndex(fh, fw, ic, k)];
-							// ςZ
+							// 積を加算
 							sum += inputValue * weight;
 						}
 					}
 				}
-				// o͓}bvɊi[
+				// 出力特徴マップに格納する
 				outputFeatureMap(h, w, k) = sum;
 			}
 		}
 	}
-	// o͓}bvԂ
-	return outputFeatureMap;
 }
 
-// t`d(zvZAd݂ƃoCAXXV)
+// im2col + GEMM で畳み込みを計算する
+// ・列行列の1行 = 出力1画素の受容野 (fh, fw, ic 順) で、重み m_packedWeights の1行 (出力チャネル1つ分) と同じ並び
+// ・内積はバイアスから直接法と同じ順に足す (パディング位置は 0 を足すだけ) ので、どちらのアルゴリズムを選んでも結果は同じ
+// ・出力 (outH*outW × outChannels) = 列行列 (outH*outW × K) × 重みの転置 (K × outChannels)
+void ConvLayer::ForwardIm2col(const Tensor3D& inputFeatureMap, Tensor3D& outputFeatureMap, std::vector<float>& columnBuffer) const
+{
+	// 受容野の要素数 K
+	const int K = m_numInputChannels * m_filtersize * m_filtersize;
+	// 出力画素数
+	const int P = m_outputHeight * m_outputWidth;
+	// 列行列を確保する(2回目以降は再利用)
+	columnBuffer.resize((size_t)P * K);
+	// 入力の生データ (HWC)
+	const float* input = inputFeatureMap.Data();
+	// 入力を列行列に展開する(パディング位置は 0)
+	for (int h = 0; h < m_outputHeight; h++)
+	{
+		for (int w = 0; w < m_outputWidth; w++)
+		{
+			// この出力画素に対応する列行列の行
+			GatherColumn(input, h, w, &columnBuffer[(size_t)(h * m_outputWidth + w) * K]);
+		}
+	}
+	// 出力の生データ (HWC = P × outChannels)
+	float* output = outputFeatureMap.Data();
+	// 行列積: 列行列の各行と重みの各行の内積を取る(どちらも K 方向に連続しているためベクトル化しやすい)
+	for (int p = 0; p < P; p++)
+	{
+		const float* column = &columnBuffer[(size_t)p * K];
+		for (int k = 0; k < m_numOutputChannels; k++)
+		{
+			const float* weightRow = &m_packedWeights[(size_t)k * K];
+			// 出力の初期値としてバイアスを設定
+			float sum = m_bias[k];
+			for (int j = 0; j < K; j++)
+			{
+				sum += column[j] * weightRow[j];
+			}
+			output[p * m_numOutputChannels + k] = sum;
+		}
+	}
+}
+
+// 出力画素 (h, w) の受容野を列行列の1行に展開する
+void ConvLayer::GatherColumn(const float* input, int h, int w, float* column) const
+{
+	for (int fh = 0; fh < m_filtersize; fh++)
+	{
+		// 入力画像上の対応位置(高さ)
+		int ih = h * m_stride + fh - m_padding;
+		for (int fw = 0; fw < m_filtersize; fw++)
+		{
+			// 入力画像上の対応位置(幅)
+			int iw = w * m_stride + fw - m_padding;
+			// パディング領域は 0 を詰める
+			if (ih < 0 || iw < 0 || ih >= m_inputHeight || iw >= m_inputWidth)
+			{
+				std::fill(column, column + m_numInputChannels, 0.0f);
+			}
+			else
+			{
+				// 入力は HWC なので、この位置の全入力チャネルは連続している
+				const float* pixel = &input[(ih * m_inputWidth + iw) * m_numInputChannels];
+				std::copy(pixel, pixel + m_numInputChannels, column);
+			}
+			column += m_numInputChannels;
+		}
+	}
+}
+
+// im2col + bf16 GEMM で畳み込みを計算する
+// ・列行列は全体を持たず、出力画素1つ分の行を展開 → bf16 変換 → 全出力チャネルとの内積の順に処理する
+// ・積和は fp32 で累積するので、誤差は入力と重みの丸め (相対 2^-9 程度) だけに収まる
+void ConvLayer::ForwardIm2colBF16(const Tensor3D& inputFeatureMap, Tensor3D& outputFeatureMap, std::vector<float>& columnBuffer, std::vector<uint16_t>& columnBF16) const
+{
+	// 受容野の要素数 K
+	const int K = m_numInputChannels * m_filtersize * m_filtersize;
+	columnBuffer.resize(K);
+	columnBF16.resize(K);
+	const float* input = inputFeatureMap.Data();
+	float* output = outputFeatureMap.Data();
+	for (int h = 0; h < m_outputHeight; h++)
+	{
+		for (int w = 0; w < m_outputWidth; w++)
+		{
+			// 受容野を展開して bf16 に変換する
+			GatherColumn(input, h, w, columnBuffer.data());
+			ConvertToBF16(columnBuffer.data(), columnBF16.data(), K);
+			float* out = output + (size_t)(h * m_outputWidth + w) * m_numOutputChannels;
+			for (int k = 0; k < m_numOutputChannels; k++)
+			{
+				out[k] = m_bias[k] + DotBF16(columnBF16.data(), &m_weightsBF16[(size_t)k * K], K);
+			}
+		}
+	}
+}
+
+// 混合精度モードを切り替える
+void ConvLayer::SetMixedPrecision(bool enabled)
+{
+	m_mixedPrecision = enabled;
+	if (enabled) { RefreshPackedWeights(); }
+	else { m_weightsBF16.clear(); }
+}
+
+// 重み・バイアスのバイト数
+size_t ConvLayer::GetParameterBytes() const
+{
+	return (m_weights.size() + m_packedWeights.size() + m_bias.size()) * sizeof(float) + m_weightsBF16.size() * sizeof(uint16_t);
+}
+
+// 勾配の累積領域のバイト数
+size_t ConvLayer::GetGradientBytes() const
+{
+	return (m_dWeights.size() + m_dBias.size()) * sizeof(float);
+}
+
+// im2col の列行列のバイト数 (縮めずに使い回すので確保済みの容量で数える)
+size_t ConvLayer::GetWorkspaceBytes() const
+{
+	return m_columnBuffer.capacity() * sizeof(float) + m_columnBF16.capacity() * sizeof(uint16_t);
+}
+
+// 重みとバイアスを書き出す
+void ConvLayer::SaveParameters(std::ostream& out) const
+{
+	WriteCheckpointArray(out, m_weights);
+	WriteCheckpointArray(out, m_bias);
+}
+
+// 重みとバイアスを読み込む
+bool ConvLayer::LoadParameters(std::istream& in)
+{
+	if (!ReadCheckpointArray(in, m_weights) || !ReadCheckpointArray(in, m_bias)) { return false; }
+	RefreshPackedWeights();
+	return true;
+}
+
+// 重みを列行列の1行と同じ並び (出力チャネルごとに fh, fw, ic 順) に並べ替える
+void ConvLayer::RefreshPackedWeights()
+{
+	m_packedWeights.resize(m_weights.size());
+	float* packed = m_packedWeights.data();
+	for (int k = 0; k < m_numOutputChannels; k++)
+	{
+		for (int fh = 0; fh < m_filtersize; fh++)
+		{
+			for (int fw = 0; fw < m_filtersize; fw++)
+			{
+				for (int ic = 0; ic < m_numInputChannels; ic++)
+				{
+					*packed++ = m_weights[WeightIndex(fh, fw, ic, k)];
+				}
+			}
+		}
+	}
+	// 混合精度モードでは順伝播用の bf16 の重みも作り直す
+	if (!m_mixedPrecision) { return; }
+	m_weightsBF16.resize(m_packedWeights.size());
+	ConvertToBF16(m_packedWeights.data(), m_weightsBF16.data(), m_packedWeights.size());
+}
+
+// 逆伝播する(勾配を計算し、重みとバイアスを更新する)
 Tensor3D ConvLayer::Backward(const Tensor3D& dOutputFeatureMap, float learningRate)
 {
-	// ͑z (H~W~inChannels)  0 ŏ
-	Tensor3D dInputFeatureMap(m_inputHeight, m_inputWidth, m_numInputChannels);
-	dInputFeatureMap.Zero();
+	// 入力側勾配 (H×W×inChannels)
+	Tensor3D dInputFeatureMap;
+	// 順伝播時の入力から勾配を求める
+	assert(m_lastInput != nullptr);
+	AccumulateGradients(*m_lastInput, dOutputFeatureMap, &dInputFeatureMap);
+	// 重みとバイアスを更新する
+	ApplyGradients(learningRate);
+	// 入力側勾配を返す
+	return dInputFeatureMap;
+}
 
-	// d݌zp̔z 0 ŏ
-	std::vector<float> dWeights(m_weights.size(), 0.0f);
-	// oCAXzp̔z 0 ŏ
-	std::vector<float> dBiasGradient(m_numOutputChannels, 0.0f);
+// 勾配を累積する(重みは更新しない)
+void ConvLayer::AccumulateGradients(const Tensor3D& inputFeatureMap, const Tensor3D& dOutputFeatureMap, Tensor3D* dInputFeatureMap)
+{
+	// 入力側勾配 (H×W×inChannels) を 0 で初期化
+	if (dInputFeatureMap)
+	{
+		if (dInputFeatureMap->GetH() != m_inputHeight || dInputFeatureMap->GetW() != m_inputWidth || dInputFeatureMap->GetC() != m_numInputChannels)
+		{
+			*dInputFeatureMap = Tensor3D(m_inputHeight, m_inputWidth, m_numInputChannels);
+		}
+		dInputFeatureMap->Zero();
+	}
 
-	// o͓}bvidOutputFeatureMapj̊ef (h, w) ɂČzvZs
-	for (int h = 0; h < m_inputHeight; h++)
+	// 出力特徴マップ（dOutputFeatureMap）の各画素 (h, w) について勾配計算を行う
+	for (int h = 0; h < m_outputHeight; h++)
 	{
-		// ̉fʒuɂă[v
-		for (int w = 0; w < m_inputWidth; w++)
+		// 横方向の画素位置についてループする
+		for (int w = 0; w < m_outputWidth; w++)
 		{
-			// eo̓`litB^jɑ΂ď
+			// 各出力チャンネル（フィルタ数）に対して処理する
 			for (int k = 0; k < m_numOutputChannels; k++)
 			{
-				// o͂̌z dL/d(out) 擾iConv2D ̋t`d̏o_j
+				// 出力の勾配 dL/d(out) を取得（Conv2D の逆伝播の出発点）
 				float gradient = dOutputFeatureMap(h, w, k);
-				// oCAX͑SlAo͌z̑â܂܌zɂȂ
-				dBiasGradient[k] += gradient;
-				// tB^iJ[lj̏cʒu[vifh = filter heightj
+				// バイアスは全結合同様、出力勾配の総和がそのまま勾配になる
+				m_dBias[k] += gradient;
+				// フィルタ（カーネル）内の縦位置をループ（fh = filter height）
 				for (int fh = 0; fh < m_filtersize; fh++)
 				{
-					// tB^̉ʒu[vifw = filter widthj
+					// フィルタ内の横位置をループ（fw = filter width）
 					for (int fw = 0; fw < m_filtersize; fw++)
 					{
-						// ͑̈ʒuipfBOj
-						int ih = h + fh - m_padding;
-						int iw = w + fw - m_padding;
-						// pfBO͈͊O͖
+						// 入力側の位置（ストライド倍した位置からパディング分だけずれる）
+						int ih = h * m_stride + fh - m_padding;
+						int iw = w * m_stride + fw - m_padding;
+						// パディング範囲外は無視する
 						if (ih < 0 || iw < 0 || ih >= m_inputHeight || iw >= m_inputWidth) { continue; }
-						// ̓`liRGB ȂǁjƂɃ[v
+						// 入力チャンネル（RGB など）ごとにループする
 						for (int ic = 0; ic < m_numInputChannels; ic++)
 						{
-							// dݔz̃CfbNXifh, fw, ic, k 41̏d݂ɑΉj
+							// 重み配列のインデックス（fh, fw, ic, k の4つで1つの重みに対応）
 							int idx = WeightIndex(fh, fw, ic, k);
-							// ď݂z dW ZidW = dL/d(out) * ͒lj
-							dWeights[idx] += gradient * m_lastInput(ih, iw, ic);
-							// ͑z dL/d(input) ɏd݂|l𑫂ށi덷͂ɓ`dj
-							dInputFeatureMap(ih, iw, ic) += gradient * m_weights[idx];
+							// 重みの勾配 dW を加算（dW = dL/d(out) * 入力値）
+							m_dWeights[idx] += gradient * inputFeatureMap(ih, iw, ic);
+							// 入力側勾配 dL/d(input) に重みを掛けた値を足し込む（誤差を入力に伝播）
+							if (dInputFeatureMap) { (*dInputFeatureMap)(ih, iw, ic) += gradient * m_weights[idx]; }
 						}
 					}
 				}
 			}
 		}
 	}
+}
 
-
-	// z~@ɂݍ݃J[lid݁jXViw = w -  * dwj
+// 累積した勾配で重みとバイアスを更新する
+void ConvLayer::ApplyGradients(float learningRate)
+{
+	// 勾配降下法により畳み込みカーネル（重み）を更新する（w = w - η * dw）
 	for (int i = 0; i < (int)m_weights.size(); i++)
 	{
-		// vZꂽd݌zgāAΉd݂炷
-		m_weights[i] -= learningRate * dWeights[i];
+		// 計算された重み勾配を使って、対応する重みを少しずつ減らす
+		m_weights[i] -= learningRate * m_dWeights[i];
+		// 次の累積のためにクリアする
+		m_dWeights[i] = 0.0f;
 	}
-	// z~@ɂeo̓`l̃oCAXXVib = b -  * dbj
+	// 勾配降下法により各出力チャンネルのバイアス項を更新する（b = b - η * db）
 	for (int k = 0; k < m_numOutputChannels; k++)
 	{
-		// vZς݂̃oCAXzgăoCAXlXV
-		m_bias[k] -= learningRate * dBiasGradient[k];
+		// 計算済みのバイアス勾配を使ってバイアス値を更新する
+		m_bias[k] -= learningRate * m_dBias[k];
+		m_dBias[k] = 0.0f;
 	}
-	// ͑zԂ
-	return dInputFeatureMap;
+	// 順伝播用に並べ替えた重みも更新する
+	RefreshPackedWeights();
+}
+
+// 後続のバッチ正規化を重みとバイアスに折り込む
+// ・BN(conv(x)) = scale * (W x + b) + shift = (scale * W) x + (scale * b + shift)
+void ConvLayer::FoldScaleShift(const std::vector<float>& scale, const std::vector<float>& shift)
+{
+	// 受容野の要素数 (出力チャネル1つ分の重みの数)
+	const int K = m_numInputChannels * m_filtersize * m_filtersize;
+	for (int k = 0; k < m_numOutputChannels; k++)
+	{
+		for (int j = 0; j < K; j++)
+		{
+			m_weights[(size_t)k * K + j] *= scale[k];
+		}
+		m_bias[k] = m_bias[k] * scale[k] + shift[k];
+	}
+	RefreshPackedWeights();
 }
@@ -1,60 +1,154 @@
 // ConvLayer.h
 #pragma once
 #include <vector>
+#include <iosfwd>
 #include "Tensor3D.h"
+#include "ConvAutoTuner.h"
+#include "BFloat16.h"
 
-// ConvLayer NX
-// EpfBOt2Dݍ݂s
+// ConvLayer クラス
+// ・ストライド・パディング付きの2D畳み込みを行う
 class ConvLayer
 {
 public:
-	// RXgN^
-	// inputHeight : ͂̍
-	// inputWidth : ͂̕
-	// inputChannel : ̓`l
-	// filterSize : J[l̈ӂ̃TCY (: 3  3~3)
-	// outChannels : o̓`l
-	ConvLayer(int inputHeight, int inputWidth, int inputChannel, int filterSize, int outChannels);
-
-	// `d
-	// EinputFeatureMap : ͓}bv
-	// E߂l : ݍ݌ʂ̓}bv
+	// コンストラクタ
+	// inputHeight : 入力の高さ
+	// inputWidth : 入力の幅
+	// inputChannel : 入力チャネル数
+	// filterSize : カーネルの一辺のサイズ (例: 3 → 3×3)
+	// outChannels : 出力チャネル数
+	// stride : フィルタをずらす間隔
+	// padding : 上下左右のパディング量 (負の値なら filterSize / 2 で、ストライド1のとき出力サイズ = 入力サイズ)
+	ConvLayer(int inputHeight, int inputWidth, int inputChannel, int filterSize, int outChannels, int stride = 1, int padding = -1);
+
+	// 出力の一辺のサイズを計算する ((input + 2 * padding - filter) / stride + 1)
+	static int OutputSize(int inputSize, int filterSize, int stride, int padding);
+	// 出力特徴マップの高さ
+	int GetOutputHeight() const { return m_outputHeight; }
+	// 出力特徴マップの幅
+	int GetOutputWidth() const { return m_outputWidth; }
+	// 出力チャネル数
+	int GetOutputChannels() const { return m_numOutputChannels; }
+
+	// 順伝播する
+	// ・inputFeatureMap : 入力特徴マップ (コピーせず参照を保持するので、Backward まで生存させておくこと)
+	// ・戻り値 : 畳み込み結果の特徴マップ
 	Tensor3D Forward(const Tensor3D& inputFeatureMap);
 
-	// t`d
-	// EdOutputFeatureMap : o͑̌z
-	// ElearningRate : wK
-	// E߂l : ͑̌z
+	// 順伝播の計算だけを行う
+	// ・Forward と同じ計算だが、逆伝播用の入力を保存しない (入力は呼び出し側が保持する)
+	// ・アルゴリズムが未選択ならオートチューナで選ぶ (1 枚ずつ計算するので、選択はミニバッチのサイズによらない)
+	Tensor3D Compute(const Tensor3D& inputFeatureMap);
+
+	// 推論用の順伝播する
+	// ・Forward と同じ計算だが、逆伝播用の入力を保存しない (const)
+	// ・アルゴリズムは生成時にチューニングのキャッシュから引いたもの (学習した後は最後に選んだもの) を使う
+	// ・複数スレッドから同時に呼び出せる
+	Tensor3D Infer(const Tensor3D& inputFeatureMap) const;
+
+	// 逆伝播する
+	// ・dOutputFeatureMap : 出力側からの勾配
+	// ・learningRate : 学習率
+	// ・戻り値 : 入力側の勾配
 	Tensor3D Backward(const Tensor3D& dOutputFeatureMap, float learningRate);
 
+	// 勾配を累積する (ミニバッチ学習用、重みは更新しない)
+	// ・inputFeatureMap : このサンプルの順伝播時の入力
+	// ・dOutputFeatureMap : 出力側からの勾配
+	// ・dInputFeatureMap : 入力側の勾配の格納先 (不要なら nullptr)
+	void AccumulateGradients(const Tensor3D& inputFeatureMap, const Tensor3D& dOutputFeatureMap, Tensor3D* dInputFeatureMap);
+	// 累積した勾配で重みとバイアスを更新し、累積をクリアする
+	void ApplyGradients(float learningRate);
+
+	// 後続のバッチ正規化 (y = x * scale + shift) を重みとバイアスに折り込む
+	// ・scale, shift : 出力チャネルごとの係数
+	void FoldScaleShift(const std::vector<float>& scale, const std::vector<float>& shift);
+
+	// 混合精度モードを切り替える
+	// ・有効な間は順伝播を bf16 の重み・入力 + fp32 累積の im2col GEMM で計算する
+	// ・重みの更新は fp32 のマスター重みに対して行い、更新後に bf16 の重みを作り直す
+	void SetMixedPrecision(bool enabled);
+
+	// 重み・バイアス (混合精度モードの bf16 の重みを含む) のバイト数
+	size_t GetParameterBytes() const;
+	// 勾配の累積領域のバイト数
+	size_t GetGradientBytes() const;
+	// 呼び出しをまたいで再利用する im2col の列行列のバイト数
+	size_t GetWorkspaceBytes() const;
+
+	// 重みとバイアスを書き出す (チェックポイント用)
+	void SaveParameters(std::ostream& out) const;
+	// 重みとバイアスを読み込む (形状がこの層と違えば false)
+	bool LoadParameters(std::istream& in);
+
 private:
-	// dݔz̃CfbNXvZswp֐
-	// fh, fw : tB^̈ʒu
-	// ic  : ̓`l
-	// oc  : o̓`l
+	// 重み配列のインデックス計算を行うヘルパ関数
+	// fh, fw : フィルタ内の位置
+	// ic  : 入力チャネル
+	// oc  : 出力チャネル
 	inline int WeightIndex(int fh, int fw, int ic, int oc) const {
-		// (outChannel Ƃ filterSize~filterSize~inChannels ̃ubN)
+		// (outChannel ごとに filterSize×filterSize×inChannels のブロック)
 		return (((oc * m_numInputChannels + ic) * m_filtersize + fh) * m_filtersize + fw);
 	}
 
+	// 出力画素 (h, w) の受容野を列行列の1行 (fh, fw, ic 順、パディング位置は 0) に展開する
+	// ・直接法と同じ順に並べ、im2col の内積が直接法と同じ順に和を取るようにする
+	void GatherColumn(const float* input, int h, int w, float* column) const;
+	// 直接法で畳み込みを計算する
+	void ForwardDirect(const Tensor3D& inputFeatureMap, Tensor3D& outputFeatureMap) const;
+	// im2col で入力を列行列に展開し、重みとの行列積で畳み込みを計算する
+	void ForwardIm2col(const Tensor3D& inputFeatureMap, Tensor3D& outputFeatureMap, std::vector<float>& columnBuffer) const;
+	// im2col の1行ずつを bf16 に変換し、bf16 の重みとの内積 (fp32 累積) で畳み込みを計算する
+	void ForwardIm2colBF16(const Tensor3D& inputFeatureMap, Tensor3D& outputFeatureMap, std::vector<float>& columnBuffer, std::vector<uint16_t>& columnBF16) const;
+	// 重み m_weights から列行列の1行と同じ並びの重み (混合精度モードでは bf16 版も) を作り直す
+	void RefreshPackedWeights();
+	// オートチューナのキーとなるこの層の形状を返す
+	ConvSignature MakeSignature() const;
+	// 指定アルゴリズムで畳み込みを計算する
+	void ForwardWith(ConvAlgorithm algorithm, const Tensor3D& inputFeatureMap, Tensor3D& outputFeatureMap);
+
 private:
-	// ͍
+	// 入力高さ
 	int m_inputHeight;
-	// ͕
+	// 入力幅
 	int m_inputWidth;
-	// ̓`l
+	// 入力チャネル数
 	int m_numInputChannels;
-	// J[lTCY()
+	// カーネルサイズ(一辺)
 	int m_filtersize;
-	// o̓`l
+	// 出力チャネル数
 	int m_numOutputChannels;
-	// pfBO
+	// ストライド
+	int m_stride;
+	// パディング量
 	int m_padding;
+	// 出力高さ
+	int m_outputHeight;
+	// 出力幅
+	int m_outputWidth;
 
-	// ݍ݃J[l̏dݔz (1zŕێ)
+	// 畳み込みカーネルの重み配列 (1次元配列で保持)
 	std::vector<float> m_weights;
-	// o̓`lƂ̃oCAXz
+	// 出力チャネルごとのバイアス配列
 	std::vector<float> m_bias;
-	// ߂͓̓}bv(t`d̂߂ɕۑ)
-	Tensor3D m_lastInput;
+	// 累積中の重み勾配
+	std::vector<float> m_dWeights;
+	// 累積中のバイアス勾配
+	std::vector<float> m_dBias;
+	// 直近の入力特徴マップへの参照(逆伝播で使う、所有はしない)
+	// ・テンソル本体は呼び出し側 (CNNModel) が持ち、Backward まで書き換えない
+	const Tensor3D* m_lastInput = nullptr;
+	// 使用する畳み込みアルゴリズム
+	// ・生成時にチューニングのキャッシュから引き (計測はしない)、キャッシュに無ければ初回の Compute でオートチューナが決める
+	ConvAlgorithm m_algorithm = ConvAlgorithm::Unset;
+	// im2col の列行列 ((H*W) × (inChannels*filterSize*filterSize)、呼び出しごとに再利用する)
+	std::vector<float> m_columnBuffer;
+	// im2col の行列積用に並べ替えた重み (出力チャネルごとに fh, fw, ic 順、m_weights を書き換えたら作り直す)
+	std::vector<float> m_packedWeights;
+	// 混合精度モードか
+	bool m_mixedPrecision = false;
+	// bf16 の重み (混合精度モードの順伝播で使う、m_packedWeights と同じ並び)
+	std::vector<uint16_t> m_weightsBF16;
+	// bf16 に変換した列行列の1行
+	std::vector<uint16_t> m_columnBF16;
 };
@@ -0,0 +1,246 @@
+﻿// DatasetCache.cpp
+// 正規化済みデータセットのキャッシュファイル
+#include "DatasetCache.h"
+#include "Gemm.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#if defined(_M_X64) || defined(__x86_64__)
+#define CACHE_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define CACHE_F16C_TARGET
+#else
+// GCC / Clang は関数単位で命令セットを有効にする (実行時判定で呼び分ける)
+#define CACHE_F16C_TARGET __attribute__((target("avx,f16c")))
+#endif
+#endif
+
+namespace
+{
+	// ファイルの識別子 ("MLPD") とバージョン
+	const uint32_t CacheMagic = 0x44504C4D;
+	const uint32_t CacheVersion = 1;
+	// 画像データの先頭の境界 (キャッシュラインと AVX のロード幅に合わせる)
+	const uint64_t ImageAlignment = 64;
+
+	// 1 画素のバイト数
+	size_t ElementBytes(DatasetCacheFormat format)
+	{
+		return format == DatasetCacheFormat::Float16 ? 2 : 4;
+	}
+
+	// float → fp16 (最近接偶数丸め、範囲外は無限大、NaN は NaN のまま)
+	uint16_t FloatToHalf(float value)
+	{
+		uint32_t bits;
+		std::memcpy(&bits, &value, 4);
+		uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+		uint32_t magnitude = bits & 0x7FFFFFFF;
+		// NaN と無限大
+		if (magnitude >= 0x7F800000) return sign | 0x7C00 | (magnitude > 0x7F800000 ? 0x200 : 0);
+		// fp16 の最大値 (65504) を丸めで超える値は無限大
+		if (magnitude >= 0x477FF000) return sign | 0x7C00;
+		// fp16 の非正規化数の範囲 (2^-14 未満): 2^-24 単位の整数に丸める
+		if (magnitude < 0x38800000)
+		{
+			float scaled;
+			uint32_t absolute = magnitude;
+			std::memcpy(&scaled, &absolute, 4);
+			return sign | (uint16_t)std::nearbyint(scaled * 16777216.0f);
+		}
+		// 正規化数: 指数を付け替えて仮数の下位 13 bit を最近接偶数で丸める (繰り上がりは指数に伝わる)
+		uint32_t rounded = magnitude + 0xFFF + ((magnitude >> 13) & 1);
+		return sign | (uint16_t)((rounded - 0x38000000) >> 13);
+	}
+
+	// fp16 → float (すべての値を正確に表せる)
+	float HalfToFloat(uint16_t half)
+	{
+		uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+		uint32_t exponent = (half >> 10) & 0x1F;
+		uint32_t mantissa = half & 0x3FF;
+		uint32_t bits;
+		if (exponent == 0x1F) bits = sign | 0x7F800000 | (mantissa << 13);
+		else if (exponent != 0) bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+		else
+		{
+			// 非正規化数 (と 0) は 2^-24 倍の整数
+			float value = (float)mantissa * (1.0f / 16777216.0f);
+			return sign ? -value : value;
+		}
+		float value;
+		std::memcpy(&value, &bits, 4);
+		return value;
+	}
+
+	// fp16 の配列を float に変換する (スカラー版)
+	void HalfToFloatArray(const uint16_t* source, float* destination, size_t count)
+	{
+		for (size_t i = 0; i < count; i++) { destination[i] = HalfToFloat(source[i]); }
+	}
+
+#ifdef CACHE_X86
+	// fp16 の配列を float に変換する (F16C 版、8 要素ずつ)
+	CACHE_F16C_TARGET void HalfToFloatArrayF16C(const uint16_t* source, float* destination, size_t count)
+	{
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8)
+		{
+			__m128i half = _mm_loadu_si128((const __m128i*)(source + i));
+			_mm256_storeu_ps(destination + i, _mm256_cvtph_ps(half));
+		}
+		HalfToFloatArray(source + i, destination + i, count - i);
+	}
+#endif
+}
+
+// キャッシュファイルを書き出す
+bool WriteDatasetCache(const std::string& path, size_t count, int rows, int columns, int channels,
+	const DatasetCacheImage& getImage, const DatasetCacheLabel& getLabel,
+	DatasetCacheFormat format, bool standardize)
+{
+	if (count == 0 || rows <= 0 || columns <= 0 || channels <= 0) return false;
+	const size_t imageElements = (size_t)rows * columns * channels;
+
+	// チャネルごとの平均・標準偏差 (0〜1 に正規化した後の値で求める)
+	std::vector<float> mean(channels, 0.0f), stddev(channels, 1.0f);
+	if (standardize)
+	{
+		std::vector<double> sum(channels, 0.0), squareSum(channels, 0.0);
+		for (size_t n = 0; n < count; n++)
+		{
+			const uint8_t* image = getImage(n);
+			for (size_t i = 0; i < imageElements; i++)
+			{
+				double value = image[i] / 255.0;
+				sum[i % channels] += value;
+				squareSum[i % channels] += value * value;
+			}
+		}
+		const double pixels = (double)count * rows * columns;
+		for (int c = 0; c < channels; c++)
+		{
+			double channelMean = sum[c] / pixels;
+			double variance = std::max(squareSum[c] / pixels - channelMean * channelMean, 0.0);
+			mean[c] = (float)channelMean;
+			// 一定値のチャネルは 0 除算にならないように標準偏差を 1 にする
+			stddev[c] = variance > 1e-12 ? (float)std::sqrt(variance) : 1.0f;
+		}
+	}
+
+	// ヘッダ・平均と標準偏差・ラベルの後、64 byte 境界から画像データを置く
+	DatasetCacheHeader header = {};
+	header.magic = CacheMagic;
+	header.version = CacheVersion;
+	header.format = (uint32_t)format;
+	header.standardized = standardize ? 1 : 0;
+	header.count = count;
+	header.rows = (uint32_t)rows;
+	header.columns = (uint32_t)columns;
+	header.channels = (uint32_t)channels;
+	uint64_t labelEnd = sizeof(header) + sizeof(float) * channels * 2 + count;
+	header.imageOffset = (labelEnd + ImageAlignment - 1) / ImageAlignment * ImageAlignment;
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file) return false;
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)mean.data(), sizeof(float) * channels);
+	file.write((const char*)stddev.data(), sizeof(float) * channels);
+	std::vector<uint8_t> labels(count);
+	for (size_t n = 0; n < count; n++) { labels[n] = (uint8_t)getLabel(n); }
+	file.write((const char*)labels.data(), (std::streamsize)count);
+	std::vector<char> padding((size_t)(header.imageOffset - labelEnd), 0);
+	file.write(padding.data(), (std::streamsize)padding.size());
+
+	// 画像を 1 枚ずつ変換して書き出す (ImageToTensor と同じ /255 の後に標準化する)
+	std::vector<float> scale(channels), offset(channels);
+	for (int c = 0; c < channels; c++)
+	{
+		scale[c] = 1.0f / stddev[c];
+		offset[c] = mean[c];
+	}
+	std::vector<float> values(imageElements);
+	std::vector<uint16_t> halves(format == DatasetCacheFormat::Float16 ? imageElements : 0);
+	for (size_t n = 0; n < count && file; n++)
+	{
+		const uint8_t* image = getImage(n);
+		for (size_t i = 0; i < imageElements; i++)
+		{
+			float value = image[i] / 255.0f;
+			values[i] = standardize ? (value - offset[i % channels]) * scale[i % channels] : value;
+		}
+		if (format == DatasetCacheFormat::Float16)
+		{
+			for (size_t i = 0; i < imageElements; i++) { halves[i] = FloatToHalf(values[i]); }
+			file.write((const char*)halves.data(), (std::streamsize)(imageElements * 2));
+		}
+		else
+		{
+			file.write((const char*)values.data(), (std::streamsize)(imageElements * 4));
+		}
+	}
+	return (bool)file;
+}
+
+// キャッシュファイルを開く
+bool DatasetCache::Open(const std::string& path)
+{
+	Close();
+	if (!m_file.Open(path)) return false;
+	const uint8_t* data = m_file.Data();
+	const size_t size = m_file.Size();
+	// ヘッダを確認する
+	if (size < sizeof(DatasetCacheHeader)) { Close(); return false; }
+	std::memcpy(&m_header, data, sizeof(m_header));
+	const DatasetCacheHeader& header = m_header;
+	bool valid = header.magic == CacheMagic && header.version == CacheVersion
+		&& (header.format == (uint32_t)DatasetCacheFormat::Float32 || header.format == (uint32_t)DatasetCacheFormat::Float16)
+		&& header.count > 0 && header.rows > 0 && header.columns > 0 && header.channels > 0
+		&& header.imageOffset % ImageAlignment == 0
+		&& header.imageOffset >= sizeof(header) + sizeof(float) * header.channels * 2 + header.count;
+	// 画像データがファイルの中に収まっているか
+	const uint64_t imageBytes = (uint64_t)header.rows * header.columns * header.channels * ElementBytes(GetFormat());
+	valid = valid && header.imageOffset <= size && (size - header.imageOffset) / imageBytes >= header.count;
+	if (!valid) { Close(); m_header = {}; return false; }
+	m_mean = (const float*)(data + sizeof(header));
+	m_std = m_mean + header.channels;
+	m_labels = data + sizeof(header) + sizeof(float) * header.channels * 2;
+	m_images = data + header.imageOffset;
+	return true;
+}
+
+// サンプル index をテンソルにする
+void DatasetCache::DecodeToTensor(size_t index, Tensor3D& tensor) const
+{
+	const int rows = GetRows(), columns = GetColumns(), channels = GetChannels();
+	if (tensor.GetH() != rows || tensor.GetW() != columns || tensor.GetC() != channels) { tensor = Tensor3D(rows, columns, channels); }
+	const size_t elements = (size_t)rows * columns * channels;
+	if (GetFormat() == DatasetCacheFormat::Float32)
+	{
+		// 変換済みの値をそのままコピーする
+		std::memcpy(tensor.Data(), m_images + index * elements * 4, elements * 4);
+		return;
+	}
+	const uint16_t* source = (const uint16_t*)(m_images + index * elements * 2);
+#ifdef CACHE_X86
+	// F16C は AVX2 より前の世代から載っているので、AVX2 の判定で代用する
+	if (HasAVX2FMA()) { HalfToFloatArrayF16C(source, tensor.Data(), elements); return; }
+#endif
+	HalfToFloatArray(source, tensor.Data(), elements);
+}
+
+// uint8 の画像にキャッシュと同じ正規化・標準化をしてテンソルにする
+void DatasetCache::NormalizeImage(const uint8_t* image, Tensor3D& tensor) const
+{
+	const int rows = GetRows(), columns = GetColumns(), channels = GetChannels();
+	if (tensor.GetH() != rows || tensor.GetW() != columns || tensor.GetC() != channels) { tensor = Tensor3D(rows, columns, channels); }
+	const size_t elements = (size_t)rows * columns * channels;
+	float* output = tensor.Data();
+	for (size_t i = 0; i < elements; i++)
+	{
+		float value = image[i] / 255.0f;
+		output[i] = m_header.standardized ? (value - m_mean[i % channels]) * (1.0f / m_std[i % channels]) : value;
+	}
+}
@@ -0,0 +1,103 @@
+﻿// DatasetCache.h
+// 正規化済みデータセットのキャッシュファイル
+// ・uint8 の画像を一度だけ 0〜1 に正規化し (任意でチャネルごとの平均・標準偏差で標準化し)、
+//   float32 または fp16 のテンソル (HWC の並び) としてファイルに書き出す
+// ・次回以降はファイルをメモリマップして、エポックごとの変換なしでテンソルにコピーするだけで使う
+//   (fp16 の場合はファイルと読み込み量が半分になり、コピー時に fp32 に戻す)
+//
+// ファイル形式 (値はすべてホストのバイト順)
+// ・ヘッダ   : DatasetCacheHeader
+// ・平均・標準偏差 : float × channels × 2 (標準化しない場合は 0 と 1)
+// ・ラベル   : uint8 × count
+// ・画像     : (float32 / fp16) × rows × columns × channels × count (64 byte 境界から始める)
+#pragma once
+#include <vector>
+#include <string>
+#include <functional>
+#include <cstdint>
+#include "MappedFile.h"
+#include "Tensor3D.h"
+
+// キャッシュの画素の保存形式
+enum class DatasetCacheFormat : uint32_t
+{
+	Float32 = 0,
+	Float16 = 1,
+};
+
+// キャッシュファイルのヘッダ
+struct DatasetCacheHeader
+{
+	// 識別子 ("MLPD") とバージョン
+	uint32_t magic;
+	uint32_t version;
+	// 画素の保存形式 (DatasetCacheFormat)
+	uint32_t format;
+	// チャネルごとに標準化したか (1 なら (x - 平均) / 標準偏差)
+	uint32_t standardized;
+	// 画像数と形状
+	uint64_t count;
+	uint32_t rows;
+	uint32_t columns;
+	uint32_t channels;
+	uint32_t reserved;
+	// 画像データの先頭位置 (ファイル先頭からのバイト数)
+	uint64_t imageOffset;
+};
+
+// サンプル index の画像 (rows × columns × channels バイト、HWC の並び) を返す関数
+using DatasetCacheImage = std::function<const uint8_t*(size_t index)>;
+// サンプル index の正解ラベルを返す関数
+using DatasetCacheLabel = std::function<int(size_t index)>;
+
+// キャッシュファイルを書き出す
+// ・count 枚の画像を 0〜1 に正規化し、standardize なら全画素のチャネルごとの平均・標準偏差で標準化する
+// ・成功すれば true
+bool WriteDatasetCache(const std::string& path, size_t count, int rows, int columns, int channels,
+	const DatasetCacheImage& getImage, const DatasetCacheLabel& getLabel,
+	DatasetCacheFormat format = DatasetCacheFormat::Float32, bool standardize = false);
+
+// DatasetCache クラス
+// ・キャッシュファイルをメモリマップして読み取る (コピー不可)
+// ・DecodeToTensor は複数スレッドから同時に呼び出せる (先読みのワーカーから使う)
+class DatasetCache
+{
+public:
+	// キャッシュファイルを開く (形式が違う・壊れていれば false)
+	bool Open(const std::string& path);
+	// 閉じる
+	void Close() { m_file.Close(); }
+	// 開いているか
+	bool IsOpen() const { return m_file.IsOpen(); }
+
+	// 画像数と形状
+	size_t GetCount() const { return (size_t)m_header.count; }
+	int GetRows() const { return (int)m_header.rows; }
+	int GetColumns() const { return (int)m_header.columns; }
+	int GetChannels() const { return (int)m_header.channels; }
+	// 保存形式
+	DatasetCacheFormat GetFormat() const { return (DatasetCacheFormat)m_header.format; }
+	// 標準化に使ったチャネルごとの平均・標準偏差 (標準化していなければ 0 と 1)
+	// ・テストデータや推論時の入力にも同じ変換をするために使う (NormalizeImage)
+	const float* GetMean() const { return m_mean; }
+	const float* GetStd() const { return m_std; }
+
+	// 正解ラベルを返す
+	int GetLabel(size_t index) const { return m_labels[index]; }
+	// サンプル index をテンソルにする (形状が合っていれば再確保しない)
+	// ・float32 はファイルからそのままコピーし、fp16 は fp32 に変換しながらコピーする
+	void DecodeToTensor(size_t index, Tensor3D& tensor) const;
+	// uint8 の画像にキャッシュと同じ正規化・標準化をしてテンソルにする (キャッシュに無い画像用)
+	void NormalizeImage(const uint8_t* image, Tensor3D& tensor) const;
+
+private:
+	// マップしたファイル
+	MappedFile m_file;
+	// ヘッダ
+	DatasetCacheHeader m_header = {};
+	// 平均・標準偏差・ラベル・画像 (マップしたファイルの中を指す)
+	const float* m_mean = nullptr;
+	const float* m_std = nullptr;
+	const uint8_t* m_labels = nullptr;
+	const uint8_t* m_images = nullptr;
+};
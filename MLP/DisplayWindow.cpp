@@ -51,7 +51,7 @@ static int g_detailImgH = 28;
 // Top-10 の (classID, probability) の配列
 static std::vector<std::pair<int, float>> g_top10;
 // Top-10 のクラス名（"Sneaker" など）
-static std::vector<std::wstring> g_top10Names;
+static std::vector<std::wstring_view> g_top10Names;
 
 // 中央配置のためのオフセット計算（グリッド全体を中央に置く）
 void CalcCenteredOffset(int winW, int winH, int& outX, int& outY)
@@ -300,10 +300,10 @@ void DrawDetailView(HDC hdc, int ox, int oy, int winW, int winH)
 		int cls = g_top10[i].first;
 		float prob = g_top10[i].second;
 		// クラス名（存在しなければ "?"）
-		const wchar_t* cname = (i < (int)g_top10Names.size()) ? g_top10Names[i].c_str() : L"?";
-		// 描画用文字列の組み立て
+		std::wstring_view cname = (i < (int)g_top10Names.size()) ? g_top10Names[i] : std::wstring_view(L"?");
+		// 描画用文字列の組み立て（ビューは終端文字を持たない前提で長さを指定する）
 		wchar_t buf[128];
-		swprintf(buf, 128, L"%d: %s (%.1f%%)", cls, cname, prob * 100.0f);
+		swprintf(buf, 128, L"%d: %.*s (%.1f%%)", cls, (int)cname.size(), cname.data(), prob * 100.0f);
 		// この行の縦位置
 		int y = textStartY + i * (barHeight + barGap);
 		// 既存の文字表示
@@ -498,7 +498,7 @@ void PumpWindowMessages()
 void UpdateDetailView(
 	const std::vector<uint8_t>& image,
 	const std::vector<std::pair<int, float>>& top10,
-	const std::vector<std::wstring>& top10Names)
+	const std::vector<std::wstring_view>& top10Names)
 {
 	// 拡大表示する画像（28×28）をコピー
 	g_detailImage = image;
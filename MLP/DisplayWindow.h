@@ -5,6 +5,7 @@
 // ベクタを使う
 #include <vector>
 #include <string>
+#include <string_view>
 #include <utility>
 
 // ウィンドウ初期化（Win32 API を使ったウィンドウ生成）
@@ -35,11 +36,11 @@ void UpdateDisplayGridWithLabels(
 // 右側の詳細ビューを更新する
 // image : 拡大表示する1枚の画像（28×28）
 // top10 : Top-10 の (classID, probability) のペア
-// top10Names : Top-10 のクラス名（"Sneaker" など）
+// top10Names : Top-10 のクラス名（"Sneaker" など、CNNModel::GetTop10Names の静的なテーブルを指すビュー）
 void UpdateDetailView(
 	const std::vector<uint8_t>& image,
 	const std::vector<std::pair<int, float>>& top10,
-	const std::vector<std::wstring>& top10Names
+	const std::vector<std::wstring_view>& top10Names
 );
 // トレーニング進捗バーの更新
 // p : 0.0 ～ 1.0 の範囲
@@ -0,0 +1,158 @@
+﻿// Evaluator.cpp
+// テストセット全体の並列評価
+#include "Evaluator.h"
+#include "FashionMNIST.h"
+#include "SoftmaxCrossEntropy.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+// 1スレッドがまとめて損失計算する画像数
+constexpr int EVAL_BATCH = 64;
+
+// 1スレッド分の集計結果
+struct EvaluationPartial
+{
+	// 正解数
+	int numCorrect = 0;
+	// 損失の合計
+	double lossSum = 0.0;
+	// 混同行列
+	std::vector<int> confusion;
+};
+
+// [begin, end) の範囲の画像を評価する (スレッド本体)
+static void EvaluateRange(const CNNModel& model,
+	const EvaluationDecode& decode, const EvaluationLabel& getLabel,
+	size_t begin, size_t end, EvaluationPartial& partial)
+{
+	// クラス数
+	const int numClasses = model.GetNumClasses();
+	// バッチ分の logits と正解ラベル
+	std::vector<float> logits((size_t)EVAL_BATCH * numClasses);
+	std::vector<int> batchLabels(EVAL_BATCH);
+	// 変換先のテンソル (スレッド内で使い回す)
+	Tensor3D tensor;
+	partial.confusion.assign((size_t)numClasses * numClasses, 0);
+	for (size_t batchStart = begin; batchStart < end; batchStart += EVAL_BATCH)
+	{
+		// このバッチの画像数
+		int count = (int)std::min((size_t)EVAL_BATCH, end - batchStart);
+		for (int i = 0; i < count; i++)
+		{
+			size_t index = batchStart + i;
+			// 画像をテンソルに変換して推論する
+			float* row = &logits[(size_t)i * numClasses];
+			decode((int)index, tensor);
+			model.InferLogits(tensor, row);
+			batchLabels[i] = getLabel((int)index);
+			// 最大スコアのクラスが予測 (Softmax は単調なので logits で判定できる)
+			int prediction = (int)(std::max_element(row, row + numClasses) - row);
+			partial.confusion[(size_t)batchLabels[i] * numClasses + prediction]++;
+			if (prediction == batchLabels[i]) partial.numCorrect++;
+		}
+		// バッチ全体の損失を融合カーネルでまとめて計算する
+		partial.lossSum += (double)SoftmaxCrossEntropy(logits.data(), batchLabels.data(), count, numClasses, nullptr, nullptr) * count;
+	}
+}
+
+// データセット全体を評価する
+EvaluationResult EvaluateDataset(const CNNModel& model, int numSamples,
+	const EvaluationDecode& decode, const EvaluationLabel& getLabel,
+	int numThreads)
+{
+	EvaluationResult result;
+	result.numClasses = model.GetNumClasses();
+	result.numSamples = std::max(0, numSamples);
+	result.confusion.assign((size_t)result.numClasses * result.numClasses, 0);
+	if (result.numSamples == 0) { return result; }
+
+	// スレッド数を決める (画像数より多くはしない)
+	if (numThreads <= 0) { numThreads = (int)std::max(1u, std::thread::hardware_concurrency()); }
+	numThreads = std::min(numThreads, result.numSamples);
+
+	auto start = std::chrono::steady_clock::now();
+	// 各スレッドに連続した範囲を割り当てる
+	std::vector<EvaluationPartial> partials(numThreads);
+	std::vector<std::thread> workers;
+	workers.reserve(numThreads);
+	for (int t = 0; t < numThreads; t++)
+	{
+		size_t begin = (size_t)result.numSamples * t / numThreads;
+		size_t end = (size_t)result.numSamples * (t + 1) / numThreads;
+		workers.emplace_back(EvaluateRange, std::cref(model), std::cref(decode), std::cref(getLabel),
+			begin, end, std::ref(partials[t]));
+	}
+	for (auto& worker : workers) { worker.join(); }
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	// スレッドごとの結果を集計する
+	double lossSum = 0.0;
+	for (const auto& partial : partials)
+	{
+		result.numCorrect += partial.numCorrect;
+		lossSum += partial.lossSum;
+		for (size_t i = 0; i < result.confusion.size(); i++)
+		{
+			result.confusion[i] += partial.confusion[i];
+		}
+	}
+	result.accuracy = result.numCorrect * 100.0f / (float)result.numSamples;
+	result.loss = (float)(lossSum / result.numSamples);
+	result.seconds = elapsed.count();
+	result.imagesPerSecond = (result.seconds > 0.0) ? result.numSamples / result.seconds : 0.0;
+	return result;
+}
+
+// IDX 形式 (グレースケール) のデータセット全体を評価する
+EvaluationResult EvaluateDataset(const CNNModel& model,
+	const std::vector<std::vector<uint8_t>>& images,
+	const std::vector<uint8_t>& labels,
+	int numThreads)
+{
+	// 画像サイズはモデルの入力形状に合わせる
+	const int rows = model.GetConfig().inputHeight;
+	const int columns = model.GetConfig().inputWidth;
+	return EvaluateDataset(model, (int)std::min(images.size(), labels.size()),
+		[&](int index, Tensor3D& tensor) { ImageToTensor(images[index], rows, columns, tensor); },
+		[&](int index) { return (int)labels[index]; },
+		numThreads);
+}
+
+// 評価結果の要約を表示する
+void PrintEvaluationSummary(const EvaluationResult& result)
+{
+	std::wcout << L"Test (" << result.numSamples << L" images) | Loss = " << result.loss
+		<< L" | Accuracy = " << result.accuracy << L"%"
+		<< L" | " << (int)result.imagesPerSecond << L" images/sec (" << (int)(result.seconds * 1000.0) << L" ms)\n";
+}
+
+// 混同行列とクラスごとの正解率を表示する
+void PrintConfusionMatrix(const EvaluationResult& result)
+{
+	const int n = result.numClasses;
+	// 表示桁数を変更するので元の設定を退避しておく
+	std::streamsize oldPrecision = std::wcout.precision();
+	// 見出し行 (予測クラス ID)
+	std::wcout << L"Confusion matrix (row = truth, column = prediction)\n" << std::setw(14) << L"";
+	for (int p = 0; p < n; p++) { std::wcout << std::setw(6) << p; }
+	std::wcout << std::setw(9) << L"acc%" << L"\n";
+	for (int t = 0; t < n; t++)
+	{
+		// 正解クラス名と件数
+		std::wcout << std::setw(2) << t << L" " << std::left << std::setw(11) << CNNModel::GetClassName(t) << std::right;
+		int rowTotal = 0;
+		for (int p = 0; p < n; p++)
+		{
+			int count = result.confusion[(size_t)t * n + p];
+			rowTotal += count;
+			std::wcout << std::setw(6) << count;
+		}
+		// クラスごとの正解率 (再現率)
+		float classAccuracy = (rowTotal > 0) ? result.confusion[(size_t)t * n + t] * 100.0f / rowTotal : 0.0f;
+		std::wcout << std::setw(9) << std::fixed << std::setprecision(1) << classAccuracy << std::defaultfloat << L"\n";
+	}
+	std::wcout.precision(oldPrecision);
+}
@@ -0,0 +1,58 @@
+﻿// Evaluator.h
+// テストセット全体の並列評価
+// ・CNNModel::InferLogits（読み取り専用の推論）を複数スレッドで同時に実行する
+// ・正解率・平均損失・混同行列・処理速度 (images/sec) を求める
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include "CNNModel.h"
+
+// 評価結果
+struct EvaluationResult
+{
+	// 評価した画像数
+	int numSamples = 0;
+	// 正解数
+	int numCorrect = 0;
+	// 正解率 (%)
+	float accuracy = 0.0f;
+	// 平均損失 (CrossEntropy)
+	float loss = 0.0f;
+	// 評価にかかった時間 (秒)
+	double seconds = 0.0;
+	// 処理速度 (images/sec)
+	double imagesPerSecond = 0.0;
+	// クラス数
+	int numClasses = 0;
+	// 混同行列 (numClasses × numClasses、[正解クラス][予測クラス] の件数)
+	std::vector<int> confusion;
+};
+
+// サンプル index をテンソルに変換する関数 (複数スレッドから同時に呼ばれる)
+using EvaluationDecode = std::function<void(int index, Tensor3D& tensor)>;
+// サンプル index の正解ラベルを返す関数
+using EvaluationLabel = std::function<int(int index)>;
+
+// データセット全体を評価する
+// ・numSamples : 評価する画像数
+// ・decode     : 画像の変換関数 (CIFAR10Loader::DecodeToTensor など、形状はモデルの入力に合わせる)
+// ・getLabel   : 正解ラベルの取得関数
+// ・numThreads : 使用スレッド数 (0 なら CPU の論理コア数)
+EvaluationResult EvaluateDataset(const CNNModel& model, int numSamples,
+	const EvaluationDecode& decode, const EvaluationLabel& getLabel,
+	int numThreads = 0);
+
+// IDX 形式 (グレースケール) のデータセット全体を評価する
+// ・images / labels : 評価する画像 (モデルの入力サイズ) と正解ラベル
+// ・numThreads      : 使用スレッド数 (0 なら CPU の論理コア数)
+EvaluationResult EvaluateDataset(const CNNModel& model,
+	const std::vector<std::vector<uint8_t>>& images,
+	const std::vector<uint8_t>& labels,
+	int numThreads = 0);
+
+// 評価結果の要約 (損失・正解率・速度) を1行で表示する
+void PrintEvaluationSummary(const EvaluationResult& result);
+
+// 混同行列とクラスごとの正解率を表示する
+void PrintConfusionMatrix(const EvaluationResult& result);
@@ -3,6 +3,7 @@
 #include <string>
 #include <fstream>
 #include <cstdint>
+#include "Tensor3D.h"
 
 // FashionMNISTクラス
 //   - IDX フォーマットの Fashion-MNIST データを読み込む構造体
@@ -42,6 +43,9 @@ public:
 		int rows = ReadInt(ifsImages);
 		// 列数(通常28)を取得する
 		int colums = ReadInt(ifsImages);
+		// 画像サイズを保持する (モデルの入力形状に使う)
+		imageRows = rows;
+		imageColumns = colums;
 
 		// ラベルファイルヘッダ読み込み（IDX1）
 		// マジックラベル(2049)を取得する
@@ -53,7 +57,7 @@ public:
 		// 全画像を順に読み込む
 		for (int i = 0; i < numImage; i++)
 		{
-			// 画像(28×28=784 byte)を確保する
+			// 画像(rows×colums byte、通常 28×28=784 byte)を確保する
 			std::vector<uint8_t> images(rows * colums);
 			// 画像データ読み込む
 			ifsImages.read((char*)images.data(), rows * colums);
@@ -81,7 +85,11 @@ public:
 	}
 
 public:
-	// 学習画像配列(28×28=784 byte)
+	// 画像の行数 (IDX ヘッダの値、通常 28)
+	int imageRows = 0;
+	// 画像の列数 (IDX ヘッダの値、通常 28)
+	int imageColumns = 0;
+	// 学習画像配列(imageRows×imageColumns byte)
 	std::vector<std::vector<uint8_t>> trainImages;
 	// 学習ラベル(0〜9)
 	std::vector<uint8_t> trainLabels;
@@ -91,3 +99,31 @@ public:
 	std::vector<uint8_t> testLabels;
 };
 
+// rows×columns グレースケール画像 → Tensor3D(rows×columns×1) に変換する
+// ・tensor の形状が合っていれば再確保せずに上書きする (先読みバッファの使い回し用)
+inline void ImageToTensor(const std::vector<uint8_t>& imges, int rows, int columns, Tensor3D& tensor)
+{
+	// テンソル(高さ rows, 幅 columns, チャネル 1)
+	if (tensor.GetH() != rows || tensor.GetW() != columns || tensor.GetC() != 1) { tensor = Tensor3D(rows, columns, 1); }
+	// 行インデックスを処理する
+	for (int row = 0; row < rows; row++)
+	{
+		// 列インデックスを処理する
+		for (int column = 0; column < columns; column++)
+		{
+			// 正規化された画素値(0〜255 → 0〜1)を計算する
+			float pixelValue = imges[row * columns + column] / 255.0f;
+			// テンソルに画素値を格納する
+			tensor(row, column, 0) = pixelValue;
+		}
+	}
+}
+
+// rows×columns グレースケール画像 → Tensor3D(rows×columns×1) に変換して返す
+inline Tensor3D ImageToTensor(const std::vector<uint8_t>& imges, int rows, int columns)
+{
+	Tensor3D tensor(rows, columns, 1);
+	ImageToTensor(imges, rows, columns, tensor);
+	// テンソルを返す
+	return tensor;
+}
@@ -0,0 +1,234 @@
+﻿// FastMath.cpp
+// 多項式近似による exp / log
+// ・exp : x = n・ln2 + r (|r| <= ln2/2) に分解し、e^r を 6 次の多項式、2^n を指数部への加算で求める
+// ・log : x = m・2^e (√½ <= m < √2) に分解し、ln(m) を f = m - 1 の多項式、e・ln2 を2つに分けて足す
+// ・係数は Cephes の expf / logf と同じ
+#include "FastMath.h"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#if defined(_M_X64) || defined(__SSE2__)
+// x64 では SSE2 が必ず使えるので、4 要素ずつまとめて処理する
+#define FASTMATH_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	// exp の入力の範囲 (これを超えると float で表せない)
+	constexpr float ExpUpperLimit = 88.7228391f;
+	constexpr float ExpLowerLimit = -87.3365448f;
+	// log2(e)
+	constexpr float Log2E = 1.44269504088896341f;
+	// ln2 を上位 (誤差なしで n 倍できる桁数) と下位に分けたもの
+	constexpr float Ln2High = 0.693359375f;
+	constexpr float Ln2Low = -2.12194440e-4f;
+	// e^r - 1 - r の近似多項式の係数 (r^2 の係数から)
+	constexpr float ExpP0 = 1.9875691500e-4f;
+	constexpr float ExpP1 = 1.3981999507e-3f;
+	constexpr float ExpP2 = 8.3334519073e-3f;
+	constexpr float ExpP3 = 4.1665795894e-2f;
+	constexpr float ExpP4 = 1.6666665459e-1f;
+	constexpr float ExpP5 = 5.0000001201e-1f;
+	// √½ (仮数をこれ以上 √2 未満に揃える)
+	constexpr float SqrtHalf = 0.707106781186547524f;
+	// ln(1 + f) の近似多項式の係数
+	constexpr float LogP0 = 7.0376836292e-2f;
+	constexpr float LogP1 = -1.1514610310e-1f;
+	constexpr float LogP2 = 1.1676998740e-1f;
+	constexpr float LogP3 = -1.2420140846e-1f;
+	constexpr float LogP4 = 1.4249322787e-1f;
+	constexpr float LogP5 = -1.6668057665e-1f;
+	constexpr float LogP6 = 2.0000714765e-1f;
+	constexpr float LogP7 = -2.4999993993e-1f;
+	constexpr float LogP8 = 3.3333331174e-1f;
+
+	inline uint32_t FloatBits(float value) { uint32_t bits; std::memcpy(&bits, &value, sizeof(bits)); return bits; }
+	inline float BitsFloat(uint32_t bits) { float value; std::memcpy(&value, &bits, sizeof(value)); return value; }
+}
+
+// e^x を返す (スカラー版)
+float FastExp(float x)
+{
+	if (!(x < ExpUpperLimit)) { return (x != x) ? x : INFINITY; }
+	if (x < ExpLowerLimit) { return 0.0f; }
+	// n = round(x / ln2)
+	float n = std::floor(x * Log2E + 0.5f);
+	// r = x - n・ln2 (ln2 を 2 つに分けて桁落ちを防ぐ)
+	float r = x - n * Ln2High;
+	r = r - n * Ln2Low;
+	// e^r = 1 + r + r^2・P(r)
+	float p = ExpP0;
+	p = p * r + ExpP1;
+	p = p * r + ExpP2;
+	p = p * r + ExpP3;
+	p = p * r + ExpP4;
+	p = p * r + ExpP5;
+	float y = p * (r * r) + r + 1.0f;
+	// 2^n を指数部に足す (n は -126 〜 128 なので、2 回に分けて掛けてオーバーフローを避ける)
+	int exponent = (int)n;
+	float half = BitsFloat((uint32_t)((exponent / 2) + 127) << 23);
+	float rest = BitsFloat((uint32_t)((exponent - exponent / 2) + 127) << 23);
+	return y * half * rest;
+}
+
+// 自然対数を返す (スカラー版)
+float FastLog(float x)
+{
+	uint32_t bits = FloatBits(x);
+	// 0 以下・非正規化数・inf・NaN は標準ライブラリに任せる
+	if (bits - 0x00800000u >= 0x7F000000u) { return std::log(x); }
+	// x = m・2^e (0.5 <= m < 1)
+	int e = (int)(bits >> 23) - 126;
+	float m = BitsFloat((bits & 0x007FFFFFu) | 0x3F000000u);
+	// √½ 未満なら m を 2 倍して e を 1 減らす (√½ <= m < √2)
+	if (m < SqrtHalf) { e -= 1; m = m + m; }
+	float f = m - 1.0f;
+	float z = f * f;
+	float p = LogP0;
+	p = p * f + LogP1;
+	p = p * f + LogP2;
+	p = p * f + LogP3;
+	p = p * f + LogP4;
+	p = p * f + LogP5;
+	p = p * f + LogP6;
+	p = p * f + LogP7;
+	p = p * f + LogP8;
+	float fe = (float)e;
+	float y = p * f * z;
+	y = y + fe * Ln2Low;
+	y = y - 0.5f * z;
+	return (f + y) + fe * Ln2High;
+}
+
+#ifdef FASTMATH_SSE2
+// e^x (4 要素、FastExp と同じ計算)
+static inline __m128 ExpSSE2(__m128 x)
+{
+	// 範囲外の要素は最後に結果を差し替える
+	__m128 overflow = _mm_cmpge_ps(x, _mm_set1_ps(ExpUpperLimit));
+	__m128 underflow = _mm_cmplt_ps(x, _mm_set1_ps(ExpLowerLimit));
+	__m128 nan = _mm_cmpunord_ps(x, x);
+	__m128 input = x;
+	x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(ExpLowerLimit)), _mm_set1_ps(ExpUpperLimit));
+	// n = floor(x / ln2 + 0.5) (SSE2 には floor が無いので、切り捨て変換して負の場合を補正する)
+	__m128 t = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(Log2E)), _mm_set1_ps(0.5f));
+	__m128i ni = _mm_cvttps_epi32(t);
+	__m128 n = _mm_cvtepi32_ps(ni);
+	__m128 greater = _mm_cmpgt_ps(n, t);
+	n = _mm_sub_ps(n, _mm_and_ps(greater, _mm_set1_ps(1.0f)));
+	ni = _mm_cvttps_epi32(n);
+	// r = x - n・ln2
+	__m128 r = _mm_sub_ps(x, _mm_mul_ps(n, _mm_set1_ps(Ln2High)));
+	r = _mm_sub_ps(r, _mm_mul_ps(n, _mm_set1_ps(Ln2Low)));
+	// e^r = 1 + r + r^2・P(r)
+	__m128 p = _mm_set1_ps(ExpP0);
+	p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(ExpP1));
+	p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(ExpP2));
+	p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(ExpP3));
+	p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(ExpP4));
+	p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(ExpP5));
+	__m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p, _mm_mul_ps(r, r)), r), _mm_set1_ps(1.0f));
+	// 2^n を 2 回に分けて掛ける (n/2 は 0 方向への切り捨て)
+	__m128i bias = _mm_set1_epi32(127);
+	__m128i halfN = _mm_srai_epi32(_mm_add_epi32(ni, _mm_srli_epi32(ni, 31)), 1);
+	__m128i restN = _mm_sub_epi32(ni, halfN);
+	__m128 half = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(halfN, bias), 23));
+	__m128 rest = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(restN, bias), 23));
+	y = _mm_mul_ps(_mm_mul_ps(y, half), rest);
+	// 範囲外の要素を差し替える (上は +inf、下は 0、NaN はそのまま)
+	y = _mm_or_ps(_mm_andnot_ps(overflow, y), _mm_and_ps(overflow, _mm_set1_ps(INFINITY)));
+	y = _mm_andnot_ps(underflow, y);
+	y = _mm_or_ps(_mm_andnot_ps(nan, y), _mm_and_ps(nan, input));
+	return y;
+}
+
+// ln(x) (4 要素、FastLog と同じ計算、範囲外の要素は呼び出し側でスカラー版に回す)
+static inline __m128 LogSSE2(__m128 x)
+{
+	__m128i bits = _mm_castps_si128(x);
+	// e = 指数部 - 126、m = 仮数 (0.5 <= m < 1)
+	__m128i e = _mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(126));
+	__m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007FFFFF)), _mm_set1_epi32(0x3F000000)));
+	// √½ 未満なら m を 2 倍して e を 1 減らす
+	__m128 small = _mm_cmplt_ps(m, _mm_set1_ps(SqrtHalf));
+	e = _mm_add_epi32(e, _mm_castps_si128(small));
+	m = _mm_add_ps(m, _mm_and_ps(small, m));
+	__m128 f = _mm_sub_ps(m, _mm_set1_ps(1.0f));
+	__m128 z = _mm_mul_ps(f, f);
+	__m128 p = _mm_set1_ps(LogP0);
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(LogP1));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(LogP2));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(LogP3));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(LogP4));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(LogP5));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(LogP6));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(LogP7));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(LogP8));
+	__m128 fe = _mm_cvtepi32_ps(e);
+	__m128 y = _mm_mul_ps(_mm_mul_ps(p, f), z);
+	y = _mm_add_ps(y, _mm_mul_ps(fe, _mm_set1_ps(Ln2Low)));
+	y = _mm_sub_ps(y, _mm_mul_ps(_mm_set1_ps(0.5f), z));
+	return _mm_add_ps(_mm_add_ps(f, y), _mm_mul_ps(fe, _mm_set1_ps(Ln2High)));
+}
+#endif
+
+// y[i] = e^x[i]
+void FastExpArray(const float* x, float* y, int count)
+{
+	int i = 0;
+#ifdef FASTMATH_SSE2
+	for (; i + 4 <= count; i += 4) { _mm_storeu_ps(y + i, ExpSSE2(_mm_loadu_ps(x + i))); }
+#endif
+	for (; i < count; i++) { y[i] = FastExp(x[i]); }
+}
+
+// y[i] = ln(x[i])
+void FastLogArray(const float* x, float* y, int count)
+{
+	int i = 0;
+#ifdef FASTMATH_SSE2
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 v = _mm_loadu_ps(x + i);
+		// 正の正規化数でない要素があれば、その4要素はスカラー版で計算する
+		__m128i bits = _mm_castps_si128(v);
+		__m128i biased = _mm_sub_epi32(bits, _mm_set1_epi32(0x00800000));
+		__m128i outside = _mm_or_si128(_mm_cmplt_epi32(biased, _mm_setzero_si128()),
+			_mm_cmpgt_epi32(biased, _mm_set1_epi32(0x7EFFFFFF)));
+		if (_mm_movemask_epi8(outside) != 0)
+		{
+			for (int j = 0; j < 4; j++) { y[i + j] = FastLog(x[i + j]); }
+			continue;
+		}
+		_mm_storeu_ps(y + i, LogSSE2(v));
+	}
+#endif
+	for (; i < count; i++) { y[i] = FastLog(x[i]); }
+}
+
+// y[i] = e^(x[i] - shift) とその総和
+float FastExpShiftedSum(const float* x, float shift, float* y, int count)
+{
+	int i = 0;
+	float sum = 0.0f;
+#ifdef FASTMATH_SSE2
+	__m128 shiftVector = _mm_set1_ps(shift);
+	__m128 sumVector = _mm_setzero_ps();
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 value = ExpSSE2(_mm_sub_ps(_mm_loadu_ps(x + i), shiftVector));
+		_mm_storeu_ps(y + i, value);
+		sumVector = _mm_add_ps(sumVector, value);
+	}
+	float lanes[4];
+	_mm_storeu_ps(lanes, sumVector);
+	sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+	for (; i < count; i++)
+	{
+		y[i] = FastExp(x[i] - shift);
+		sum += y[i];
+	}
+	return sum;
+}
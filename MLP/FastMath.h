@@ -0,0 +1,21 @@
+﻿// FastMath.h
+// 多項式近似による exp / log (ベクトル化版と、同じ計算のスカラー版)
+// ・Softmax・交差エントロピーなど、大量の exp / log を呼ぶ箇所で libm の代わりに使う
+//   (sigmoid / tanh / GELU などの活性化関数を追加するときもここの関数で組み立てる)
+// ・x64 では SSE2 で 4 要素ずつ計算する。端数もスカラー版で同じ計算をするので、結果は要素の位置によらない
+// ・誤差は正しく丸めた値に対して最大 1 ULP (exp は [-87, 88.5]、log は正の正規化数全域で実測)
+#pragma once
+
+// e^x を返す
+// ・x > 88.72 は +inf、x < -87.33 は 0 を返す (非正規化数は作らない)
+float FastExp(float x);
+// 自然対数 ln(x) を返す
+// ・x は正の正規化数を前提とする (0 以下・非正規化数・inf・NaN は std::log に任せる)
+float FastLog(float x);
+
+// y[i] = e^x[i] を計算する (x と y は同じ配列でもよい)
+void FastExpArray(const float* x, float* y, int count);
+// y[i] = ln(x[i]) を計算する (x と y は同じ配列でもよい)
+void FastLogArray(const float* x, float* y, int count);
+// y[i] = e^(x[i] - shift) を計算し、その総和を返す (Softmax の分子と分母を1パスで求める)
+float FastExpShiftedSum(const float* x, float shift, float* y, int count);
@@ -1,68 +1,59 @@
 // FlattenLayer.cpp
-// CNN  3D e\ 1xNgɕϊw
-// EForward: Tensor3D  1~1~N  Tensor3D
-// EBackward: 1~1~N   H~W~C ɕ
+// CNN の 3D テンソルを 1次元ベクトルに変換する層
+// ・Forward: Tensor3D → 1×1×N の Tensor3D
+// ・Backward: 1×1×N → 元の H×W×C に復元
+// ・データの並び (HWC) はどちらも同じなので、変換は形状の付け替えだけ
 
 #include "FlattenLayer.h"
 
-// Forwardi`dj
-// E Tensor3DiH ~ W ~ Cj 1 xNgɕϊ
-// E߂l 1~1~(H*W*C)  Tensor3D
+// Forward（順伝播）
+// ・入力 Tensor3D（H × W × C）を 1 次元ベクトルに変換
+// ・戻り値は 1×1×(H*W*C) の Tensor3D
 Tensor3D FlattenLayer::Forward(const Tensor3D& input)
 {
-	// ͌`ۑ
-	m_lastInput = input;
-	inH = input.GetH();
-	inW = input.GetW();
-	inC = input.GetC();
-
-	// vf
-	int total = inH * inW * inC;
-
-	// o͗pxNgm
-	m_flatOutput.resize(total);
-
-	// Tensor3D  1D xNgɃRs[
-	int idx = 0;
-	for (int h = 0; h < inH; ++h) {
-		for (int w = 0; w < inW; ++w) {
-			for (int c = 0; c < inC; ++c)	{
-				m_flatOutput[idx++] = input(h, w, c);
-			}
-		}
-	}
-
-	// 1~1~total  Tensor3D ƂĕԂ
-	Tensor3D out(1, 1, total);
-	for (int i = 0; i < total; ++i) 	{
-		out(0, 0, i) = m_flatOutput[i];
-	}
+	// 戻り値用にコピーしてから形状を付け替える
+	Tensor3D out = input;
+	ForwardInPlace(out);
 	return out;
 }
 
-// t`d
-// EdOut: Flatten o(1~1~N)ɑ΂z
-// Ě` H~W~C ɖ߂
-Tensor3D FlattenLayer::Backward(const Tensor3D& dOut, float learningRate)
+// その場で順伝播する
+void FlattenLayer::ForwardInPlace(Tensor3D& x)
 {
-	int H = inH;
-	int W = inW;
-	int C = inC;
-
-	// 1~1~(H*W*C) ł邱ƂmF
-	assert(dOut.GetH() == 1 && dOut.GetW() == 1);
-	assert(dOut.GetC() == H * W * C);
+	// 入力形状を保存 (Backward で必要なのは形状だけなので、入力そのものは保持しない)
+	inH = x.GetH();
+	inW = x.GetW();
+	inC = x.GetC();
+	// 1×1×total に付け替える
+	x.Reshape(1, 1, inH * inW * inC);
+}
 
-	Tensor3D dInput(H, W, C);
-	dInput.Zero();
+// 推論用の順伝播
+// ・HWC の並びのまま 1×1×(H*W*C) に詰め直す
+Tensor3D FlattenLayer::Infer(const Tensor3D& input) const
+{
+	// データの並びは同じなのでコピーして形状だけ変える
+	Tensor3D out = input;
+	out.Reshape(1, 1, input.Size());
+	return out;
+}
 
-	int idx = 0;
-	for (int h = 0; h < H; ++h) {
-		for (int w = 0; w < W; ++w) {
-			for (int c = 0; c < C; ++c) {
-				dInput(h, w, c) = dOut(0, 0, idx++);
-			}
-		}
-	}
+// 逆伝播する
+// ・dOut: Flatten 出力(1×1×N)に対する勾配
+// ・これを元の形状 H×W×C に戻す
+Tensor3D FlattenLayer::Backward(const Tensor3D& dOut, float /*learningRate*/)
+{
+	Tensor3D dInput = dOut;
+	BackwardInPlace(dInput);
 	return dInput;
 }
+
+// その場で逆伝播する
+void FlattenLayer::BackwardInPlace(Tensor3D& grad) const
+{
+	// 1×1×(H*W*C) であることを確認する
+	assert(grad.GetH() == 1 && grad.GetW() == 1);
+	assert(grad.GetC() == inH * inW * inC);
+	// 元の形状に付け替える
+	grad.Reshape(inH, inW, inC);
+}
@@ -1,48 +1,57 @@
 #pragma once
 // FlattenLayer.h
-// Flatten(R)C[
-// ECNN ̏ݍݑwv[Ow̏o̓e\
-//   (~~`l)
-//   1xNgzɕϊB
-// ESwɓn߂̕K{Xebv
-// Et`dł1 dOut̃e\ɖ߂
+// Flatten(平坦化)レイヤー
+// ・CNN の畳み込み層やプーリング層の出力テンソル
+//   (高さ×幅×チャンネル)
+//   を1次元ベクトル配列に変換する。
+// ・全結合層に渡すための必須ステップ
+// ・逆伝播では1次元 dOutを元のテンソルに戻す
+// ・Tensor3D は HWC の順に連続して並んでいるので、1×1×N への変換は形状の付け替えだけで済む
+//   (ForwardInPlace / BackwardInPlace はデータを一切コピーしない)
 
 #include <vector>
 #include <cassert>
 #include "Tensor3D.h"
 #include "IBaseLayer.h"
 
-// FlattenLayer NX
-// Tensor3D  xNg(floatz) ւ̕ϊw
+// FlattenLayer クラス
+// Tensor3D → ベクトル(float配列) への変換層
 class FlattenLayer : public IBaseLayer
 {
 public:
-	// RXgN^(ɏȂ)
+	// コンストラクタ(特に処理なし)
 	FlattenLayer() = default;
 
-	// Forwardi`dj
-	// ETensor3D  1~1~(H*W*C) ̃e\ɕϊ
+	// Forward（順伝播）
+	// ・Tensor3D を 1×1×(H*W*C) のテンソルに変換
+	// ・戻り値を返すためにコピーが1回発生する (コピー不要なら ForwardInPlace を使う)
 	Tensor3D Forward(const Tensor3D& input) override;
 
-	// Backwardit`dj
-	// E1~1~N  Tensor3D(Flatten ̏o͑)
-	//    H~W~C ̌zɖ߂
+	// その場で順伝播する
+	// ・x の形状を 1×1×(H*W*C) に付け替えるだけで、データは動かさない
+	// ・変換後の x.Data() がそのまま全結合層の入力ベクトルになる
+	void ForwardInPlace(Tensor3D& x);
+
+	// 推論用の順伝播
+	// ・1×1×(H*W*C) のテンソルを返すが、入力形状を保存しない
+	Tensor3D Infer(const Tensor3D& input) const override;
+
+	// Backward（逆伝播）
+	// ・1×1×N の Tensor3D(Flatten の出力側)
+	//   元の H×W×C の勾配に戻す
 	Tensor3D Backward(const Tensor3D& dOut, float learningRate) override;
-	// Forwardʂ std::vector<float>ƂĎ擾
-	const std::vector<float>& GetFlatOutput() const { return m_flatOutput; }
 
-	// ͌`擾piFCw͎̓vZɕKvj
+	// その場で逆伝播する
+	// ・1×1×N の勾配の形状を Forward 時の H×W×C に付け替えるだけで、データは動かさない
+	void BackwardInPlace(Tensor3D& grad) const;
+
+	// 入力形状取得用（FC層の入力次元計算に必要）
 	int GetInputHeight()  const { return inH; }
 	int GetInputWidth()   const { return inW; }
 	int GetInputChannel() const { return inC; }
 
 private:
-	// Forward ̓͂ێe\(Backward Ŏg)
-	Tensor3D m_lastInput;
-	// Flatten  1 xNg
-	std::vector<float> m_flatOutput;
-
-	// ̓͌`
+	// 元の入力形状
 	int inH = 0;
 	int inW = 0;
 	int inC = 0;
@@ -1,109 +1,205 @@
 // FullyConnectedLayer.cpp
 #include "FullyConnectedLayer.h"
-#include <random>
+#include "BFloat16.h"
+#include "Gemm.h"
+#include "Random.h"
+#include "Checkpoint.h"
 #include <cmath>
+#include <algorithm>
 
-// Kzɏ]𐶐 (He p)
+// 正規分布に従う乱数を生成する (He 初期化用)
 static float GenerateNormalRandom(float mean, float stddev)
 {
-	// ZkcCX^
-	static std::mt19937 rng(std::random_device{}());
-	// ςƕW΍w肵Kz
-	std::normal_distribution<float> dist(mean, stddev);
-	// zɏ]Ԃ
-	return dist(rng);
+	// 共通の乱数サービスの初期化用ストリームから取る (シードが同じなら毎回同じ重みになる)
+	return InitializationRandom().NextNormal(mean, stddev);
 }
 
-// RXgN^(͎Əo͎w)
+// コンストラクタ(入力次元と出力次元を指定)
 FullyConnectedLayer::FullyConnectedLayer(int inputSize, int outputSize)
 	: m_inSize(inputSize),
 	m_outSize(outputSize)
 {
-	// He p̕W΍vZ
+	// He 初期化用の標準偏差を計算する
 	float stddev = std::sqrt(2.0f / m_inSize);
 
-	// dݍs𐳋Kzŏ
+	// 重み行列を正規分布で初期化する
 	m_weights.resize(m_inSize * m_outSize);
 	for (auto& w : m_weights)
 	{
 		w = GenerateNormalRandom(0.0f, stddev);
 	}
 
-	// oCAX 0 ŏ
+	// バイアスを 0 で初期化する
 	m_bias.assign(m_outSize, 0.0f);
 
-	// `dŎgp̓xNgmۂ
-	m_lastInputVector.resize(m_inSize);
+	// 勾配の累積領域を 0 で初期化する
+	m_dWeights.assign(m_weights.size(), 0.0f);
+	m_dBias.assign(m_outSize, 0.0f);
+
+	// 順伝播用のパネル形式の重みを作る
+	RefreshPackedWeights();
+}
+
+// 順伝播する
+std::vector<float> FullyConnectedLayer::Forward(const float* inputVector)
+{
+	// 入力への参照を保持する (逆伝播で使用、コピーはしない)
+	m_lastInput = inputVector;
+	// 出力ベクトルを計算して返す
+	return Infer(inputVector);
 }
 
-// `d
-std::vector<float> FullyConnectedLayer::Forward(const std::vector<float>& inputVector)
+// 推論用の順伝播する
+std::vector<float> FullyConnectedLayer::Infer(const float* inputVector) const
 {
-	// ͂ۑ (t`dŎgp)
-	m_lastInputVector = inputVector;
 
-	// o̓xNgmۂ
+	// 出力ベクトルを確保する
 	std::vector<float> outputVector(m_outSize);
 
-	// o̓j[ƂɌvZ
-	for (int outNeuron = 0; outNeuron < m_outSize; outNeuron++)
+	// 混合精度モード: 入力を bf16 に変換し、bf16 の重みの各行との内積を fp32 で累積する
+	if (m_mixedPrecision)
 	{
-		// oCAXlɐݒ
-		float sum = m_bias[outNeuron];
-
-		// e̓j[̊^Z
-		for (int inNeuron = 0; inNeuron < m_inSize; inNeuron++)
+		// 変換した入力はスレッドごとに使い回す
+		thread_local std::vector<uint16_t> inputBF16;
+		inputBF16.resize(m_inSize);
+		ConvertToBF16(inputVector, inputBF16.data(), m_inSize);
+		for (int outNeuron = 0; outNeuron < m_outSize; outNeuron++)
 		{
-			sum += m_weights[WeightIndex(outNeuron, inNeuron)] * inputVector[inNeuron];
+			outputVector[outNeuron] = m_bias[outNeuron] + DotBF16(&m_weightsBF16[WeightIndex(outNeuron, 0)], inputBF16.data(), m_inSize);
 		}
-
-		// o̓xNgɊi[
-		outputVector[outNeuron] = sum;
+		return outputVector;
 	}
 
-	// o̓xNgԂ
+	// パネル形式の重みで 8 出力ずつまとめて計算する (GEMV)
+	GemmPackedPanels(1, m_outSize, m_inSize, m_packedWeights.data(), m_bias.data(), inputVector, outputVector.data());
+
+	// 出力ベクトルを返す
 	return outputVector;
 }
 
-// t`d
-// o͌z dOut 󂯎A͌z dInput vZ
-// ɏd݂ƃoCAX SGD ōXV
+// 推論用の順伝播をまとめて行う
+void FullyConnectedLayer::InferBatch(const float* input, float* output, int count) const
+{
+	// 混合精度モードはサンプルごとに bf16 の内積で計算する
+	if (m_mixedPrecision)
+	{
+		for (int sample = 0; sample < count; sample++)
+		{
+			std::vector<float> row = Infer(input + (size_t)sample * m_inSize);
+			std::copy(row.begin(), row.end(), output + (size_t)sample * m_outSize);
+		}
+		return;
+	}
+	// パネルを読み込んだら全サンプルに使い回す (GEMM)
+	GemmPackedPanels(count, m_outSize, m_inSize, m_packedWeights.data(), m_bias.data(), input, output);
+}
+
+// 逆伝播する
+// 出力勾配 dOut を受け取り、入力勾配 dInput を計算する
+// 勾配を求めてから重みとバイアスを SGD で更新する
+// ・入力側勾配は更新前の重みで計算し終えてから更新するので、重みを退避する必要はない
 std::vector<float> FullyConnectedLayer::Backward(const std::vector<float>& dOut, float learningRate)
 {
-	// ͑z 0 ŏ
-	std::vector<float> dInputGradients(m_inSize, 0.0f);
+	// 入力側勾配
+	std::vector<float> dInputGradients(m_inSize);
+	// 勾配を求める (dX = dY × W, dW = dY^T × X)
+	AccumulateGradients(m_lastInput, dOut.data(), dInputGradients.data());
+	// 重みとバイアスを更新する
+	ApplyGradients(learningRate);
+	// 入力側勾配を返す
+	return dInputGradients;
+}
 
-	// ̏d݂ޔ (͑žvZɎgp)
-	std::vector<float> oldWeights = m_weights;
+// 勾配を累積する (重みは更新しないので、入力側勾配は現在の重みでそのまま計算できる)
+// ・count 個のサンプルをまとめて 2 つの行列積で計算する
+void FullyConnectedLayer::AccumulateGradients(const float* input, const float* dOut, float* dInput, int count)
+{
+	// バイアス勾配を加算する (dL/db += Σ dY の各行)
+	for (int sample = 0; sample < count; sample++)
+	{
+		const float* dOutRow = dOut + (size_t)sample * m_outSize;
+		for (int outNeuron = 0; outNeuron < m_outSize; outNeuron++)
+		{
+			m_dBias[outNeuron] += dOutRow[outNeuron];
+		}
+	}
+	// 重み勾配 dW (outSize×inSize) += dY^T (outSize×count) × X (count×inSize)
+	GemmAccumulate(m_outSize, m_inSize, count, dOut, m_outSize, true, input, m_inSize, m_dWeights.data(), m_inSize);
+	// 入力側勾配 dX (count×inSize) = dY (count×outSize) × W (outSize×inSize)
+	if (dInput)
+	{
+		std::fill(dInput, dInput + (size_t)count * m_inSize, 0.0f);
+		GemmAccumulate(count, m_inSize, m_outSize, dOut, m_outSize, false, m_weights.data(), m_inSize, dInput, m_inSize);
+	}
+}
 
-	// o̓j[ƂɌzvZ
+// 累積した勾配で重みとバイアスを更新する
+void FullyConnectedLayer::ApplyGradients(float learningRate)
+{
+	// SGD による重み更新 (W -= η * dL/dW)
+	for (size_t i = 0; i < m_weights.size(); i++)
+	{
+		m_weights[i] -= learningRate * m_dWeights[i];
+		m_dWeights[i] = 0.0f;
+	}
+	// バイアスを更新する (b -= η * dL/db)
 	for (int outNeuron = 0; outNeuron < m_outSize; outNeuron++)
 	{
-		// o͌z dL/d(y_outNeuron)
-		float grad = dOut[outNeuron];
+		m_bias[outNeuron] -= learningRate * m_dBias[outNeuron];
+		m_dBias[outNeuron] = 0.0f;
+	}
+	// 順伝播用の重みを作り直す
+	if (m_mixedPrecision) { RefreshWeightsBF16(); }
+	else { RefreshPackedWeights(); }
+}
 
-		// oCAXXV (b -=  * dL/db)
-		m_bias[outNeuron] -= learningRate * grad;
+// 混合精度モードを切り替える
+void FullyConnectedLayer::SetMixedPrecision(bool enabled)
+{
+	m_mixedPrecision = enabled;
+	// 使わない方の順伝播用の重みは解放する
+	if (enabled) { RefreshWeightsBF16(); m_packedWeights.clear(); }
+	else { m_weightsBF16.clear(); RefreshPackedWeights(); }
+}
 
-		// ̓j[Ƃ̌zvZ
-		for (int inNeuron = 0; inNeuron < m_inSize; inNeuron++)
-		{
-			// dݔzCfbNXvZ
-			int idx = WeightIndex(outNeuron, inNeuron);
+// 重み・バイアスのバイト数
+size_t FullyConnectedLayer::GetParameterBytes() const
+{
+	return (m_weights.size() + m_bias.size() + m_packedWeights.size()) * sizeof(float) + m_weightsBF16.size() * sizeof(uint16_t);
+}
+
+// 勾配の累積領域のバイト数
+size_t FullyConnectedLayer::GetGradientBytes() const
+{
+	return (m_dWeights.size() + m_dBias.size()) * sizeof(float);
+}
 
-			// ͑zvZ (XVȌd݂gp)
-			// dL/dx_in += dL/dy_out * W(out,in)
-			dInputGradients[inNeuron] += grad * oldWeights[idx];
+// 重みとバイアスを書き出す
+void FullyConnectedLayer::SaveParameters(std::ostream& out) const
+{
+	WriteCheckpointArray(out, m_weights);
+	WriteCheckpointArray(out, m_bias);
+}
 
-			// d݌zvZ
-			// dL/dW(out,in) = dL/dy_out * x_in
-			float gradW = grad * m_lastInputVector[inNeuron];
+// 重みとバイアスを読み込む
+bool FullyConnectedLayer::LoadParameters(std::istream& in)
+{
+	if (!ReadCheckpointArray(in, m_weights) || !ReadCheckpointArray(in, m_bias)) { return false; }
+	// 順伝播用の重みを作り直す
+	if (m_mixedPrecision) { RefreshWeightsBF16(); }
+	else { RefreshPackedWeights(); }
+	return true;
+}
 
-			// SGD ɂdݍXV (W -=  * dL/dW)
-			m_weights[idx] -= learningRate * gradW;
-		}
-	}
+// fp32 のマスター重みから bf16 の重みを作り直す
+void FullyConnectedLayer::RefreshWeightsBF16()
+{
+	m_weightsBF16.resize(m_weights.size());
+	ConvertToBF16(m_weights.data(), m_weightsBF16.data(), m_weights.size());
+}
 
-	// ͑zԂ
-	return dInputGradients;
+// fp32 のマスター重みからパネル形式の重みを作り直す
+void FullyConnectedLayer::RefreshPackedWeights()
+{
+	PackWeightPanels(m_weights.data(), m_outSize, m_inSize, m_packedWeights);
 }
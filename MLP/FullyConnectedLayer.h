@@ -1,48 +1,102 @@
 // FullyConnectedLayer.h
 #pragma once
 #include <vector>
+#include <cstdint>
+#include <iosfwd>
 
-// SwNX
-// E̓xNg  o̓xNg ̐`ϊ (y = W x + b)
-// E֐͊O(CNNModel)ōs
+// 完全結合層クラス
+// ・入力ベクトル → 出力ベクトル の線形変換 (y = W x + b)
+// ・活性化関数は外側(CNNModel)で行う
 class FullyConnectedLayer
 {
 public:
-	// RXgN^
-	// inputSize  : ͎
-	// outputSize : o͎
+	// コンストラクタ
+	// inputSize  : 入力次元数
+	// outputSize : 出力次元数
 	FullyConnectedLayer(int inputSize, int outputSize);
 
-	// `d
-	// inputVector : ̓xNg ( inputSize)
-	// ߂l : o̓xNg ( outputSize)
-	std::vector<float> Forward(const std::vector<float>& inputVector);
+	// 順伝播する
+	// inputVector : 入力ベクトル (長さ inputSize、参照を保持するので Backward まで生存させておくこと)
+	// 戻り値 : 出力ベクトル (長さ outputSize)
+	std::vector<float> Forward(const std::vector<float>& inputVector) { return Forward(inputVector.data()); }
+	// 順伝播する (入力を配列で受け取る、テンソルのデータをコピーせずに渡すとき用)
+	std::vector<float> Forward(const float* inputVector);
 
-	// t`d
-	// dOut : o͑z ( outputSize)
-	// learningRate : wK
-	// ߂l : ͑z ( inputSize)
+	// 推論用の順伝播する
+	// ・Forward と同じ計算だが、逆伝播用の入力を保存しない (const)
+	std::vector<float> Infer(const std::vector<float>& inputVector) const { return Infer(inputVector.data()); }
+	std::vector<float> Infer(const float* inputVector) const;
+	// 推論用の順伝播を count サンプル分まとめて行う
+	// input : count × inputSize、output : count × outputSize (サンプルごとの行を連続して並べる)
+	void InferBatch(const float* input, float* output, int count) const;
+
+	// 逆伝播する
+	// dOut : 出力側勾配 (長さ outputSize)
+	// learningRate : 学習率
+	// 戻り値 : 入力側勾配 (長さ inputSize)
 	std::vector<float> Backward(const std::vector<float>& dOut, float learningRate);
 
+	// 勾配を累積する (ミニバッチ学習用、重みは更新しない)
+	// ・dX = dY × W と dW += dY^T × X の 2 つの行列積で計算する
+	// input : 順伝播時の入力 (count × inputSize、サンプルごとの行を連続して並べる)
+	// dOut : 出力側勾配 (count × outputSize)
+	// dInput : 入力側勾配の格納先 (count × inputSize、不要なら nullptr)
+	// count : サンプル数
+	void AccumulateGradients(const float* input, const float* dOut, float* dInput, int count = 1);
+	// 累積した勾配で重みとバイアスを更新し、累積をクリアする
+	void ApplyGradients(float learningRate);
+
+	// 混合精度モードを切り替える
+	// ・有効な間は順伝播を bf16 の重み・入力の内積 (fp32 累積) で計算する
+	// ・重みの更新は fp32 のマスター重みに対して行う
+	void SetMixedPrecision(bool enabled);
+
+	// 重み・バイアス (順伝播用のパネル形式 / bf16 の重みを含む) のバイト数
+	size_t GetParameterBytes() const;
+	// 勾配の累積領域のバイト数
+	size_t GetGradientBytes() const;
+
+	// 重みとバイアスを書き出す (チェックポイント用)
+	void SaveParameters(std::ostream& out) const;
+	// 重みとバイアスを読み込む (形状がこの層と違えば false)
+	// ・読み込んだ重みから順伝播用の重み (パネル形式 / bf16) を作り直す
+	bool LoadParameters(std::istream& in);
+
 private:
-	// dݔz̃CfbNXvZ
-	// outNeuron : o̓j[ index
-	// inNeuron  : ̓j[ index
+	// 重み配列のインデックスを計算する
+	// outNeuron : 出力ニューロン index
+	// inNeuron  : 入力ニューロン index
 	inline int WeightIndex(int outNeuron, int inNeuron) const
 	{
-		// [outNeuron][inNeuron] ƍlƂ1z̈ʒu
+		// [outNeuron][inNeuron] と考えたときの1次元配列上の位置
 		return outNeuron * m_inSize + inNeuron;
 	}
 
+	// fp32 のマスター重みから bf16 の重みを作り直す
+	void RefreshWeightsBF16();
+	// fp32 のマスター重みからパネル形式の重みを作り直す (初期化時と重みの更新ごとに呼ぶ)
+	void RefreshPackedWeights();
+
 private:
-	// ͎
+	// 入力次元数
 	int m_inSize;
-	// o͎
+	// 出力次元数
 	int m_outSize;
-	// dݔz (TCY: m_outSize * m_inSize)
+	// 重み配列 (サイズ: m_outSize * m_inSize)
 	std::vector<float> m_weights;
-	// oCAXz (TCY: m_outSize)
+	// バイアス配列 (サイズ: m_outSize)
 	std::vector<float> m_bias;
-	// ߂ Forward Ŏgp̓xNg (t`dɎgp)
-	std::vector<float> m_lastInputVector;
+	// 直近の Forward で使用した入力ベクトルへの参照 (逆伝播時に使用、所有はしない)
+	const float* m_lastInput = nullptr;
+	// 累積中の重み勾配 (AccumulateGradients で使用)
+	std::vector<float> m_dWeights;
+	// 累積中のバイアス勾配
+	std::vector<float> m_dBias;
+	// 混合精度モードか
+	bool m_mixedPrecision = false;
+	// bf16 の重み (混合精度モードの順伝播で使う、m_weights と同じ並び)
+	std::vector<uint16_t> m_weightsBF16;
+	// パネル形式に並べ替えた重み (fp32 の順伝播で使う、8 出力ずつ入力方向に交互に並べる)
+	// ・m_weights は逆伝播の行列積と更新に使うマスター重みとして、行優先のまま持つ
+	std::vector<float> m_packedWeights;
 };
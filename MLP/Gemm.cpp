@@ -0,0 +1,243 @@
+﻿// Gemm.cpp
+// fp32 の行列積カーネル
+#include "Gemm.h"
+#include <algorithm>
+#if defined(_M_X64) || defined(__x86_64__)
+#define GEMM_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC は /arch 指定なしで AVX2 の組み込み関数を使える
+#define GEMM_TARGET
+#else
+#include <cpuid.h>
+// GCC / Clang は関数単位で命令セットを有効にする (実行時判定で呼び分ける)
+#define GEMM_TARGET __attribute__((target("avx2,fma")))
+#endif
+#endif
+
+namespace
+{
+	// 1回のブロックで扱う B の列数 (C・B の1行分の区間が 1 KB)
+	constexpr int BlockColumns = 256;
+	// 1回のブロックで扱う K 方向の行数 (B のブロックは 128 × 256 × 4 byte = 128 KB で L2 に収まる)
+	constexpr int BlockDepth = 128;
+
+	// op(A) の (i, k) 要素
+	inline float ElementA(const float* A, int lda, bool transposeA, int i, int k)
+	{
+		return transposeA ? A[(size_t)k * lda + i] : A[(size_t)i * lda + k];
+	}
+}
+
+// AVX2 + FMA の実行時判定
+bool HasAVX2FMA()
+{
+#ifdef GEMM_X86
+	static const bool supported = [] {
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7) { return false; }
+		__cpuid(info, 1);
+		unsigned int ecx1 = (unsigned int)info[2];
+		__cpuidex(info, 7, 0);
+		unsigned int ebx7 = (unsigned int)info[1];
+		// OSXSAVE が無いと xgetbv は使えない
+		if (!(ecx1 & (1u << 27))) { return false; }
+		unsigned long long xcr0 = _xgetbv(0);
+#else
+		unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+		if (__get_cpuid_max(0, nullptr) < 7) { return false; }
+		__get_cpuid(1, &eax, &ebx, &ecx, &edx);
+		unsigned int ecx1 = ecx;
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+		unsigned int ebx7 = ebx;
+		if (!(ecx1 & (1u << 27))) { return false; }
+		unsigned int xcrLow, xcrHigh;
+		__asm__("xgetbv" : "=a"(xcrLow), "=d"(xcrHigh) : "c"(0));
+		unsigned long long xcr0 = ((unsigned long long)xcrHigh << 32) | xcrLow;
+#endif
+		// OS が XMM/YMM の状態を保存するか (XCR0 bit 1,2)、FMA (CPUID.1:ECX bit 12)、AVX (bit 28)、AVX2 (CPUID.7.0:EBX bit 5)
+		bool osSupport = (xcr0 & 0x6) == 0x6;
+		return osSupport && (ecx1 & (1u << 12)) && (ecx1 & (1u << 28)) && (ebx7 & (1u << 5));
+	}();
+	return supported;
+#else
+	return false;
+#endif
+}
+
+#ifdef GEMM_X86
+// C の1行の区間 [n0, n0 + width) に op(A) の i 行 × B の [k0, k0 + depth) 行を積和する (AVX2 + FMA)
+// ・32 列 (8 レーン × 4 本) の累積をレジスタに置いたまま K 方向に回し、C の読み書きを 1 回にする
+GEMM_TARGET static void RowBlockAVX2(int i, int n0, int width, int k0, int depth,
+	const float* A, int lda, bool transposeA, const float* B, int ldb, float* C, int ldc)
+{
+	float* c = C + (size_t)i * ldc + n0;
+	int n = 0;
+	for (; n + 32 <= width; n += 32)
+	{
+		__m256 acc0 = _mm256_loadu_ps(c + n);
+		__m256 acc1 = _mm256_loadu_ps(c + n + 8);
+		__m256 acc2 = _mm256_loadu_ps(c + n + 16);
+		__m256 acc3 = _mm256_loadu_ps(c + n + 24);
+		for (int k = k0; k < k0 + depth; k++)
+		{
+			__m256 a = _mm256_set1_ps(ElementA(A, lda, transposeA, i, k));
+			const float* b = B + (size_t)k * ldb + n0 + n;
+			acc0 = _mm256_fmadd_ps(a, _mm256_loadu_ps(b), acc0);
+			acc1 = _mm256_fmadd_ps(a, _mm256_loadu_ps(b + 8), acc1);
+			acc2 = _mm256_fmadd_ps(a, _mm256_loadu_ps(b + 16), acc2);
+			acc3 = _mm256_fmadd_ps(a, _mm256_loadu_ps(b + 24), acc3);
+		}
+		_mm256_storeu_ps(c + n, acc0);
+		_mm256_storeu_ps(c + n + 8, acc1);
+		_mm256_storeu_ps(c + n + 16, acc2);
+		_mm256_storeu_ps(c + n + 24, acc3);
+	}
+	for (; n + 8 <= width; n += 8)
+	{
+		__m256 acc = _mm256_loadu_ps(c + n);
+		for (int k = k0; k < k0 + depth; k++)
+		{
+			__m256 a = _mm256_set1_ps(ElementA(A, lda, transposeA, i, k));
+			acc = _mm256_fmadd_ps(a, _mm256_loadu_ps(B + (size_t)k * ldb + n0 + n), acc);
+		}
+		_mm256_storeu_ps(c + n, acc);
+	}
+	// 端数の列
+	for (; n < width; n++)
+	{
+		float sum = c[n];
+		for (int k = k0; k < k0 + depth; k++)
+		{
+			sum += ElementA(A, lda, transposeA, i, k) * B[(size_t)k * ldb + n0 + n];
+		}
+		c[n] = sum;
+	}
+}
+#endif
+
+// 同じ計算のスカラー版 (列方向の内側ループはコンパイラがベクトル化する)
+static void RowBlockScalar(int i, int n0, int width, int k0, int depth,
+	const float* A, int lda, bool transposeA, const float* B, int ldb, float* C, int ldc)
+{
+	float* c = C + (size_t)i * ldc + n0;
+	for (int k = k0; k < k0 + depth; k++)
+	{
+		float a = ElementA(A, lda, transposeA, i, k);
+		if (a == 0.0f) { continue; }
+		const float* b = B + (size_t)k * ldb + n0;
+		for (int n = 0; n < width; n++) { c[n] += a * b[n]; }
+	}
+}
+
+// C += op(A) × B
+void GemmAccumulate(int M, int N, int K, const float* A, int lda, bool transposeA,
+	const float* B, int ldb, float* C, int ldc)
+{
+#ifdef GEMM_X86
+	const bool useAVX2 = HasAVX2FMA();
+#endif
+	// B を列ブロック × 深さブロックに区切り、ブロックをキャッシュに載せたまま A の全行で使い回す
+	for (int n0 = 0; n0 < N; n0 += BlockColumns)
+	{
+		int width = std::min(BlockColumns, N - n0);
+		for (int k0 = 0; k0 < K; k0 += BlockDepth)
+		{
+			int depth = std::min(BlockDepth, K - k0);
+			for (int i = 0; i < M; i++)
+			{
+#ifdef GEMM_X86
+				if (useAVX2) { RowBlockAVX2(i, n0, width, k0, depth, A, lda, transposeA, B, ldb, C, ldc); continue; }
+#endif
+				RowBlockScalar(i, n0, width, k0, depth, A, lda, transposeA, B, ldb, C, ldc);
+			}
+		}
+	}
+}
+
+// 重みをパネル形式に並べ替える
+void PackWeightPanels(const float* W, int rows, int columns, std::vector<float>& panels)
+{
+	const int numPanels = (rows + GemmPanelWidth - 1) / GemmPanelWidth;
+	panels.assign((size_t)numPanels * columns * GemmPanelWidth, 0.0f);
+	for (int row = 0; row < rows; row++)
+	{
+		float* panel = &panels[(size_t)(row / GemmPanelWidth) * columns * GemmPanelWidth];
+		const int lane = row % GemmPanelWidth;
+		for (int column = 0; column < columns; column++)
+		{
+			panel[(size_t)column * GemmPanelWidth + lane] = W[(size_t)row * columns + column];
+		}
+	}
+}
+
+#ifdef GEMM_X86
+// 1パネル (8 出力) × 1サンプルの積和 (AVX2 + FMA)
+// ・入力 4 個ずつを別々の累積に入れて FMA の依存を切り、最後に足し合わせる
+GEMM_TARGET static void PanelDotAVX2(const float* panel, int columns, const float* x, float* out8)
+{
+	__m256 acc0 = _mm256_setzero_ps();
+	__m256 acc1 = _mm256_setzero_ps();
+	__m256 acc2 = _mm256_setzero_ps();
+	__m256 acc3 = _mm256_setzero_ps();
+	int j = 0;
+	for (; j + 4 <= columns; j += 4)
+	{
+		const float* w = panel + (size_t)j * GemmPanelWidth;
+		acc0 = _mm256_fmadd_ps(_mm256_set1_ps(x[j]), _mm256_loadu_ps(w), acc0);
+		acc1 = _mm256_fmadd_ps(_mm256_set1_ps(x[j + 1]), _mm256_loadu_ps(w + 8), acc1);
+		acc2 = _mm256_fmadd_ps(_mm256_set1_ps(x[j + 2]), _mm256_loadu_ps(w + 16), acc2);
+		acc3 = _mm256_fmadd_ps(_mm256_set1_ps(x[j + 3]), _mm256_loadu_ps(w + 24), acc3);
+	}
+	for (; j < columns; j++)
+	{
+		acc0 = _mm256_fmadd_ps(_mm256_set1_ps(x[j]), _mm256_loadu_ps(panel + (size_t)j * GemmPanelWidth), acc0);
+	}
+	_mm256_storeu_ps(out8, _mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+}
+#endif
+
+// 同じ計算のスカラー版 (8 レーンの内側ループはコンパイラがベクトル化する)
+static void PanelDotScalar(const float* panel, int columns, const float* x, float* out8)
+{
+	float acc[GemmPanelWidth] = {};
+	for (int j = 0; j < columns; j++)
+	{
+		const float* w = panel + (size_t)j * GemmPanelWidth;
+		for (int lane = 0; lane < GemmPanelWidth; lane++) { acc[lane] += x[j] * w[lane]; }
+	}
+	for (int lane = 0; lane < GemmPanelWidth; lane++) { out8[lane] = acc[lane]; }
+}
+
+// Y = X × W^T + bias (パネル形式の重み)
+void GemmPackedPanels(int count, int rows, int columns, const float* panels, const float* bias,
+	const float* X, float* Y)
+{
+#ifdef GEMM_X86
+	const bool useAVX2 = HasAVX2FMA();
+#endif
+	const int numPanels = (rows + GemmPanelWidth - 1) / GemmPanelWidth;
+	// パネルを外側に回し、1パネル (columns × 8 個) を読み込んだら全サンプルで使い回す
+	for (int p = 0; p < numPanels; p++)
+	{
+		const float* panel = panels + (size_t)p * columns * GemmPanelWidth;
+		const int row0 = p * GemmPanelWidth;
+		const int width = std::min(GemmPanelWidth, rows - row0);
+		for (int sample = 0; sample < count; sample++)
+		{
+			float out8[GemmPanelWidth];
+			const float* x = X + (size_t)sample * columns;
+#ifdef GEMM_X86
+			if (useAVX2) { PanelDotAVX2(panel, columns, x, out8); }
+			else
+#endif
+			{ PanelDotScalar(panel, columns, x, out8); }
+			// 0 埋めした余りのレーンは書き込まない
+			float* y = Y + (size_t)sample * rows + row0;
+			for (int lane = 0; lane < width; lane++) { y[lane] = out8[lane] + bias[row0 + lane]; }
+		}
+	}
+}
@@ -0,0 +1,30 @@
+﻿// Gemm.h
+// fp32 の行列積カーネル (全結合層の逆伝播・順伝播で使う)
+// ・行列はすべて行優先 (row-major) で、ld* は1行の要素数 (行の先頭どうしの間隔)
+// ・AVX2 + FMA が使える CPU では 8 レーンの FMA、それ以外はスカラー (コンパイラのベクトル化) で計算する
+// ・B の列方向を L1/L2 に収まるブロックに区切り、C の1行分の区間をレジスタに載せたまま K 方向に積和する
+#pragma once
+#include <vector>
+
+// 実行中の CPU が AVX2 と FMA を使えるかを返す (初回に cpuid で判定する)
+bool HasAVX2FMA();
+
+// C (M×N) += op(A) × B (K×N)
+// ・transposeA = false : A は M×K で、op(A) = A
+// ・transposeA = true  : A は K×M で、op(A) = A^T (dW = dY^T × X のように転置を作らずに計算する)
+void GemmAccumulate(int M, int N, int K, const float* A, int lda, bool transposeA,
+	const float* B, int ldb, float* C, int ldc);
+
+// 重みをパネル形式に並べ替えるときの、1パネルに入れる出力 (行) の数
+// ・AVX2 の 1 レジスタ (8 レーン) に 8 出力分の積和を持ち、入力を 1 回読むごとに 8 出力を同時に進める
+constexpr int GemmPanelWidth = 8;
+
+// 行優先の重み W (rows×columns) をパネル形式に並べ替える
+// ・パネル p の入力 j の位置に、出力 p*8 〜 p*8+7 の重み W(p*8+r, j) を 8 個続けて置く
+// ・行数が 8 の倍数でない場合、最後のパネルの余りは 0 で埋める
+void PackWeightPanels(const float* W, int rows, int columns, std::vector<float>& panels);
+
+// パネル形式の重みで Y (count×rows) = X (count×columns) × W^T + bias を計算する
+// ・count = 1 なら GEMV、count > 1 ならパネルをキャッシュに載せたまま全サンプルに使う GEMM
+void GemmPackedPanels(int count, int rows, int columns, const float* panels, const float* bias,
+	const float* X, float* Y);
@@ -0,0 +1,205 @@
+﻿// ImageAugmenter.cpp
+// 学習データの拡張
+#include "ImageAugmenter.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#if defined(_M_X64) || defined(__SSE2__)
+// x64 では SSE2 が必ず使えるので、16 画素ずつまとめて処理する
+#define AUGMENT_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	// 補間の重みの分母 (8 bit の固定小数点)
+	constexpr int WeightOne = 256;
+
+	// out = (a × (256 - weight) + b × weight + 128) / 256 (2 点の線形補間)
+	// ・途中の値は 255 × 256 + 128 < 65536 なので 16 bit に収まる
+	void Lerp(const uint8_t* a, const uint8_t* b, uint8_t* out, int count, int weight)
+	{
+		int i = 0;
+#ifdef AUGMENT_SSE2
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i weightA = _mm_set1_epi16((short)(WeightOne - weight));
+		const __m128i weightB = _mm_set1_epi16((short)weight);
+		const __m128i half = _mm_set1_epi16(WeightOne / 2);
+		for (; i + 16 <= count; i += 16)
+		{
+			__m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+			__m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+			// 8 bit → 16 bit に広げて下位・上位 8 画素ずつ計算する
+			__m128i low = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), weightA), _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), weightB));
+			__m128i high = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), weightA), _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), weightB));
+			low = _mm_srli_epi16(_mm_add_epi16(low, half), 8);
+			high = _mm_srli_epi16(_mm_add_epi16(high, half), 8);
+			_mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(low, high));
+		}
+#endif
+		for (; i < count; i++)
+		{
+			out[i] = (uint8_t)((a[i] * (WeightOne - weight) + b[i] * weight + WeightOne / 2) >> 8);
+		}
+	}
+
+	// 1 行の画素の並びを左右逆にする (channels バイトの画素単位)
+	void ReverseRow(const uint8_t* source, uint8_t* destination, int columns, int channels)
+	{
+		if (channels != 1)
+		{
+			for (int x = 0; x < columns; x++)
+			{
+				std::memcpy(destination + (size_t)(columns - 1 - x) * channels, source + (size_t)x * channels, channels);
+			}
+			return;
+		}
+		int x = 0;
+#ifdef AUGMENT_SSE2
+		// 16 byte の並びを逆にする (16 bit 内のバイト交換 → 16 bit 単位の逆順 → 64 bit の入れ替え)
+		for (; x + 16 <= columns; x += 16)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(source + x));
+			v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+			v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+			v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+			v = _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+			_mm_storeu_si128((__m128i*)(destination + columns - x - 16), v);
+		}
+#endif
+		for (; x < columns; x++) { destination[columns - 1 - x] = source[x]; }
+	}
+
+	// 整数画素の平行移動: canvas(y, x) = image(y + shiftY, x + shiftX) (範囲外は 0)
+	// ・canvas は canvasRows 行 × canvasColumns 画素 (補間で使う右端・下端の 1 画素分を含められる)
+	void Translate(const uint8_t* image, int rows, int columns, int channels,
+		uint8_t* canvas, int canvasRows, int canvasColumns, int shiftX, int shiftY)
+	{
+		const size_t canvasRowBytes = (size_t)canvasColumns * channels;
+		// 元の画像と重なる列の範囲 [x0, x1)
+		const int x0 = std::clamp(-shiftX, 0, canvasColumns);
+		const int x1 = std::clamp(columns - shiftX, x0, canvasColumns);
+		for (int y = 0; y < canvasRows; y++)
+		{
+			uint8_t* row = canvas + y * canvasRowBytes;
+			const int sourceY = y + shiftY;
+			if (sourceY < 0 || sourceY >= rows || x0 == x1) { std::memset(row, 0, canvasRowBytes); continue; }
+			std::memset(row, 0, (size_t)x0 * channels);
+			std::memcpy(row + (size_t)x0 * channels, image + ((size_t)sourceY * columns + x0 + shiftX) * channels, (size_t)(x1 - x0) * channels);
+			std::memset(row + (size_t)x1 * channels, 0, (size_t)(canvasColumns - x1) * channels);
+		}
+	}
+
+	// 平行移動量を整数部と補間の重み (0〜255) に分ける
+	void SplitShift(float shift, int& integer, int& weight)
+	{
+		float floorShift = std::floor(shift);
+		integer = (int)floorShift;
+		weight = (int)std::lround((shift - floorShift) * WeightOne);
+		if (weight == WeightOne) { integer++; weight = 0; }
+	}
+}
+
+// コンストラクタ
+ImageAugmenter::ImageAugmenter(const AugmentationConfig& config, int rows, int columns, int channels)
+	: m_config(config), m_rows(rows), m_columns(columns), m_channels(channels), m_rowBytes(columns* channels)
+{
+	m_config.cropPadding = std::max(0, m_config.cropPadding);
+	m_config.maxShift = std::max(0.0f, m_config.maxShift);
+	m_config.cutoutSize = std::max(0, m_config.cutoutSize);
+}
+
+// 画像を拡張して output に書き込む
+void ImageAugmenter::Apply(const uint8_t* image, uint8_t* output, RandomStream& random) const
+{
+	// 拡張のパラメータを決める (有効な拡張の分だけ決まった順番で乱数を使う)
+	float shiftX = 0.0f, shiftY = 0.0f;
+	if (m_config.cropPadding > 0)
+	{
+		shiftX += (float)(random.NextInt(2 * m_config.cropPadding + 1) - m_config.cropPadding);
+		shiftY += (float)(random.NextInt(2 * m_config.cropPadding + 1) - m_config.cropPadding);
+	}
+	if (m_config.maxShift > 0.0f)
+	{
+		shiftX += (random.NextFloat() * 2.0f - 1.0f) * m_config.maxShift;
+		shiftY += (random.NextFloat() * 2.0f - 1.0f) * m_config.maxShift;
+	}
+	bool flip = m_config.flipProbability > 0.0f && random.NextFloat() < m_config.flipProbability;
+	int cutoutX = 0, cutoutY = 0;
+	bool cutout = m_config.cutoutSize > 0 && random.NextFloat() < m_config.cutoutProbability;
+	if (cutout)
+	{
+		// 正方形の中心は画像内のどこでもよい (端にかかる部分は切り捨てる)
+		cutoutX = random.NextInt(m_columns) - m_config.cutoutSize / 2;
+		cutoutY = random.NextInt(m_rows) - m_config.cutoutSize / 2;
+	}
+
+	// 作業領域 (ワーカースレッドごとに使い回す)
+	thread_local std::vector<uint8_t> canvas;
+	thread_local std::vector<uint8_t> horizontal;
+	thread_local std::vector<uint8_t> shifted;
+	const size_t imageBytes = (size_t)m_rows * m_rowBytes;
+
+	// 平行移動 (クロップ + サブピクセル)
+	int integerX, integerY, weightX, weightY;
+	SplitShift(shiftX, integerX, weightX);
+	SplitShift(shiftY, integerY, weightY);
+	// 反転する場合は作業領域に平行移動してから反転して output に書き込む
+	shifted.resize(imageBytes);
+	uint8_t* target = flip ? shifted.data() : output;
+	if (weightX == 0 && weightY == 0)
+	{
+		Translate(image, m_rows, m_columns, m_channels, target, m_rows, m_columns, integerX, integerY);
+	}
+	else
+	{
+		// 補間で右・下の隣の画素を使うので 1 画素大きいキャンバスに平行移動する
+		const int canvasColumns = m_columns + 1;
+		const size_t canvasRowBytes = (size_t)canvasColumns * m_channels;
+		canvas.resize((m_rows + 1) * canvasRowBytes);
+		Translate(image, m_rows, m_columns, m_channels, canvas.data(), m_rows + 1, canvasColumns, integerX, integerY);
+		// 横方向の補間 (m_rows + 1 行)
+		const uint8_t* rows = canvas.data();
+		size_t rowStride = canvasRowBytes;
+		if (weightX != 0)
+		{
+			horizontal.resize((m_rows + 1) * (size_t)m_rowBytes);
+			for (int y = 0; y <= m_rows; y++)
+			{
+				const uint8_t* row = canvas.data() + y * canvasRowBytes;
+				Lerp(row, row + m_channels, horizontal.data() + (size_t)y * m_rowBytes, m_rowBytes, weightX);
+			}
+			rows = horizontal.data();
+			rowStride = m_rowBytes;
+		}
+		// 縦方向の補間 (縦にずらさない場合はコピーだけ)
+		for (int y = 0; y < m_rows; y++)
+		{
+			const uint8_t* row = rows + y * rowStride;
+			uint8_t* destination = target + (size_t)y * m_rowBytes;
+			if (weightY != 0) { Lerp(row, row + rowStride, destination, m_rowBytes, weightY); }
+			else { std::memcpy(destination, row, m_rowBytes); }
+		}
+	}
+
+	// 左右反転
+	if (flip)
+	{
+		for (int y = 0; y < m_rows; y++)
+		{
+			ReverseRow(shifted.data() + (size_t)y * m_rowBytes, output + (size_t)y * m_rowBytes, m_columns, m_channels);
+		}
+	}
+
+	// カットアウト
+	if (cutout)
+	{
+		const int x0 = std::max(cutoutX, 0), x1 = std::min(cutoutX + m_config.cutoutSize, m_columns);
+		const int y0 = std::max(cutoutY, 0), y1 = std::min(cutoutY + m_config.cutoutSize, m_rows);
+		for (int y = y0; y < y1 && x0 < x1; y++)
+		{
+			std::memset(output + (size_t)y * m_rowBytes + (size_t)x0 * m_channels, 0, (size_t)(x1 - x0) * m_channels);
+		}
+	}
+}
@@ -0,0 +1,58 @@
+﻿// ImageAugmenter.h
+// 学習データの拡張 (uint8 の画像のまま、正規化の前に行う)
+// ・ランダムクロップ (周囲を 0 で埋めてから元の大きさで切り出す = 整数画素の平行移動)
+// ・サブピクセルの平行移動 (双線形補間)
+// ・左右反転
+// ・カットアウト (正方形の領域を 0 で塗る)
+// ・行単位の処理を SSE2 で 16 画素ずつまとめて行う
+// ・先読みのワーカースレッドから呼び出す (Apply は const で、複数スレッドから同時に呼び出せる)
+#pragma once
+#include <cstdint>
+#include "Random.h"
+
+// データ拡張の設定
+struct AugmentationConfig
+{
+	// ランダムクロップで周囲に足す画素数 (切り出し位置が上下左右に ±cropPadding ずれる、0 で無効)
+	int cropPadding = 2;
+	// サブピクセルの平行移動の最大量 (画素、クロップのずれに加える、0 で無効)
+	float maxShift = 0.5f;
+	// 左右反転する確率
+	float flipProbability = 0.5f;
+	// カットアウトの正方形の一辺 (画素、0 で無効) と、カットアウトする確率
+	int cutoutSize = 0;
+	float cutoutProbability = 0.5f;
+};
+
+// サンプルごとのデータ拡張の乱数ストリーム
+// ・(エポック, サンプル番号) だけで決まるので、ワーカーの数や実行順によらず同じ拡張になる
+inline RandomStream MakeAugmentationRandom(int epochIndex, int sampleIndex)
+{
+	return MakeRandomStream(RandomPurpose::Augmentation, ((uint64_t)(uint32_t)epochIndex << 32) | (uint32_t)sampleIndex);
+}
+
+// ImageAugmenter クラス
+class ImageAugmenter
+{
+public:
+	// コンストラクタ
+	// ・rows, columns, channels : 画像の形状 (HWC の並び)
+	ImageAugmenter(const AugmentationConfig& config, int rows, int columns, int channels);
+
+	// 画像を拡張して output に書き込む
+	// ・image, output : rows × columns × channels バイト (同じバッファは不可)
+	// ・random : 拡張のパラメータを決める乱数 (MakeAugmentationRandom で作る)
+	void Apply(const uint8_t* image, uint8_t* output, RandomStream& random) const;
+
+	// 設定
+	const AugmentationConfig& GetConfig() const { return m_config; }
+
+private:
+	// 設定
+	AugmentationConfig m_config;
+	// 画像の形状と 1 行のバイト数
+	int m_rows;
+	int m_columns;
+	int m_channels;
+	int m_rowBytes;
+};
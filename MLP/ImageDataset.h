@@ -0,0 +1,166 @@
+﻿// ImageDataset.h
+// 学習に使う画像データセット (Fashion-MNIST と CIFAR-10 の切り替え)
+// ・Main はデータセットの種類によらず、このクラスから入力形状・画像・ラベル・クラス名を受け取る
+// ・画像は画素ごとにチャネルが並ぶ HWC の uint8 で渡す (データ拡張・キャッシュ・シャードと同じ並び)
+// ・CIFAR-10 はメモリマップしたプレーン形式 (CHW) のまま持ち、取り出すときに呼び出し元のバッファへ並べ替える
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "FashionMNIST.h"
+#include "CIFAR10Loader.h"
+#include "Tensor3D.h"
+
+// データセットの種類
+enum class DatasetKind
+{
+	// Fashion-MNIST (28×28 グレースケール、IDX 形式)
+	FashionMNIST,
+	// CIFAR-10 (32×32 RGB、バイナリ版)
+	Cifar10,
+};
+
+// ImageDataset クラス
+class ImageDataset
+{
+public:
+	// Fashion-MNIST を読み込む (テストデータ t10k は無くてもよい)
+	bool LoadFashionMNIST(const std::string& trainImagePath, const std::string& trainLabelPath,
+		const std::string& testImagePath, const std::string& testLabelPath)
+	{
+		m_kind = DatasetKind::FashionMNIST;
+		if (!m_mnist.Load(trainImagePath, trainLabelPath, true)) return false;
+		m_hasTestSet = m_mnist.Load(testImagePath, testLabelPath, false);
+		m_rows = m_mnist.imageRows;
+		m_columns = m_mnist.imageColumns;
+		m_channels = 1;
+		m_classNames = { L"T-shirt/top", L"Trouser", L"Pullover", L"Dress", L"Coat",
+			L"Sandal", L"Shirt", L"Sneaker", L"Bag", L"Ankle boot" };
+		return true;
+	}
+
+	// CIFAR-10 を読み込む (directory : data_batch_1〜5.bin / test_batch.bin のあるディレクトリ)
+	// ・クラス名は batches.meta.txt から読む (無ければ CIFAR-10 の既定の名前)
+	bool LoadCifar10(const std::string& directory)
+	{
+		m_kind = DatasetKind::Cifar10;
+		if (!m_cifar.Load(directory, true)) return false;
+		m_hasTestSet = m_cifar.Load(directory, false);
+		m_rows = CIFAR10Loader::Height;
+		m_columns = CIFAR10Loader::Width;
+		m_channels = CIFAR10Loader::Channels;
+		// サンプラに渡すラベルの配列を作る (マップしたファイルから 1 byte ずつ拾う)
+		m_cifarTrainLabels.resize(m_cifar.GetCount(true));
+		for (size_t i = 0; i < m_cifarTrainLabels.size(); i++) { m_cifarTrainLabels[i] = (uint8_t)m_cifar.GetLabel(true, i); }
+		// クラス名は ASCII なのでそのまま wchar_t に広げる
+		m_classNames.clear();
+		for (const std::string& name : m_cifar.GetLabelNames()) { m_classNames.emplace_back(name.begin(), name.end()); }
+		if (m_classNames.size() != 10)
+		{
+			m_classNames = { L"airplane", L"automobile", L"bird", L"cat", L"deer",
+				L"dog", L"frog", L"horse", L"ship", L"truck" };
+		}
+		return true;
+	}
+
+	// データセットの種類
+	DatasetKind GetKind() const { return m_kind; }
+	// テストデータがあるか
+	bool HasTestSet() const { return m_hasTestSet; }
+	// 画像の形状
+	int GetRows() const { return m_rows; }
+	int GetColumns() const { return m_columns; }
+	int GetChannels() const { return m_channels; }
+	// 画像1枚のバイト数
+	size_t GetImageBytes() const { return (size_t)m_rows * m_columns * m_channels; }
+	// 画像数
+	size_t GetCount(bool isTraining) const
+	{
+		if (m_kind == DatasetKind::Cifar10) { return m_cifar.GetCount(isTraining); }
+		return (isTraining ? m_mnist.trainImages : m_mnist.testImages).size();
+	}
+	// 正解ラベル
+	int GetLabel(bool isTraining, size_t index) const
+	{
+		if (m_kind == DatasetKind::Cifar10) { return m_cifar.GetLabel(isTraining, index); }
+		return (isTraining ? m_mnist.trainLabels : m_mnist.testLabels)[index];
+	}
+	// 学習データの全ラベル (サンプラのクラスごとの索引に使う)
+	const std::vector<uint8_t>& GetTrainLabels() const
+	{
+		return m_kind == DatasetKind::Cifar10 ? m_cifarTrainLabels : m_mnist.trainLabels;
+	}
+	// クラス名 (クラス ID 順)
+	const std::vector<std::wstring>& GetClassNames() const { return m_classNames; }
+
+	// HWC の uint8 の画像を返す
+	// ・Fashion-MNIST はメモリ上の画像を直接指す (scratch は使わない)
+	// ・CIFAR-10 は scratch に並べ替えてそれを指す (scratch を次に使うまで有効)
+	const uint8_t* GetImage(bool isTraining, size_t index, std::vector<uint8_t>& scratch) const
+	{
+		if (m_kind == DatasetKind::Cifar10)
+		{
+			scratch.resize(GetImageBytes());
+			m_cifar.CopyImageHWC(isTraining, index, scratch.data());
+			return scratch.data();
+		}
+		return (isTraining ? m_mnist.trainImages : m_mnist.testImages)[index].data();
+	}
+
+	// 画像をモデルのテンソル形式 (rows×columns×channels、0〜1 に正規化) に変換する
+	// ・複数のスレッドから同時に呼んでよい (CIFAR-10 はプレーンから直接並べ替えるので作業領域を使わない)
+	void DecodeToTensor(bool isTraining, size_t index, Tensor3D& tensor) const
+	{
+		if (m_kind == DatasetKind::Cifar10) { m_cifar.DecodeToTensor(isTraining, index, tensor); return; }
+		ImageToTensor((isTraining ? m_mnist.trainImages : m_mnist.testImages)[index], m_rows, m_columns, tensor);
+	}
+
+	// HWC の uint8 の画像 (拡張した画像など) をテンソル形式に変換する
+	// ・tensor の形状が合っていれば再確保しない
+	void NormalizeImage(const uint8_t* image, Tensor3D& tensor) const
+	{
+		if (tensor.GetH() != m_rows || tensor.GetW() != m_columns || tensor.GetC() != m_channels)
+		{
+			tensor = Tensor3D(m_rows, m_columns, m_channels);
+		}
+		float* out = tensor.Data();
+		const size_t size = GetImageBytes();
+		for (size_t i = 0; i < size; i++) { out[i] = image[i] / 255.0f; }
+	}
+
+	// 表示用のグレースケール画像 (rows×columns) を返す
+	// ・RGB は輝度 (0.299R + 0.587G + 0.114B) に変換する (表示ウィンドウはグレースケールだけを描く)
+	void GetDisplayImage(bool isTraining, size_t index, std::vector<uint8_t>& image) const
+	{
+		if (m_kind != DatasetKind::Cifar10)
+		{
+			image = (isTraining ? m_mnist.trainImages : m_mnist.testImages)[index];
+			return;
+		}
+		const uint8_t* planes = m_cifar.GetImage(isTraining, index);
+		const int planeBytes = CIFAR10Loader::PlaneBytes;
+		image.resize(planeBytes);
+		for (int pixel = 0; pixel < planeBytes; pixel++)
+		{
+			int luminance = 299 * planes[pixel] + 587 * planes[planeBytes + pixel] + 114 * planes[planeBytes * 2 + pixel];
+			image[pixel] = (uint8_t)((luminance + 500) / 1000);
+		}
+	}
+
+private:
+	// データセットの種類
+	DatasetKind m_kind = DatasetKind::FashionMNIST;
+	// Fashion-MNIST の画像とラベル
+	FashionMNIST m_mnist;
+	// CIFAR-10 のバッチファイル (メモリマップ) と学習データのラベル
+	CIFAR10Loader m_cifar;
+	std::vector<uint8_t> m_cifarTrainLabels;
+	// テストデータがあるか
+	bool m_hasTestSet = false;
+	// 画像の形状
+	int m_rows = 0;
+	int m_columns = 0;
+	int m_channels = 0;
+	// クラス名
+	std::vector<std::wstring> m_classNames;
+};
@@ -0,0 +1,422 @@
+﻿// InferenceServer.cpp
+// 学習済みモデルの推論サーバー
+#include "InferenceServer.h"
+#include "SoftmaxCrossEntropy.h"
+#include "TopK.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#ifdef _WIN32
+// Windows は Winsock（Unix ドメインソケットは Windows 10 以降の afunix.h）
+// ・windows.h の min / max マクロが std::min / std::max を壊さないようにする
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <afunix.h>
+#pragma comment(lib, "Ws2_32.lib")
+using SocketHandle = SOCKET;
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+using SocketHandle = int;
+#endif
+
+// レイテンシを保持する直近のリクエスト数（p50 / p99 はこの範囲から求める）
+static const size_t LatencyWindow = 8192;
+
+namespace
+{
+	// 無効なソケット
+	const intptr_t InvalidSocket = -1;
+
+	// ソケットを閉じる
+	void CloseSocket(intptr_t socket)
+	{
+#ifdef _WIN32
+		closesocket((SocketHandle)socket);
+#else
+		close((SocketHandle)socket);
+#endif
+	}
+
+	// ソケットの送受信を打ち切る（別スレッドで待っている accept / recv を戻らせる）
+	void ShutdownSocket(intptr_t socket)
+	{
+#ifdef _WIN32
+		shutdown((SocketHandle)socket, SD_BOTH);
+#else
+		shutdown((SocketHandle)socket, SHUT_RDWR);
+#endif
+	}
+
+	// size バイトを受信し終えるまで読む（接続が切れたら false）
+	bool ReceiveAll(intptr_t socket, void* buffer, size_t size)
+	{
+		char* p = static_cast<char*>(buffer);
+		while (size > 0)
+		{
+			int received = (int)recv((SocketHandle)socket, p, (int)std::min(size, (size_t)1 << 20), 0);
+			if (received <= 0) return false;
+			p += received;
+			size -= (size_t)received;
+		}
+		return true;
+	}
+
+	// size バイトを送信し終えるまで書く（接続が切れたら false）
+	bool SendAll(intptr_t socket, const void* buffer, size_t size)
+	{
+		const char* p = static_cast<const char*>(buffer);
+		while (size > 0)
+		{
+#ifdef MSG_NOSIGNAL
+			int sent = (int)send((SocketHandle)socket, p, (int)size, MSG_NOSIGNAL);
+#else
+			int sent = (int)send((SocketHandle)socket, p, (int)size, 0);
+#endif
+			if (sent <= 0) return false;
+			p += sent;
+			size -= (size_t)sent;
+		}
+		return true;
+	}
+}
+
+// 統計値を1行の文字列にする
+std::string FormatInferenceStats(const InferenceServerStats& stats)
+{
+	char text[256];
+	std::snprintf(text, sizeof(text), "requests=%llu batches=%llu avg_batch=%.2f p50_us=%.1f p99_us=%.1f qps=%.1f",
+		(unsigned long long)stats.requests, (unsigned long long)stats.batches, stats.averageBatchSize,
+		stats.p50Microseconds, stats.p99Microseconds, stats.requestsPerSecond);
+	return text;
+}
+
+// コンストラクタ
+InferenceServer::InferenceServer(const CNNModel& model, const InferenceServerConfig& config)
+	: m_model(model),
+	m_config(config),
+	m_imageBytes(model.GetConfig().inputHeight * model.GetConfig().inputWidth * model.GetConfig().inputChannels)
+{
+	m_config.maxBatchSize = std::max(1, m_config.maxBatchSize);
+	m_config.maxDelayMicroseconds = std::max(0, m_config.maxDelayMicroseconds);
+	m_config.numWorkers = std::max(1, m_config.numWorkers);
+	m_latencies.reserve(LatencyWindow);
+}
+
+// デストラクタ
+InferenceServer::~InferenceServer()
+{
+	Stop();
+}
+
+// 待ち受けを開始する
+bool InferenceServer::Start()
+{
+#ifdef _WIN32
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) return false;
+#endif
+	SocketHandle listenSocket;
+	// 失敗したらソケットを閉じて false を返す
+	auto fail = [&listenSocket]()
+		{
+			if ((intptr_t)listenSocket != InvalidSocket) { CloseSocket((intptr_t)listenSocket); }
+#ifdef _WIN32
+			WSACleanup();
+#endif
+			return false;
+		};
+	if (!m_config.unixSocketPath.empty())
+	{
+		// Unix ドメインソケット（前回のソケットファイルが残っていれば消してから作る）
+		sockaddr_un address = {};
+		listenSocket = (SocketHandle)InvalidSocket;
+		if (m_config.unixSocketPath.size() >= sizeof(address.sun_path)) return fail();
+		address.sun_family = AF_UNIX;
+		std::strcpy(address.sun_path, m_config.unixSocketPath.c_str());
+		std::remove(m_config.unixSocketPath.c_str());
+		listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+		if ((intptr_t)listenSocket == InvalidSocket) return fail();
+		if (bind(listenSocket, (const sockaddr*)&address, sizeof(address)) != 0) return fail();
+	}
+	else
+	{
+		// localhost の TCP（外部からは接続させない）
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_port = htons((uint16_t)m_config.tcpPort);
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+		if ((intptr_t)listenSocket == InvalidSocket) return fail();
+		int reuse = 1;
+		setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+		if (bind(listenSocket, (const sockaddr*)&address, sizeof(address)) != 0) return fail();
+	}
+	if (listen(listenSocket, SOMAXCONN) != 0) return fail();
+	m_listenSocket = (intptr_t)listenSocket;
+	m_stop = false;
+	m_startTime = std::chrono::steady_clock::now();
+	// ワーカーと受け付けスレッドを起動する
+	for (int i = 0; i < m_config.numWorkers; i++) { m_workers.emplace_back(&InferenceServer::WorkerLoop, this); }
+	m_acceptThread = std::thread(&InferenceServer::AcceptLoop, this);
+	return true;
+}
+
+// 待ち受けを止め、すべての接続とスレッドを終了する
+void InferenceServer::Stop()
+{
+	if (m_listenSocket == InvalidSocket && m_workers.empty()) return;
+	{
+		std::lock_guard<std::mutex> lock(m_queueMutex);
+		m_stop = true;
+	}
+	m_queueChanged.notify_all();
+	m_resultReady.notify_all();
+	// 待ち受けソケットを閉じて accept を戻らせる
+	if (m_listenSocket != InvalidSocket)
+	{
+		ShutdownSocket(m_listenSocket);
+		CloseSocket(m_listenSocket);
+		m_listenSocket = InvalidSocket;
+	}
+	if (m_acceptThread.joinable()) { m_acceptThread.join(); }
+	// 各接続の recv を戻らせてから受信スレッドを終了する
+	{
+		std::lock_guard<std::mutex> lock(m_connectionMutex);
+		for (auto& connection : m_connections) { ShutdownSocket(connection->socket); }
+	}
+	for (auto& connection : m_connections)
+	{
+		if (connection->thread.joinable()) { connection->thread.join(); }
+		CloseSocket(connection->socket);
+	}
+	m_connections.clear();
+	for (auto& worker : m_workers) { worker.join(); }
+	m_workers.clear();
+	if (!m_config.unixSocketPath.empty()) { std::remove(m_config.unixSocketPath.c_str()); }
+#ifdef _WIN32
+	WSACleanup();
+#endif
+}
+
+// 接続を受け付けるスレッドの本体
+void InferenceServer::AcceptLoop()
+{
+	while (!m_stop)
+	{
+		intptr_t client = (intptr_t)accept((SocketHandle)m_listenSocket, nullptr, nullptr);
+		if (client == InvalidSocket)
+		{
+			// 停止要求で待ち受けソケットが閉じられた
+			if (m_stop) break;
+			continue;
+		}
+		// 応答を小さなパケットのまま遅らせずに送る
+		if (m_config.unixSocketPath.empty())
+		{
+			int noDelay = 1;
+			setsockopt((SocketHandle)client, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+		}
+		std::lock_guard<std::mutex> lock(m_connectionMutex);
+		// 終了済みの接続を片付ける
+		for (auto it = m_connections.begin(); it != m_connections.end(); )
+		{
+			if ((*it)->finished)
+			{
+				(*it)->thread.join();
+				CloseSocket((*it)->socket);
+				it = m_connections.erase(it);
+			}
+			else { ++it; }
+		}
+		m_connections.emplace_back(new Connection());
+		Connection* connection = m_connections.back().get();
+		connection->socket = client;
+		connection->thread = std::thread(&InferenceServer::ConnectionLoop, this, connection);
+	}
+}
+
+// 1 接続分のリクエストを処理するスレッドの本体
+void InferenceServer::ConnectionLoop(Connection* connection)
+{
+	const int numClasses = m_model.GetNumClasses();
+	// 画像と応答のバッファ（接続ごとに使い回す）
+	std::vector<uint8_t> image(m_imageBytes);
+	std::vector<char> response;
+	Request request;
+	uint32_t topK = 0;
+	while (!m_stop && ReceiveAll(connection->socket, &topK, sizeof(topK)))
+	{
+		if (topK == 0)
+		{
+			// 統計リクエスト
+			std::string text = FormatInferenceStats(GetStats());
+			uint32_t length = (uint32_t)text.size();
+			if (!SendAll(connection->socket, &length, sizeof(length)) || !SendAll(connection->socket, text.data(), text.size())) break;
+			continue;
+		}
+		// k がクラス数を超えるリクエストは不正として接続を切る
+		if (topK > (uint32_t)numClasses) break;
+		if (!ReceiveAll(connection->socket, image.data(), image.size())) break;
+		// ワーカーのバッチに入れて結果を待つ
+		request.image = image.data();
+		request.topK = (int)topK;
+		Submit(request);
+		if (!request.done) break;
+		// 応答: n + n × (クラスID, 確率)
+		uint32_t n = (uint32_t)request.result.size();
+		response.resize(sizeof(uint32_t) + n * (sizeof(int32_t) + sizeof(float)));
+		char* p = response.data();
+		std::memcpy(p, &n, sizeof(n));
+		p += sizeof(n);
+		for (const auto& entry : request.result)
+		{
+			int32_t classId = entry.first;
+			std::memcpy(p, &classId, sizeof(classId));
+			std::memcpy(p + sizeof(classId), &entry.second, sizeof(float));
+			p += sizeof(classId) + sizeof(float);
+		}
+		if (!SendAll(connection->socket, response.data(), response.size())) break;
+	}
+	// 相手に切断を知らせる（ソケットを閉じるのは片付けるとき）
+	ShutdownSocket(connection->socket);
+	connection->finished = true;
+}
+
+// 1 枚の画像を推論する（ソケットを経由しない）
+std::vector<std::pair<int, float>> InferenceServer::Classify(const uint8_t* image, int topK)
+{
+	Request request;
+	request.image = image;
+	request.topK = std::min(std::max(1, topK), m_model.GetNumClasses());
+	Submit(request);
+	return request.result;
+}
+
+// リクエストをキューに入れ、結果が出るまで待つ
+void InferenceServer::Submit(Request& request)
+{
+	request.done = false;
+	request.arrival = std::chrono::steady_clock::now();
+	std::unique_lock<std::mutex> lock(m_queueMutex);
+	if (m_stop) return;
+	m_queue.push_back(&request);
+	m_queueChanged.notify_one();
+	// 停止要求のときは結果を待たずに戻る（キューに残った分はワーカーが処理してから終了する）
+	m_resultReady.wait(lock, [&] { return request.done; });
+}
+
+// バッチにまとめて推論するワーカースレッドの本体
+void InferenceServer::WorkerLoop()
+{
+	const auto maxDelay = std::chrono::microseconds(m_config.maxDelayMicroseconds);
+	// バッチ・入力テンソル・logits の領域（ワーカーごとに使い回す）
+	std::vector<Request*> batch;
+	std::vector<Tensor3D> tensors(m_config.maxBatchSize);
+	std::vector<float> logits;
+	std::unique_lock<std::mutex> lock(m_queueMutex);
+	for (;;)
+	{
+		// リクエストが届くまで待つ
+		m_queueChanged.wait(lock, [&] { return m_stop || !m_queue.empty(); });
+		if (m_queue.empty()) break;
+		// 先頭のリクエストの待ち時間の上限まで、バッチが埋まるのを待つ
+		const auto deadline = m_queue.front()->arrival + maxDelay;
+		while (!m_stop && (int)m_queue.size() < m_config.maxBatchSize)
+		{
+			if (m_queueChanged.wait_until(lock, deadline) == std::cv_status::timeout) break;
+		}
+		// 他のワーカーが先に取っていったら待ち直す
+		if (m_queue.empty()) continue;
+		batch.clear();
+		while (!m_queue.empty() && (int)batch.size() < m_config.maxBatchSize)
+		{
+			batch.push_back(m_queue.front());
+			m_queue.pop_front();
+		}
+		// 推論中は他のワーカーと受信スレッドを止めない
+		lock.unlock();
+		RunBatch(batch, tensors, logits);
+		lock.lock();
+		for (Request* request : batch) { request->done = true; }
+		m_resultReady.notify_all();
+	}
+}
+
+// バッチを推論して各リクエストに結果を書き込む
+void InferenceServer::RunBatch(const std::vector<Request*>& batch, std::vector<Tensor3D>& tensors, std::vector<float>& logits)
+{
+	const CNNConfig& config = m_model.GetConfig();
+	const int numClasses = config.numClasses;
+	const int count = (int)batch.size();
+	// 画素値を 0〜1 に正規化して入力テンソルにする（学習時の ImageToTensor と同じ変換、並びは HWC）
+	for (int i = 0; i < count; i++)
+	{
+		Tensor3D& tensor = tensors[i];
+		if (tensor.GetH() != config.inputHeight || tensor.GetW() != config.inputWidth || tensor.GetC() != config.inputChannels)
+		{
+			tensor = Tensor3D(config.inputHeight, config.inputWidth, config.inputChannels);
+		}
+		float* data = tensor.Data();
+		for (int p = 0; p < m_imageBytes; p++) { data[p] = batch[i]->image[p] / 255.0f; }
+	}
+	// バッチ全体をまとめて推論し、Softmax で確率にする
+	logits.resize((size_t)count * numClasses);
+	m_model.InferLogitsBatch(tensors.data(), count, logits.data());
+	Softmax(logits.data(), count, numClasses, logits.data());
+	// 各リクエストの上位 k 個を確率の高い順に取り出す
+	const auto finished = std::chrono::steady_clock::now();
+	for (int i = 0; i < count; i++)
+	{
+		const float* probs = &logits[(size_t)i * numClasses];
+		auto& result = batch[i]->result;
+		result.resize(batch[i]->topK);
+		SelectTopK(probs, numClasses, batch[i]->topK, result.data());
+	}
+	// レイテンシを記録する
+	std::lock_guard<std::mutex> lock(m_statsMutex);
+	for (Request* request : batch)
+	{
+		float latency = std::chrono::duration<float, std::micro>(finished - request->arrival).count();
+		if (m_latencies.size() < LatencyWindow) { m_latencies.push_back(latency); }
+		else { m_latencies[m_latencyCursor] = latency; }
+		m_latencyCursor = (m_latencyCursor + 1) % LatencyWindow;
+	}
+	m_requestCount += count;
+	m_batchCount++;
+}
+
+// 統計値を返す
+InferenceServerStats InferenceServer::GetStats() const
+{
+	InferenceServerStats stats;
+	std::vector<float> latencies;
+	{
+		std::lock_guard<std::mutex> lock(m_statsMutex);
+		stats.requests = m_requestCount;
+		stats.batches = m_batchCount;
+		latencies = m_latencies;
+	}
+	if (stats.batches > 0) { stats.averageBatchSize = (double)stats.requests / (double)stats.batches; }
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_startTime).count();
+	if (seconds > 0.0) { stats.requestsPerSecond = (double)stats.requests / seconds; }
+	// パーセンタイルは部分的な並べ替えで求める
+	auto percentile = [&latencies](double ratio)
+		{
+			size_t k = std::min(latencies.size() - 1, (size_t)(ratio * (double)latencies.size()));
+			std::nth_element(latencies.begin(), latencies.begin() + k, latencies.end());
+			return (double)latencies[k];
+		};
+	if (!latencies.empty())
+	{
+		stats.p50Microseconds = percentile(0.50);
+		stats.p99Microseconds = percentile(0.99);
+	}
+	return stats;
+}
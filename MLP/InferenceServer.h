@@ -0,0 +1,170 @@
+﻿// InferenceServer.h
+// 学習済みモデルの推論サーバー（ローカルソケット経由）
+// ・Unix ドメインソケットまたは localhost の TCP で、生の uint8 画像（モデルの入力形状、HWC の並び）を受け取る
+// ・同時に届いたリクエストをミニバッチにまとめ（待ち時間の上限付き）、CNNModel::InferLogitsBatch で推論する
+// ・結果は GetTop10 と同じ (クラスID, 確率) を確率の高い順に上位 k 個返す
+// ・レイテンシ (p50 / p99) とスループットを計測する
+//
+// プロトコル（値はすべてホストのバイト順、1 接続で何回でも繰り返せる）
+// ・推論リクエスト : uint32 k (1〜クラス数) + 画像 H×W×C バイト
+//   応答           : uint32 n + n × (int32 クラスID, float 確率)
+// ・統計リクエスト : uint32 0
+//   応答           : uint32 バイト数 + 統計値の文字列 (FormatInferenceStats の結果)
+// ・不正なリクエスト (k がクラス数を超えるなど) を受け取ったら接続を切る
+#pragma once
+#include <vector>
+#include <deque>
+#include <list>
+#include <memory>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include "CNNModel.h"
+
+// 推論サーバーの設定
+struct InferenceServerConfig
+{
+	// Unix ドメインソケットのパス（空なら localhost の TCP で待ち受ける）
+	std::string unixSocketPath;
+	// TCP のポート番号（127.0.0.1 でだけ待ち受ける）
+	int tcpPort = 5555;
+	// 1 回の推論にまとめる最大リクエスト数
+	int maxBatchSize = 32;
+	// バッチの最初のリクエストが届いてから推論を始めるまでの最大の待ち時間（マイクロ秒）
+	// ・この間に届いたリクエストを同じバッチに入れる（0 なら待たずにその時点の分だけで推論する）
+	int maxDelayMicroseconds = 2000;
+	// バッチを推論するスレッド数
+	int numWorkers = 1;
+};
+
+// 推論サーバーの統計値
+struct InferenceServerStats
+{
+	// 処理したリクエスト数
+	uint64_t requests = 0;
+	// 実行したバッチ数
+	uint64_t batches = 0;
+	// 1 バッチあたりの平均リクエスト数
+	double averageBatchSize = 0.0;
+	// レイテンシの中央値 (p50) と 99 パーセンタイル (p99)（マイクロ秒、直近のリクエストから求める）
+	// ・リクエストを受信し終えてから応答を返すまでの時間
+	double p50Microseconds = 0.0;
+	double p99Microseconds = 0.0;
+	// 開始してからの平均スループット（リクエスト/秒）
+	double requestsPerSecond = 0.0;
+};
+
+// 統計値を1行の文字列にする
+std::string FormatInferenceStats(const InferenceServerStats& stats);
+
+// InferenceServer クラス
+// ・受信スレッド（接続ごとに1つ）がリクエストをキューに入れ、ワーカースレッドがバッチにまとめて推論する
+// ・モデルは InferLogitsBatch（読み取り専用）しか呼ばないので、複数のワーカーで共有できる
+class InferenceServer
+{
+public:
+	// コンストラクタ
+	// ・model : 推論に使うモデル（サーバーより長く生存させておくこと）
+	InferenceServer(const CNNModel& model, const InferenceServerConfig& config);
+	// デストラクタ（停止していなければ停止する）
+	~InferenceServer();
+
+	InferenceServer(const InferenceServer&) = delete;
+	InferenceServer& operator=(const InferenceServer&) = delete;
+
+	// 待ち受けを開始する（ソケットを作れなければ false）
+	bool Start();
+	// 待ち受けを止め、すべての接続とスレッドを終了する
+	void Stop();
+
+	// 1 枚の画像を推論する（ソケットを経由しない、ワーカーのバッチに相乗りする）
+	// ・Start() の後に呼ぶ（ワーカーが動いていないと戻らない）
+	// ・image : H×W×C バイトの画像
+	// ・topK  : 返す上位の個数
+	std::vector<std::pair<int, float>> Classify(const uint8_t* image, int topK);
+
+	// 統計値を返す
+	InferenceServerStats GetStats() const;
+	// 1 リクエストの画像のバイト数
+	int GetImageBytes() const { return m_imageBytes; }
+
+private:
+	// 推論待ちの1リクエスト
+	struct Request
+	{
+		// 画像（受信スレッドのバッファを指す、結果が出るまで有効）
+		const uint8_t* image = nullptr;
+		// 返す上位の個数
+		int topK = 0;
+		// 受信し終えた時刻
+		std::chrono::steady_clock::time_point arrival;
+		// 結果（上位 topK 個の (クラスID, 確率)）
+		std::vector<std::pair<int, float>> result;
+		// 結果が出たか
+		bool done = false;
+	};
+	// 1 接続
+	struct Connection
+	{
+		// ソケット
+		intptr_t socket = -1;
+		// 受信スレッド
+		std::thread thread;
+		// 受信スレッドが終了したか（終了した接続は次の accept のときに片付ける）
+		std::atomic<bool> finished{ false };
+	};
+
+	// 接続を受け付けるスレッドの本体
+	void AcceptLoop();
+	// 1 接続分のリクエストを処理するスレッドの本体
+	void ConnectionLoop(Connection* connection);
+	// バッチにまとめて推論するワーカースレッドの本体
+	void WorkerLoop();
+	// リクエストをキューに入れ、結果が出るまで待つ
+	void Submit(Request& request);
+	// バッチを推論して各リクエストに結果を書き込む
+	void RunBatch(const std::vector<Request*>& batch, std::vector<Tensor3D>& tensors, std::vector<float>& logits);
+
+private:
+	// 推論に使うモデル
+	const CNNModel& m_model;
+	// 設定
+	InferenceServerConfig m_config;
+	// 1 リクエストの画像のバイト数（H×W×C）
+	int m_imageBytes;
+	// 待ち受けソケット
+	intptr_t m_listenSocket = -1;
+	// 停止要求
+	std::atomic<bool> m_stop{ false };
+	// 受け付けスレッド
+	std::thread m_acceptThread;
+	// ワーカースレッド
+	std::vector<std::thread> m_workers;
+	// 接続の一覧（m_connectionMutex で保護する）
+	std::list<std::unique_ptr<Connection>> m_connections;
+	std::mutex m_connectionMutex;
+
+	// 推論待ちのリクエスト（到着順）
+	std::deque<Request*> m_queue;
+	std::mutex m_queueMutex;
+	// ワーカーへの通知（リクエストが届いた / 停止）
+	std::condition_variable m_queueChanged;
+	// 受信スレッドへの通知（結果が出た）
+	std::condition_variable m_resultReady;
+
+	// 統計値（m_statsMutex で保護する）
+	mutable std::mutex m_statsMutex;
+	// 処理したリクエスト数とバッチ数
+	uint64_t m_requestCount = 0;
+	uint64_t m_batchCount = 0;
+	// 直近のリクエストのレイテンシ（マイクロ秒、リングバッファ）
+	std::vector<float> m_latencies;
+	// 次に書き込むリングバッファの位置
+	size_t m_latencyCursor = 0;
+	// 開始時刻
+	std::chrono::steady_clock::time_point m_startTime;
+};
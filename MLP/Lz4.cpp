@@ -0,0 +1,171 @@
+﻿// Lz4.cpp
+// LZ4 ブロック形式の圧縮・展開
+//
+// ブロック形式: シーケンスの並び
+// ・トークン (上位 4 bit = リテラル長、下位 4 bit = 一致長 - 4、15 なら続くバイトで 255 ずつ加算)
+// ・リテラル、一致位置のオフセット (2 byte Little-endian、1〜65535)
+// ・最後のシーケンスはリテラルだけで終わる
+#include "Lz4.h"
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
+namespace
+{
+	// 最短の一致長
+	constexpr size_t MinMatch = 4;
+	// ブロックの末尾 5 byte は必ずリテラルにする (LZ4 の規約)
+	constexpr size_t LastLiterals = 5;
+	// 最後の一致はブロックの末尾から 12 byte 以上前で始める (LZ4 の規約)
+	constexpr size_t MatchFindLimit = 12;
+	// オフセットの最大値 (2 byte)
+	constexpr size_t MaxOffset = 65535;
+	// ハッシュ表の大きさ (2^HashBits 要素)
+	constexpr int HashBits = 16;
+
+	// 4 byte を読み込む
+	inline uint32_t Read32(const uint8_t* p)
+	{
+		uint32_t value;
+		std::memcpy(&value, p, 4);
+		return value;
+	}
+
+	// 4 byte のハッシュ値
+	inline uint32_t Hash4(const uint8_t* p)
+	{
+		return (Read32(p) * 2654435761u) >> (32 - HashBits);
+	}
+
+	// 長さの 15 以上の部分を 255 ずつ書き込む
+	inline uint8_t* WriteLength(uint8_t* out, size_t length)
+	{
+		while (length >= 255) { *out++ = 255; length -= 255; }
+		*out++ = (uint8_t)length;
+		return out;
+	}
+
+	// 1 シーケンス (リテラル + 一致) を書き込む (一致長 0 ならリテラルだけの最後のシーケンス)
+	// ・出力先が足りなければ nullptr
+	uint8_t* WriteSequence(uint8_t* out, uint8_t* outEnd, const uint8_t* literals, size_t literalLength, size_t offset, size_t matchLength)
+	{
+		// トークン + 長さの追加バイト + リテラル + オフセットの最大バイト数
+		size_t worst = 1 + literalLength / 255 + 1 + literalLength + 2 + matchLength / 255 + 1;
+		if ((size_t)(outEnd - out) < worst) return nullptr;
+		uint8_t* token = out++;
+		*token = (uint8_t)(std::min(literalLength, (size_t)15) << 4);
+		if (literalLength >= 15) { out = WriteLength(out, literalLength - 15); }
+		if (literalLength > 0) { std::memcpy(out, literals, literalLength); }
+		out += literalLength;
+		if (matchLength == 0) return out;
+		*out++ = (uint8_t)(offset & 0xFF);
+		*out++ = (uint8_t)(offset >> 8);
+		size_t code = matchLength - MinMatch;
+		*token |= (uint8_t)std::min(code, (size_t)15);
+		if (code >= 15) { out = WriteLength(out, code - 15); }
+		return out;
+	}
+}
+
+// 圧縮する
+size_t Lz4Compress(const uint8_t* src, size_t size, uint8_t* dst, size_t capacity, int level)
+{
+	uint8_t* out = dst;
+	uint8_t* outEnd = dst + capacity;
+	size_t anchor = 0;
+	if (size > MatchFindLimit)
+	{
+		// 調べる候補の数 (level 1 はハッシュ表の最新の 1 つだけ)
+		const int depth = 1 << (std::min(std::max(level, 1), 12) - 1);
+		// ハッシュ値ごとの最新の位置と、同じハッシュ値の1つ前の位置 (-1 は無し)
+		std::vector<int32_t> head((size_t)1 << HashBits, -1);
+		std::vector<int32_t> chain(depth > 1 ? size : 0);
+		auto insert = [&](size_t position) {
+			uint32_t h = Hash4(src + position);
+			if (depth > 1) { chain[position] = head[h]; }
+			head[h] = (int32_t)position;
+		};
+		// 一致はここより前で始め、matchLimit より前で終える
+		const size_t searchEnd = size - MatchFindLimit;
+		const size_t matchLimit = size - LastLiterals;
+		size_t i = 0;
+		while (i <= searchEnd)
+		{
+			// 候補を新しい順にたどって最長の一致を探す
+			size_t bestLength = 0, bestOffset = 0;
+			int32_t candidate = head[Hash4(src + i)];
+			for (int step = 0; step < depth && candidate >= 0 && i - (size_t)candidate <= MaxOffset; step++)
+			{
+				const uint8_t* a = src + candidate;
+				const uint8_t* b = src + i;
+				if (Read32(a) == Read32(b))
+				{
+					size_t length = MinMatch;
+					while (i + length < matchLimit && a[length] == b[length]) { length++; }
+					if (length > bestLength) { bestLength = length; bestOffset = i - (size_t)candidate; }
+				}
+				if (depth == 1) break;
+				candidate = chain[candidate];
+			}
+			insert(i);
+			if (bestLength < MinMatch) { i++; continue; }
+			// シーケンスを書き込み、一致した区間の位置もハッシュ表に入れる
+			out = WriteSequence(out, outEnd, src + anchor, i - anchor, bestOffset, bestLength);
+			if (!out) return 0;
+			size_t end = i + bestLength;
+			for (size_t p = i + 1; p < end && p <= searchEnd; p++) { insert(p); }
+			i = end;
+			anchor = end;
+		}
+	}
+	// 残りをリテラルだけのシーケンスとして書き込む
+	out = WriteSequence(out, outEnd, src + anchor, size - anchor, 0, 0);
+	return out ? (size_t)(out - dst) : 0;
+}
+
+// 展開する
+bool Lz4Decompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize)
+{
+	const uint8_t* in = src;
+	const uint8_t* inEnd = src + srcSize;
+	uint8_t* out = dst;
+	uint8_t* outEnd = dst + dstSize;
+	// 15 以上の長さの追加バイトを読む
+	auto readLength = [&](size_t& length) {
+		uint8_t byte;
+		do
+		{
+			if (in >= inEnd) return false;
+			byte = *in++;
+			length += byte;
+		} while (byte == 255);
+		return true;
+	};
+	while (in < inEnd)
+	{
+		uint8_t token = *in++;
+		// リテラル
+		size_t literalLength = token >> 4;
+		if (literalLength == 15 && !readLength(literalLength)) return false;
+		if ((size_t)(inEnd - in) < literalLength || (size_t)(outEnd - out) < literalLength) return false;
+		if (literalLength > 0) { std::memcpy(out, in, literalLength); }
+		in += literalLength;
+		out += literalLength;
+		// 入力の終わりはリテラルだけの最後のシーケンス
+		if (in == inEnd) break;
+		// 一致
+		if (inEnd - in < 2) return false;
+		size_t offset = (size_t)in[0] | ((size_t)in[1] << 8);
+		in += 2;
+		if (offset == 0 || offset > (size_t)(out - dst)) return false;
+		size_t matchLength = token & 15;
+		if (matchLength == 15 && !readLength(matchLength)) return false;
+		matchLength += MinMatch;
+		if ((size_t)(outEnd - out) < matchLength) return false;
+		// 重なる一致 (offset < 長さ) は繰り返しになるので 1 byte ずつコピーする
+		const uint8_t* match = out - offset;
+		if (offset >= matchLength) { std::memcpy(out, match, matchLength); out += matchLength; }
+		else { for (size_t k = 0; k < matchLength; k++) { *out++ = match[k]; } }
+	}
+	return out == outEnd;
+}
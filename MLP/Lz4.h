@@ -0,0 +1,19 @@
+﻿// Lz4.h
+// LZ4 ブロック形式の圧縮・展開 (外部ライブラリを使わない実装)
+// ・出力は LZ4 のブロック形式 (フレームヘッダなし) と互換で、他の LZ4 実装でも展開できる
+// ・展開は入力が壊れていても出力バッファの外を読み書きしない
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// 圧縮後の最大バイト数 (圧縮できないデータでもこれを超えない)
+inline size_t Lz4CompressBound(size_t size) { return size + size / 255 + 16; }
+
+// src の size バイトを圧縮して dst に書き込む
+// ・level : 一致を探す深さ (1 = ハッシュ表だけの高速な圧縮、大きいほど遅いが圧縮率が上がる、最大 12)
+// ・戻り値 : 圧縮後のバイト数 (capacity に収まらなければ 0)
+size_t Lz4Compress(const uint8_t* src, size_t size, uint8_t* dst, size_t capacity, int level = 1);
+
+// 圧縮データ src (srcSize バイト) を展開して dst にちょうど dstSize バイト書き込む
+// ・データが壊れている・展開後のサイズが dstSize と違えば false
+bool Lz4Decompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize);
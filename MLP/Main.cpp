@@ -1,127 +1,217 @@
 ﻿// main.cpp
-// CNN による Fashion-MNIST 画像認識
+// CNN による Fashion-MNIST / CIFAR-10 画像認識
 // ・28×28画像 → CNN(2層Conv + 2層MaxPool + 2層FC)
+// ・TRAINING_DATASET で学習するデータセットを切り替える (CIFAR-10 は 32×32×3 の RGB 画像)
+// ・入力形状とクラス名は読み込んだデータセットから決める (CNNConfig / CNNModel::SetClassNames)
 // ・学習中に一定ステップごとに画像を更新表示
 // ・右側に拡大画像 + Top-10 横棒グラフをGUI表示
+// ・学習後のモデルはチェックポイントファイルに保存する
+// ・"--serve <チェックポイント>" で起動すると、学習せずに推論サーバーとして動く (ServeCheckpoint)
 
 #include <iostream>
-#include <random>
 #include <conio.h>
 #include <algorithm>
 #include <numeric>
-#include "FashionMNIST.h"
+#include <string>
+#include <thread>
+#include <chrono>
+#include "ImageDataset.h"
 #include "Tensor3D.h"
 #include "CNNModel.h"
+#include "Evaluator.h"
+#include "SamplePrefetcher.h"
+#include "Random.h"
+#include "InferenceServer.h"
+#include "TopK.h"
+#include "StreamingDataset.h"
+#include "DatasetCache.h"
+#include "ShardedDataset.h"
+#include "ImageAugmenter.h"
+#include "Sampler.h"
+#include "TrainingController.h"
 #include "DisplayWindow.h"   // 100画像グリッド + 詳細表示（Top-10）
 
 // 学習何ステップごとに画面更新するか
 constexpr int VISUAL_INTERVAL = 100;
+// ミニバッチの画像数 (バッチ正規化の統計量もこの単位で求める)
+constexpr int BATCH_SIZE = 32;
+// 乱数のシード (重みの初期化・シャッフル・表示するサンプルがすべてこの値で決まり、同じ値なら学習結果が再現する)
+constexpr uint64_t RANDOM_SEED = 1;
+// 学習するデータセット (FashionMNIST: カレントディレクトリの IDX ファイル / Cifar10: CIFAR10_DIRECTORY のバッチファイル)
+constexpr DatasetKind TRAINING_DATASET = DatasetKind::FashionMNIST;
+// CIFAR-10 バイナリ版のバッチファイル (data_batch_1〜5.bin / test_batch.bin / batches.meta.txt) のあるディレクトリ
+constexpr const char* CIFAR10_DIRECTORY = "cifar-10-batches-bin";
+// Fashion-MNIST を選んでいるか (データセットごとに分けるファイル名の切り替えに使う)
+constexpr bool USE_FASHION_MNIST = TRAINING_DATASET == DatasetKind::FashionMNIST;
+// 学習後のモデルを保存するチェックポイントファイル
+constexpr const char* CHECKPOINT_PATH = USE_FASHION_MNIST ? "fashion_mnist.ckpt" : "cifar10.ckpt";
+// 学習データをストリーミングで読むか
+// ・true なら学習データ全体をメモリに載せず、ファイルからブロック単位で順次読み込んでシャッフルバッファで混ぜる
+//   (メモリに載りきらない大きなデータセット用、件数の上限 5000 枚も適用しない)
+constexpr bool STREAM_TRAINING_DATA = false;
+// ストリーミングで読む学習データの圧縮コンテナファイル
+// ・シャードごとに LZ4 で圧縮して読み込むバイト数を減らし、展開は読み込みスレッドで並列に行う
+// ・無ければ初回に読み込んだ学習データから作る (作れなければ元の IDX / CIFAR のファイルをそのまま読む)
+constexpr const char* SHARD_TRAINING_PATH = USE_FASHION_MNIST ? "train-images.shards" : "cifar10-train.shards";
+// 正規化済みの学習データのキャッシュファイル
+// ・初回に /255 した float32 のテンソルを書き出し、以降はメモリマップしてコピーするだけで使う (エポックごとの変換をしない)
+// ・値は ImageDataset::DecodeToTensor と同じなので、テストデータの評価はキャッシュなしでそのまま行える
+constexpr bool USE_DATASET_CACHE = true;
+constexpr const char* DATASET_CACHE_PATH = USE_FASHION_MNIST ? "train-images.cache" : "cifar10-train.cache";
+// 学習データを拡張するか (ランダムクロップ・サブピクセルの平行移動・左右反転、設定は AugmentationConfig)
+// ・uint8 の画像のまま先読みのワーカースレッドで拡張してから正規化する (キャッシュの正規化済みの値は使わない)
+constexpr bool AUGMENT_TRAINING_DATA = true;
+// 学習サンプルの抽出方法 (Uniform: 従来どおりシャッフル / ClassBalanced: クラスごとに同数 / HardExample: 損失の大きいサンプルを優先)
+constexpr SamplerMode SAMPLER_MODE = SamplerMode::Uniform;
+// 1 エポックで学習するサンプル数 (全学習データから抽出する、デバッグ用: 全データを使うなら 0)
+constexpr int SAMPLES_PER_EPOCH = 5000;
+// 画像 → テンソル変換 (拡張を含む) を先読みするワーカースレッド数
+constexpr int PREFETCH_WORKERS = 2;
+// 学習データの末尾から検証用に取り分ける (学習に使わない) 画像数
+// ・検証用データの正解率で早期終了と最良のモデルの選択を行う (テストデータは最後の評価にだけ使う)
+// ・ストリーミングで学習する場合は取り分けられないので、検証用データも学習に含まれる
+constexpr int VALIDATION_SAMPLES = 5000;
+// 検証用データで最良だったモデルを保存するチェックポイントファイル
+constexpr const char* BEST_CHECKPOINT_PATH = USE_FASHION_MNIST ? "fashion_mnist_best.ckpt" : "cifar10_best.ckpt";
+// 推論サーバーの統計値を表示する間隔 (秒)
+constexpr int SERVER_STATS_INTERVAL = 10;
 
 // プロトタイプ宣言(TrainOneEpoch から実行する)
 // ランダムイメージを表示する
-void ShowRandomImages(CNNModel& model, FashionMNIST& mnist);
+// ・cache : 学習データの正規化済みキャッシュ (nullptr なら画像をその場で変換する)
+void ShowRandomImages(CNNModel& model, const ImageDataset& data, const DatasetCache* cache);
 
-// 28×28 グレースケール画像 → Tensor3D(28×28×1) に変換する
-Tensor3D ImageToTensor(const std::vector<uint8_t>& imges)
+// CNN 学習を1エポック実行する
+// ・stream : 学習データのストリーミングリーダー (nullptr なら data の学習データをメモリから使う)
+// ・cache  : 学習データの正規化済みキャッシュ (nullptr なら先読みスレッドで画像を変換する)
+// ・augmenter : データ拡張 (nullptr なら拡張しない)
+// ・sampler : このエポックで学習するサンプルを決めるサンプラ (学習したサンプルの損失も知らせる、ストリーミングでは使わない)
+// ・controller : 学習率のスケジュール (エポック内の進捗に応じてバッチごとに学習率を決める)
+void TrainOneEpoch(CNNModel& model, const ImageDataset& data, StreamingDataset* stream, const DatasetCache* cache,
+	const ImageAugmenter* augmenter, ISampler& sampler, const TrainingController& controller, int epochIndex)
 {
-	// テンソル(高さ 28, 幅 28, チャネル 1)
-	Tensor3D tensor(28, 28, 1);
-	// 行インデックスを処理する
-	for (int row = 0; row < 28; row++)
+	// このエポックで学習するサンプルの並びをサンプラから受け取る (エポック番号ごとの乱数ストリームで決まる)
+	// ・ストリーミングの場合はリーダーから受け取る順番の番号 (0, 1, 2, ...) を並べる
+	std::vector<int> indices;
+	if (stream)
 	{
-		// 列インデックスを処理する
-		for (int column = 0; column < 28; column++)
-		{
-			// 正規化された画素値(0〜255 → 0〜1)を計算する
-			float pixelValue = imges[row * 28 + column] / 255.0f;
-			// テンソルに画素値を格納する
-			tensor(row, column, 0) = pixelValue;
-		}
+		indices.resize(stream->GetCount());
+		std::iota(indices.begin(), indices.end(), 0);
 	}
-	// テンソルを返す
-	return tensor;
-}
-
-// one-hot ベクトル生成する（10クラス）
-std::vector<float> OneHot(int label)
-{
-	// 全要素 0 で長さ 10 のベクトルを作成する
-	std::vector<float> oneHotVector(10, 0.0f);
-	// 該当クラスのみ 1.0 にする
-	oneHotVector[label] = 1.0f;
-	return oneHotVector;
-}
+	else { indices = sampler.SampleEpoch(epochIndex); }
+	size_t trainCount = indices.size();
+	// ストリーミングで受け取ったサンプルの正解ラベル (番号ごと、ワーカーが書き込む、受け取れなかった番号は -1)
+	std::vector<int> streamLabels(stream ? trainCount : 0, -1);
 
-// CNN 学習を1エポック実行する
-void TrainOneEpoch(CNNModel& model, FashionMNIST& mnist, 	float learningRate, int epochIndex, int totalEpochs)
-{
-	// 利用画像枚数は最大5000枚に設定する (デバッグ用: 全データを使うなら変更可能)
-	size_t trainCount = std::min(mnist.trainImages.size(), (size_t)5000);
-	// 学習に使うインデックス配列 [0,1,...,trainCount-1] を用意する
-	std::vector<int> indices((int)trainCount);
-	std::iota(indices.begin(), indices.end(), 0);
-	// 各エポックごとにデータをシャッフルして汎化性能を上げる
-	std::mt19937 rng(std::random_device{}());
-	std::shuffle(indices.begin(), indices.end(), rng);
+	// 画像 → テンソル変換をワーカースレッドで先読みする (学習スレッドは変換を待たない)
+	// ・拡張する場合は uint8 の画像を拡張してから正規化する (乱数は (エポック, サンプル) ごとのストリーム)
+	// ・拡張しない場合、キャッシュがあれば正規化済みの値をコピーするだけになる
+	// ・ストリーミングの場合はシャッフルバッファからの取り出しだけを番号順に行い、拡張・正規化はワーカーで並列に行う
+	SamplePrefetcher prefetcher([&data, stream, &streamLabels, cache, augmenter, epochIndex](int index, Tensor3D& tensor) {
+		// HWC の uint8 の画像 (CIFAR-10 は source に並べ替える、ストリーミングは source に受け取る)
+		thread_local std::vector<uint8_t> source, augmented;
+		const uint8_t* image = nullptr;
+		if (stream)
+		{
+			int label = -1;
+			if (!stream->NextInOrder((size_t)index, source, label)) { source.assign(data.GetImageBytes(), 0); }
+			streamLabels[index] = label;
+			image = source.data();
+		}
+		else if (augmenter) { image = data.GetImage(true, (size_t)index, source); }
+		else if (cache) { cache->DecodeToTensor((size_t)index, tensor); return; }
+		else { data.DecodeToTensor(true, (size_t)index, tensor); return; }
+		if (augmenter)
+		{
+			augmented.resize(data.GetImageBytes());
+			RandomStream random = MakeAugmentationRandom(epochIndex, index);
+			augmenter->Apply(image, augmented.data(), random);
+			image = augmented.data();
+		}
+		if (cache) { cache->NormalizeImage(image, tensor); }
+		else { data.NormalizeImage(image, tensor); }
+		}, PREFETCH_WORKERS);
+	// ストリーミングの場合はブロックの順番とシャッフルバッファでエポックごとに順番を変える
+	if (stream) { stream->StartEpoch(epochIndex); }
+	prefetcher.Start(indices);
+	// このエポックの活性値の最大バイト数を計測する
+	model.ResetPeakActivationBytes();
 
 	// 総損失を初期化する
 	float totalLoss = 0.0f;
 	// 正解数を初期化する
 	int correct = 0;
-	// 各サンプルに対して順伝播＋逆伝播を行う (SGD)
-	for (int sampleIndex = 0; sampleIndex < static_cast<int>(trainCount); sampleIndex++)
+	// ミニバッチの変換済みテンソルと正解ラベル
+	std::vector<Tensor3D> batchTensors(BATCH_SIZE);
+	std::vector<int> batchLabels(BATCH_SIZE);
+	// ミニバッチのサンプル番号とサンプルごとの損失 (サンプラの損失キャッシュを更新する)
+	std::vector<int> batchIndices(BATCH_SIZE);
+	std::vector<float> batchLosses(BATCH_SIZE);
+	int idx = 0;
+	// 学習したサンプル数 (ストリームが途中で終われば trainCount より少ない)
+	int sampleIndex = 0;
+	// ミニバッチごとに順伝播＋逆伝播を行う (ミニバッチ SGD)
+	while (sampleIndex < (int)trainCount)
 	{
-		// シャッフルされたインデックスを取得する
-		int idx = indices[sampleIndex];
-		// 画像を取得する
-		const auto& images = mnist.trainImages[idx];
-		// ラベルを取得する
-		int label = mnist.trainLabels[idx];
-		// テンソルに変換する
-		Tensor3D tensor = ImageToTensor(images);
-		// 順伝播（確率分布が返ってくる）
-		auto probability = model.Forward(tensor);
-		// 損失計算用ターゲット(one-hot)
-		auto target = OneHot(label);
-		model.SetTarget(target);
-		// 損失を計算する
-		float loss = model.ComputeLoss(target);
-		// 総損失を加算する
-		totalLoss += loss;
-		// 逆伝播する (SGD 更新)
-		model.Backward(learningRate);
-		// 推論結果 (確率分布) の中で最も値が大きい要素のインデックスを計算する
-		int prediction = static_cast<int>(std::max_element(probability.begin(), probability.end()) - probability.begin());
+		// 先読み済みのサンプルをバッチ分受け取る (テンソルはバッファの交換で受け取るのでコピーしない)
+		int count = 0;
+		while (count < BATCH_SIZE)
+		{
+			if (!prefetcher.Next(batchTensors[count], idx)) break;
+			// ラベルを取得する (ストリーミングはワーカーが受け取ったラベル、受け取れなければエポックの終わり)
+			int label = stream ? streamLabels[idx] : data.GetLabel(true, (size_t)idx);
+			if (label < 0) break;
+			batchIndices[count] = idx;
+			batchLabels[count++] = label;
+		}
+		if (count == 0) break;
+		// このバッチの学習率をスケジュールから求める
+		float learningRate = controller.GetLearningRate(epochIndex + (double)sampleIndex / (double)trainCount);
+		// 順伝播 → 損失計算 → 逆伝播 (バッチ全体の勾配で 1 回更新) を行う
+		int batchCorrect = 0;
+		float loss = model.TrainBatch(batchTensors.data(), batchLabels.data(), count, learningRate, &batchCorrect, batchLosses.data());
+		// 順伝播で求まったサンプルごとの損失をサンプラに知らせる
+		if (!stream) { sampler.UpdateLosses(batchIndices.data(), batchLosses.data(), count); }
+		// 総損失を加算する (TrainBatch はバッチ平均を返す)
+		totalLoss += loss * count;
 		// 正解数をカウントする
-		if (prediction == label) correct++;
-		// VISUAL_INTERVAL ステップごとに画像更新する
-		if (sampleIndex % VISUAL_INTERVAL == 0)
+		correct += batchCorrect;
+		// VISUAL_INTERVAL ステップをまたいだら画像更新する
+		bool showImages = (sampleIndex / VISUAL_INTERVAL) != ((sampleIndex + count - 1) / VISUAL_INTERVAL) || sampleIndex % VISUAL_INTERVAL == 0;
+		sampleIndex += count;
+		if (showImages)
 		{
 			// エポックと サンプルインデックスを表示する
 			std::wcout << L"[Epoch " << (epochIndex + 1) << L"] Update at step " << sampleIndex << L"\n";
 			// ランダムイメージを表示する
-			ShowRandomImages(model, mnist);
+			ShowRandomImages(model, data, cache);
 			// 再描画する
 			PumpWindowMessages();
 		}
 		// プログレスバーを更新する
 		float progress = static_cast<float>(sampleIndex) / static_cast<float>(trainCount);
 		// 学習進捗を設定する（0～1 の値）
-		SetTrainProgress((epochIndex + progress) / totalEpochs);
+		SetTrainProgress((epochIndex + progress) / controller.GetConfig().maxEpochs);
 	}
+	// 実際に学習したサンプル数で割る (1 件も学習できなかったときは 0 除算を避ける)
+	const float trainedCount = static_cast<float>(std::max(sampleIndex, 1));
 	// 平均損失を計算する
-	float avgLoss = totalLoss / static_cast<float>(trainCount);
+	float avgLoss = totalLoss / trainedCount;
 	// 精度(%)を計算する
-	float accuracy = correct * 100.0f / static_cast<float>(trainCount);
+	float accuracy = correct * 100.0f / trainedCount;
 	// 結果を表示する
-	std::wcout << L"Epoch " << (epochIndex + 1) << L" | Loss = " << avgLoss << L" | Accuracy = " << accuracy << L"%\n";
+	std::wcout << L"Epoch " << (epochIndex + 1) << L" | Loss = " << avgLoss << L" | Accuracy = " << accuracy << L"%"
+		<< L" | Peak activation = " << (model.GetPeakActivationBytes() / 1024) << L" KB"
+		<< L" | Input wait = " << (int)(prefetcher.GetWaitSeconds() * 1000.0) << L" ms"
+		<< L" | LR = " << controller.GetLearningRate(epochIndex + 1.0)
+		<< L" | Allocations/step = " << model.GetMemoryStats().stepAllocations << L"\n";
 }
 
 // CNN の推論結果を GUI に送る(100枚ランダム表示)
-void ShowRandomImages(CNNModel& model, FashionMNIST& mnist)
+void ShowRandomImages(CNNModel& model, const ImageDataset& data, const DatasetCache* cache)
 {
 	// 表示枚数(最大100枚)を決定する
-	int count = std::min(100, static_cast<int>(mnist.trainImages.size()));
+	int count = std::min(100, static_cast<int>(data.GetCount(true)));
 	// 画像データを格納する配列を準備する
 	std::vector<std::vector<uint8_t>> images(count);
 	// 正解ラベルを格納する配列を準備する
@@ -130,76 +220,236 @@ void ShowRandomImages(CNNModel& model, FashionMNIST& mnist)
 	std::vector<int> prediction(count);
 	// 正誤フラグを格納する配列を準備する
 	std::vector<bool> correctFlags(count);
-	// ランダムにインデックスを生成するための乱数エンジンを宣言する
-	std::mt19937 random(std::random_device{}());
-	// ランダムにインデックスを生成するための分布を宣言する
-	std::uniform_int_distribution<int> dist(0, static_cast<int>(mnist.trainImages.size()) - 1);
-	// 指定枚数分ランダムにサンプルを選び、推論結果を計算する
+	// ランダムにインデックスを生成するための乱数ストリームを用意する (呼び出しごとに番号を変える)
+	static uint64_t callIndex = 0;
+	RandomStream random = MakeRandomStream(RandomPurpose::Display, callIndex++);
+	// 指定枚数分ランダムにサンプルを選び、テンソルに変換する
+	std::vector<Tensor3D> inputTensors(count);
 	for (int sampleIndex = 0; sampleIndex < count; sampleIndex++)
 	{
 		// ランダムに選んだサンプルのインデックスを設定する
-		int randomIndex = dist(random);
-		// 画像を取得する
-		images[sampleIndex] = mnist.trainImages[randomIndex];
+		int randomIndex = random.NextInt(static_cast<int>(data.GetCount(true)));
+		// 表示用の画像を取得する (RGB はグレースケールに変換する)
+		data.GetDisplayImage(true, (size_t)randomIndex, images[sampleIndex]);
 		// 正解ラベルを取得する
-		groundTruth[sampleIndex] = mnist.trainLabels[randomIndex];
-		// 画像をテンソルに変換してモデルに入力する
-		Tensor3D inputTensor = ImageToTensor(images[sampleIndex]);
-		// モデルの予測ラベルを取得する
-		prediction[sampleIndex] = model.Predict(inputTensor);
+		groundTruth[sampleIndex] = data.GetLabel(true, (size_t)randomIndex);
+		// 画像をテンソルに変換する (キャッシュがあれば正規化済みの値をコピーする)
+		if (cache) { cache->DecodeToTensor((size_t)randomIndex, inputTensors[sampleIndex]); }
+		else { data.DecodeToTensor(true, (size_t)randomIndex, inputTensors[sampleIndex]); }
+	}
+	// 全サンプルの確率をまとめて推論する (詳細ビューの Top-10 もこの結果から選び、推論をやり直さない)
+	const int numClasses = model.GetNumClasses();
+	std::vector<float> probabilities((size_t)count * numClasses);
+	model.PredictProbaBatch(inputTensors.data(), count, probabilities.data());
+	// 各サンプルの最も確率の高いクラスを予測ラベルにする
+	std::vector<std::pair<int, float>> best(count);
+	SelectTopKBatch(probabilities.data(), count, numClasses, 1, best.data());
+	for (int sampleIndex = 0; sampleIndex < count; sampleIndex++)
+	{
+		prediction[sampleIndex] = best[sampleIndex].first;
 		// 予測が正解かどうかを判定してフラグに記録する
 		correctFlags[sampleIndex] = (prediction[sampleIndex] == groundTruth[sampleIndex]);
 	}
 	// 左側のグリッドに画像とラベルを表示する（scale=2 → 2倍拡大表示）
-	UpdateDisplayGridWithLabels(images, groundTruth, prediction, correctFlags, 28, 28, 10, 2);
-	// 詳細ビュー用に先頭の画像 (0番目) をテンソルに変換する
-	Tensor3D inputTensor = ImageToTensor(images[0]);
-	// CNN モデルから Top-10 の予測結果を取得する
-	auto top10 = model.GetTop10(inputTensor);
-	// Top-10 の予測結果に対応するクラス名を取得する
-	auto top10names = model.GetTop10Names(top10);
+	UpdateDisplayGridWithLabels(images, groundTruth, prediction, correctFlags, data.GetColumns(), data.GetRows(), 10, 2);
+	// 詳細ビュー用に先頭の画像 (0番目) の Top-10 を計算済みの確率から選ぶ
+	auto top10 = model.GetTopK(probabilities.data(), 10);
+	// Top-10 の予測結果に対応するクラス名を取得する (データセットのクラス名を指すビュー)
+	auto top10names = CNNModel::GetTop10Names(top10);
 	// 詳細ビューを更新する(画像と Top-10 推定結果を表示)
 	UpdateDetailView(images[0], top10, top10names);
 	// 再描画する
 	PumpWindowMessages();
 }
 
+// 推論サーバーとして動く
+// ・使い方: MLP --serve <チェックポイント> [--port N | --unix <パス>] [--batch N] [--delay-us N] [--workers N]
+// ・何かキーを押すまで待ち受け、一定間隔で統計値 (p50 / p99 レイテンシ・スループット) を表示する
+int ServeCheckpoint(int argc, char* argv[])
+{
+	if (argc < 3) { std::cerr << "Usage: MLP --serve <checkpoint> [--port N | --unix PATH] [--batch N] [--delay-us N] [--workers N]\n"; return 1; }
+	// チェックポイントからモデルを作る (構成設定もファイルから読む)
+	std::unique_ptr<CNNModel> model = CNNModel::LoadCheckpoint(argv[2]);
+	if (!model) { std::cerr << "Error: チェックポイントを読み込めません: " << argv[2] << "\n"; return 1; }
+	// オプションを読む
+	InferenceServerConfig config;
+	for (int i = 3; i + 1 < argc; i += 2)
+	{
+		std::string option = argv[i];
+		if (option == "--port") { config.tcpPort = std::stoi(argv[i + 1]); }
+		else if (option == "--unix") { config.unixSocketPath = argv[i + 1]; }
+		else if (option == "--batch") { config.maxBatchSize = std::stoi(argv[i + 1]); }
+		else if (option == "--delay-us") { config.maxDelayMicroseconds = std::stoi(argv[i + 1]); }
+		else if (option == "--workers") { config.numWorkers = std::stoi(argv[i + 1]); }
+		else { std::cerr << "Error: 不明なオプション " << option << "\n"; return 1; }
+	}
+	InferenceServer server(*model, config);
+	if (!server.Start()) { std::cerr << "Error: ソケットを開けません\n"; return 1; }
+	if (config.unixSocketPath.empty()) { std::cout << "Listening on 127.0.0.1:" << config.tcpPort; }
+	else { std::cout << "Listening on " << config.unixSocketPath; }
+	std::cout << " (batch " << config.maxBatchSize << ", delay " << config.maxDelayMicroseconds << " us). Press any key to stop.\n";
+	// キーが押されるまで統計値を表示し続ける
+	for (int seconds = 1; !_kbhit(); seconds++)
+	{
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+		if (seconds % SERVER_STATS_INTERVAL == 0) { std::cout << FormatInferenceStats(server.GetStats()) << "\n"; }
+	}
+	server.Stop();
+	std::cout << FormatInferenceStats(server.GetStats()) << "\n";
+	return 0;
+}
+
 // メインエントリ
-int main()
+int main(int argc, char* argv[])
 {
-	// Fashion MNISTデータセットを読み込む
-	FashionMNIST mnist;
-	// FashionMNISTデータセットをロードする
-	if (!mnist.Load("train-images-idx3-ubyte", "train-labels-idx1-ubyte", true))
-	{ std::cerr << "Error: MNIST 読み込み失敗\n"; 	return 1; 	}
+	// 推論サーバーとして起動された場合は学習しない
+	if (argc >= 2 && std::string(argv[1]) == "--serve") { return ServeCheckpoint(argc, argv); }
 
+	// 学習するデータセットを読み込む (テストデータ (t10k / test_batch) が無ければテスト評価を省略する)
+	ImageDataset data;
+	bool loaded = USE_FASHION_MNIST
+		? data.LoadFashionMNIST("train-images-idx3-ubyte", "train-labels-idx1-ubyte", "t10k-images-idx3-ubyte", "t10k-labels-idx1-ubyte")
+		: data.LoadCifar10(CIFAR10_DIRECTORY);
+	if (!loaded) { std::cerr << "Error: " << (USE_FASHION_MNIST ? "MNIST" : "CIFAR-10") << " 読み込み失敗\n"; return 1; }
+	const bool hasTestSet = data.HasTestSet();
+	if (!hasTestSet) { std::cerr << "Warning: テストデータが無いためテスト評価を省略します\n"; }
+	// 表示と混同行列のクラス名をデータセットから設定する
+	CNNModel::SetClassNames(data.GetClassNames());
+
+	// 乱数のシードを設定する (モデルの重みの初期化より前に行う)
+	SetRandomSeed(RANDOM_SEED);
+	// モデルの入力形状をデータセットのヘッダから設定する
+	CNNConfig config;
+	config.inputHeight = data.GetRows();
+	config.inputWidth = data.GetColumns();
+	config.inputChannels = data.GetChannels();
+	// 画像を HWC の uint8 で取り出す作業領域 (シャード・キャッシュの書き出し用、CIFAR-10 の並べ替えに使う)
+	std::vector<uint8_t> imageScratch;
+	// 畳み込み層の後にバッチ正規化を入れる (大きめの学習率とミニバッチで少ないエポックで収束する)
+	config.batchNorm = true;
+	// ストリーミングで学習する場合は学習データのファイルをリーダーに登録する
+	StreamingDataset stream;
+	if (STREAM_TRAINING_DATA && !stream.AddShardFile(SHARD_TRAINING_PATH))
+	{
+		WriteShardFile(SHARD_TRAINING_PATH, data.GetCount(true), data.GetRows(), data.GetColumns(), data.GetChannels(),
+			[&](size_t index) { return data.GetImage(true, index, imageScratch); },
+			[&](size_t index) { return (uint8_t)data.GetLabel(true, index); });
+		// 書き出せなければ元のファイルをそのまま読む
+		auto addSourceFiles = [&] {
+			if (USE_FASHION_MNIST) { return stream.AddIdxFiles("train-images-idx3-ubyte", "train-labels-idx1-ubyte"); }
+			for (int i = 1; i <= 5; i++)
+			{
+				if (!stream.AddCifarFile(std::string(CIFAR10_DIRECTORY) + "/data_batch_" + std::to_string(i) + ".bin")) return false;
+			}
+			return true;
+		};
+		if (!stream.AddShardFile(SHARD_TRAINING_PATH) && !addSourceFiles())
+		{ std::cerr << "Error: 学習データをストリーミングで開けません\n"; return 1; }
+	}
+	// 正規化済みの学習データのキャッシュを開く (無い・学習データと合わなければ書き出してから開く)
+	DatasetCache cache;
+	if (USE_DATASET_CACHE)
+	{
+		auto matches = [&] {
+			return cache.GetCount() == data.GetCount(true) && cache.GetRows() == data.GetRows()
+				&& cache.GetColumns() == data.GetColumns() && cache.GetChannels() == data.GetChannels();
+		};
+		if (!cache.Open(DATASET_CACHE_PATH) || !matches())
+		{
+			cache.Close();
+			WriteDatasetCache(DATASET_CACHE_PATH, data.GetCount(true), data.GetRows(), data.GetColumns(), data.GetChannels(),
+				[&](size_t index) { return data.GetImage(true, index, imageScratch); },
+				[&](size_t index) { return (uint8_t)data.GetLabel(true, index); });
+			if (!cache.Open(DATASET_CACHE_PATH) || !matches())
+			{
+				cache.Close();
+				std::cerr << "Warning: データセットのキャッシュを作れないため画像をその場で変換します\n";
+			}
+		}
+	}
+	const DatasetCache* trainCache = cache.IsOpen() ? &cache : nullptr;
+	// 学習データの拡張
+	ImageAugmenter augmenter(AugmentationConfig(), data.GetRows(), data.GetColumns(), data.GetChannels());
+	// 学習サンプルのサンプラ
+	SamplerConfig samplerConfig;
+	samplerConfig.mode = SAMPLER_MODE;
+	samplerConfig.samplesPerEpoch = SAMPLES_PER_EPOCH;
+	// 学習データの末尾を検証用に取り分け、サンプラは先頭の trainPool 枚だけから抽出する
+	const int validationCount = std::clamp(VALIDATION_SAMPLES, 0, (int)data.GetCount(true) / 2);
+	const int trainPool = (int)data.GetCount(true) - validationCount;
+	std::vector<uint8_t> poolLabels(data.GetTrainLabels().begin(), data.GetTrainLabels().begin() + trainPool);
+	std::unique_ptr<ISampler> sampler = CreateSampler(samplerConfig, poolLabels, config.numClasses);
 	// CNNのインスタンスを生成する
-	CNNModel model;
+	CNNModel model(config);
 	// GUI ウィンドウを初期化する
-	InitDisplayWindow(1200, 980, L"CNN FashionMNIST Viewer");
+	InitDisplayWindow(1200, 980, USE_FASHION_MNIST ? L"CNN FashionMNIST Viewer" : L"CNN CIFAR-10 Viewer");
 	// 再描画する
 	PumpWindowMessages();
 	// まだ学習していない最初のイメージを表示する
-	ShowRandomImages(model, mnist);
-	// 学習回数を設定する
-	const int epochs = 8;
-	// 学習率を設定する (0.0003 → 0.001 に上げて学習を進みやすくする)
-	float learningRate = 0.006f;
+	ShowRandomImages(model, data, trainCache);
+	// 学習の制御 (最大エポック数・学習率のスケジュール・早期終了)
+	// ・学習率はバッチ正規化 + ミニバッチ平均の勾配なので 0.05 から、ウォームアップの後にコサインで下げる
+	// ・検証用データの正解率が patience 回続けて上がらなければ、最大エポック数の前でも打ち切る
+	TrainingControllerConfig controllerConfig;
+	controllerConfig.bestCheckpointPath = BEST_CHECKPOINT_PATH;
+	TrainingController controller(controllerConfig);
+	const int maxEpochs = controller.GetConfig().maxEpochs;
+	// テストデータ全体を評価する (読み取り専用の推論を並列実行)
+	auto evaluateTestSet = [&] {
+		return EvaluateDataset(model, (int)data.GetCount(false),
+			[&](int index, Tensor3D& tensor) { data.DecodeToTensor(false, (size_t)index, tensor); },
+			[&](int index) { return data.GetLabel(false, (size_t)index); });
+	};
 	// 各エポックで学習を行う
-	for (int epoch = 0; epoch < epochs; epoch++)
+	for (int epoch = 0; epoch < maxEpochs; epoch++)
 	{
 		// 1エポック学習する
-		TrainOneEpoch(model, mnist, learningRate, epoch, epochs);
+		TrainOneEpoch(model, data, STREAM_TRAINING_DATA ? &stream : nullptr, trainCache,
+			AUGMENT_TRAINING_DATA ? &augmenter : nullptr, *sampler, controller, epoch);
+		// 検証用データで評価して、最良のモデルの保存と早期終了の判定を行う
+		if (validationCount > 0 && controller.ShouldEvaluate(epoch))
+		{
+			EvaluationResult validation = EvaluateDataset(model, validationCount,
+				[&](int index, Tensor3D& tensor) {
+					if (trainCache) { trainCache->DecodeToTensor((size_t)(trainPool + index), tensor); }
+					else { data.DecodeToTensor(true, (size_t)(trainPool + index), tensor); }
+				},
+				[&](int index) { return data.GetLabel(true, (size_t)(trainPool + index)); });
+			bool improved = controller.ReportValidation(epoch, validation.accuracy, validation.loss, model);
+			std::wcout << L"Validation (" << validationCount << L" images) | Loss = " << validation.loss
+				<< L" | Accuracy = " << validation.accuracy << L"%" << (improved ? L" | best" : L"") << L"\n";
+		}
+		// テストセット全体で汎化性能を評価する (読み取り専用の推論を並列実行)
+		if (hasTestSet) { PrintEvaluationSummary(evaluateTestSet()); }
 		// 各エポック終了時にも1回画面更新
-		ShowRandomImages(model, mnist);
+		ShowRandomImages(model, data, trainCache);
 		// 再描画する
 		PumpWindowMessages();
+		// 検証用データの正解率が上がらなくなったら打ち切る
+		if (controller.ShouldStop())
+		{
+			std::wcout << L"Early stopping at epoch " << (epoch + 1) << L" (best epoch " << (controller.GetBestEpoch() + 1)
+				<< L", validation accuracy = " << controller.GetBestAccuracy() << L"%)\n";
+			break;
+		}
 	}
+	// 学習の最後のステップの層ごとのメモリ使用量を表示する (バッチサイズ・スレッド数を決める目安)
+	PrintMemoryStats(model.GetMemoryStats());
+	// 検証用データで最良だったモデルに戻す (最後のエポックが最良なら何もしない)
+	if (!controller.RestoreBest(model)) { std::cerr << "Warning: 最良のモデルに戻せません\n"; }
+	else if (controller.GetBestEpoch() >= 0) { std::wcout << L"Using model from epoch " << (controller.GetBestEpoch() + 1) << L"\n"; }
 
+	// 推論用にバッチ正規化を畳み込み層へ折り込む (推論結果は同じで BN の計算が無くなる)
+	model.FoldBatchNorm();
+	// 推論サーバー (--serve) で使うチェックポイントを保存する
+	if (model.SaveCheckpoint(CHECKPOINT_PATH)) { std::cout << "Saved checkpoint: " << CHECKPOINT_PATH << "\n"; }
+	else { std::cerr << "Warning: チェックポイントを保存できません\n"; }
+	// 最終モデルのクラス別の結果 (混同行列) を表示する
+	if (hasTestSet) { PrintConfusionMatrix(evaluateTestSet()); }
 	// ポーズする
 	std::cout << "Training Finished. Press any key to exit...";
 	// 最終結果を表示する
-	ShowRandomImages(model, mnist);
+	ShowRandomImages(model, data, trainCache);
 	PumpWindowMessages();
 	// キー入力待ち
 	int key = _getch();
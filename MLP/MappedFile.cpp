@@ -0,0 +1,100 @@
+﻿// MappedFile.cpp
+// 読み取り専用のメモリマップトファイル
+#include "MappedFile.h"
+#include <utility>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// デストラクタ (マップを解除する)
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+// ムーブコンストラクタ
+MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+	*this = std::move(other);
+}
+
+// ムーブ代入 (所有権を移して相手を空にする)
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+	if (this != &other)
+	{
+		Close();
+		std::swap(m_data, other.m_data);
+		std::swap(m_size, other.m_size);
+#ifdef _WIN32
+		std::swap(m_file, other.m_file);
+		std::swap(m_mapping, other.m_mapping);
+#else
+		std::swap(m_fd, other.m_fd);
+#endif
+	}
+	return *this;
+}
+
+// ファイルを開いてマップする
+bool MappedFile::Open(const std::string& path)
+{
+	Close();
+#ifdef _WIN32
+	// 読み取り専用・順次アクセスのヒント付きで開く
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) { return false; }
+	// ファイルサイズを取得する
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) { CloseHandle(file); return false; }
+	// ファイル全体のマッピングを作る
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping) { CloseHandle(file); return false; }
+	const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!view) { CloseHandle(mapping); CloseHandle(file); return false; }
+	m_file = file;
+	m_mapping = mapping;
+	m_data = static_cast<const uint8_t*>(view);
+	m_size = (size_t)fileSize.QuadPart;
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) { return false; }
+	// ファイルサイズを取得する
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) { ::close(fd); return false; }
+	void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (view == MAP_FAILED) { ::close(fd); return false; }
+	// 先頭から順に読むことを OS に伝えて先読みを促す
+	madvise(view, (size_t)st.st_size, MADV_SEQUENTIAL);
+	m_fd = fd;
+	m_data = static_cast<const uint8_t*>(view);
+	m_size = (size_t)st.st_size;
+#endif
+	return true;
+}
+
+// マップを解除してファイルを閉じる
+void MappedFile::Close()
+{
+#ifdef _WIN32
+	if (m_data) { UnmapViewOfFile(m_data); }
+	if (m_mapping) { CloseHandle(m_mapping); }
+	if (m_file) { CloseHandle(m_file); }
+	m_mapping = nullptr;
+	m_file = nullptr;
+#else
+	if (m_data) { munmap(const_cast<uint8_t*>(m_data), m_size); }
+	if (m_fd >= 0) { ::close(m_fd); }
+	m_fd = -1;
+#endif
+	m_data = nullptr;
+	m_size = 0;
+}
@@ -0,0 +1,50 @@
+﻿// MappedFile.h
+// 読み取り専用のメモリマップトファイル
+// ・ファイル全体をアドレス空間にマップし、ReadFile によるコピー無しで参照する
+// ・Windows は CreateFileMapping / MapViewOfFile、それ以外は mmap を使う
+#pragma once
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+// MappedFile クラス
+// ・コピー不可、ムーブ可 (マップはデストラクタで解除する)
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	MappedFile(MappedFile&& other) noexcept;
+	MappedFile& operator=(MappedFile&& other) noexcept;
+
+	// ファイルを開いてマップする
+	// ・成功すれば true (空のファイルは失敗扱い)
+	bool Open(const std::string& path);
+	// マップを解除してファイルを閉じる
+	void Close();
+
+	// マップされた先頭アドレス
+	const uint8_t* Data() const { return m_data; }
+	// ファイルサイズ (バイト)
+	size_t Size() const { return m_size; }
+	// マップ済みか
+	bool IsOpen() const { return m_data != nullptr; }
+
+private:
+	// マップされた先頭アドレス
+	const uint8_t* m_data = nullptr;
+	// ファイルサイズ
+	size_t m_size = 0;
+#ifdef _WIN32
+	// ファイルハンドル (HANDLE)
+	void* m_file = nullptr;
+	// ファイルマッピングハンドル (HANDLE)
+	void* m_mapping = nullptr;
+#else
+	// ファイルディスクリプタ
+	int m_fd = -1;
+#endif
+};
@@ -1,6 +1,6 @@
 ﻿// MaxPoolLayer.cpp
 #include "MaxPoolLayer.h"
-#include <cmath> 
+#include <cassert>
 
 // コンストラクタ
 // ・poolSize : プーリング領域の一辺の長さ(例: 2 → 2×2 プーリング)
@@ -8,15 +8,34 @@ MaxPoolLayer::MaxPoolLayer(int poolSize)
 	: 
 	m_size(poolSize)
 {
+	// 領域内の位置を 1 byte で保存するため、領域の画素数は 256 以下に限る
+	assert(poolSize > 0 && poolSize * poolSize <= 256);
 }
 
 // 順伝播する
 // ・入力特徴マップをsize×size単位で区切り その中の最大値を出力する
-// ・最大値位置は Backward 時に必要なため入力と出力を保存する
+// ・最大値位置は Backward 時に必要なため、領域内の位置だけを保存する
 Tensor3D MaxPoolLayer::Forward(const Tensor3D& inputFeatureMap)
 {
-	// 逆伝播(Backward)で最大値の場所を特定するため 入力特徴マップを保存する
-	m_lastInputFeatureMap = inputFeatureMap;
+	// 逆伝播で入力側勾配を確保するため 入力の形状を保存する
+	m_inputHeight = inputFeatureMap.GetH();
+	m_inputWidth = inputFeatureMap.GetW();
+	m_inputChannels = inputFeatureMap.GetC();
+	// 出力1要素につき1つ、最大値の位置を記録する領域を確保する
+	m_argmax.resize((size_t)OutputSize(m_inputHeight) * OutputSize(m_inputWidth) * m_inputChannels);
+	// プーリングを計算しながら最大値の位置を記録する
+	return Pool(inputFeatureMap, m_argmax.data());
+}
+
+// 推論用の順伝播する(最大値の位置を保存しない)
+Tensor3D MaxPoolLayer::Infer(const Tensor3D& inputFeatureMap) const
+{
+	return Pool(inputFeatureMap, nullptr);
+}
+
+// プーリングを計算する
+Tensor3D MaxPoolLayer::Pool(const Tensor3D& inputFeatureMap, uint8_t* argmax) const
+{
 	// 入力特徴マップの高さ(H) を取得する
 	int H = inputFeatureMap.GetH();
 	// 入力特徴マップの幅(W)を取得する
@@ -36,6 +55,8 @@ Tensor3D MaxPoolLayer::Forward(const Tensor3D& inputFeatureMap)
 			for (int ow = 0; ow < outW; ow++) {
 				// プーリング領域内の最大値を保持する
 				float maxValue = -1e9f;  // 非常に小さい値で初期化
+				// 最大値だった領域内の位置
+				int maxPosition = 0;
 				// size×size のプーリング領域を探索して最大値を求める
 				for (int kh = 0; kh < m_size; kh++) {
 					for (int kw = 0; kw < m_size; kw++) {
@@ -48,63 +69,65 @@ Tensor3D MaxPoolLayer::Forward(const Tensor3D& inputFeatureMap)
 						// 最大値を更新する
 						if (inputValue > maxValue)	{
 							maxValue = inputValue;
+							maxPosition = kh * m_size + kw;
 						}
 					}
 				}
 				// プーリング領域から得られた最大値を出力特徴マップに格納する
 				out(oh, ow, c) = maxValue;
+				// 逆伝播用に最大値の位置を記録する (出力と同じ HWC の並び)
+				if (argmax) { argmax[(oh * outW + ow) * C + c] = (uint8_t)maxPosition; }
 			}
 		}
 	}
 
-	// 逆伝播で最大位置を再判定するため Forward の出力も保存する
-	m_lastOutputFeatureMap = out;
 	// プーリング結果を返す
 	return out;
 }
 
+// 順伝播する (最大値の位置を呼び出し側の領域に記録する)
+Tensor3D MaxPoolLayer::Forward(const Tensor3D& inputFeatureMap, std::vector<uint8_t>& argmax) const
+{
+	argmax.resize((size_t)OutputSize(inputFeatureMap.GetH()) * OutputSize(inputFeatureMap.GetW()) * inputFeatureMap.GetC());
+	return Pool(inputFeatureMap, argmax.data());
+}
+
 // 逆伝播する
 // ・dOutFeatureMap: 出力側の勾配 (outH×outW×C)
 // ・戻り値: 入力側の勾配 (H×W×C)
 Tensor3D MaxPoolLayer::Backward(const Tensor3D& dOutFeatureMap)
 {
-	// Forward 時の入力特徴マップのサイズを取得する
-	int H = m_lastInputFeatureMap.GetH();
-	int W = m_lastInputFeatureMap.GetW();
-	int C = m_lastInputFeatureMap.GetC();
+	assert((size_t)dOutFeatureMap.Size() == m_argmax.size());
+	return Scatter(m_argmax.data(), dOutFeatureMap, m_inputHeight, m_inputWidth, m_inputChannels);
+}
 
-	// プーリング後の出力サイズを取得する(Forward と同じ計算)
-	int outH = H / m_size;
-	int outW = W / m_size;
+// 逆伝播する (最大値の位置を引数で受け取る)
+// ・値の一致で最大値の位置を探すと、同じ値が並ぶ領域で勾配が複数の位置に流れるので、順伝播で記録した位置を使う
+Tensor3D MaxPoolLayer::Backward(const Tensor3D& inputFeatureMap, const std::vector<uint8_t>& argmax, const Tensor3D& dOutFeatureMap) const
+{
+	assert((size_t)dOutFeatureMap.Size() == argmax.size());
+	return Scatter(argmax.data(), dOutFeatureMap, inputFeatureMap.GetH(), inputFeatureMap.GetW(), inputFeatureMap.GetC());
+}
 
+// 出力側の勾配を最大値だった位置にだけ流す
+Tensor3D MaxPoolLayer::Scatter(const uint8_t* argmax, const Tensor3D& dOutFeatureMap, int H, int W, int C) const
+{
+	// 出力側勾配の形状を取得する
+	int outH = dOutFeatureMap.GetH();
+	int outW = dOutFeatureMap.GetW();
 	// 入力側の勾配マップを0で初期化
 	// ・MaxPoolはパラメータを持たないため勾配は入力へ流す
 	Tensor3D dInputFeatureMap(H, W, C);
 	dInputFeatureMap.Zero();
-
-	// 各チャネルごとに逆伝播処理を行う
-	for (int channel = 0; channel < C; channel++) {
-		// 出力特徴マップの高さ方向へループ
-		for (int outY = 0; outY < outH; outY++) {
-			// 出力特徴マップの幅方向へループ
-			for (int outX = 0; outX < outW; outX++) {
-				// Forward の出力に保存された最大値を取得する
-				float maxValue = m_lastOutputFeatureMap(outY, outX, channel);
-				// プーリング領域（size×size）を探索する
-				for (int poolY = 0; poolY < m_size; poolY++) {
-					for (int poolX = 0; poolX < m_size; poolX++) {
-						// 入力側の対応する位置（pool の逆写像）
-						int inY = outY * m_size + poolY;
-						int inX = outX * m_size + poolX;
-						// 入力値が Forward 時の最大値だった位置にだけ勾配を流す
-						// MaxPool の逆伝播：最大値の位置にだけ誤差を伝える
-						if (std::fabs(m_lastInputFeatureMap(inY, inX, channel) - maxValue) < 1e-6f)
-						{
-							// 最大値だった位置に dOut（次層からの勾配）を加算する
-							dInputFeatureMap(inY, inX, channel) += dOutFeatureMap(outY, outX, channel);
-						}
-					}
-				}
+	// 出力の各要素の勾配を、順伝播で最大値だった位置にだけ流す
+	for (int outY = 0; outY < outH; outY++) {
+		for (int outX = 0; outX < outW; outX++) {
+			for (int channel = 0; channel < C; channel++) {
+				// 記録しておいた領域内の位置を入力上の座標に戻す
+				int position = argmax[(outY * outW + outX) * C + channel];
+				int inY = outY * m_size + position / m_size;
+				int inX = outX * m_size + position % m_size;
+				dInputFeatureMap(inY, inX, channel) = dOutFeatureMap(outY, outX, channel);
 			}
 		}
 	}
@@ -1,5 +1,7 @@
 ﻿// MaxPoolLayer.h
 #pragma once
+#include <vector>
+#include <cstdint>
 #include "Tensor3D.h"
 
 // MaxPoolLayer クラス
@@ -10,20 +12,45 @@ public:
 	// コンストラクタ
 	// ・poolSize : プーリングの一辺のサイズ (例: 2 → 2×2 プーリング)
 	MaxPoolLayer(int poolSize);
+	// 入力の一辺のサイズからプーリング後のサイズを返す (端数は切り捨て)
+	int OutputSize(int inputSize) const { return inputSize / m_size; }
 	// 順伝播する
 	// ・inputFeatureMap : 入力特徴マップ (H×W×C)
 	// ・戻り値 : プーリング後の出力特徴マップ
+	// ・逆伝播用には最大値の位置だけを保存する (入力・出力のコピーは持たない)
 	Tensor3D Forward(const Tensor3D& inputFeatureMap);
+	// 推論用の順伝播する
+	// ・Forward と同じ計算だが、逆伝播用の入力・出力を保存しない (const)
+	Tensor3D Infer(const Tensor3D& inputFeatureMap) const;
+	// 順伝播する (最大値の位置を呼び出し側の領域に記録する、ミニバッチ学習用)
+	// ・argmax : 出力1要素につき 1 byte の最大値の位置の格納先 (出力の要素数に合わせて確保し直す)
+	Tensor3D Forward(const Tensor3D& inputFeatureMap, std::vector<uint8_t>& argmax) const;
 	// 逆伝播する
 	// ・dOutFeatureMap : 出力側から流れてきた勾配
 	// ・戻り値 : 入力側の勾配
 	Tensor3D Backward(const Tensor3D& dOutFeatureMap);
+	// 逆伝播する (順伝播で記録した最大値の位置を呼び出し側が渡す、ミニバッチ学習用)
+	// ・inputFeatureMap : このサンプルの順伝播時の入力 (入力側勾配の形状に使う)
+	// ・argmax : 同じサンプルの Forward(input, argmax) で記録した最大値の位置
+	Tensor3D Backward(const Tensor3D& inputFeatureMap, const std::vector<uint8_t>& argmax, const Tensor3D& dOutFeatureMap) const;
+	// 逆伝播用に保持している最大値の位置のバイト数
+	size_t GetStoredBytes() const { return m_argmax.size(); }
+
+private:
+	// プーリングを計算する
+	// ・argmax : 各出力の最大値が領域内のどの位置 (kh * size + kw) だったかの格納先 (不要なら nullptr)
+	Tensor3D Pool(const Tensor3D& inputFeatureMap, uint8_t* argmax) const;
+	// 出力側の勾配を最大値だった位置にだけ流す (入力側勾配は H×W×C)
+	Tensor3D Scatter(const uint8_t* argmax, const Tensor3D& dOutFeatureMap, int H, int W, int C) const;
 
 private:
 	// プーリングサイズ (例: 2の場合 2×2の領域でmaxを取得する)
 	int m_size;
-	// 順伝播で使用した入力特徴マップ (逆伝播で最大値の位置を特定する)
-	Tensor3D m_lastInputFeatureMap;
-	// 順伝播の出力 (最大値 : 逆伝播で比較に使う)
-	Tensor3D m_lastOutputFeatureMap;
+	// 順伝播で最大値だった領域内の位置 (出力1要素につき 1 byte、逆伝播で勾配を流す先)
+	// ・入力・出力の特徴マップそのものは保持しない
+	std::vector<uint8_t> m_argmax;
+	// 順伝播の入力の形状 (逆伝播で入力側勾配を確保するのに使う)
+	int m_inputHeight = 0;
+	int m_inputWidth = 0;
+	int m_inputChannels = 0;
 };
@@ -0,0 +1,178 @@
+﻿// MemoryStats.cpp
+// メモリ使用量の計測
+#include "MemoryStats.h"
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <iostream>
+#include <iomanip>
+#if defined(_MSC_VER)
+#include <malloc.h>
+// ヒープのブロックのサイズ
+#define HEAP_BLOCK_SIZE(p) _msize(p)
+#elif defined(__GLIBC__)
+#include <malloc.h>
+#define HEAP_BLOCK_SIZE(p) malloc_usable_size(p)
+#else
+// ブロックのサイズが分からない環境では使用中のバイト数を数えない (確保回数・確保バイト数だけ数える)
+#define HEAP_BLOCK_SIZE(p) ((size_t)0)
+#endif
+
+namespace
+{
+	// スレッドごとの計測値 (定数で初期化されるので、スレッドの開始・終了で確保は起きない)
+	thread_local AllocationCounters t_counters;
+	// 計測中の区間ごとの使用中のバイト数の最大値 (外側から順に t_scopeDepth 個)
+	thread_local int64_t t_scopePeaks[AllocationScope::MaxDepth];
+	thread_local int t_scopeDepth = 0;
+
+	// 確保を数える
+	void CountAllocation(void* p, size_t size)
+	{
+		AllocationCounters& counters = t_counters;
+		counters.allocations++;
+		counters.allocatedBytes += size;
+		counters.liveBytes += (int64_t)HEAP_BLOCK_SIZE(p);
+		// 内側の区間から最大値を更新する (外側の区間の最大値は内側以上なので、更新しなくてよい区間で止める)
+		for (int d = std::min(t_scopeDepth, AllocationScope::MaxDepth) - 1; d >= 0 && t_scopePeaks[d] < counters.liveBytes; d--)
+		{
+			t_scopePeaks[d] = counters.liveBytes;
+		}
+	}
+
+	// 解放を数える
+	void CountFree(void* p)
+	{
+		t_counters.liveBytes -= (int64_t)HEAP_BLOCK_SIZE(p);
+	}
+
+	// malloc で確保して数える (0 バイトでも固有のアドレスを返す)
+	void* AllocateCounted(size_t size)
+	{
+		void* p = std::malloc(size ? size : 1);
+		if (p) { CountAllocation(p, size); }
+		return p;
+	}
+}
+
+// ---- グローバルな operator new / delete の置き換え ----
+// ・配列版は既定の実装がこれらを呼ぶので置き換えない
+
+void* operator new(std::size_t size)
+{
+	void* p = AllocateCounted(size);
+	if (!p) { throw std::bad_alloc(); }
+	return p;
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	return AllocateCounted(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	if (!p) return;
+	CountFree(p);
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	operator delete(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+	operator delete(p);
+}
+
+// 呼び出し元のスレッドの計測値を返す
+AllocationCounters GetThreadAllocationCounters()
+{
+	return t_counters;
+}
+
+// ---- AllocationScope ----
+
+// 開始する
+AllocationScope::AllocationScope()
+	: m_start(t_counters), m_depth(t_scopeDepth++)
+{
+	if (m_depth < MaxDepth) { t_scopePeaks[m_depth] = t_counters.liveBytes; }
+}
+
+// 終了する
+AllocationScope::~AllocationScope()
+{
+	t_scopeDepth--;
+}
+
+// 開始してからの確保回数
+uint64_t AllocationScope::GetAllocations() const
+{
+	return t_counters.allocations - m_start.allocations;
+}
+
+// 開始してからの確保バイト数
+uint64_t AllocationScope::GetAllocatedBytes() const
+{
+	return t_counters.allocatedBytes - m_start.allocatedBytes;
+}
+
+// 開始時点から使用中のバイト数が最大でどれだけ増えたか
+size_t AllocationScope::GetPeakBytes() const
+{
+	if (m_depth >= MaxDepth) return 0;
+	return (size_t)std::max<int64_t>(t_scopePeaks[m_depth] - m_start.liveBytes, 0);
+}
+
+// ここから計測をやり直す
+void AllocationScope::Restart()
+{
+	m_start = t_counters;
+	if (m_depth < MaxDepth) { t_scopePeaks[m_depth] = t_counters.liveBytes; }
+}
+
+// ---- ModelMemoryStats ----
+
+// 全層の合計を返す
+LayerMemoryStats ModelMemoryStats::GetTotal() const
+{
+	LayerMemoryStats total;
+	total.name = "total";
+	for (const LayerMemoryStats& layer : layers)
+	{
+		total.parameterBytes += layer.parameterBytes;
+		total.gradientBytes += layer.gradientBytes;
+		total.workspaceBytes += layer.workspaceBytes;
+		total.activationBytes += layer.activationBytes;
+		// 逆伝播の一時領域は層ごとに確保・解放されるので、合計ではなく最大値にする
+		total.backwardPeakBytes = std::max(total.backwardPeakBytes, layer.backwardPeakBytes);
+		total.backwardAllocations += layer.backwardAllocations;
+	}
+	return total;
+}
+
+// 層ごとのメモリ使用量を表にして表示する (バイト数は KB 単位)
+void PrintMemoryStats(const ModelMemoryStats& stats)
+{
+	// 表示桁数を変更するので元の設定を退避しておく
+	std::streamsize oldPrecision = std::wcout.precision();
+	std::wcout << std::left << std::setw(14) << L"Memory (KB)" << std::right << std::setw(10) << L"params" << std::setw(10) << L"grads"
+		<< std::setw(11) << L"workspace" << std::setw(12) << L"activation" << std::setw(10) << L"bwd peak" << std::setw(12) << L"bwd allocs" << L"\n";
+	std::wcout << std::fixed << std::setprecision(1);
+	auto printRow = [](const LayerMemoryStats& layer)
+		{
+			std::wcout << L" " << std::left << std::setw(13) << layer.name << std::right
+				<< std::setw(10) << layer.parameterBytes / 1024.0 << std::setw(10) << layer.gradientBytes / 1024.0
+				<< std::setw(11) << layer.workspaceBytes / 1024.0 << std::setw(12) << layer.activationBytes / 1024.0
+				<< std::setw(10) << layer.backwardPeakBytes / 1024.0 << std::setw(12) << layer.backwardAllocations << L"\n";
+		};
+	for (const LayerMemoryStats& layer : stats.layers) { printRow(layer); }
+	printRow(stats.GetTotal());
+	std::wcout << L"Step: " << stats.stepAllocations << L" allocations (" << stats.stepAllocatedBytes / 1024.0
+		<< L" KB allocated) | Peak heap growth = " << stats.stepPeakBytes / 1024.0 << L" KB\n";
+	std::wcout << std::defaultfloat;
+	std::wcout.precision(oldPrecision);
+}
@@ -0,0 +1,93 @@
+﻿// MemoryStats.h
+// メモリ使用量の計測
+// ・グローバルな operator new / delete を置き換え、スレッドごとにヒープの確保回数・確保バイト数・使用中のバイト数を数える
+// ・AllocationScope : 区間内の確保回数と、区間の開始時点から使用中のバイト数が最大でどれだけ増えたか (一時領域の最大) を求める
+// ・LayerMemoryStats / ModelMemoryStats : 層ごとのメモリ使用量 (CNNModel::GetMemoryStats が返す)
+// ※ 計測は確保したスレッドごとに行う (別のスレッドで確保された領域の解放は、解放したスレッドの使用中のバイト数から引かれる)
+// ※ アライメント指定付きの operator new (alignas で over-aligned な型の new) は数えない
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// スレッドごとのヒープの計測値
+struct AllocationCounters
+{
+	// 確保回数
+	uint64_t allocations = 0;
+	// 確保したバイト数の合計 (要求したサイズ)
+	uint64_t allocatedBytes = 0;
+	// 使用中のバイト数 (確保 - 解放、ヒープのブロックのサイズ)
+	int64_t liveBytes = 0;
+};
+
+// 呼び出し元のスレッドの計測値を返す
+AllocationCounters GetThreadAllocationCounters();
+
+// AllocationScope クラス
+// ・生成してからの呼び出し元のスレッドのヒープの確保を数える
+// ・入れ子にしてよい (使用中のバイト数の最大値は区間ごとに持つ、MaxDepth より深い区間は最大値を数えない)
+class AllocationScope
+{
+public:
+	AllocationScope();
+	~AllocationScope();
+	AllocationScope(const AllocationScope&) = delete;
+	AllocationScope& operator=(const AllocationScope&) = delete;
+
+	// 開始してからの確保回数
+	uint64_t GetAllocations() const;
+	// 開始してからの確保バイト数
+	uint64_t GetAllocatedBytes() const;
+	// 開始時点から使用中のバイト数が最大でどれだけ増えたか
+	size_t GetPeakBytes() const;
+	// ここから計測をやり直す (区間を続けて計測するとき用)
+	void Restart();
+
+	// 最大値を数える区間の入れ子の深さ
+	static constexpr int MaxDepth = 16;
+
+private:
+	// 開始時点の計測値
+	AllocationCounters m_start;
+	// 入れ子の深さ (0 が一番外側、スレッドごとの最大値の配列の位置)
+	int m_depth;
+};
+
+// 層ごとのメモリ使用量
+struct LayerMemoryStats
+{
+	// 層の名前
+	const char* name = "";
+	// パラメータ (重み・バイアス、順伝播用の bf16 / パネル形式の複製、BN の移動平均を含む)
+	size_t parameterBytes = 0;
+	// 勾配の累積領域
+	size_t gradientBytes = 0;
+	// 呼び出しをまたいで再利用する作業領域 (im2col の列行列など)
+	size_t workspaceBytes = 0;
+	// 逆伝播のために保持している活性値
+	// ・直前の TrainBatch の順伝播の終わり (保持する量が最大になる時点) のバイト数と、
+	//   単一サンプルの Forward の結果として今保持しているバイト数の和
+	size_t activationBytes = 0;
+	// 直前の TrainBatch の逆伝播でこの層が一時的に確保した最大バイト数と確保回数
+	size_t backwardPeakBytes = 0;
+	size_t backwardAllocations = 0;
+};
+
+// モデル全体のメモリ使用量
+struct ModelMemoryStats
+{
+	// 層ごとの内訳 (順伝播の順)
+	std::vector<LayerMemoryStats> layers;
+	// 直前の TrainBatch 1 ステップのヒープの確保回数と確保バイト数
+	size_t stepAllocations = 0;
+	size_t stepAllocatedBytes = 0;
+	// 直前の TrainBatch で使用中のヒープが開始時点から最大でどれだけ増えたか (保持する活性値 + 一時領域)
+	size_t stepPeakBytes = 0;
+
+	// 全層の合計を返す (name は "total")
+	LayerMemoryStats GetTotal() const;
+};
+
+// 層ごとのメモリ使用量を表にして表示する
+void PrintMemoryStats(const ModelMemoryStats& stats);
@@ -0,0 +1,140 @@
+﻿// Random.cpp
+// 再現可能な乱数サービス (Philox4x32-10)
+#include "Random.h"
+#include <cmath>
+
+namespace
+{
+	// Philox4x32 の乗数
+	constexpr uint32_t PhiloxM0 = 0xD2511F53u;
+	constexpr uint32_t PhiloxM1 = 0xCD9E8D57u;
+	// ラウンドごとに鍵に足す定数 (黄金比・√3 由来)
+	constexpr uint32_t PhiloxW0 = 0x9E3779B9u;
+	constexpr uint32_t PhiloxW1 = 0xBB67AE85u;
+	// ラウンド数
+	constexpr int PhiloxRounds = 10;
+
+	// 現在のシード
+	uint64_t g_seed = 0;
+	// 重みの初期化用のストリーム
+	RandomStream g_initialization(0, (uint64_t)RandomPurpose::Initialization << 56);
+}
+
+// コンストラクタ
+RandomStream::RandomStream(uint64_t seed, uint64_t streamId)
+{
+	m_key[0] = (uint32_t)seed;
+	m_key[1] = (uint32_t)(seed >> 32);
+	m_counter[0] = 0;
+	m_counter[1] = 0;
+	m_counter[2] = (uint32_t)streamId;
+	m_counter[3] = (uint32_t)(streamId >> 32);
+}
+
+// 現在のカウンタから 4 個の乱数を作る
+void RandomStream::Refill()
+{
+	uint32_t c0 = m_counter[0], c1 = m_counter[1], c2 = m_counter[2], c3 = m_counter[3];
+	uint32_t k0 = m_key[0], k1 = m_key[1];
+	for (int round = 0; round < PhiloxRounds; round++)
+	{
+		// 2 つの 32×32 → 64 bit の乗算の上位・下位を入れ替えながら混ぜる
+		uint64_t product0 = (uint64_t)PhiloxM0 * c0;
+		uint64_t product1 = (uint64_t)PhiloxM1 * c2;
+		uint32_t hi0 = (uint32_t)(product0 >> 32), lo0 = (uint32_t)product0;
+		uint32_t hi1 = (uint32_t)(product1 >> 32), lo1 = (uint32_t)product1;
+		c0 = hi1 ^ c1 ^ k0;
+		c1 = lo1;
+		c2 = hi0 ^ c3 ^ k1;
+		c3 = lo0;
+		// 鍵を進める
+		k0 += PhiloxW0;
+		k1 += PhiloxW1;
+	}
+	m_buffer[0] = c0;
+	m_buffer[1] = c1;
+	m_buffer[2] = c2;
+	m_buffer[3] = c3;
+	m_position = 0;
+	// ブロック番号 (64 bit) を進める
+	if (++m_counter[0] == 0) { m_counter[1]++; }
+}
+
+// 32 bit の一様乱数
+uint32_t RandomStream::NextUInt32()
+{
+	if (m_position == 4) { Refill(); }
+	return m_buffer[m_position++];
+}
+
+// [0, 1) の一様乱数
+float RandomStream::NextFloat()
+{
+	// 上位 24 bit を仮数の精度に合わせて使う
+	return (NextUInt32() >> 8) * (1.0f / 16777216.0f);
+}
+
+// [0, bound) の一様な整数
+int RandomStream::NextInt(int bound)
+{
+	if (bound <= 1) { return 0; }
+	const uint32_t range = (uint32_t)bound;
+	// 乗算の上位 32 bit を使い、偏りが出る下位の端数だけ引き直す (Lemire の方法)
+	uint64_t product = (uint64_t)NextUInt32() * range;
+	uint32_t low = (uint32_t)product;
+	if (low < range)
+	{
+		const uint32_t threshold = (0u - range) % range;
+		while (low < threshold)
+		{
+			product = (uint64_t)NextUInt32() * range;
+			low = (uint32_t)product;
+		}
+	}
+	return (int)(product >> 32);
+}
+
+// 正規分布に従う乱数
+float RandomStream::NextNormal(float mean, float stddev)
+{
+	if (m_hasSpareNormal)
+	{
+		m_hasSpareNormal = false;
+		return mean + stddev * m_spareNormal;
+	}
+	// u1 は (0, 1] にして log(0) を避ける
+	double u1 = ((NextUInt32() >> 8) + 1) * (1.0 / 16777216.0);
+	double u2 = (NextUInt32() >> 8) * (1.0 / 16777216.0);
+	double radius = std::sqrt(-2.0 * std::log(u1));
+	double angle = 6.283185307179586 * u2;
+	m_spareNormal = (float)(radius * std::sin(angle));
+	m_hasSpareNormal = true;
+	return mean + stddev * (float)(radius * std::cos(angle));
+}
+
+// 乱数のシードを設定する
+void SetRandomSeed(uint64_t seed)
+{
+	g_seed = seed;
+	g_initialization = MakeRandomStream(RandomPurpose::Initialization);
+}
+
+// 現在の乱数のシードを返す
+uint64_t GetRandomSeed()
+{
+	return g_seed;
+}
+
+// 用途と番号から乱数ストリームを作る
+RandomStream MakeRandomStream(RandomPurpose purpose, uint64_t index)
+{
+	// ストリーム番号の上位 8 bit に用途、下位 56 bit に番号を入れる
+	uint64_t streamId = ((uint64_t)purpose << 56) | (index & 0x00FFFFFFFFFFFFFFull);
+	return RandomStream(g_seed, streamId);
+}
+
+// 重みの初期化用のストリームを返す
+RandomStream& InitializationRandom()
+{
+	return g_initialization;
+}
@@ -0,0 +1,91 @@
+﻿// Random.h
+// 再現可能な乱数サービス (カウンタベースの Philox4x32-10)
+// ・乱数列は (シード, 用途, 番号) だけで決まり、生成した順番やスレッドの実行順には依存しない
+//   → 同じシードなら重みの初期化・シャッフル・表示するサンプルが毎回同じになり、学習結果がビット単位で再現する
+// ・並列処理では、ワーカーやサンプルごとに番号の違うストリームを MakeRandomStream で作って使う
+// ・分布の変換 (一様整数・正規分布・シャッフル) も自前で行うので、標準ライブラリの実装差に影響されない
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <utility>
+
+// 乱数の用途 (用途ごとに独立したストリームの空間を持つ)
+enum class RandomPurpose : uint32_t
+{
+	// 重みの初期化
+	Initialization = 1,
+	// エポックごとの学習データのシャッフル
+	Shuffle = 2,
+	// 表示するサンプルの選択
+	Display = 3,
+	// データ拡張
+	Augmentation = 4,
+	// 学習サンプルの抽出 (サンプラ)
+	Sampling = 5,
+};
+
+// Philox4x32-10 の乱数ストリーム
+// ・128 bit のカウンタを暗号的な混合関数 (10 ラウンド) に通して、1 回に 32 bit × 4 個の乱数を作る
+// ・カウンタの上位 64 bit にストリーム番号、下位 64 bit にブロック番号を入れる
+class RandomStream
+{
+public:
+	// std::shuffle などに渡せるようにする (UniformRandomBitGenerator)
+	using result_type = uint32_t;
+	static constexpr result_type min() { return 0; }
+	static constexpr result_type max() { return 0xFFFFFFFFu; }
+	result_type operator()() { return NextUInt32(); }
+
+	// コンストラクタ
+	// ・seed     : 乱数の鍵 (同じ seed と streamId なら同じ乱数列になる)
+	// ・streamId : ストリーム番号 (番号が違えば独立した乱数列になる)
+	RandomStream(uint64_t seed = 0, uint64_t streamId = 0);
+
+	// 32 bit の一様乱数
+	uint32_t NextUInt32();
+	// [0, 1) の一様乱数 (24 bit 精度)
+	float NextFloat();
+	// [0, bound) の一様な整数 (偏りのない棄却法)
+	int NextInt(int bound);
+	// 正規分布に従う乱数 (Box-Muller 法、2 個ずつ作って 1 個を次回に回す)
+	float NextNormal(float mean, float stddev);
+
+	// 配列をシャッフルする (Fisher-Yates)
+	template <typename T>
+	void Shuffle(std::vector<T>& values)
+	{
+		for (int i = (int)values.size() - 1; i > 0; i--)
+		{
+			std::swap(values[i], values[NextInt(i + 1)]);
+		}
+	}
+
+private:
+	// 現在のカウンタから 4 個の乱数を作り、カウンタを進める
+	void Refill();
+
+private:
+	// 鍵 (シード)
+	uint32_t m_key[2];
+	// カウンタ ([0],[1] がブロック番号、[2],[3] がストリーム番号)
+	uint32_t m_counter[4];
+	// 作った乱数
+	uint32_t m_buffer[4];
+	// m_buffer の次に使う位置 (4 なら使い切り)
+	int m_position = 4;
+	// Box-Muller で作った 2 個目の正規乱数
+	float m_spareNormal = 0.0f;
+	bool m_hasSpareNormal = false;
+};
+
+// 乱数のシードを設定する (モデルを作る前に呼ぶ、既定値は 0)
+// ・重みの初期化用のストリームも最初からやり直す
+void SetRandomSeed(uint64_t seed);
+// 現在の乱数のシードを返す
+uint64_t GetRandomSeed();
+// 用途と番号から乱数ストリームを作る
+// ・index にはエポック番号、ワーカー番号、サンプル番号などを渡す
+RandomStream MakeRandomStream(RandomPurpose purpose, uint64_t index = 0);
+// 重みの初期化用のストリームを返す
+// ・各層のコンストラクタが作られた順に使うので、モデルの構築は1つのスレッドで行う
+RandomStream& InitializationRandom();
@@ -1,64 +1,131 @@
 // ReLULayer.cpp
-// CNN wiReLUj̎
-// EForward : y = max(0, x)
-// EBackward: x > 0 ̂Ƃz`dAx <= 0 ̂Ƃ 0
+// CNN 活性化層（ReLU）の実装
+// ・Forward : y = max(0, x)
+// ・Backward: x > 0 のときだけ勾配を伝播、x <= 0 のとき 0
 #include "ReLULayer.h"
+#include <algorithm>
+#include <cassert>
+#if defined(_M_X64) || defined(__SSE2__)
+// x64 では SSE2 が必ず使えるので、4 要素ずつまとめて処理する
+#define RELU_SSE2 1
+#include <emmintrin.h>
+#endif
 
-// `d
+// 順伝播する
 Tensor3D ReLULayer::Forward(const Tensor3D& input)
 {
-	// ͂ۑ(t`dp)
-	lastInput = input;
-	// ̓e\̍EE`l擾
-	int H = input.GetH();
-	int W = input.GetW();
-	int C = input.GetC();
+	// 入力をコピーしてからその場で ReLU を適用する
+	Tensor3D out = input;
+	ForwardInPlace(out);
+	// ReLU を適用した出力を返す
+	return out;
+}
 
-	// o̓e\쐬
-	Tensor3D out(H, W, C);
-	// evf ReLU Kp
-	for (int h = 0; h < H; h++) {
-		for (int w = 0; w < W; w++) {
-			for (int c = 0; c < C; c++) {
-				// ͒l擾
-				float v = input(h, w, c);
-				// 0 傫΂̂܂܁A0 ȉȂ 0 ɂ
-				out(h, w, c) = (v > 0.0f) ? v : 0.0f;
-			}
-		}
-	}
-	// o͂Ԃ
+// その場で順伝播する
+void ReLULayer::ForwardInPlace(Tensor3D& x)
+{
+	// 入力の形状を保存する(逆伝播用)
+	m_height = x.GetH();
+	m_width = x.GetW();
+	m_channels = x.GetC();
+	// マスクを確保して ReLU を適用する
+	m_mask.resize(MaskWords(x.Size()));
+	ApplyInPlace(x.Data(), x.Size(), m_mask.data());
+}
+
+// 推論用の順伝播する
+Tensor3D ReLULayer::Infer(const Tensor3D& input) const
+{
+	// 出力テンソルを作成する
+	Tensor3D out = input;
+	// 各要素に ReLU を適用する
+	ApplyInPlace(out);
+	// 出力を返す
 	return out;
 }
 
-// t`d
+// 逆伝播する
 Tensor3D ReLULayer::Backward(const Tensor3D& dOut, float /*learningRate*/)
 {
-	// ze\̃TCY擾
-	int H = dOut.GetH();
-	int W = dOut.GetW();
-	int C = dOut.GetC();
-	// ͑̌zi[e\쐬
-	Tensor3D dInput(H, W, C);
-	// (Svf0 )
-	dInput.Zero();
-	// evfƂɌzvZ
-	for (int h = 0; h < H; h++) {
-		for (int w = 0; w < W; w++) {
-			for (int c = 0; c < C; c++) {
-				// `d̓͒lQƂ
-				float x = lastInput(h, w, c);
-				// ͂Ȃẑ܂ܓ`d
-				if (x > 0.0f) {
-					dInput(h, w, c) = dOut(h, w, c);
-				}
-				else {
-					// ͂ 0 ȉȂz 0
-					dInput(h, w, c) = 0.0f;
-				}
-			}
-		}
-	}
-	// ͑ւ̌zԂ
+	// 入力側の勾配は出力側の勾配をマスクしたもの
+	Tensor3D dInput = dOut;
+	BackwardInPlace(dInput);
+	// 入力側への勾配を返す
 	return dInput;
 }
+
+// その場で逆伝播する
+void ReLULayer::BackwardInPlace(Tensor3D& grad) const
+{
+	// 順伝播と同じ形状であることを確認する
+	assert(grad.GetH() == m_height && grad.GetW() == m_width && grad.GetC() == m_channels);
+	MaskGradient(m_mask.data(), grad.Data(), grad.Size());
+}
+
+// その場で max(0, x) を適用する
+void ReLULayer::ApplyInPlace(float* data, int size, uint64_t* mask)
+{
+	// マスクは立てるビットだけ OR するので先に 0 にする
+	if (mask) { std::fill(mask, mask + MaskWords(size), 0ull); }
+	int i = 0;
+#ifdef RELU_SSE2
+	const __m128 zero = _mm_setzero_ps();
+	for (; i + 4 <= size; i += 4)
+	{
+		__m128 v = _mm_loadu_ps(data + i);
+		// x > 0 の要素だけ全ビット 1 になる比較結果
+		__m128 positive = _mm_cmpgt_ps(v, zero);
+		_mm_storeu_ps(data + i, _mm_and_ps(v, positive));
+		// 比較結果の符号ビット 4 つがそのままマスクの 4 bit になる (i は 4 の倍数なので語をまたがない)
+		if (mask) { mask[i >> 6] |= (uint64_t)_mm_movemask_ps(positive) << (i & 63); }
+	}
+#endif
+	// 残りの要素
+	for (; i < size; i++)
+	{
+		bool positive = data[i] > 0.0f;
+		data[i] = positive ? data[i] : 0.0f;
+		if (mask && positive) { mask[i >> 6] |= 1ull << (i & 63); }
+	}
+}
+
+// マスクのビットが立っていない位置の勾配を 0 にする
+void ReLULayer::MaskGradient(const uint64_t* mask, float* grad, int size)
+{
+	int i = 0;
+#ifdef RELU_SSE2
+	// 4 bit をレーンごとの全ビットマスクに展開するための各レーンのビット
+	const __m128i laneBits = _mm_set_epi32(8, 4, 2, 1);
+	for (; i + 4 <= size; i += 4)
+	{
+		int bits = (int)((mask[i >> 6] >> (i & 63)) & 0xF);
+		// ビットが立っているレーンだけ全ビット 1 にして勾配との AND を取る (0 / 1 を掛けるのと同じ)
+		__m128i lanes = _mm_and_si128(_mm_set1_epi32(bits), laneBits);
+		__m128 keep = _mm_castsi128_ps(_mm_cmpeq_epi32(lanes, laneBits));
+		_mm_storeu_ps(grad + i, _mm_and_ps(_mm_loadu_ps(grad + i), keep));
+	}
+#endif
+	// 残りの要素
+	for (; i < size; i++)
+	{
+		if (!((mask[i >> 6] >> (i & 63)) & 1ull)) { grad[i] = 0.0f; }
+	}
+}
+
+// 活性化後の値から勾配をマスクする
+void ReLULayer::MaskGradient(const float* activation, float* grad, int size)
+{
+	int i = 0;
+#ifdef RELU_SSE2
+	const __m128 zero = _mm_setzero_ps();
+	for (; i + 4 <= size; i += 4)
+	{
+		__m128 keep = _mm_cmpgt_ps(_mm_loadu_ps(activation + i), zero);
+		_mm_storeu_ps(grad + i, _mm_and_ps(_mm_loadu_ps(grad + i), keep));
+	}
+#endif
+	for (; i < size; i++)
+	{
+		grad[i] = (activation[i] > 0.0f) ? grad[i] : 0.0f;
+	}
+}
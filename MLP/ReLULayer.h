@@ -1,35 +1,69 @@
 #pragma once
 // ReLULayer.h
-// wiReLU: Rectified Linear Unitj
-// EForward : y = max(0, x)
-// EBackward: x > 0 ̂ƂzʂAx <= 0 ̂Ƃz 0
-// EłʓI CNN ̊֐
+// 活性化層（ReLU: Rectified Linear Unit）
+// ・Forward : y = max(0, x)
+// ・Backward: x > 0 のときだけ勾配を通し、x <= 0 のとき勾配 0に
+// ・最も一般的な CNN の活性化関数
+#include <vector>
+#include <cstdint>
 #include "Tensor3D.h"
 #include "IBaseLayer.h"
 
-// ReLULayer NX
-// ECNNReLU w
-// EForward : vfƂ max(0, x)
-// EBackward : ͂ 0 ȉʒu͌z 0
+// ReLULayer クラス
+// ・CNNのReLU 活性化層
+// ・Forward : 要素ごとに max(0, x)
+// ・Backward : 入力が 0 以下だった位置は勾配 0に
+// ・逆伝播用には入力を保持せず、x > 0 だった位置を 1 要素 1 bit のマスクで保持する
 class ReLULayer : public IBaseLayer
 {
 public:
-	// RXgN^iɉȂj
+	// コンストラクタ（特に何もなし）
 	ReLULayer() = default;
 
-	// `d
-	// E̓e\ max(0, x) Kp
-	// EBackward Ŏgp邽߁A͂ lastInput ɕۑ
+	// 順伝播する
+	// ・入力テンソルに max(0, x) を適用した新しいテンソルを返す
+	// ・Backward で使用するため、x > 0 の位置をマスクに記録する
 	Tensor3D Forward(const Tensor3D& input) override;
 
-	// t`d
-	// EdOut(o͌z)󂯎 ͂֓`
-	// ElastInput[h,w,c] > 0 ̏ꍇ̂ dOut ʂ
-	// EȊO 0
+	// その場で順伝播する
+	// ・x を max(0, x) で上書きし（前段の出力バッファをそのまま使う）、マスクを記録する
+	void ForwardInPlace(Tensor3D& x);
+
+	// 推論用の順伝播する
+	// ・max(0, x) を適用するがマスクは記録しない
+	Tensor3D Infer(const Tensor3D& input) const override;
+
+	// 逆伝播する
+	// ・dOut(出力勾配)を受け取り 入力へ伝搬する
+	// ・順伝播の入力 x[h,w,c] > 0 の場合のみ dOut を通す
+	// ・それ以外は 0
 	Tensor3D Backward(const Tensor3D& dOut, float learningRate) override;
 
+	// その場で逆伝播する（grad をマスクした勾配で上書きする）
+	void BackwardInPlace(Tensor3D& grad) const;
+	// 逆伝播用に保持しているマスクのバイト数
+	size_t GetStoredBytes() const { return m_mask.size() * sizeof(uint64_t); }
+
+	// ---- ReLU の基本処理（全結合層の ReLU やミニバッチ学習からも使う）----
+	// size 要素のマスクに必要な 64 bit 語の数を返す
+	static size_t MaskWords(int size) { return ((size_t)size + 63) / 64; }
+	// その場で max(0, x) を適用する
+	// ・mask : x > 0 だった位置のビットを立てる格納先（MaskWords(size) 語、不要なら nullptr）
+	static void ApplyInPlace(float* data, int size, uint64_t* mask = nullptr);
+	// その場で max(0, x) を適用する (入力を保存しない)
+	static void ApplyInPlace(Tensor3D& x) { ApplyInPlace(x.Data(), x.Size()); }
+	// マスクのビットが立っていない位置の勾配をその場で 0 にする（勾配にマスクを掛ける）
+	static void MaskGradient(const uint64_t* mask, float* grad, int size);
+	// 活性化後の値 activation が 0 以下の位置の勾配をその場で 0 にする (ミニバッチ学習用)
+	// ・y > 0 と x > 0 は同値なので、入力の代わりに出力で判定できる
+	static void MaskGradient(const float* activation, float* grad, int size);
+	static void MaskGradient(const Tensor3D& activation, Tensor3D& grad) { MaskGradient(activation.Data(), grad.Data(), grad.Size()); }
+
 private:
-	// Forward ̓͂ۑe\(Backward Ŋ֐̓֐Ɏg)
-	Tensor3D lastInput;
+	// 直近の Forward で x > 0 だった位置 (1 要素 1 bit、要素 i は m_mask[i / 64] の bit (i % 64))
+	std::vector<uint64_t> m_mask;
+	// 直近の Forward の入力の形状
+	int m_height = 0;
+	int m_width = 0;
+	int m_channels = 0;
 };
-
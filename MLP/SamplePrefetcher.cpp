@@ -0,0 +1,106 @@
+﻿// SamplePrefetcher.cpp
+// 学習サンプルの先読みパイプライン
+#include "SamplePrefetcher.h"
+#include <algorithm>
+#include <utility>
+
+// コンストラクタ
+SamplePrefetcher::SamplePrefetcher(DecodeFunction decode, int numWorkers, int capacity)
+	: m_decode(std::move(decode)),
+	m_numWorkers(std::max(1, numWorkers)),
+	m_slots(std::max(1, capacity))
+{
+}
+
+// デストラクタ
+SamplePrefetcher::~SamplePrefetcher()
+{
+	Stop();
+}
+
+// 1エポック分の先読みを開始する
+void SamplePrefetcher::Start(const std::vector<int>& order)
+{
+	// 前のエポックのワーカーが残っていれば止める
+	Stop();
+	m_order = order;
+	m_produced = 0;
+	m_consumed = 0;
+	m_stop = false;
+	m_waitTime = {};
+	for (auto& slot : m_slots) { slot.ready = false; }
+	// ワーカースレッドを起動する
+	for (int i = 0; i < m_numWorkers; i++)
+	{
+		m_workers.emplace_back(&SamplePrefetcher::WorkerLoop, this);
+	}
+}
+
+// ワーカースレッドの本体
+// ・空きスロットがある限り、処理順の次の位置を取って変換する
+// ・変換自体はロックの外で行うので、複数ワーカーが並列に動く
+void SamplePrefetcher::WorkerLoop()
+{
+	for (;;)
+	{
+		size_t position;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			// 学習スレッドが受け取っていないサンプルでリングが埋まっている間は待つ
+			m_spaceAvailable.wait(lock, [&] {
+				return m_stop || m_produced >= m_order.size() || m_produced < m_consumed + m_slots.size();
+				});
+			if (m_stop || m_produced >= m_order.size()) { return; }
+			// 変換する位置を確保する
+			position = m_produced++;
+		}
+		// スロットに変換する (このスロットは受け取られるまで他のワーカーが触らない)
+		Slot& slot = m_slots[position % m_slots.size()];
+		slot.index = m_order[position];
+		m_decode(slot.index, slot.tensor);
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			slot.ready = true;
+		}
+		m_sampleReady.notify_all();
+	}
+}
+
+// 次のサンプルを受け取る
+bool SamplePrefetcher::Next(Tensor3D& tensor, int& index)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (m_consumed >= m_order.size()) { return false; }
+	// 処理順どおりのスロットの変換完了を待つ
+	Slot& slot = m_slots[m_consumed % m_slots.size()];
+	if (!slot.ready && !m_stop)
+	{
+		// 待った時間を計測する
+		auto waitStart = std::chrono::steady_clock::now();
+		m_sampleReady.wait(lock, [&] { return slot.ready || m_stop; });
+		m_waitTime += std::chrono::steady_clock::now() - waitStart;
+	}
+	if (!slot.ready) { return false; }
+	// 呼び出し側のバッファと交換して渡す (古いバッファは次の変換で再利用される)
+	std::swap(tensor, slot.tensor);
+	index = slot.index;
+	slot.ready = false;
+	m_consumed++;
+	lock.unlock();
+	// スロットが空いたことをワーカーに知らせる
+	m_spaceAvailable.notify_all();
+	return true;
+}
+
+// 先読みを中断してワーカーを停止する
+void SamplePrefetcher::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_spaceAvailable.notify_all();
+	m_sampleReady.notify_all();
+	for (auto& worker : m_workers) { worker.join(); }
+	m_workers.clear();
+}
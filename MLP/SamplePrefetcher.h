@@ -0,0 +1,91 @@
+﻿// SamplePrefetcher.h
+// 学習サンプルの先読みパイプライン
+// ・ワーカースレッドが画像 → Tensor3D の変換 (デコード・正規化) を先回りして行う
+// ・学習スレッドは Next() で変換済みテンソルを受け取るだけになり、変換待ちが発生しない
+// ・受け取り順は Start() で渡した順序と必ず一致する
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include "Tensor3D.h"
+
+// SamplePrefetcher クラス
+class SamplePrefetcher
+{
+public:
+	// サンプル index を tensor に変換する関数
+	// ・tensor は使い回されるので、形状が同じなら再確保せずに上書きする
+	using DecodeFunction = std::function<void(int index, Tensor3D& tensor)>;
+
+	// コンストラクタ
+	// ・decode     : サンプルの変換関数
+	// ・numWorkers : 変換を行うワーカースレッド数
+	// ・capacity   : 先読みしておくサンプル数 (リングバッファのスロット数)
+	SamplePrefetcher(DecodeFunction decode, int numWorkers = 1, int capacity = 64);
+	// デストラクタ (ワーカーを停止する)
+	~SamplePrefetcher();
+
+	SamplePrefetcher(const SamplePrefetcher&) = delete;
+	SamplePrefetcher& operator=(const SamplePrefetcher&) = delete;
+
+	// 1エポック分の先読みを開始する
+	// ・order : 処理するサンプル index の順序 (シャッフル済みの配列など)
+	void Start(const std::vector<int>& order);
+
+	// 次のサンプルを受け取る
+	// ・tensor : 変換済みテンソル (呼び出し側のバッファと交換するのでコピーは発生しない)
+	// ・index  : サンプル index
+	// ・戻り値 : エポックの終わりなら false
+	bool Next(Tensor3D& tensor, int& index);
+
+	// 先読みを中断してワーカーを停止する
+	void Stop();
+
+	// このエポックで Next() が変換の完了を待った合計時間 (秒)
+	// ・0 に近ければ学習スレッドは変換を待っていない (ワーカー数が足りている)
+	double GetWaitSeconds() const { return std::chrono::duration<double>(m_waitTime).count(); }
+
+private:
+	// ワーカースレッドの本体
+	void WorkerLoop();
+
+	// リングバッファの1スロット
+	struct Slot
+	{
+		// 変換済みテンソル
+		Tensor3D tensor;
+		// サンプル index
+		int index = -1;
+		// 変換が終わって受け取れる状態か
+		bool ready = false;
+	};
+
+private:
+	// 変換関数
+	DecodeFunction m_decode;
+	// ワーカースレッド数
+	int m_numWorkers;
+	// リングバッファ
+	std::vector<Slot> m_slots;
+	// 今エポックの処理順
+	std::vector<int> m_order;
+	// 次にワーカーが変換する位置
+	size_t m_produced = 0;
+	// 次に学習スレッドが受け取る位置
+	size_t m_consumed = 0;
+	// 停止要求
+	bool m_stop = false;
+	// Next() が変換の完了を待った合計時間
+	std::chrono::steady_clock::duration m_waitTime{};
+	// ワーカースレッド
+	std::vector<std::thread> m_workers;
+	// 排他制御
+	std::mutex m_mutex;
+	// ワーカーへの通知 (空きスロットができた / 停止)
+	std::condition_variable m_spaceAvailable;
+	// 学習スレッドへの通知 (スロットの変換が終わった)
+	std::condition_variable m_sampleReady;
+};
@@ -0,0 +1,161 @@
+﻿// Sampler.cpp
+// 学習サンプルの抽出
+#include "Sampler.h"
+#include "Random.h"
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+
+namespace
+{
+	// 1 エポックのサンプル数を [1, 全サンプル数] に収める (0 なら全サンプル数)
+	int ClampSamplesPerEpoch(int samplesPerEpoch, int numSamples)
+	{
+		if (samplesPerEpoch <= 0 || samplesPerEpoch > numSamples) return numSamples;
+		return samplesPerEpoch;
+	}
+}
+
+// ---- UniformSampler ----
+
+// コンストラクタ
+UniformSampler::UniformSampler(int numSamples, int samplesPerEpoch)
+	: m_numSamples(numSamples), m_samplesPerEpoch(ClampSamplesPerEpoch(samplesPerEpoch, numSamples))
+{
+}
+
+// 全サンプルをシャッフルして先頭から使う
+std::vector<int> UniformSampler::SampleEpoch(int epochIndex)
+{
+	std::vector<int> indices(m_numSamples);
+	std::iota(indices.begin(), indices.end(), 0);
+	RandomStream random = MakeRandomStream(RandomPurpose::Shuffle, (uint64_t)epochIndex);
+	random.Shuffle(indices);
+	indices.resize(m_samplesPerEpoch);
+	return indices;
+}
+
+// ---- ClassBalancedSampler ----
+
+// コンストラクタ
+ClassBalancedSampler::ClassBalancedSampler(const std::vector<uint8_t>& labels, int numClasses, int samplesPerEpoch)
+	: m_classIndices(numClasses), m_classCursor(numClasses, 0), m_classRounds(numClasses, 0),
+	m_samplesPerEpoch(ClampSamplesPerEpoch(samplesPerEpoch, (int)labels.size()))
+{
+	for (int i = 0; i < (int)labels.size(); i++)
+	{
+		if (labels[i] < numClasses) { m_classIndices[labels[i]].push_back(i); }
+	}
+	// 最初の並びは使い始めるときにシャッフルする
+	for (int c = 0; c < numClasses; c++) { m_classCursor[c] = m_classIndices[c].size(); }
+}
+
+// 各クラスから同じ数ずつ抽出する
+std::vector<int> ClassBalancedSampler::SampleEpoch(int epochIndex)
+{
+	// サンプルのあるクラス
+	std::vector<int> classes;
+	for (int c = 0; c < (int)m_classIndices.size(); c++)
+	{
+		if (!m_classIndices[c].empty()) { classes.push_back(c); }
+	}
+	std::vector<int> indices;
+	if (classes.empty()) return indices;
+	indices.reserve(m_samplesPerEpoch);
+	// 割り切れない分はエポックごとに別のクラスに回す
+	RandomStream random = MakeRandomStream(RandomPurpose::Sampling, (uint64_t)epochIndex);
+	const int numClasses = (int)classes.size();
+	const int perClass = m_samplesPerEpoch / numClasses;
+	const int remainder = m_samplesPerEpoch % numClasses;
+	const int firstExtra = random.NextInt(numClasses);
+	for (int k = 0; k < numClasses; k++)
+	{
+		const int c = classes[k];
+		std::vector<int>& pool = m_classIndices[c];
+		int take = perClass + (((k - firstExtra + numClasses) % numClasses) < remainder ? 1 : 0);
+		for (int n = 0; n < take; n++)
+		{
+			// クラスの並びを使い切ったらシャッフルし直す (クラスと回数ごとのストリーム)
+			if (m_classCursor[c] >= pool.size())
+			{
+				RandomStream shuffle = MakeRandomStream(RandomPurpose::Sampling, ((uint64_t)(c + 1) << 32) | m_classRounds[c]++);
+				shuffle.Shuffle(pool);
+				m_classCursor[c] = 0;
+			}
+			indices.push_back(pool[m_classCursor[c]++]);
+		}
+	}
+	random.Shuffle(indices);
+	return indices;
+}
+
+// ---- HardExampleSampler ----
+
+// コンストラクタ
+HardExampleSampler::HardExampleSampler(int numSamples, int numClasses, const SamplerConfig& config)
+	: m_config(config),
+	m_losses(numSamples, std::log((float)std::max(numClasses, 2))),
+	m_samplesPerEpoch(ClampSamplesPerEpoch(config.samplesPerEpoch, numSamples))
+{
+	m_config.uniformFraction = std::clamp(m_config.uniformFraction, 0.0f, 1.0f);
+	m_config.lossExponent = std::max(0.0f, m_config.lossExponent);
+}
+
+// 損失に応じた確率で非復元抽出する
+std::vector<int> HardExampleSampler::SampleEpoch(int epochIndex)
+{
+	const int numSamples = (int)m_losses.size();
+	if (m_samplesPerEpoch <= 0) return {};
+	// 損失の重みとその合計
+	std::vector<double> weights(numSamples);
+	double total = 0.0;
+	for (int i = 0; i < numSamples; i++)
+	{
+		weights[i] = std::pow((double)std::max(m_losses[i], 0.0f), (double)m_config.lossExponent);
+		total += weights[i];
+	}
+	// 抽出確率 (全サンプルの損失が 0 なら一様)
+	const double uniform = total > 0.0 ? m_config.uniformFraction : 1.0;
+	const double lossScale = total > 0.0 ? (1.0 - uniform) / total : 0.0;
+	// A-Res 法: キー log(u) / p の大きい順に samplesPerEpoch 個を選ぶ (u^(1/p) の大小と同じ)
+	RandomStream random = MakeRandomStream(RandomPurpose::Sampling, (uint64_t)epochIndex);
+	std::vector<std::pair<double, int>> keys(numSamples);
+	for (int i = 0; i < numSamples; i++)
+	{
+		double p = weights[i] * lossScale + uniform / numSamples;
+		// u は (0, 1] にする (log(0) を避ける)
+		double u = 1.0 - random.NextFloat();
+		keys[i] = { p > 0.0 ? std::log(u) / p : -HUGE_VAL, i };
+	}
+	std::nth_element(keys.begin(), keys.begin() + (m_samplesPerEpoch - 1), keys.end(),
+		[](const std::pair<double, int>& a, const std::pair<double, int>& b) { return a.first > b.first || (a.first == b.first && a.second < b.second); });
+	std::vector<int> indices(m_samplesPerEpoch);
+	for (int n = 0; n < m_samplesPerEpoch; n++) { indices[n] = keys[n].second; }
+	// 選んだサンプルの学習順は損失によらずシャッフルする
+	random.Shuffle(indices);
+	return indices;
+}
+
+// 学習したサンプルの損失を損失キャッシュに書き込む
+void HardExampleSampler::UpdateLosses(const int* indices, const float* losses, int count)
+{
+	for (int n = 0; n < count; n++)
+	{
+		if (indices[n] >= 0 && indices[n] < (int)m_losses.size() && std::isfinite(losses[n])) { m_losses[indices[n]] = losses[n]; }
+	}
+}
+
+// 設定に応じたサンプラを作る
+std::unique_ptr<ISampler> CreateSampler(const SamplerConfig& config, const std::vector<uint8_t>& labels, int numClasses)
+{
+	switch (config.mode)
+	{
+	case SamplerMode::ClassBalanced:
+		return std::make_unique<ClassBalancedSampler>(labels, numClasses, config.samplesPerEpoch);
+	case SamplerMode::HardExample:
+		return std::make_unique<HardExampleSampler>((int)labels.size(), numClasses, config);
+	case SamplerMode::Uniform:
+	default:
+		return std::make_unique<UniformSampler>((int)labels.size(), config.samplesPerEpoch);
+	}
+}
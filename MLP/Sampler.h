@@ -0,0 +1,108 @@
+﻿// Sampler.h
+// 学習サンプルの抽出 (エポックごとにどのサンプルをどの順番で学習するかを決める)
+// ・ISampler : サンプラの共通インターフェース
+// ・UniformSampler       : 全サンプルをシャッフルして先頭から使う (従来の動作)
+// ・ClassBalancedSampler : 各クラスから同じ数ずつ抽出する
+// ・HardExampleSampler   : 損失の大きい (まだ学習できていない) サンプルほど高い確率で抽出する
+//   (損失は TrainBatch の順伝播の副産物として受け取り、サンプルごとにキャッシュする)
+#pragma once
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+// サンプラの種類
+enum class SamplerMode
+{
+	Uniform,
+	ClassBalanced,
+	HardExample,
+};
+
+// サンプラの設定
+struct SamplerConfig
+{
+	// サンプラの種類
+	SamplerMode mode = SamplerMode::Uniform;
+	// 1 エポックで学習するサンプル数 (全サンプル数より多ければ全サンプル数、0 なら全サンプル数)
+	int samplesPerEpoch = 0;
+	// HardExample: 一様に抽出する割合 (損失の小さいサンプルも一定の確率で学習し直し、損失キャッシュを更新する)
+	float uniformFraction = 0.3f;
+	// HardExample: 損失に掛ける指数 (大きいほど損失の大きいサンプルに集中する)
+	float lossExponent = 1.0f;
+};
+
+// ISampler クラス
+// ・サンプラの共通インターフェース
+class ISampler
+{
+public:
+	// 仮想デストラクタ
+	virtual ~ISampler() = default;
+	// 1 エポックで学習するサンプル番号の並びを返す
+	// ・同じ epochIndex なら同じ並びになる (乱数は (用途, エポック) ごとのストリーム)
+	virtual std::vector<int> SampleEpoch(int epochIndex) = 0;
+	// 学習したサンプルの損失を知らせる (TrainBatch の sampleLosses をそのまま渡す)
+	// ・損失を使わないサンプラは何もしない
+	virtual void UpdateLosses(const int* /*indices*/, const float* /*losses*/, int /*count*/) {}
+};
+
+// 全サンプルをシャッフルして先頭から samplesPerEpoch 個を使うサンプラ
+// ・シャッフルは MakeRandomStream(Shuffle, エポック) で、従来のシャッフルと同じ並びになる
+class UniformSampler : public ISampler
+{
+public:
+	UniformSampler(int numSamples, int samplesPerEpoch);
+	std::vector<int> SampleEpoch(int epochIndex) override;
+
+private:
+	// 全サンプル数と 1 エポックのサンプル数
+	int m_numSamples;
+	int m_samplesPerEpoch;
+};
+
+// 各クラスから同じ数ずつ抽出するサンプラ
+// ・クラスごとにシャッフルした並びを順に使い、使い切ったらシャッフルし直す
+//   (エポックをまたいで続きから使うので、少ないクラスのサンプルも偏りなく一巡する)
+// ・抽出したサンプルはクラスが混ざるように全体をシャッフルする
+class ClassBalancedSampler : public ISampler
+{
+public:
+	ClassBalancedSampler(const std::vector<uint8_t>& labels, int numClasses, int samplesPerEpoch);
+	std::vector<int> SampleEpoch(int epochIndex) override;
+
+private:
+	// クラスごとのサンプル番号 (シャッフル済み) と、次に使う位置
+	std::vector<std::vector<int>> m_classIndices;
+	std::vector<size_t> m_classCursor;
+	// クラスごとの並びをシャッフルし直した回数 (シャッフルの乱数ストリームの番号に使う)
+	std::vector<uint32_t> m_classRounds;
+	// 1 エポックのサンプル数
+	int m_samplesPerEpoch;
+};
+
+// 損失の大きいサンプルほど高い確率で抽出するサンプラ (hard example mining)
+// ・抽出確率 p_i = (1 - uniformFraction) × loss_i^lossExponent / Σ + uniformFraction / N
+// ・重み付きの非復元抽出 (同じエポックで同じサンプルを 2 回使わない) を A-Res 法 (キー u^(1/p)) で行う
+// ・まだ学習していないサンプルの損失は一様な予測の損失 log(クラス数) とする
+class HardExampleSampler : public ISampler
+{
+public:
+	HardExampleSampler(int numSamples, int numClasses, const SamplerConfig& config);
+	std::vector<int> SampleEpoch(int epochIndex) override;
+	void UpdateLosses(const int* indices, const float* losses, int count) override;
+
+	// サンプルごとの損失キャッシュ
+	const std::vector<float>& GetLosses() const { return m_losses; }
+
+private:
+	// 設定
+	SamplerConfig m_config;
+	// サンプルごとの直近の損失
+	std::vector<float> m_losses;
+	// 1 エポックのサンプル数
+	int m_samplesPerEpoch;
+};
+
+// 設定に応じたサンプラを作る
+// ・labels : 全サンプルの正解ラベル (ClassBalanced で使う)
+std::unique_ptr<ISampler> CreateSampler(const SamplerConfig& config, const std::vector<uint8_t>& labels, int numClasses);
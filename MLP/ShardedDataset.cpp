@@ -0,0 +1,157 @@
+﻿// ShardedDataset.cpp
+// 圧縮したシャードに分けたデータセットのコンテナファイル
+#include "ShardedDataset.h"
+#include "Lz4.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+	// ファイルの識別子 ("MLPS") とバージョン
+	const uint32_t ShardMagic = 0x53504C4D;
+	// ・2: シャードの中を画像 → ラベルの順にした (1 はラベル → 画像の順)
+	const uint32_t ShardVersion = 2;
+
+	// FNV-1a (32 bit)
+	uint32_t Checksum(const uint8_t* data, size_t size, uint32_t hash = 2166136261u)
+	{
+		for (size_t i = 0; i < size; i++) { hash = (hash ^ data[i]) * 16777619u; }
+		return hash;
+	}
+}
+
+// コンテナファイルを書き出す
+bool WriteShardFile(const std::string& path, size_t count, int rows, int columns, int channels,
+	const ShardImageFunction& getImage, const ShardLabelFunction& getLabel,
+	const ShardWriterOptions& options)
+{
+	if (count == 0 || rows <= 0 || columns <= 0 || channels <= 0) return false;
+	const size_t imageBytes = (size_t)rows * columns * channels;
+	const size_t recordsPerShard = (size_t)std::max(1, options.recordsPerShard);
+	const size_t shards = (count + recordsPerShard - 1) / recordsPerShard;
+
+	ShardFileHeader header = {};
+	header.magic = ShardMagic;
+	header.version = ShardVersion;
+	header.count = count;
+	header.shards = (uint32_t)shards;
+	header.rows = (uint32_t)rows;
+	header.columns = (uint32_t)columns;
+	header.channels = (uint32_t)channels;
+	std::vector<ShardIndexEntry> index(shards);
+
+	// 索引は全シャードを書いた後で確定するので、いったん空けておいて最後に書き直す
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file) return false;
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)index.data(), (std::streamsize)(sizeof(ShardIndexEntry) * shards));
+	uint64_t offset = sizeof(header) + sizeof(ShardIndexEntry) * shards;
+
+	std::vector<uint8_t> raw, compressed;
+	for (size_t shard = 0; shard < shards; shard++)
+	{
+		// 画像をまとめた後にラベルをまとめる (同じ種類のデータが続くほうがよく圧縮できる)
+		// ・ラベルを後ろに置くので、読み込み側は展開した領域の末尾を切り詰めるだけで画像を取り出せる
+		size_t first = shard * recordsPerShard;
+		size_t records = std::min(recordsPerShard, count - first);
+		raw.resize(records * (1 + imageBytes));
+		for (size_t r = 0; r < records; r++)
+		{
+			std::memcpy(&raw[r * imageBytes], getImage(first + r), imageBytes);
+			raw[records * imageBytes + r] = (uint8_t)getLabel(first + r);
+		}
+		compressed.resize(Lz4CompressBound(raw.size()));
+		size_t compressedBytes = Lz4Compress(raw.data(), raw.size(), compressed.data(), compressed.size(), options.compressionLevel);
+		if (compressedBytes == 0) return false;
+		file.write((const char*)compressed.data(), (std::streamsize)compressedBytes);
+		index[shard] = { offset, (uint32_t)compressedBytes, (uint32_t)records, first, Checksum(raw.data(), raw.size()), 0 };
+		offset += compressedBytes;
+	}
+	// 索引を書き込む
+	file.seekp((std::streamoff)sizeof(header));
+	file.write((const char*)index.data(), (std::streamsize)(sizeof(ShardIndexEntry) * shards));
+	return (bool)file;
+}
+
+// ファイルを開いて索引を読み込む
+bool ShardFile::Open(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file) return false;
+	const uint64_t size = (uint64_t)file.tellg();
+	file.seekg(0);
+	ShardFileHeader header;
+	if (!file.read((char*)&header, sizeof(header))) return false;
+	if (header.magic != ShardMagic || header.version != ShardVersion || header.shards == 0
+		|| header.rows == 0 || header.columns == 0 || header.channels == 0) return false;
+	if ((size - sizeof(header)) / sizeof(ShardIndexEntry) < header.shards) return false;
+	std::vector<ShardIndexEntry> index(header.shards);
+	if (!file.read((char*)index.data(), (std::streamsize)(sizeof(ShardIndexEntry) * header.shards))) return false;
+	// シャードのレコード範囲が連続してレコード数と合い、圧縮データがファイルに収まっているか
+	uint64_t next = 0;
+	for (const ShardIndexEntry& entry : index)
+	{
+		if (entry.firstRecord != next || entry.records == 0) return false;
+		if (entry.offset > size || size - entry.offset < entry.compressedBytes) return false;
+		next += entry.records;
+	}
+	if (next != header.count) return false;
+	m_path = path;
+	m_header = header;
+	m_index = std::move(index);
+	std::lock_guard<std::mutex> lock(m_recordMutex);
+	m_cachedShard = -1;
+	return true;
+}
+
+// 全シャードの圧縮後のバイト数の合計
+uint64_t ShardFile::GetCompressedBytes() const
+{
+	uint64_t total = 0;
+	for (const ShardIndexEntry& entry : m_index) { total += entry.compressedBytes; }
+	return total;
+}
+
+// シャードを読み込んで展開する
+bool ShardFile::ReadShard(int shard, std::vector<uint8_t>& images, std::vector<uint8_t>& labels, std::vector<uint8_t>& compressed) const
+{
+	if (shard < 0 || shard >= GetShardCount()) return false;
+	const ShardIndexEntry& entry = m_index[shard];
+	const size_t imageBytes = (size_t)GetImageBytes();
+	// 圧縮データを 1 回の順次読み込みで読む
+	std::ifstream file(m_path, std::ios::binary);
+	file.seekg((std::streamoff)entry.offset);
+	compressed.resize(entry.compressedBytes);
+	if (!file.read((char*)compressed.data(), (std::streamsize)compressed.size())) return false;
+	// 画像とラベルを images に続けて展開し、末尾のラベルだけを取り出して切り詰める (画像は動かさない)
+	const size_t imageRegion = (size_t)entry.records * imageBytes;
+	images.resize(imageRegion + entry.records);
+	if (!Lz4Decompress(compressed.data(), compressed.size(), images.data(), images.size())) return false;
+	if (Checksum(images.data(), images.size()) != entry.checksum) return false;
+	labels.assign(images.begin() + imageRegion, images.end());
+	images.resize(imageRegion);
+	return true;
+}
+
+// 任意のレコードを読み出す
+bool ShardFile::ReadRecord(size_t index, std::vector<uint8_t>& image, int& label)
+{
+	if (index >= GetCount()) return false;
+	// レコード番号からシャードを二分探索する
+	auto it = std::upper_bound(m_index.begin(), m_index.end(), (uint64_t)index,
+		[](uint64_t value, const ShardIndexEntry& entry) { return value < entry.firstRecord; });
+	int shard = (int)(it - m_index.begin()) - 1;
+	std::lock_guard<std::mutex> lock(m_recordMutex);
+	if (shard != m_cachedShard)
+	{
+		m_cachedShard = -1;
+		if (!ReadShard(shard, m_cachedImages, m_cachedLabels, m_cachedCompressed)) return false;
+		m_cachedShard = shard;
+	}
+	const size_t imageBytes = (size_t)GetImageBytes();
+	size_t position = index - (size_t)m_index[shard].firstRecord;
+	image.assign(m_cachedImages.begin() + position * imageBytes, m_cachedImages.begin() + (position + 1) * imageBytes);
+	label = m_cachedLabels[position];
+	return true;
+}
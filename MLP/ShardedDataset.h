@@ -0,0 +1,109 @@
+﻿// ShardedDataset.h
+// 圧縮したシャードに分けたデータセットのコンテナファイル
+// ・レコード (ラベル + HWC の uint8 画像) を一定数ずつシャードにまとめ、シャードごとに LZ4 で圧縮する
+// ・ファイルの先頭にシャードの索引 (位置・圧縮後のサイズ・レコード範囲) を置くので、任意のレコードを
+//   そのシャードだけ読んで展開すれば取り出せる
+// ・シャードは互いに独立しているので、複数のスレッドで別々のシャードを同時に展開できる
+//   (StreamingDataset::AddShardFile で入力パイプラインに組み込む)
+//
+// ファイル形式 (値はすべてホストのバイト順)
+// ・ヘッダ : ShardFileHeader
+// ・索引   : ShardIndexEntry × シャード数
+// ・シャード : LZ4 ブロック (展開すると画像 × レコード数 + ラベル × レコード数)
+#pragma once
+#include <vector>
+#include <string>
+#include <mutex>
+#include <functional>
+#include <cstdint>
+
+// コンテナファイルのヘッダ
+struct ShardFileHeader
+{
+	// 識別子 ("MLPS") とバージョン
+	uint32_t magic;
+	uint32_t version;
+	// レコード数とシャード数
+	uint64_t count;
+	uint32_t shards;
+	// 画像の形状
+	uint32_t rows;
+	uint32_t columns;
+	uint32_t channels;
+};
+
+// シャードの索引の1要素
+struct ShardIndexEntry
+{
+	// 圧縮データの位置 (ファイル先頭からのバイト数) と圧縮後のバイト数
+	uint64_t offset;
+	uint32_t compressedBytes;
+	// このシャードのレコード数
+	uint32_t records;
+	// 先頭レコードの番号
+	uint64_t firstRecord;
+	// 展開したデータのチェックサム (FNV-1a、壊れたシャードを検出する)
+	uint32_t checksum;
+	uint32_t reserved;
+};
+
+// コンテナファイルを書き出すときの設定
+struct ShardWriterOptions
+{
+	// 1 シャードのレコード数 (展開・読み込みの単位、StreamingDataset のブロックになる)
+	int recordsPerShard = 2048;
+	// LZ4 の圧縮レベル (Lz4Compress の level)
+	int compressionLevel = 6;
+};
+
+// サンプル index の画像 (rows × columns × channels バイト、HWC の並び) を返す関数
+using ShardImageFunction = std::function<const uint8_t*(size_t index)>;
+// サンプル index の正解ラベルを返す関数
+using ShardLabelFunction = std::function<int(size_t index)>;
+
+// コンテナファイルを書き出す (成功すれば true)
+bool WriteShardFile(const std::string& path, size_t count, int rows, int columns, int channels,
+	const ShardImageFunction& getImage, const ShardLabelFunction& getLabel,
+	const ShardWriterOptions& options = ShardWriterOptions());
+
+// ShardFile クラス
+// ・コンテナファイルの索引を読み込み、シャードやレコードを読み出す
+// ・ReadShard は複数スレッドから同時に呼び出せる (呼び出しごとにファイルを開いて読む)
+class ShardFile
+{
+public:
+	// ファイルを開いて索引を読み込む (形式が違う・索引が壊れていれば false)
+	bool Open(const std::string& path);
+
+	// レコード数・シャード数・画像の形状
+	size_t GetCount() const { return (size_t)m_header.count; }
+	int GetShardCount() const { return (int)m_index.size(); }
+	int GetRows() const { return (int)m_header.rows; }
+	int GetColumns() const { return (int)m_header.columns; }
+	int GetChannels() const { return (int)m_header.channels; }
+	int GetImageBytes() const { return GetRows() * GetColumns() * GetChannels(); }
+	// シャードの索引
+	const ShardIndexEntry& GetShard(int shard) const { return m_index[shard]; }
+	// 全シャードの圧縮後のバイト数の合計
+	uint64_t GetCompressedBytes() const;
+
+	// シャードを読み込んで展開する
+	// ・images : レコード数 × 画像バイト数、labels : レコード数
+	// ・compressed : 圧縮データを読み込む作業領域 (スレッドごとに使い回す)
+	bool ReadShard(int shard, std::vector<uint8_t>& images, std::vector<uint8_t>& labels, std::vector<uint8_t>& compressed) const;
+	// 任意のレコードを読み出す (直前に展開したシャードは展開し直さない)
+	bool ReadRecord(size_t index, std::vector<uint8_t>& image, int& label);
+
+private:
+	// ファイルのパス
+	std::string m_path;
+	// ヘッダと索引
+	ShardFileHeader m_header = {};
+	std::vector<ShardIndexEntry> m_index;
+	// ReadRecord で最後に展開したシャード (m_recordMutex で保護する)
+	std::mutex m_recordMutex;
+	int m_cachedShard = -1;
+	std::vector<uint8_t> m_cachedImages;
+	std::vector<uint8_t> m_cachedLabels;
+	std::vector<uint8_t> m_cachedCompressed;
+};
@@ -0,0 +1,113 @@
+﻿// SoftmaxCrossEntropy.cpp
+// Softmax + 交差エントロピーの融合カーネル
+#include "SoftmaxCrossEntropy.h"
+#include <algorithm>
+#include <vector>
+#include "FastMath.h"
+
+namespace
+{
+	// 行ごとの log をまとめて計算する行数 (スタック上の配列に置くので、呼び出しごとのヒープ確保が起きない)
+	constexpr int LogChunkRows = 64;
+}
+
+// Softmax を計算する
+void Softmax(const float* logits, int batchSize, int numClasses, float* probabilities)
+{
+	for (int b = 0; b < batchSize; b++)
+	{
+		// この行の入力と出力
+		const float* z = logits + (size_t)b * numClasses;
+		float* y = probabilities + (size_t)b * numClasses;
+		// Softmax の安定化のため max(logits) を取得
+		float maxValue = *std::max_element(z, z + numClasses);
+		// exp の総和で割って確率分布にする (数値安定化のため最大値を引いてから exp() を計算する)
+		float inverseSum = 1.0f / FastExpShiftedSum(z, maxValue, y, numClasses);
+		for (int i = 0; i < numClasses; i++)
+		{
+			y[i] *= inverseSum;
+		}
+	}
+}
+
+// Softmax + 交差エントロピー損失と勾配を計算する
+// ・損失 = log Σ exp(z) - Σ t[i]・z[i] = log(sum) - Σ t[i]・(z[i] - max)
+//   (確率の log を取らないので log(0) を防ぐ eps が要らない)
+// ・勾配 = (softmax(z) - t) / batchSize
+// ・t = (1 - ε)・onehot(label) + ε / numClasses (ε = 0 なら one-hot そのもの)
+float SoftmaxCrossEntropy(const float* logits, const int* labels, int batchSize, int numClasses,
+	float* probabilities, float* dLogits, float labelSmoothing, float* sampleLosses)
+{
+	// バッチ平均を取るための係数
+	const float inverseBatch = 1.0f / (float)batchSize;
+	// 教師分布のうち全クラスに均等に配る確率 (ε / numClasses)
+	const float uniformTarget = labelSmoothing / (float)numClasses;
+	// 正解クラスに上乗せする確率 (1 - ε)
+	const float labelTarget = 1.0f - labelSmoothing;
+	// 行ごとの log Σ exp(z - max) と Σ t[i]・(z[i] - max) (log は LogChunkRows 行ごとにまとめて計算する)
+	// ・FastLogArray は要素の位置によらず FastLog と同じ値になるので、区切り方で結果は変わらない
+	float rowSums[LogChunkRows];
+	float rowTargets[LogChunkRows];
+	// 損失だけが必要な場合に exp(z - max) を書き捨てる作業領域 (スレッドごとに使い回す)
+	thread_local std::vector<float> scratch;
+	if (!probabilities && !dLogits && (int)scratch.size() < numClasses) { scratch.resize(numClasses); }
+	float totalLoss = 0.0f;
+	for (int b = 0; b < batchSize; b++)
+	{
+		// この行のまとめて log を計算する位置
+		const int row = b % LogChunkRows;
+		// この行の入力と正解ラベル
+		const float* z = logits + (size_t)b * numClasses;
+		int label = labels[b];
+		// Softmax の安定化のため max(logits) を取得
+		float maxValue = *std::max_element(z, z + numClasses);
+		// exp(z - max) の格納先 (確率を返す場合はそちら、返さない場合は勾配の領域を使う)
+		// (どちらも不要な場合は作業領域に書き捨てて総和だけを使う)
+		float* y = probabilities ? probabilities + (size_t)b * numClasses
+			: (dLogits ? dLogits + (size_t)b * numClasses : nullptr);
+		float sum = FastExpShiftedSum(z, maxValue, y ? y : scratch.data(), numClasses);
+		// 教師分布側の項 Σ t[i]・(z[i] - max)
+		float targetDotLogits = labelTarget * (z[label] - maxValue);
+		if (uniformTarget != 0.0f)
+		{
+			// スムージング分: ε / numClasses × Σ (z[i] - max)
+			float shiftedSum = 0.0f;
+			for (int i = 0; i < numClasses; i++) { shiftedSum += z[i] - maxValue; }
+			targetDotLogits += uniformTarget * shiftedSum;
+		}
+		rowSums[row] = sum;
+		rowTargets[row] = targetDotLogits;
+		if (y)
+		{
+			// exp を総和で割って確率にする
+			float inverseSum = 1.0f / sum;
+			for (int i = 0; i < numClasses; i++)
+			{
+				y[i] *= inverseSum;
+			}
+			// 勾配 (y - t) / batchSize を求める
+			if (dLogits)
+			{
+				float* dz = dLogits + (size_t)b * numClasses;
+				for (int i = 0; i < numClasses; i++)
+				{
+					dz[i] = (y[i] - uniformTarget) * inverseBatch;
+				}
+				// 正解クラスの位置だけ (1 - ε) を追加で引く
+				dz[label] -= labelTarget * inverseBatch;
+			}
+		}
+		// 区切りの最後の行か、バッチの最後の行まで来たら負の対数尤度 log(sum) - Σ t[i]・(z[i] - max) を合計する
+		if (row != LogChunkRows - 1 && b != batchSize - 1) { continue; }
+		const int first = b - row;
+		FastLogArray(rowSums, rowSums, row + 1);
+		for (int k = 0; k <= row; k++)
+		{
+			float rowLoss = rowSums[k] - rowTargets[k];
+			if (sampleLosses) { sampleLosses[first + k] = rowLoss; }
+			totalLoss += rowLoss;
+		}
+	}
+	// バッチ平均の損失を返す
+	return totalLoss * inverseBatch;
+}
@@ -0,0 +1,22 @@
+﻿// SoftmaxCrossEntropy.h
+// Softmax と交差エントロピー損失を1パスで計算するカーネル
+// ・log-softmax (logsumexp) で数値安定に損失を求める
+// ・教師データは整数ラベル (one-hot ベクトルは不要)
+// ・バッチ (batchSize × numClasses の行優先配列) をまとめて処理する
+#pragma once
+
+// Softmax を計算する
+// ・logits        : 入力スコア (batchSize × numClasses)
+// ・probabilities : 出力確率 (batchSize × numClasses、logits と同じ配列でもよい)
+void Softmax(const float* logits, int batchSize, int numClasses, float* probabilities);
+
+// Softmax + 交差エントロピー損失と、logits に対する勾配を同時に計算する
+// ・logits        : 入力スコア (batchSize × numClasses)
+// ・labels        : 正解クラス ID (batchSize 個)
+// ・probabilities : Softmax 出力の格納先 (不要なら nullptr)
+// ・dLogits       : 勾配 dL/dz = (y - t) / batchSize の格納先 (不要なら nullptr)
+// ・labelSmoothing: ラベルスムージング ε (教師分布 t = (1 - ε)・onehot + ε / numClasses)
+// ・sampleLosses  : サンプルごとの損失の格納先 (batchSize 個、不要なら nullptr)
+// ・戻り値        : バッチ平均の損失
+float SoftmaxCrossEntropy(const float* logits, const int* labels, int batchSize, int numClasses,
+	float* probabilities, float* dLogits, float labelSmoothing = 0.0f, float* sampleLosses = nullptr);
@@ -0,0 +1,370 @@
+﻿// StreamingDataset.cpp
+// メモリに載りきらないデータセットを順次読み込むストリーミングリーダー
+#include "StreamingDataset.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+	// IDX ヘッダのマジック番号（画像 idx3 / ラベル idx1）
+	const uint32_t IdxImageMagic = 0x00000803;
+	const uint32_t IdxLabelMagic = 0x00000801;
+	// CIFAR-10 バイナリの画像の形状と 1 レコードのバイト数（ラベル 1 byte + RGB プレーン）
+	const int CifarSide = 32;
+	const int CifarChannels = 3;
+	const int CifarRecordBytes = 1 + CifarSide * CifarSide * CifarChannels;
+
+	// IDX ヘッダの整数を Big-endian で読み込む
+	bool ReadBigEndian(std::ifstream& stream, uint32_t& value)
+	{
+		unsigned char bytes[4];
+		if (!stream.read((char*)bytes, 4)) return false;
+		value = ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+		return true;
+	}
+}
+
+// コンストラクタ
+StreamingDataset::StreamingDataset(const StreamingDatasetConfig& config)
+	: m_config(config)
+{
+	m_config.blockRecords = std::max(1, m_config.blockRecords);
+	m_config.shuffleBufferRecords = std::max(1, m_config.shuffleBufferRecords);
+	m_config.prefetchBlocks = std::max(1, m_config.prefetchBlocks);
+	m_config.readerThreads = std::max(1, m_config.readerThreads);
+}
+
+// デストラクタ
+StreamingDataset::~StreamingDataset()
+{
+	Stop();
+}
+
+// 画像の形状を確認して設定する
+bool StreamingDataset::SetShape(int rows, int columns, int channels)
+{
+	if (rows <= 0 || columns <= 0) return false;
+	if (m_sources.empty())
+	{
+		m_rows = rows;
+		m_columns = columns;
+		m_channels = channels;
+		return true;
+	}
+	return rows == m_rows && columns == m_columns && channels == m_channels;
+}
+
+// IDX 形式の画像ファイルとラベルファイルの組を追加する
+bool StreamingDataset::AddIdxFiles(const std::string& imagePath, const std::string& labelPath)
+{
+	std::ifstream images(imagePath, std::ios::binary);
+	std::ifstream labels(labelPath, std::ios::binary);
+	if (!images || !labels) return false;
+	// 画像: マジック番号・画像数・行数・列数、ラベル: マジック番号・ラベル数
+	uint32_t imageMagic, numImages, rows, columns, labelMagic, numLabels;
+	if (!ReadBigEndian(images, imageMagic) || !ReadBigEndian(images, numImages)
+		|| !ReadBigEndian(images, rows) || !ReadBigEndian(images, columns)) return false;
+	if (!ReadBigEndian(labels, labelMagic) || !ReadBigEndian(labels, numLabels)) return false;
+	if (imageMagic != IdxImageMagic || labelMagic != IdxLabelMagic || numImages != numLabels) return false;
+	if (!SetShape((int)rows, (int)columns, 1)) return false;
+	Source source;
+	source.imagePath = imagePath;
+	source.labelPath = labelPath;
+	source.records = numImages;
+	source.imageOffset = 16;
+	source.labelOffset = 8;
+	m_sources.push_back(source);
+	m_totalRecords += source.records;
+	return true;
+}
+
+// CIFAR-10 バイナリ形式のファイルを追加する
+bool StreamingDataset::AddCifarFile(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file) return false;
+	uint64_t size = (uint64_t)file.tellg();
+	if (size == 0 || size % CifarRecordBytes != 0) return false;
+	if (!SetShape(CifarSide, CifarSide, CifarChannels)) return false;
+	Source source;
+	source.format = SourceFormat::Cifar;
+	source.imagePath = path;
+	source.records = (size_t)(size / CifarRecordBytes);
+	m_sources.push_back(source);
+	m_totalRecords += source.records;
+	return true;
+}
+
+// 圧縮したシャードのコンテナファイルを追加する
+bool StreamingDataset::AddShardFile(const std::string& path)
+{
+	auto shards = std::make_shared<ShardFile>();
+	if (!shards->Open(path)) return false;
+	if (!SetShape(shards->GetRows(), shards->GetColumns(), shards->GetChannels())) return false;
+	Source source;
+	source.format = SourceFormat::Shards;
+	source.imagePath = path;
+	source.records = shards->GetCount();
+	source.shards = std::move(shards);
+	m_sources.push_back(source);
+	m_totalRecords += source.records;
+	return true;
+}
+
+// シャッフルバッファと先読みブロックが最大で使うバイト数
+size_t StreamingDataset::GetMaxBufferBytes() const
+{
+	const size_t recordBytes = (size_t)GetImageBytes() + 1;
+	// 1 ブロックの最大レコード数（コンテナファイルはシャードの大きさで決まる）
+	size_t blockRecords = (size_t)m_config.blockRecords;
+	for (const Source& source : m_sources)
+	{
+		if (source.format != SourceFormat::Shards) continue;
+		for (int shard = 0; shard < source.shards->GetShardCount(); shard++)
+		{
+			blockRecords = std::max(blockRecords, (size_t)source.shards->GetShard(shard).records);
+		}
+	}
+	// シャッフルバッファ + 先読みの枠 + 取り出し中のブロック + 各読み込みスレッドが読み込み中のブロック
+	// ・圧縮データの作業領域は含まない
+	size_t blocks = (size_t)PrefetchWindow() + 1 + m_config.readerThreads;
+	return recordBytes * ((size_t)m_config.shuffleBufferRecords + blocks * blockRecords);
+}
+
+// 1 エポック分の読み込みを開始する
+void StreamingDataset::StartEpoch(int epochIndex)
+{
+	// 前のエポックの読み込みが残っていれば止める
+	Stop();
+	// 全ファイルをブロックに分ける（ブロックはファイルをまたがない、コンテナファイルは1シャードが1ブロック）
+	std::vector<BlockRange> order;
+	for (int s = 0; s < (int)m_sources.size(); s++)
+	{
+		if (m_sources[s].format == SourceFormat::Shards)
+		{
+			const ShardFile& shards = *m_sources[s].shards;
+			for (int shard = 0; shard < shards.GetShardCount(); shard++) { order.push_back({ s, (size_t)shard, shards.GetShard(shard).records }); }
+			continue;
+		}
+		for (size_t first = 0; first < m_sources[s].records; first += m_config.blockRecords)
+		{
+			order.push_back({ s, first, std::min((size_t)m_config.blockRecords, m_sources[s].records - first) });
+		}
+	}
+	// ブロックの順番をシャッフルし、同じストリームの続きでシャッフルバッファの取り出し位置を選ぶ
+	m_random = MakeRandomStream(RandomPurpose::Shuffle, (uint64_t)epochIndex);
+	m_random.Shuffle(order);
+	// 取り出し側の状態を初期化する（前のエポックのブロックは領域を使い回す）
+	RecycleBlock(m_current);
+	for (Block& block : m_readyBlocks) { RecycleBlock(block); }
+	// 同時に使うブロックの数 (先読みの枠 + 取り出し中 + 各読み込みスレッド) を超えた分は解放する
+	m_freeBlocks.resize(std::min(m_freeBlocks.size(), (size_t)PrefetchWindow() + 1 + m_config.readerThreads));
+	m_readyBlocks.clear();
+	m_current = Block();
+	m_currentPosition = 0;
+	m_bufferImages.resize((size_t)m_config.shuffleBufferRecords * GetImageBytes());
+	m_bufferLabels.resize(m_config.shuffleBufferRecords);
+	m_bufferCount = 0;
+	m_order = std::move(order);
+	m_nextRead = 0;
+	m_nextTake = 0;
+	m_failedPosition = SIZE_MAX;
+	m_stop = false;
+	{
+		std::lock_guard<std::mutex> lock(m_turnMutex);
+		m_nextPosition = 0;
+		m_turnStopped = false;
+	}
+	for (int t = 0; t < m_config.readerThreads; t++) { m_readers.emplace_back(&StreamingDataset::ReaderLoop, this); }
+}
+
+// 読み込みスレッドの本体
+void StreamingDataset::ReaderLoop()
+{
+	// 読み込み中のブロックと、CIFAR のレコード・圧縮データを読む作業領域
+	Block block;
+	std::vector<uint8_t> scratch;
+	const size_t window = (size_t)PrefetchWindow();
+	for (;;)
+	{
+		// 次の順番のブロックを受け持つ（先読みの枠が埋まっていれば、取り出し側がブロックを受け取るまで待つ）
+		size_t position;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_spaceAvailable.wait(lock, [&] {
+				return m_stop || m_nextRead >= std::min(m_order.size(), m_failedPosition) || m_nextRead < m_nextTake + window;
+				});
+			if (m_stop || m_nextRead >= std::min(m_order.size(), m_failedPosition))
+			{
+				// 手元のブロックの領域は次のエポックで使い回す
+				RecycleBlock(block);
+				return;
+			}
+			position = m_nextRead++;
+			// 受け持った順番の枠を用意する
+			while (m_readyBlocks.size() <= position - m_nextTake) { m_readyBlocks.emplace_back(); }
+			// 取り出し側が使い終わったブロックがあれば、その領域に読む
+			if (!m_freeBlocks.empty())
+			{
+				std::swap(block, m_freeBlocks.back());
+				m_freeBlocks.pop_back();
+			}
+		}
+		// 読み込み・展開自体はロックの外で行う
+		bool succeeded = ReadBlock(m_order[position], block, scratch);
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (succeeded)
+			{
+				// 取り出し側は自分の枠より先には進まないので、枠の位置は受け持ったときから変わらない
+				Block& slot = m_readyBlocks[position - m_nextTake];
+				std::swap(slot, block);
+				slot.ready = true;
+			}
+			else
+			{
+				// 読み込みに失敗したら、そのブロックの手前でエポックを終える
+				m_failedPosition = std::min(m_failedPosition, position);
+			}
+		}
+		m_blockReady.notify_one();
+		m_spaceAvailable.notify_all();
+	}
+}
+
+// 1 ブロックを読み込む
+bool StreamingDataset::ReadBlock(const BlockRange& range, Block& block, std::vector<uint8_t>& scratch)
+{
+	const Source& source = m_sources[range.source];
+	const size_t imageBytes = (size_t)GetImageBytes();
+	if (source.format == SourceFormat::Shards)
+	{
+		// コンテナファイル: シャードの圧縮データを 1 回で読んで展開する (領域の大きさは ReadShard が決める)
+		return source.shards->ReadShard((int)range.first, block.images, block.labels, scratch);
+	}
+	block.images.resize(range.count * imageBytes);
+	block.labels.resize(range.count);
+	if (source.format == SourceFormat::Idx)
+	{
+		// IDX: 画像とラベルはそれぞれのファイルの中で連続しているので、1 回ずつ読むだけで済む
+		std::ifstream images(source.imagePath, std::ios::binary);
+		std::ifstream labels(source.labelPath, std::ios::binary);
+		images.seekg((std::streamoff)(source.imageOffset + range.first * imageBytes));
+		labels.seekg((std::streamoff)(source.labelOffset + range.first));
+		images.read((char*)block.images.data(), (std::streamsize)block.images.size());
+		labels.read((char*)block.labels.data(), (std::streamsize)block.labels.size());
+		return (bool)images && (bool)labels;
+	}
+	// CIFAR: レコード (ラベル + RGB プレーン) をまとめて読み、ラベルと HWC の画像に分ける
+	std::ifstream file(source.imagePath, std::ios::binary);
+	file.seekg((std::streamoff)(range.first * CifarRecordBytes));
+	scratch.resize(range.count * CifarRecordBytes);
+	if (!file.read((char*)scratch.data(), (std::streamsize)scratch.size())) return false;
+	const int planeBytes = CifarSide * CifarSide;
+	for (size_t r = 0; r < range.count; r++)
+	{
+		const uint8_t* record = &scratch[r * CifarRecordBytes];
+		uint8_t* image = &block.images[r * imageBytes];
+		block.labels[r] = record[0];
+		for (int pixel = 0; pixel < planeBytes; pixel++)
+		{
+			image[pixel * CifarChannels + 0] = record[1 + pixel];
+			image[pixel * CifarChannels + 1] = record[1 + planeBytes + pixel];
+			image[pixel * CifarChannels + 2] = record[1 + planeBytes * 2 + pixel];
+		}
+	}
+	return true;
+}
+
+// 使い終わったブロックの領域を読み込みスレッドに戻す
+void StreamingDataset::RecycleBlock(Block& block)
+{
+	// 領域を確保していない空のブロックは戻さない
+	if (block.images.capacity() == 0) return;
+	block.ready = false;
+	m_freeBlocks.push_back(std::move(block));
+}
+
+// 読み込みスレッドから次のブロックを受け取る
+bool StreamingDataset::TakeBlock()
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		// 順番どおりの次のブロックが読み込まれるまで待つ（最後のブロックの後と失敗したブロックでは待たない）
+		const size_t end = std::min(m_order.size(), m_failedPosition);
+		m_blockReady.wait(lock, [&] {
+			return m_stop || m_nextTake >= end || (!m_readyBlocks.empty() && m_readyBlocks.front().ready);
+			});
+		if (m_stop || m_nextTake >= end) return false;
+		// 使い終わったブロックと交換して受け取り、使い終わった領域は読み込みスレッドに戻す
+		std::swap(m_current, m_readyBlocks.front());
+		RecycleBlock(m_readyBlocks.front());
+		m_readyBlocks.pop_front();
+		m_nextTake++;
+	}
+	m_currentPosition = 0;
+	m_spaceAvailable.notify_all();
+	return true;
+}
+
+// 次のサンプルを受け取る
+bool StreamingDataset::Next(std::vector<uint8_t>& image, int& label)
+{
+	const size_t imageBytes = (size_t)GetImageBytes();
+	// シャッフルバッファが一杯になるまで、ブロックの先頭から順にレコードを入れる
+	while (m_bufferCount < m_bufferLabels.size())
+	{
+		if (m_currentPosition >= m_current.labels.size() && !TakeBlock()) break;
+		std::memcpy(&m_bufferImages[m_bufferCount * imageBytes], &m_current.images[m_currentPosition * imageBytes], imageBytes);
+		m_bufferLabels[m_bufferCount] = m_current.labels[m_currentPosition];
+		m_bufferCount++;
+		m_currentPosition++;
+	}
+	// 入力を使い切ってバッファも空ならエポックの終わり
+	if (m_bufferCount == 0) return false;
+	// バッファからランダムに1つ取り出し、空いた位置には最後のレコードを移す
+	size_t pick = (size_t)m_random.NextInt((int)m_bufferCount);
+	image.resize(imageBytes);
+	std::memcpy(image.data(), &m_bufferImages[pick * imageBytes], imageBytes);
+	label = m_bufferLabels[pick];
+	m_bufferCount--;
+	if (pick != m_bufferCount)
+	{
+		std::memcpy(&m_bufferImages[pick * imageBytes], &m_bufferImages[m_bufferCount * imageBytes], imageBytes);
+		m_bufferLabels[pick] = m_bufferLabels[m_bufferCount];
+	}
+	return true;
+}
+
+// エポックの中で position 番目のサンプルを受け取る
+bool StreamingDataset::NextInOrder(size_t position, std::vector<uint8_t>& image, int& label)
+{
+	std::unique_lock<std::mutex> lock(m_turnMutex);
+	m_turnChanged.wait(lock, [&] { return m_turnStopped || m_nextPosition == position; });
+	if (m_turnStopped) return false;
+	// シャッフルバッファの取り出しは 1 スレッドずつ番号順に行う（拡張・正規化は呼び出し元で並列に行う）
+	bool received = Next(image, label);
+	m_nextPosition++;
+	lock.unlock();
+	m_turnChanged.notify_all();
+	return received;
+}
+
+// 読み込みを中断して読み込みスレッドを停止する
+void StreamingDataset::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_turnMutex);
+		m_turnStopped = true;
+	}
+	m_turnChanged.notify_all();
+	m_spaceAvailable.notify_all();
+	m_blockReady.notify_all();
+	for (std::thread& reader : m_readers) { reader.join(); }
+	m_readers.clear();
+}
@@ -0,0 +1,192 @@
+﻿// StreamingDataset.h
+// メモリに載りきらないデータセットを順次読み込むストリーミングリーダー
+// ・IDX (画像 idx3 + ラベル idx1) と CIFAR-10 バイナリのファイルを、一定レコード数のブロック単位で読む
+// ・圧縮したシャードのコンテナファイル (ShardedDataset.h) はシャードを1ブロックとして読み、展開する
+// ・ブロックの読み込み・展開は複数のスレッドで並列に行う (取り出す順番はスレッド数によらず同じ)
+// ・ブロックの中は先頭から連続して読むので、ディスクへのアクセスはブロックごとの大きな順次読み込みになる
+// ・エポックごとにブロックの順番をシャッフルし、さらにシャッフルバッファで個々のサンプルの順番を混ぜる
+// ・メモリ使用量は (シャッフルバッファ + 先読みブロック) のレコード数で決まり、データセット全体の大きさによらない
+// ・同じ形状なら複数のファイルをつなげて1つのデータセットとして扱える
+#pragma once
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+#include "Random.h"
+#include "ShardedDataset.h"
+
+// ストリーミングリーダーの設定
+struct StreamingDatasetConfig
+{
+	// 1 ブロックのレコード数（1 回の順次読み込みの単位、シャッフルの粒度）
+	int blockRecords = 4096;
+	// シャッフルバッファのレコード数（大きいほど順番がよく混ざる）
+	int shuffleBufferRecords = 8192;
+	// 読み込みスレッドが先読みしておくブロック数
+	int prefetchBlocks = 2;
+	// ブロックを読み込み・展開するスレッド数 (圧縮したシャードの展開を並列化する)
+	int readerThreads = 2;
+};
+
+// StreamingDataset クラス
+// ・読み込みスレッドがブロックを先読みし、Next() を呼ぶスレッドがシャッフルバッファからサンプルを取り出す
+// ・読み込みスレッドはブロックを並列に読むが、Next() にはシャッフルしたブロックの順番どおりに渡す
+// ・画像はファイル形式によらず HWC の並びの uint8 で返す（CIFAR の RGB プレーンは読み込み時に並べ替える）
+class StreamingDataset
+{
+public:
+	explicit StreamingDataset(const StreamingDatasetConfig& config = StreamingDatasetConfig());
+	// デストラクタ（読み込みスレッドを停止する）
+	~StreamingDataset();
+
+	StreamingDataset(const StreamingDataset&) = delete;
+	StreamingDataset& operator=(const StreamingDataset&) = delete;
+
+	// IDX 形式の画像ファイルとラベルファイルの組を追加する（ヘッダだけを読む）
+	// ・画像数が一致しない、または既に追加したファイルと画像の形状が違えば false
+	bool AddIdxFiles(const std::string& imagePath, const std::string& labelPath);
+	// CIFAR-10 バイナリ形式のファイル（data_batch_1.bin など）を追加する
+	// ・レコード長の倍数でない、または既に追加したファイルと画像の形状が違えば false
+	bool AddCifarFile(const std::string& path);
+	// 圧縮したシャードのコンテナファイル (WriteShardFile で書き出したもの) を追加する
+	// ・索引だけを読む、既に追加したファイルと画像の形状が違えば false
+	bool AddShardFile(const std::string& path);
+
+	// 1 エポック分の読み込みを開始する
+	// ・ブロックの順番とシャッフルバッファの取り出し順は MakeRandomStream(Shuffle, epochIndex) で決まる
+	void StartEpoch(int epochIndex);
+	// 次のサンプルを受け取る
+	// ・image : HWC の並びの画像（GetImageBytes() バイト、サイズが違えば確保し直す）
+	// ・label : 正解ラベル
+	// ・戻り値 : エポックの終わりなら false
+	bool Next(std::vector<uint8_t>& image, int& label);
+	// エポックの中で position 番目のサンプルを受け取る（複数のスレッドから呼んでよい）
+	// ・position の順に Next() を呼ぶので、前の番号が受け取られるまで待つ（呼ぶ順番によらず結果は同じ）
+	// ・SamplePrefetcher のワーカーから呼び、拡張・正規化を受け取ったスレッドで並列に行うために使う
+	// ・エポックの中の番号は 0 から抜けなく呼ぶこと
+	bool NextInOrder(size_t position, std::vector<uint8_t>& image, int& label);
+	// 読み込みを中断して読み込みスレッドを停止する
+	void Stop();
+
+	// 全ファイルのレコード数の合計
+	size_t GetCount() const { return m_totalRecords; }
+	// 画像の形状
+	int GetImageRows() const { return m_rows; }
+	int GetImageColumns() const { return m_columns; }
+	int GetImageChannels() const { return m_channels; }
+	// 画像1枚のバイト数
+	int GetImageBytes() const { return m_rows * m_columns * m_channels; }
+	// シャッフルバッファと先読みブロックが最大で使うバイト数（データセットの大きさによらない上限）
+	size_t GetMaxBufferBytes() const;
+
+private:
+	// ファイルの形式
+	enum class SourceFormat
+	{
+		Idx,
+		Cifar,
+		Shards,
+	};
+	// 読み込むファイル（1 ファイル = IDX の組 / CIFAR のバッチファイル / シャードのコンテナファイル 1 つ）
+	struct Source
+	{
+		// ファイルの形式
+		SourceFormat format = SourceFormat::Idx;
+		// 画像ファイル（CIFAR はラベルも同じファイル）
+		std::string imagePath;
+		// ラベルファイル（IDX のみ）
+		std::string labelPath;
+		// レコード数
+		size_t records = 0;
+		// 画像データとラベルデータの先頭位置（ヘッダの後）
+		uint64_t imageOffset = 0;
+		uint64_t labelOffset = 0;
+		// シャードの索引（コンテナファイルのみ、読み込みスレッドで共有する）
+		std::shared_ptr<const ShardFile> shards;
+	};
+	// ファイル内の連続したレコードの範囲（読み込みとシャッフルの単位、コンテナファイルは first がシャード番号）
+	struct BlockRange
+	{
+		int source;
+		size_t first;
+		size_t count;
+	};
+	// 読み込んだ 1 ブロック
+	struct Block
+	{
+		// count × 画像バイト数（HWC に並べ替え済み）
+		std::vector<uint8_t> images;
+		std::vector<uint8_t> labels;
+		// 読み込み済みか（先読みの枠の中で読み込み中のものは false）
+		bool ready = false;
+	};
+
+	// 画像の形状を確認して設定する（最初のファイルで決まる）
+	bool SetShape(int rows, int columns, int channels);
+	// 先読みの枠の数（読み込みスレッドがすべて同時に読めるように、スレッド数より少なくしない）
+	int PrefetchWindow() const { return std::max(m_config.prefetchBlocks, m_config.readerThreads); }
+	// 読み込みスレッドの本体
+	void ReaderLoop();
+	// 1 ブロックを読み込む
+	bool ReadBlock(const BlockRange& range, Block& block, std::vector<uint8_t>& scratch);
+	// 読み込みスレッドから次のブロックを受け取る（エポックの終わりなら false）
+	bool TakeBlock();
+	// 使い終わったブロックの領域を読み込みスレッドに戻す（m_mutex を取るか、読み込みスレッドが止まっている間に呼ぶ）
+	void RecycleBlock(Block& block);
+
+private:
+	// 設定
+	StreamingDatasetConfig m_config;
+	// 読み込むファイル
+	std::vector<Source> m_sources;
+	// レコード数の合計
+	size_t m_totalRecords = 0;
+	// 画像の形状
+	int m_rows = 0;
+	int m_columns = 0;
+	int m_channels = 0;
+
+	// 読み込みスレッド
+	std::vector<std::thread> m_readers;
+	// このエポックで読むブロックの順番
+	std::vector<BlockRange> m_order;
+	// 以下は m_mutex で保護する
+	// ・次に読み込みスレッドが受け持つ順番の位置と、次に Next() に渡す順番の位置
+	size_t m_nextRead = 0;
+	size_t m_nextTake = 0;
+	// ・先読み済みのブロック（m_nextTake から順に prefetchBlocks 個分の枠、読み込み中の枠は ready = false）
+	std::deque<Block> m_readyBlocks;
+	// ・取り出し側が使い終わったブロック（読み込みスレッドが次の読み込みに使い、領域を確保し直さない）
+	std::vector<Block> m_freeBlocks;
+	// ・読み込みに失敗した順番の位置（失敗したブロックの手前でエポックを終える）
+	size_t m_failedPosition = SIZE_MAX;
+	// ・停止要求
+	bool m_stop = false;
+	std::mutex m_mutex;
+	// 読み込みスレッドへの通知（ブロックを受け取った / 停止）
+	std::condition_variable m_spaceAvailable;
+	// Next() への通知（ブロックを読み込んだ）
+	std::condition_variable m_blockReady;
+
+	// 取り出し中のブロックと次に取り出す位置（Next() を呼ぶスレッドだけが触る）
+	Block m_current;
+	size_t m_currentPosition = 0;
+	// シャッフルバッファ（shuffleBufferRecords × 画像バイト数）とラベル、格納数
+	std::vector<uint8_t> m_bufferImages;
+	std::vector<uint8_t> m_bufferLabels;
+	size_t m_bufferCount = 0;
+	// 取り出し位置を選ぶ乱数
+	RandomStream m_random;
+
+	// NextInOrder() の順番待ち（m_turnMutex で保護する）
+	// ・次に受け取れる番号と停止要求
+	size_t m_nextPosition = 0;
+	bool m_turnStopped = false;
+	std::mutex m_turnMutex;
+	std::condition_variable m_turnChanged;
+};
@@ -2,6 +2,7 @@
 #include <vector>
 #include <algorithm>
 #include <stdexcept>
+#include <utility>
 
 class Tensor3D
 {
@@ -11,6 +12,26 @@ public:
 	{
 	}
 
+	Tensor3D(int h, int w, int c, std::vector<float>&& values)
+		: H(h), W(w), C(c), data(std::move(values))
+	{
+		if ((size_t)h * w * c != data.size())
+		{
+			throw std::invalid_argument("Tensor3D size mismatch");
+		}
+	}
+
+	void Reshape(int h, int w, int c)
+	{
+		if ((size_t)h * w * c != data.size())
+		{
+			throw std::invalid_argument("Tensor3D reshape size mismatch");
+		}
+		H = h;
+		W = w;
+		C = c;
+	}
+
 	void Zero()
 	{
 		std::fill(data.begin(), data.end(), 0.0f);
@@ -43,6 +64,10 @@ public:
 	int GetH() const { return H; }
 	int GetW() const { return W; }
 	int GetC() const { return C; }
+	int Size() const { return (int)data.size(); }
+
+	float* Data() { return data.data(); }
+	const float* Data() const { return data.data(); }
 
 private:
 	int H, W, C;
@@ -0,0 +1,45 @@
+﻿// TopK.cpp
+// スコアの上位 k クラスの選択
+#include "TopK.h"
+#include <algorithm>
+
+// 1 行分のスコアから上位 k 個を取り出す
+int SelectTopK(const float* scores, int numClasses, int k, std::pair<int, float>* out)
+{
+	k = std::min(k, numClasses);
+	if (k <= 0) return 0;
+	// 先頭 k 個を高い順に並べた状態から始める
+	int filled = 0;
+	for (int c = 0; c < numClasses; c++)
+	{
+		float score = scores[c];
+		// 保持している k 番目より低ければ入らない (ほとんどの要素はこの比較だけで済む)
+		if (filled == k && !(score > out[k - 1].second)) continue;
+		// 挿入位置まで後ろにずらす (同じスコアなら先に来たクラスを前に残す)
+		int position = (filled < k) ? filled++ : k - 1;
+		while (position > 0 && score > out[position - 1].second)
+		{
+			out[position] = out[position - 1];
+			position--;
+		}
+		out[position] = { c, score };
+	}
+	return k;
+}
+
+// バッチの各行から上位 k 個を取り出す
+void SelectTopKBatch(const float* scores, int batchSize, int numClasses, int k, std::pair<int, float>* out)
+{
+	for (int b = 0; b < batchSize; b++)
+	{
+		SelectTopK(scores + (size_t)b * numClasses, numClasses, k, out + (size_t)b * k);
+	}
+}
+
+// 1 行分のスコアから上位 k 個を取り出して返す
+std::vector<std::pair<int, float>> SelectTopK(const float* scores, int numClasses, int k)
+{
+	std::vector<std::pair<int, float>> result(std::max(0, std::min(k, numClasses)));
+	SelectTopK(scores, numClasses, k, result.data());
+	return result;
+}
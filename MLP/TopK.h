@@ -0,0 +1,23 @@
+﻿// TopK.h
+// スコア (確率・logits) の上位 k クラスの選択
+// ・全体を並べ替えず、上位 k 個だけを保持しながら1回走査する (部分選択、k が小さいほど速い)
+// ・バッチ (batchSize × numClasses の行優先配列) の各行をまとめて処理できる
+// ・結果はスコアの高い順、同じスコアはクラス ID の小さい順
+#pragma once
+#include <vector>
+#include <utility>
+
+// 1 行分のスコアから上位 k 個の (クラスID, スコア) を取り出す
+// ・scores : numClasses 個のスコア
+// ・k      : 取り出す個数 (numClasses を超える場合は numClasses 個)
+// ・out    : 結果の格納先 (k 個分の領域)
+// ・戻り値 : 格納した個数
+int SelectTopK(const float* scores, int numClasses, int k, std::pair<int, float>* out);
+
+// バッチの各行から上位 k 個を取り出す
+// ・scores : batchSize × numClasses のスコア
+// ・out    : batchSize × k の格納先 (行 b の結果は out[b * k] から)
+void SelectTopKBatch(const float* scores, int batchSize, int numClasses, int k, std::pair<int, float>* out);
+
+// 1 行分のスコアから上位 k 個を取り出して返す
+std::vector<std::pair<int, float>> SelectTopK(const float* scores, int numClasses, int k);
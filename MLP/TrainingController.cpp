@@ -0,0 +1,78 @@
+﻿// TrainingController.cpp
+// 学習の制御 (学習率のスケジュールと早期終了)
+#include "TrainingController.h"
+#include <algorithm>
+#include <cmath>
+
+// コンストラクタ
+TrainingController::TrainingController(const TrainingControllerConfig& config)
+	: m_config(config)
+{
+	m_config.maxEpochs = std::max(1, m_config.maxEpochs);
+	m_config.warmupEpochs = std::max(0.0f, m_config.warmupEpochs);
+	m_config.stepEpochs = std::max(1, m_config.stepEpochs);
+	m_config.evaluateEvery = std::max(1, m_config.evaluateEvery);
+	m_config.patience = std::max(1, m_config.patience);
+}
+
+// 学習率を返す
+float TrainingController::GetLearningRate(double epochPosition) const
+{
+	const double base = m_config.learningRate;
+	const double warmup = m_config.warmupEpochs;
+	// ウォームアップ中は基本の warmupStartFactor 倍から線形に上げる
+	if (epochPosition < warmup)
+	{
+		double t = epochPosition / warmup;
+		return (float)(base * (m_config.warmupStartFactor + (1.0 - m_config.warmupStartFactor) * t));
+	}
+	// スケジュールはウォームアップの後から数える
+	const double position = epochPosition - warmup;
+	switch (m_config.schedule)
+	{
+	case LearningRateSchedule::Step:
+		return (float)(base * std::pow((double)m_config.stepFactor, std::floor(position / m_config.stepEpochs)));
+	case LearningRateSchedule::Cosine:
+	{
+		const double length = std::max(m_config.maxEpochs - warmup, 1e-6);
+		const double t = std::min(position / length, 1.0);
+		const double pi = 3.14159265358979323846;
+		return (float)(m_config.minLearningRate + (base - m_config.minLearningRate) * 0.5 * (1.0 + std::cos(pi * t)));
+	}
+	case LearningRateSchedule::Constant:
+	default:
+		return (float)base;
+	}
+}
+
+// このエポックの終わりに検証用データで評価するか
+bool TrainingController::ShouldEvaluate(int epochIndex) const
+{
+	return (epochIndex + 1) % m_config.evaluateEvery == 0 || epochIndex + 1 >= m_config.maxEpochs;
+}
+
+// 検証用データの評価結果を知らせる
+bool TrainingController::ReportValidation(int epochIndex, float accuracy, float loss, const CNNModel& model)
+{
+	m_lastEvaluatedEpoch = epochIndex;
+	// 最初の評価か、正解率が minImprovement 以上上がったら最良の結果を更新する
+	bool improved = m_bestEpoch < 0 || accuracy >= m_bestAccuracy + m_config.minImprovement;
+	if (!improved)
+	{
+		if (++m_evaluationsWithoutImprovement >= m_config.patience) { m_stopped = true; }
+		return false;
+	}
+	m_bestEpoch = epochIndex;
+	m_bestAccuracy = accuracy;
+	m_bestLoss = loss;
+	m_evaluationsWithoutImprovement = 0;
+	m_bestSaved = !m_config.bestCheckpointPath.empty() && model.SaveCheckpoint(m_config.bestCheckpointPath);
+	return true;
+}
+
+// 最良のモデルに戻す
+bool TrainingController::RestoreBest(CNNModel& model) const
+{
+	if (m_bestEpoch < 0 || m_bestEpoch == m_lastEvaluatedEpoch) return true;
+	return m_bestSaved && model.RestoreCheckpoint(m_config.bestCheckpointPath);
+}
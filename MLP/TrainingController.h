@@ -0,0 +1,91 @@
+﻿// TrainingController.h
+// 学習の制御 (学習率のスケジュールと早期終了)
+// ・学習率をエポックの途中の位置 (エポック番号 + 進捗) から決める (ウォームアップ + 一定 / ステップ / コサイン)
+// ・一定エポックごとに検証用データ (学習に使わない held-out の分割) の評価結果を受け取り、
+//   最良の正解率のモデルをチェックポイントに保存する
+// ・最良の結果が patience 回の評価のあいだ更新されなければ学習を打ち切る
+#pragma once
+#include <string>
+#include "CNNModel.h"
+
+// 学習率のスケジュール
+enum class LearningRateSchedule
+{
+	// 一定
+	Constant,
+	// stepEpochs エポックごとに stepFactor 倍する
+	Step,
+	// 最大エポック数で minLearningRate まで余弦曲線で下げる
+	Cosine,
+};
+
+// 学習の制御の設定
+struct TrainingControllerConfig
+{
+	// 最大エポック数 (早期終了しなければここまで学習する、コサインのスケジュールの長さ)
+	int maxEpochs = 12;
+	// 基本の学習率
+	float learningRate = 0.05f;
+	// 学習率のスケジュール
+	LearningRateSchedule schedule = LearningRateSchedule::Cosine;
+	// ウォームアップのエポック数 (学習率を基本の warmupStartFactor 倍から線形に上げる、0 で無効)
+	float warmupEpochs = 0.5f;
+	float warmupStartFactor = 0.1f;
+	// Step: 学習率を下げる間隔 (エポック) と倍率
+	int stepEpochs = 3;
+	float stepFactor = 0.5f;
+	// Cosine: 最後の学習率
+	float minLearningRate = 0.0f;
+	// 検証用データで評価する間隔 (エポック)
+	int evaluateEvery = 1;
+	// 最良の結果が更新されない評価が何回続いたら打ち切るか
+	int patience = 3;
+	// 正解率 (%) がこれ以上上がったときだけ改善とみなす
+	float minImprovement = 0.05f;
+	// 最良のモデルを保存するチェックポイントファイル (空なら保存しない)
+	std::string bestCheckpointPath;
+};
+
+// TrainingController クラス
+class TrainingController
+{
+public:
+	explicit TrainingController(const TrainingControllerConfig& config);
+
+	// 学習率を返す
+	// ・epochPosition : エポック番号 + エポック内の進捗 (0〜1)
+	float GetLearningRate(double epochPosition) const;
+	// このエポックの終わりに検証用データで評価するか (最後のエポックは必ず評価する)
+	bool ShouldEvaluate(int epochIndex) const;
+	// 検証用データの評価結果を知らせる
+	// ・最良の正解率を更新したらモデルをチェックポイントに保存して true を返す
+	bool ReportValidation(int epochIndex, float accuracy, float loss, const CNNModel& model);
+	// 学習を打ち切るか (改善しない評価が patience 回続いた)
+	bool ShouldStop() const { return m_stopped; }
+	// 最良のモデルに戻す
+	// ・最後に評価したモデルが最良なら何もしない、戻せなければ false
+	bool RestoreBest(CNNModel& model) const;
+
+	// 最良の結果 (評価していなければ m_bestEpoch は -1)
+	int GetBestEpoch() const { return m_bestEpoch; }
+	float GetBestAccuracy() const { return m_bestAccuracy; }
+	float GetBestLoss() const { return m_bestLoss; }
+	// 設定
+	const TrainingControllerConfig& GetConfig() const { return m_config; }
+
+private:
+	// 設定
+	TrainingControllerConfig m_config;
+	// 最良の結果のエポックと正解率・損失
+	int m_bestEpoch = -1;
+	float m_bestAccuracy = 0.0f;
+	float m_bestLoss = 0.0f;
+	// 最良のモデルをチェックポイントに保存できたか
+	bool m_bestSaved = false;
+	// 最後に評価したエポック
+	int m_lastEvaluatedEpoch = -1;
+	// 最良の結果が更新されなかった評価の回数
+	int m_evaluationsWithoutImprovement = 0;
+	// 打ち切ったか
+	bool m_stopped = false;
+};